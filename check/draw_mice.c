@@ -1,17 +1,74 @@
 /**
  * I used this file to take the videos of the dualtouch capabilities. What it
  * does is just drawing behind the mouse.
+ *
+ * With -l, it also measures the latency between the moment an event is
+ * injected in the kernel and the moment X delivers it: fake devices are
+ * created through uinput, and for each injected contact we wait for the
+ * matching XI_ButtonPress and XI_Motion (or XI_TouchBegin and XI_TouchUpdate
+ * with -t, to compare the fake mice with a multitouch device). See
+ * lumio_latency_harness to run it in a headless X server.
  */
 
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <time.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/XInput2.h>
 
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#define MAX_DEVICE_ID	256
+#define MAX_SEGMENTS	256
+#define MAX_FAKE	8
+/** @brief Coordinates range of the fake devices, same as firmware 2.0/3.0. */
+#define FAKE_MAX_COORD	4095
+/** @brief How long to wait for X to deliver an injected event, in ms. */
+#define EVENT_TIMEOUT	1000
+
+typedef struct		drawing_s
+{
+  unsigned int		x[MAX_DEVICE_ID];
+  unsigned int		y[MAX_DEVICE_ID];
+  unsigned int		up[MAX_DEVICE_ID];
+  XSegment		segments[MAX_SEGMENTS];
+  int			nb_segments;
+}			drawing_t;
+
+typedef struct		fake_device_s
+{
+  char			name[64];
+  int			fd;
+  int			xi_id;
+  double*		press; /**< Down latencies, in us. */
+  double*		motion; /**< Motion latencies, in us. */
+  int			nb_press;
+  int			nb_motion;
+}			fake_device_t;
+
+static drawing_t	drawing;
+static int		touch_mode = 0;
+
+static double	now_us(void)
+{
+  struct timespec	ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e6 + ts.tv_nsec / 1e3);
+}
+
 static Window	create_win(Display *dpy)
 {
-    Window	win = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, 
-					  200, 200, 0, 0, BlackPixel(dpy, 0));
+    Window	win = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0,
+					  DisplayWidth(dpy, DefaultScreen(dpy)),
+					  DisplayHeight(dpy, DefaultScreen(dpy)),
+					  0, 0, BlackPixel(dpy, 0));
     XMapWindow(dpy, win);
     XSync(dpy, False);
     return (win);
@@ -21,15 +78,16 @@ static Window	create_win(Display *dpy)
 static int	has_xi2(Display *dpy)
 {
   int		major = 2;
-  int		minor = 0;
+  int		minor = touch_mode ? 2 : 0;
   int		rc;
 
   rc = XIQueryVersion(dpy, &major, &minor);
-  if (rc == BadRequest) 
+  if (rc == BadRequest || (touch_mode && minor < 2))
     {
-      printf("No XI2 support. Server supports version %d.%d only.\n", major, minor);
+      printf("No XI2%s support. Server supports version %d.%d only.\n",
+	     touch_mode ? ".2" : "", major, minor);
       return (0);
-    } 
+    }
   else
     {
       printf("XI2 supported. Server provides version %d.%d.\n", major, minor);
@@ -39,16 +97,25 @@ static int	has_xi2(Display *dpy)
 
 static void		select_events(Display *dpy, Window win)
 {
-  unsigned char		mask1 = 0;;
+  unsigned char		mask1[XIMaskLen(XI_LASTEVENT)];
   XIEventMask		evmasks;
-  
-  XISetMask(&mask1, XI_Motion);
-  XISetMask(&mask1, XI_ButtonPress);
-  XISetMask(&mask1, XI_ButtonRelease);
+
+  memset(mask1, 0x0, sizeof (mask1));
+  XISetMask(mask1, XI_Motion);
+  XISetMask(mask1, XI_ButtonPress);
+  XISetMask(mask1, XI_ButtonRelease);
+#ifdef XI_TouchBegin
+  if (touch_mode)
+    {
+      XISetMask(mask1, XI_TouchBegin);
+      XISetMask(mask1, XI_TouchUpdate);
+      XISetMask(mask1, XI_TouchEnd);
+    }
+#endif
 
   evmasks.deviceid = XIAllDevices;
   evmasks.mask_len = sizeof(mask1);
-  evmasks.mask = &mask1;
+  evmasks.mask = mask1;
 
   XISelectEvents(dpy, win, &evmasks, 1);
   XFlush(dpy);
@@ -64,17 +131,453 @@ static GC	init_gc(Display* dpy, Window win)
   return (teton);
 }
 
+static void	add_segment(Display* dpy, Window win, GC gc,
+			    int x1, int y1, int x2, int y2)
+{
+  XSegment*	segment = NULL;
+
+  if (drawing.nb_segments == MAX_SEGMENTS)
+    {
+      XDrawSegments(dpy, win, gc, drawing.segments, drawing.nb_segments);
+      drawing.nb_segments = 0;
+    }
+  segment = &drawing.segments[drawing.nb_segments++];
+  segment->x1 = x1;
+  segment->y1 = y1;
+  segment->x2 = x2;
+  segment->y2 = y2;
+}
+
+/**
+ * Draws everything received since the last frame, with a single request.
+ */
+static void	flush_frame(Display* dpy, Window win, GC gc)
+{
+  if (drawing.nb_segments)
+    XDrawSegments(dpy, win, gc, drawing.segments, drawing.nb_segments);
+  drawing.nb_segments = 0;
+  XFlush(dpy);
+}
+
+static void	draw_event(Display* dpy, Window win, GC gc,
+			   int evtype, XIDeviceEvent* real_ev)
+{
+  int		id = real_ev->deviceid;
+
+  if (id < 0 || id >= MAX_DEVICE_ID)
+    return;
+
+#ifdef XI_TouchBegin
+  if (evtype == XI_TouchBegin)
+    evtype = XI_ButtonPress;
+  else if (evtype == XI_TouchUpdate)
+    evtype = XI_Motion;
+  else if (evtype == XI_TouchEnd)
+    evtype = XI_ButtonRelease;
+#endif
+
+  if (evtype == XI_Motion && drawing.up[id])
+    {
+      if (drawing.x[id] == 0 && drawing.y[id] == 0)
+	{
+	  drawing.x[id] = real_ev->event_x;
+	  drawing.y[id] = real_ev->event_y;
+	}
+      else
+	{
+	  add_segment(dpy, win, gc, drawing.x[id], drawing.y[id],
+		      real_ev->event_x, real_ev->event_y);
+	  drawing.x[id] = real_ev->event_x;
+	  drawing.y[id] = real_ev->event_y;
+	}
+    }
+  else if (evtype == XI_ButtonPress)
+    {
+      add_segment(dpy, win, gc, real_ev->event_x, real_ev->event_y,
+		  real_ev->event_x, real_ev->event_y);
+      drawing.up[id] = 1;
+    }
+  else if (evtype == XI_ButtonRelease)
+    {
+      drawing.x[id] = 0;
+      drawing.y[id] = 0;
+      drawing.up[id] = 0;
+    }
+}
+
+/**
+ * Handles one X event, returns its XI2 type (0 if it isn't an XI2 event) and
+ * the id of the device it comes from.
+ */
+static int	handle_event(Display* dpy, Window win, GC gc, int xi_opcode,
+			     int* deviceid)
+{
+  XEvent	ev;
+  XGenericEventCookie *cookie = &ev.xcookie;
+  XIDeviceEvent* real_ev;
+  int		evtype = 0;
+
+  XNextEvent(dpy, &ev);
+
+  if (cookie->type != GenericEvent ||
+      cookie->extension != xi_opcode)
+    return (0);
+
+  if (XGetEventData(dpy, cookie))
+    {
+      real_ev = cookie->data;
+      evtype = cookie->evtype;
+      *deviceid = real_ev->deviceid;
+      draw_event(dpy, win, gc, evtype, real_ev);
+      XFreeEventData(dpy, &ev.xcookie);
+    }
+
+  return (evtype);
+}
+
+static void	draw_loop(Display* dpy, Window win, GC gc, int xi_opcode)
+{
+  int		deviceid = 0;
+
+  while (1)
+    {
+      handle_event(dpy, win, gc, xi_opcode, &deviceid);
+      while (XPending(dpy))
+	handle_event(dpy, win, gc, xi_opcode, &deviceid);
+      flush_frame(dpy, win, gc);
+    }
+}
+
+/*
+ * Latency mode.
+ */
+
+static int	create_fake_device(fake_device_t* fake, int i)
+{
+  struct uinput_user_dev	dev;
+
+  if ((fake->fd = open("/dev/uinput", O_WRONLY)) < 0 &&
+      (fake->fd = open("/dev/input/uinput", O_WRONLY)) < 0)
+    {
+      perror("uinput");
+      return (-1);
+    }
+
+  memset(&dev, 0x0, sizeof (dev));
+  snprintf(fake->name, sizeof (fake->name), "Lumio latency%d", i + 1);
+  snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "%s", fake->name);
+  dev.id.bustype = BUS_VIRTUAL;
+
+  ioctl(fake->fd, UI_SET_EVBIT, EV_SYN);
+  ioctl(fake->fd, UI_SET_EVBIT, EV_KEY);
+  ioctl(fake->fd, UI_SET_EVBIT, EV_ABS);
+  if (!touch_mode)
+    {
+      /* Same capabilities as the driver fake mice (see INIT_FAKEMOUSE) */
+      ioctl(fake->fd, UI_SET_KEYBIT, BTN_LEFT);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_X);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_Y);
+      dev.absmax[ABS_X] = FAKE_MAX_COORD;
+      dev.absmax[ABS_Y] = FAKE_MAX_COORD;
+    }
+  else
+    {
+      ioctl(fake->fd, UI_SET_KEYBIT, BTN_TOUCH);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_X);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_Y);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_MT_SLOT);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_MT_TRACKING_ID);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_MT_POSITION_X);
+      ioctl(fake->fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y);
+#ifdef INPUT_PROP_DIRECT
+      ioctl(fake->fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT);
+#endif
+      dev.absmax[ABS_X] = FAKE_MAX_COORD;
+      dev.absmax[ABS_Y] = FAKE_MAX_COORD;
+      dev.absmax[ABS_MT_SLOT] = 1;
+      dev.absmax[ABS_MT_TRACKING_ID] = 0xffff;
+      dev.absmax[ABS_MT_POSITION_X] = FAKE_MAX_COORD;
+      dev.absmax[ABS_MT_POSITION_Y] = FAKE_MAX_COORD;
+    }
+
+  if (write(fake->fd, &dev, sizeof (dev)) != sizeof (dev) ||
+      ioctl(fake->fd, UI_DEV_CREATE) < 0)
+    {
+      perror("uinput");
+      return (-1);
+    }
+
+  return (0);
+}
+
+static void	add_input_event(struct input_event* events, int* n,
+				int type, int code, int value)
+{
+  memset(&events[*n], 0x0, sizeof (struct input_event));
+  events[*n].type = type;
+  events[*n].code = code;
+  events[*n].value = value;
+  ++*n;
+}
+
+/**
+ * Injects a contact, down is -1 to only move it. Returns when it was injected,
+ * right before the write: the cost of uinput is part of the latency.
+ */
+static double	inject(fake_device_t* fake, int x, int y, int down)
+{
+  struct input_event	events[8];
+  double		time_us = 0;
+  int			n = 0;
+
+  if (!touch_mode)
+    {
+      add_input_event(events, &n, EV_ABS, ABS_X, x);
+      add_input_event(events, &n, EV_ABS, ABS_Y, y);
+      if (down >= 0)
+	add_input_event(events, &n, EV_KEY, BTN_LEFT, down);
+    }
+  else
+    {
+      add_input_event(events, &n, EV_ABS, ABS_MT_SLOT, 0);
+      if (down >= 0)
+	add_input_event(events, &n, EV_ABS, ABS_MT_TRACKING_ID,
+			down ? fake->nb_press : -1);
+      if (down != 0)
+	{
+	  add_input_event(events, &n, EV_ABS, ABS_MT_POSITION_X, x);
+	  add_input_event(events, &n, EV_ABS, ABS_MT_POSITION_Y, y);
+	  add_input_event(events, &n, EV_ABS, ABS_X, x);
+	  add_input_event(events, &n, EV_ABS, ABS_Y, y);
+	}
+      if (down >= 0)
+	add_input_event(events, &n, EV_KEY, BTN_TOUCH, down);
+    }
+  add_input_event(events, &n, EV_SYN, SYN_REPORT, 0);
+
+  time_us = now_us();
+  if (write(fake->fd, events, n * sizeof (struct input_event)) < 0)
+    perror("uinput");
+
+  return (time_us);
+}
+
+/**
+ * Waits for X to tell us about the fake device, returns its XI2 id.
+ */
+static int	find_xi_device(Display* dpy, const char* name)
+{
+  XIDeviceInfo*	info = NULL;
+  int		nb_devices = 0;
+  int		tries = 0;
+  int		id = -1;
+  int		i = 0;
+
+  for (tries = 0; id < 0 && tries < 100; ++tries)
+    {
+      info = XIQueryDevice(dpy, XIAllDevices, &nb_devices);
+      for (i = 0; i < nb_devices; ++i)
+	if (!strcmp(info[i].name, name) &&
+	    (info[i].use == XISlavePointer || info[i].use == XIFloatingSlave))
+	  id = info[i].deviceid;
+      XIFreeDeviceInfo(info);
+      if (id < 0)
+	usleep(50000);
+    }
+
+  return (id);
+}
+
+/**
+ * Processes X events until one of the wanted type comes from the device,
+ * drawing them on the way. Returns when it was received, or -1 on timeout.
+ */
+static double	wait_for(Display* dpy, Window win, GC gc, int xi_opcode,
+			 int deviceid, int wanted)
+{
+  double	deadline = now_us() + EVENT_TIMEOUT * 1000.0;
+  double	received = -1;
+  struct timeval	tv;
+  fd_set	fds;
+  int		from = 0;
+  int		evtype = 0;
+
+  while (received < 0 && now_us() < deadline)
+    {
+      if (!XPending(dpy))
+	{
+	  flush_frame(dpy, win, gc);
+	  FD_ZERO(&fds);
+	  FD_SET(ConnectionNumber(dpy), &fds);
+	  tv.tv_sec = 0;
+	  tv.tv_usec = 10000;
+	  select(ConnectionNumber(dpy) + 1, &fds, NULL, NULL, &tv);
+	  continue;
+	}
+      evtype = handle_event(dpy, win, gc, xi_opcode, &from);
+      if (evtype == wanted && from == deviceid)
+	received = now_us();
+    }
+  flush_frame(dpy, win, gc);
+
+  return (received);
+}
+
+static int	compare_double(const void* a, const void* b)
+{
+  double	da = *(const double*) a;
+  double	db = *(const double*) b;
+
+  return (da < db ? -1 : da > db);
+}
+
+static void	print_latencies(const char* what, double* values, int n)
+{
+  if (n == 0)
+    {
+      printf("\t%s: no event received\n", what);
+      return;
+    }
+  qsort(values, n, sizeof (double), compare_double);
+  printf("\t%s (%d): min %.0fus, p50 %.0fus, p90 %.0fus, p99 %.0fus, "
+	 "max %.0fus\n", what, n, values[0], values[n / 2],
+	 values[(int) (0.9 * (n - 1))], values[(int) (0.99 * (n - 1))],
+	 values[n - 1]);
+}
+
+/**
+ * Injects samples contacts on each fake device, one at a time, and measures
+ * how long X takes to deliver the press and the motion that follows.
+ */
+static int	run_latency(Display* dpy, Window win, GC gc, int xi_opcode,
+			    int nb_fake, int samples)
+{
+  fake_device_t	fakes[MAX_FAKE];
+  int		press_type = XI_ButtonPress;
+  int		motion_type = XI_Motion;
+  int		release_type = XI_ButtonRelease;
+  double	sent = 0;
+  double	received = 0;
+  int		x = 0;
+  int		y = 0;
+  int		i = 0;
+  int		d = 0;
+
+#ifdef XI_TouchBegin
+  if (touch_mode)
+    {
+      press_type = XI_TouchBegin;
+      motion_type = XI_TouchUpdate;
+      release_type = XI_TouchEnd;
+    }
+#endif
+
+  memset(fakes, 0x0, sizeof (fakes));
+  for (d = 0; d < nb_fake; ++d)
+    {
+      if (create_fake_device(&fakes[d], d) != 0)
+	return (-1);
+      fakes[d].press = calloc(samples, sizeof (double));
+      fakes[d].motion = calloc(samples, sizeof (double));
+    }
+  for (d = 0; d < nb_fake; ++d)
+    if ((fakes[d].xi_id = find_xi_device(dpy, fakes[d].name)) < 0)
+      {
+	fprintf(stderr, "%s never showed up in X, does the server hotplug "
+		"input devices ?\n", fakes[d].name);
+	return (-1);
+      }
+
+  srand(42);
+  for (i = 0; i < samples; ++i)
+    for (d = 0; d < nb_fake; ++d)
+      {
+	x = rand() % (FAKE_MAX_COORD - 200) + 100;
+	y = rand() % (FAKE_MAX_COORD - 200) + 100;
+
+	sent = inject(&fakes[d], x, y, 1);
+	received = wait_for(dpy, win, gc, xi_opcode, fakes[d].xi_id, press_type);
+	if (received >= 0)
+	  fakes[d].press[fakes[d].nb_press++] = received - sent;
+
+	sent = inject(&fakes[d], x + 50, y + 50, -1);
+	received = wait_for(dpy, win, gc, xi_opcode, fakes[d].xi_id, motion_type);
+	if (received >= 0)
+	  fakes[d].motion[fakes[d].nb_motion++] = received - sent;
+
+	inject(&fakes[d], x + 50, y + 50, 0);
+	wait_for(dpy, win, gc, xi_opcode, fakes[d].xi_id, release_type);
+      }
+
+  printf("kernel -> X latency, %s path:\n",
+	 touch_mode ? "multitouch" : "fake mouse");
+  for (d = 0; d < nb_fake; ++d)
+    {
+      printf("%s (XI2 device %d):\n", fakes[d].name, fakes[d].xi_id);
+      print_latencies(touch_mode ? "touch begin" : "button press",
+		      fakes[d].press, fakes[d].nb_press);
+      print_latencies(touch_mode ? "touch update" : "motion",
+		      fakes[d].motion, fakes[d].nb_motion);
+      ioctl(fakes[d].fd, UI_DEV_DESTROY);
+      close(fakes[d].fd);
+      free(fakes[d].press);
+      free(fakes[d].motion);
+    }
+
+  return (0);
+}
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: draw_mice [-l samples [-n devices] [-t]]\n"
+	  "  -l n  inject n contacts per fake device through uinput and print\n"
+	  "        the kernel -> X latency, instead of waiting for real fingers\n"
+	  "  -n n  number of fake devices (default 2, max %d)\n"
+	  "  -t    inject through a multitouch device and wait for XI2.2 touch\n"
+	  "        events instead of fake mice and pointer events\n", MAX_FAKE);
+}
+
 int			main(int argc, char **argv)
 {
-  unsigned int		x[25], y[25], up[25];
-  unsigned int		counter = 0;
   Display		*dpy = NULL;
   Window		win = 0;
-  XEvent		ev;
   GC			gc = 0;
   int			xi_opcode = 0;
   int			event = 0;
   int			error = 0;
+  int			samples = 0;
+  int			nb_fake = 2;
+  int			opt = 0;
+
+  while ((opt = getopt(argc, argv, "l:n:th")) != -1)
+    switch (opt)
+      {
+      case 'l':
+	samples = atoi(optarg);
+	break;
+      case 'n':
+	nb_fake = atoi(optarg);
+	break;
+      case 't':
+	touch_mode = 1;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (nb_fake < 1 || nb_fake > MAX_FAKE)
+    {
+      usage();
+      return (1);
+    }
+#ifndef XI_TouchBegin
+  if (touch_mode)
+    {
+      fprintf(stderr, "Built without XI2.2 touch support.\n");
+      return (1);
+    }
+#endif
 
   dpy = XOpenDisplay(NULL);
   if (!dpy)
@@ -95,60 +598,15 @@ int			main(int argc, char **argv)
   select_events(dpy, win);
   gc = init_gc(dpy, win);
 
-  memset(x, 0x0, 25 * sizeof(int));
-  memset(y, 0x0, 25 * sizeof(int));
-  memset(up, 0x0, 25 * sizeof(int));
-
-  while(1)
-    {
-      XGenericEventCookie *cookie = &ev.xcookie;
-      XIDeviceEvent* real_ev;
-      XNextEvent(dpy, &ev);
-
-      if (cookie->type != GenericEvent ||
-      	  cookie->extension != xi_opcode)
-      	continue;
+  memset(&drawing, 0x0, sizeof (drawing));
 
-      if (XGetEventData(dpy, cookie))
-	{
-	  real_ev = cookie->data;
-	  
-	  if (cookie->evtype == XI_Motion && up[real_ev->deviceid])
-	    {
-	      if (x[real_ev->deviceid] == 0 && y[real_ev->deviceid] == 0)
-	      	{
-	      	  x[real_ev->deviceid] = real_ev->event_x;
-	      	  y[real_ev->deviceid] = real_ev->event_y;
-	      	}
-	      else
-	      	{
-	      	  XDrawLine(dpy, win, gc,
-	      		    x[real_ev->deviceid], y[real_ev->deviceid],
-	      		    real_ev->event_x, real_ev->event_y);
-	      	  x[real_ev->deviceid] = real_ev->event_x;
-	      	  y[real_ev->deviceid] = real_ev->event_y;
-	      	}
-	    }
-	  else if (cookie->evtype == XI_ButtonPress)
-	    {
-	      XDrawLine(dpy, win, gc,
-			real_ev->event_x, real_ev->event_y,
-			real_ev->event_x, real_ev->event_y);
-	      up[real_ev->deviceid] = 1;
-	    }
-	  else if (cookie->evtype == XI_ButtonRelease)
-	    {
-	      x[real_ev->deviceid] = 0;
-	      y[real_ev->deviceid] = 0;
-	      up[real_ev->deviceid] = 0;
-	    }
-	  XFreeEventData(dpy, &ev.xcookie);
-	}
-      XFlush(dpy);
-      ++counter;
-    }
+  if (samples > 0)
+    error = run_latency(dpy, win, gc, xi_opcode, nb_fake, samples);
+  else
+    draw_loop(dpy, win, gc, xi_opcode);
 
   XFreeGC(dpy, gc);
+  XCloseDisplay(dpy);
 
-  return 0;
+  return (error ? 1 : 0);
 }
@@ -0,0 +1,732 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_analyze.c
+ * @author Quentin Casasnovas
+ * @brief Tells the health of the touchscreens from their traces.
+ *
+ *	Reads lumio traces (see lumio_trace.h), as many as there are, and prints
+ * for each what the touchscreen it was recorded on looks like, in CSV or JSON:
+ * - the effective sample rate: reports per second while a contact is down,
+ *   dropouts included;
+ * - the period, the median time between two reports of a stroke, the jitter
+ *   (standard deviation of that time, dropouts left out) and its 99th
+ *   percentile;
+ * - the dropouts: a stroke going without reports for more than
+ *   GAP_FACTOR periods, and the reports they are worth;
+ * - the tag swaps: the two contacts of dual reports trading their tags from
+ *   one report to the next, much closer to each other's position than to
+ *   their own;
+ * - the contacts coming down and lifted, the lifts of contacts which weren't
+ *   down, and the lifts lost: a contact still down after LOST_LIFT_US without
+ *   a report;
+ * - the noise floor: the standard deviation of the positions reported, told
+ *   from the second differences of the strokes, which don't see the
+ *   movements of the fingers;
+ * - the blocks of the trace which were damaged.
+ *
+ *	The reports are decoded with lumio_decode_report(), as lumio_treat_event()
+ * does. The traces are mapped, and read by as many threads as there are
+ * processors: each takes the next trace to read, until there's none left.
+ * -g sums up the traces by directory, for fleets keeping the traces of each
+ * touchscreen apart.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+
+#include "lumio_protocol.h"
+#include "lumio_trace.h"
+
+/** @brief Resolution of the periods measured, those are rounded down. */
+#define BUCKET_US		10
+/** @brief A stroke going this long without a report has lost its lift. */
+#define LOST_LIFT_US		100000
+#define NB_BUCKETS		(LOST_LIFT_US / BUCKET_US)
+/** @brief Periods this many times the median are dropouts. */
+#define GAP_FACTOR		2.5
+/** @brief Least movement, in units, for the contacts to trade tags. */
+#define SWAP_DISTANCE		32
+/** @brief Largest second difference, in units, still taken for noise. */
+#define NOISE_MAX		64
+
+/*
+ * Above those, a touchscreen is reported as needing a look.
+ */
+#define MAX_DROPOUTS		0.01 /**< Of the reports. */
+#define MAX_P99_FACTOR		2 /**< Times the period. */
+#define MAX_SWAPS		0.001 /**< Of the dual reports. */
+#define MAX_IMBALANCE		0.01 /**< Of the contacts coming down. */
+#define MAX_NOISE		4.0 /**< Units. */
+
+enum			format
+{
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+/**
+ * @brief The health of a touchscreen.
+ *
+ *	Sums only, so that the health of several traces is the sum of theirs,
+ * but for the period and its percentile, which are weighed and the worst of
+ * them.
+ */
+typedef struct		health_s
+{
+  const char*		path; /**< Or the directory, with -g. */
+  const char*		error; /**< Why the trace couldn't be read, if so. */
+  unsigned int		files;
+  __u16			vid;
+  __u16			pid;
+  __u8			firmware;
+  __u64			bytes;
+  __u64			reports;
+  __u64			damaged;
+  __u64			touch_us; /**< Time with a contact down. */
+  __u64			intervals; /**< Between two reports of a stroke. */
+  double		period_us; /**< Median of the intervals. */
+  double		p99_us;
+  __u64			steady; /**< Intervals which aren't dropouts. */
+  double		sum_us; /**< Of the steady intervals... */
+  double		sum2_us; /**< ... and of their squares. */
+  __u64			gaps;
+  __u64			missing; /**< Reports the gaps are worth. */
+  __u64			dual;
+  __u64			swaps;
+  __u64			downs;
+  __u64			ups;
+  __u64			orphan_ups;
+  __u64			lost_lifts;
+  __u64			noise_n;
+  double		noise_sum;
+}			health_t;
+
+/**
+ * @brief What a thread needs to read a trace.
+ */
+typedef struct		worker_s
+{
+  pthread_t		thread;
+  __u32			histogram[NB_BUCKETS];
+}			worker_t;
+
+static const char**	paths = NULL;
+static health_t*	healths = NULL;
+static unsigned int	nb_paths = 0;
+static unsigned int	next_path = 0;
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_analyze [-j threads] [-f csv|json] [-g] [-o output] "
+	  "trace...\n"
+	  "  -j  threads reading the traces (default one per processor)\n"
+	  "  -f  output format (default csv)\n"
+	  "  -g  sums up the traces by directory\n"
+	  "  -o  where to write the output (default the standard output)\n"
+	  "The traces are read from the standard input, one per line, if none "
+	  "or \"-\" is given.\n");
+}
+
+/**
+ * Squared distance between two contacts.
+ */
+static __s64	distance2(const struct lumio_contact* a,
+			  const struct lumio_contact* b)
+{
+  __s64		dx = (__s64) a->x - b->x;
+  __s64		dy = (__s64) a->y - b->y;
+
+  return (dx * dx + dy * dy);
+}
+
+/**
+ * Reads the intervals histogram of a trace once it has been read through.
+ */
+static void	sum_intervals(health_t* h, const __u32* histogram)
+{
+  double	period_us = 0;
+  double	gap_us = 0;
+  double	us = 0;
+  __u64		seen = 0;
+  __u64		n = 0;
+  int		i = 0;
+
+  if (!h->intervals)
+    return;
+
+  for (i = 0; i < NB_BUCKETS && seen * 2 < h->intervals; ++i)
+    seen += histogram[i];
+  h->period_us = (i - 1) * BUCKET_US;
+  for (seen = 0, i = 0; i < NB_BUCKETS && seen * 100 < h->intervals * 99; ++i)
+    seen += histogram[i];
+  h->p99_us = (i - 1) * BUCKET_US;
+
+  /* A median in the first bucket is under BUCKET_US, not 0 */
+  period_us = h->period_us < BUCKET_US ? BUCKET_US : h->period_us;
+  gap_us = period_us * GAP_FACTOR;
+  for (i = 0; i < NB_BUCKETS; ++i)
+    {
+      if (!(n = histogram[i]))
+	continue;
+      us = i * BUCKET_US;
+      if (us <= gap_us)
+	{
+	  h->steady += n;
+	  h->sum_us += us * n;
+	  h->sum2_us += us * us * n;
+	}
+      else
+	{
+	  h->gaps += n;
+	  h->missing += n * (__u64) (us / period_us - 0.5);
+	}
+    }
+}
+
+/**
+ * Reads a mapped trace through.
+ */
+static void			analyze(health_t*	h,
+					__u32*		histogram,
+					const __u8*	trace,
+					size_t		size)
+{
+  struct lumio_trace_info	info;
+  struct lumio_trace_decoder	dec;
+  struct lumio_contact		contacts[LUMIO_MAX_CONTACTS];
+  struct lumio_contact		last[2][2]; /**< Per tag, the last two. */
+  struct lumio_contact		prev_dual[2]; /**< Per tag. */
+  const __u8*			p = trace + LUMIO_TRACE_HEADER_SIZE;
+  const __u8*			end = trace + size;
+  unsigned long			damaged = 0;
+  __u64				dt = 0;
+  __u64				prev_us = 0;
+  __s64				d2x = 0;
+  __s64				d2y = 0;
+  int				positions[2] = { 0, 0 };
+  int				down[2] = { 0, 0 };
+  int				was_down = 0;
+  int				was_dual = 0;
+  int				nb_contacts = 0;
+  int				ret = 0;
+  int				tag = 0;
+  int				i = 0;
+
+  if (size < LUMIO_TRACE_HEADER_SIZE ||
+      lumio_trace_get_header(trace, &info) < 0)
+    {
+      h->error = "not a lumio trace, or of a later version";
+      return;
+    }
+  h->vid = info.vid;
+  h->pid = info.pid;
+  h->firmware = info.firmware;
+  memset(histogram, 0x0, NB_BUCKETS * sizeof (*histogram));
+
+  while (lumio_trace_next_block(&p, end, &info, &dec, &damaged))
+    while ((ret = lumio_trace_next(&dec)) != 0)
+      {
+	if (ret < 0)
+	  {
+	    ++damaged;
+	    break;
+	  }
+	++h->reports;
+	nb_contacts = lumio_decode_report(dec.report, contacts);
+
+	/* Intervals, while a stroke goes on */
+	dt = dec.time_us - prev_us;
+	prev_us = dec.time_us;
+	if (was_down && dt < LOST_LIFT_US)
+	  {
+	    ++h->intervals;
+	    ++histogram[dt / BUCKET_US];
+	    h->touch_us += dt;
+	  }
+	else if (was_down)
+	  for (tag = 0; tag < 2; ++tag)
+	    if (down[tag])
+	      {
+		++h->lost_lifts;
+		down[tag] = 0;
+		positions[tag] = 0;
+	      }
+
+	/* Tag swaps, between two dual reports with both contacts down */
+	if (nb_contacts == 2 && contacts[0].down && contacts[1].down &&
+	    contacts[0].tag != contacts[1].tag)
+	  {
+	    if (was_dual && dt < LOST_LIFT_US)
+	      {
+		__s64	straight = distance2(&contacts[0],
+					     &prev_dual[contacts[0].tag]) +
+		  distance2(&contacts[1], &prev_dual[contacts[1].tag]);
+		__s64	cross = distance2(&contacts[0],
+					  &prev_dual[contacts[1].tag]) +
+		  distance2(&contacts[1], &prev_dual[contacts[0].tag]);
+
+		++h->dual;
+		if (straight > SWAP_DISTANCE * SWAP_DISTANCE &&
+		    cross * 4 < straight)
+		  ++h->swaps;
+	      }
+	    prev_dual[contacts[0].tag] = contacts[0];
+	    prev_dual[contacts[1].tag] = contacts[1];
+	    was_dual = 1;
+	  }
+	else
+	  was_dual = 0;
+
+	/* Downs, ups and the noise of the strokes */
+	for (i = 0; i < nb_contacts; ++i)
+	  {
+	    tag = contacts[i].tag;
+	    if (!contacts[i].down)
+	      {
+		if (down[tag])
+		  ++h->ups;
+		else
+		  ++h->orphan_ups;
+		down[tag] = 0;
+		positions[tag] = 0;
+		continue;
+	      }
+	    if (!down[tag])
+	      {
+		++h->downs;
+		down[tag] = 1;
+		positions[tag] = 0;
+	      }
+	    if (positions[tag] == 2)
+	      {
+		d2x = (__s64) contacts[i].x - 2 * last[tag][1].x + last[tag][0].x;
+		d2y = (__s64) contacts[i].y - 2 * last[tag][1].y + last[tag][0].y;
+		if (d2x <= NOISE_MAX && d2x >= -NOISE_MAX &&
+		    d2y <= NOISE_MAX && d2y >= -NOISE_MAX)
+		  {
+		    ++h->noise_n;
+		    h->noise_sum += d2x * d2x + d2y * d2y;
+		  }
+	      }
+	    else
+	      ++positions[tag];
+	    last[tag][0] = last[tag][1];
+	    last[tag][1] = contacts[i];
+	  }
+	was_down = down[0] || down[1];
+      }
+
+  h->damaged = damaged;
+  sum_intervals(h, histogram);
+}
+
+static void*		work(void* data)
+{
+  worker_t*		worker = data;
+  struct stat		st;
+  health_t*		h = NULL;
+  void*			trace = NULL;
+  unsigned int		i = 0;
+  int			fd = -1;
+
+  while ((i = __sync_fetch_and_add(&next_path, 1)) < nb_paths)
+    {
+      h = &healths[i];
+      h->path = paths[i];
+      h->files = 1;
+      if ((fd = open(h->path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	{
+	  h->error = strerror(errno);
+	  if (fd >= 0)
+	    close(fd);
+	  continue;
+	}
+      h->bytes = st.st_size;
+      if (st.st_size == 0)
+	{
+	  h->error = "empty";
+	  close(fd);
+	  continue;
+	}
+      trace = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (trace == MAP_FAILED)
+	{
+	  h->error = strerror(errno);
+	  continue;
+	}
+      madvise(trace, st.st_size, MADV_SEQUENTIAL);
+      analyze(h, worker->histogram, trace, st.st_size);
+      munmap(trace, st.st_size);
+    }
+
+  return (NULL);
+}
+
+/**
+ * Adds the health of a trace to the one of its directory.
+ */
+static void	merge(health_t* to, const health_t* from)
+{
+  to->files += from->files;
+  to->bytes += from->bytes;
+  if (from->error)
+    {
+      to->error = "some traces couldn't be read";
+      return;
+    }
+  if (from->intervals)
+    {
+      to->period_us = (to->period_us * to->intervals +
+		       from->period_us * from->intervals) /
+	(to->intervals + from->intervals);
+      if (from->p99_us > to->p99_us)
+	to->p99_us = from->p99_us;
+    }
+  if (to->firmware && (to->vid != from->vid || to->pid != from->pid))
+    to->vid = to->pid = 0;
+  else
+    {
+      to->vid = from->vid;
+      to->pid = from->pid;
+      to->firmware = from->firmware;
+    }
+  to->reports += from->reports;
+  to->damaged += from->damaged;
+  to->touch_us += from->touch_us;
+  to->intervals += from->intervals;
+  to->steady += from->steady;
+  to->sum_us += from->sum_us;
+  to->sum2_us += from->sum2_us;
+  to->gaps += from->gaps;
+  to->missing += from->missing;
+  to->dual += from->dual;
+  to->swaps += from->swaps;
+  to->downs += from->downs;
+  to->ups += from->ups;
+  to->orphan_ups += from->orphan_ups;
+  to->lost_lifts += from->lost_lifts;
+  to->noise_n += from->noise_n;
+  to->noise_sum += from->noise_sum;
+}
+
+/**
+ * Sums up the traces by directory, in the order they were given.
+ */
+static health_t*	group(unsigned int* nb_groups)
+{
+  health_t*		groups = calloc(nb_paths, sizeof (*groups));
+  char*			dir = NULL;
+  char*			slash = NULL;
+  unsigned int		i = 0;
+  unsigned int		j = 0;
+
+  *nb_groups = 0;
+  if (!groups)
+    return (NULL);
+  for (i = 0; i < nb_paths; ++i)
+    {
+      if (!(dir = strdup(paths[i])))
+	return (NULL);
+      if ((slash = strrchr(dir, '/')))
+	*(slash == dir ? slash + 1 : slash) = '\0';
+      else
+	strcpy(dir, ".");
+      for (j = 0; j < *nb_groups && strcmp(groups[j].path, dir); ++j)
+	;
+      if (j == *nb_groups)
+	groups[(*nb_groups)++].path = dir;
+      else
+	free(dir);
+      merge(&groups[j], &healths[i]);
+    }
+  return (groups);
+}
+
+static void	print_string(FILE* out, const char* s, enum format format)
+{
+  if (format == FORMAT_CSV && !strpbrk(s, ",\"\n"))
+    {
+      fputs(s, out);
+      return;
+    }
+  fputc('"', out);
+  for (; *s; ++s)
+    if (*s == '"')
+      fputs(format == FORMAT_CSV ? "\"\"" : "\\\"", out);
+    else if (format == FORMAT_JSON && *s == '\\')
+      fputs("\\\\", out);
+    else if (format == FORMAT_JSON && (unsigned char) *s < 0x20)
+      fprintf(out, "\\u%04x", *s);
+    else
+      fputc(*s, out);
+  fputc('"', out);
+}
+
+/**
+ * Prints the health of a touchscreen, with what looks wrong with it.
+ */
+static void	print_health(FILE* out, const health_t* h, enum format format,
+			     int first)
+{
+  static const char*	csv = "%u,%04x:%04x,%u,%llu,%llu,%llu,%.1f,%.1f,"
+    "%.0f,%.1f,%.0f,%.3f,%llu,%.4f,%llu,%llu,%llu,%llu,%.2f,";
+  static const char*	json = ", \"files\": %u, \"usb_id\": \"%04x:%04x\", "
+    "\"firmware\": %u, \"bytes\": %llu, \"reports\": %llu, \"damaged\": %llu, "
+    "\"touch_s\": %.1f, \"rate_hz\": %.1f, \"period_us\": %.0f, "
+    "\"jitter_us\": %.1f, \"p99_us\": %.0f, \"dropout_pct\": %.3f, "
+    "\"swaps\": %llu, \"swap_pct\": %.4f, \"downs\": %llu, \"ups\": %llu, "
+    "\"orphan_ups\": %llu, \"lost_lifts\": %llu, \"noise\": %.2f, "
+    "\"issues\": [";
+  const char*	issues[7];
+  double	mean = h->steady ? h->sum_us / h->steady : 0;
+  double	jitter = h->steady ? h->sum2_us / h->steady - mean * mean : 0;
+  double	dropouts = h->reports ?
+    (double) h->missing / (h->reports + h->missing) : 0;
+  double	swaps = h->dual ? (double) h->swaps / h->dual : 0;
+  double	noise = h->noise_n ? sqrt(h->noise_sum / (12.0 * h->noise_n)) : 0;
+  __s64		imbalance = (__s64) h->downs - h->ups;
+  int		nb_issues = 0;
+  int		i = 0;
+
+  jitter = jitter > 0 ? sqrt(jitter) : 0;
+  if (h->error)
+    issues[nb_issues++] = h->error;
+  if (dropouts > MAX_DROPOUTS)
+    issues[nb_issues++] = "dropouts";
+  if (h->intervals && h->p99_us > MAX_P99_FACTOR * h->period_us)
+    issues[nb_issues++] = "jitter";
+  if (swaps > MAX_SWAPS)
+    issues[nb_issues++] = "swaps";
+  if ((imbalance < 0 ? -imbalance : imbalance) > MAX_IMBALANCE * h->downs)
+    issues[nb_issues++] = "imbalance";
+  if (noise > MAX_NOISE)
+    issues[nb_issues++] = "noise";
+  if (h->damaged)
+    issues[nb_issues++] = "damaged";
+
+  if (format == FORMAT_JSON)
+    {
+      fputs(first ? "  { \"path\": " : ",\n  { \"path\": ", out);
+      print_string(out, h->path, format);
+    }
+  else
+    {
+      print_string(out, h->path, format);
+      fputc(',', out);
+    }
+  fprintf(out, format == FORMAT_JSON ? json : csv, h->files, h->vid, h->pid,
+	  h->firmware, (unsigned long long) h->bytes,
+	  (unsigned long long) h->reports, (unsigned long long) h->damaged,
+	  h->touch_us / 1e6, h->touch_us ? h->intervals / (h->touch_us / 1e6) : 0,
+	  h->period_us, jitter, h->p99_us, dropouts * 100,
+	  (unsigned long long) h->swaps, swaps * 100,
+	  (unsigned long long) h->downs, (unsigned long long) h->ups,
+	  (unsigned long long) h->orphan_ups,
+	  (unsigned long long) h->lost_lifts, noise);
+  for (i = 0; i < nb_issues; ++i)
+    if (format == FORMAT_JSON)
+      {
+	if (i)
+	  fputs(", ", out);
+	print_string(out, issues[i], format);
+      }
+    else
+      fprintf(out, i ? " %s" : "%s", issues[i]);
+  fputs(format == FORMAT_JSON ? "] }" : "\n", out);
+}
+
+/**
+ * Reads the paths of the traces from the standard input, one per line.
+ */
+static int	read_paths(void)
+{
+  char		line[PATH_MAX];
+  size_t	len = 0;
+  unsigned int	size = 0;
+  const char**	more = NULL;
+
+  while (fgets(line, sizeof (line), stdin))
+    {
+      if ((len = strlen(line)) && line[len - 1] == '\n')
+	line[--len] = '\0';
+      if (!len)
+	continue;
+      if (nb_paths == size)
+	{
+	  size = size ? size * 2 : 1024;
+	  if (!(more = realloc(paths, size * sizeof (*paths))))
+	    return (-1);
+	  paths = more;
+	}
+      if (!(paths[nb_paths++] = strdup(line)))
+	return (-1);
+    }
+  return (0);
+}
+
+int			main(int argc, char** argv)
+{
+  struct timeval	start;
+  struct timeval	stop;
+  enum format		format = FORMAT_CSV;
+  const char*		output = NULL;
+  worker_t*		workers = NULL;
+  health_t*		results = NULL;
+  FILE*			out = stdout;
+  __u64			bytes = 0;
+  __u64			reports = 0;
+  double		elapsed = 0;
+  unsigned int		nb_results = 0;
+  unsigned int		i = 0;
+  long			nb_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  int			by_directory = 0;
+  int			failed = 0;
+  int			opt = 0;
+
+  while ((opt = getopt(argc, argv, "j:f:go:h")) != -1)
+    switch (opt)
+      {
+      case 'j':
+	nb_workers = atoi(optarg);
+	break;
+      case 'f':
+	if (!strcmp(optarg, "json"))
+	  format = FORMAT_JSON;
+	else if (strcmp(optarg, "csv"))
+	  {
+	    usage();
+	    return (1);
+	  }
+	break;
+      case 'g':
+	by_directory = 1;
+	break;
+      case 'o':
+	output = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (nb_workers < 1)
+    {
+      usage();
+      return (1);
+    }
+
+  if (optind == argc || (optind + 1 == argc && !strcmp(argv[optind], "-")))
+    {
+      if (read_paths() < 0)
+	{
+	  perror("lumio_analyze");
+	  return (1);
+	}
+    }
+  else
+    {
+      paths = (const char**) argv + optind;
+      nb_paths = argc - optind;
+    }
+  if (!nb_paths)
+    {
+      usage();
+      return (1);
+    }
+  if (nb_workers > nb_paths)
+    nb_workers = nb_paths;
+  if (output && !(out = fopen(output, "w")))
+    {
+      perror(output);
+      return (1);
+    }
+
+  if (!(healths = calloc(nb_paths, sizeof (*healths))) ||
+      !(workers = malloc(nb_workers * sizeof (*workers))))
+    {
+      perror("lumio_analyze");
+      return (1);
+    }
+  gettimeofday(&start, NULL);
+  for (i = 0; i < nb_workers; ++i)
+    if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0)
+      {
+	perror("pthread_create");
+	return (1);
+      }
+  for (i = 0; i < nb_workers; ++i)
+    pthread_join(workers[i].thread, NULL);
+  gettimeofday(&stop, NULL);
+  elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6;
+
+  for (i = 0; i < nb_paths; ++i)
+    {
+      bytes += healths[i].bytes;
+      reports += healths[i].reports;
+      if (healths[i].error)
+	{
+	  fprintf(stderr, "%s: %s\n", healths[i].path, healths[i].error);
+	  failed = 1;
+	}
+    }
+
+  results = healths;
+  nb_results = nb_paths;
+  if (by_directory && !(results = group(&nb_results)))
+    {
+      perror("lumio_analyze");
+      return (1);
+    }
+  if (format == FORMAT_JSON)
+    fputs("[\n", out);
+  else
+    fputs("path,files,usb_id,firmware,bytes,reports,damaged,touch_s,rate_hz,"
+	  "period_us,jitter_us,p99_us,dropout_pct,swaps,swap_pct,downs,ups,"
+	  "orphan_ups,lost_lifts,noise,issues\n", out);
+  for (i = 0; i < nb_results; ++i)
+    print_health(out, &results[i], format, i == 0);
+  if (format == FORMAT_JSON)
+    fputs("\n]\n", out);
+  if (out != stdout && fclose(out) != 0)
+    {
+      perror(output);
+      failed = 1;
+    }
+
+  fprintf(stderr, "%u traces, %llu reports, %.1f MB in %.2f s with %ld "
+	  "threads: %.0f reports/s, %.1f MB/s\n", nb_paths,
+	  (unsigned long long) reports, bytes / 1e6, elapsed, nb_workers,
+	  elapsed > 0 ? reports / elapsed : 0,
+	  elapsed > 0 ? bytes / 1e6 / elapsed : 0);
+
+  return (failed);
+}
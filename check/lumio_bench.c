@@ -0,0 +1,477 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_bench.c
+ * @author Quentin Casasnovas
+ * @brief Measures what the lumio evdev devices are reporting.
+ *
+ *	Opens every lumio evdev device (the /dev/input/lumio* links created by
+ * 99-lumio.rules, or the devices given on the command line), waits on all of
+ * them with epoll and reads their events in batches. For each device it
+ * reports the event rate, the frame (SYN_REPORT) rate, the gaps between
+ * frames and the latency between the timestamp the kernel gave each frame and
+ * the time it was read, so that two builds of the driver (or lumiod) can be
+ * compared on the same input.
+ *
+ *	With -c, it also takes the driver counters (IOCTL_GET_STATS) of a
+ * touchscreen char device before and after the run, to report the usb errors,
+ * the injected faults, the recovery times and the reports lost meanwhile.
+ */
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+#include <time.h>
+
+#include <linux/input.h>
+
+#include "lumio_driver.h"
+
+#ifndef SYN_DROPPED
+# define SYN_DROPPED		3
+#endif
+
+#ifndef input_event_sec
+# define input_event_sec	time.tv_sec
+# define input_event_usec	time.tv_usec
+#endif
+
+#define MAX_DEVICES		32
+/** @brief Events read per read() call. */
+#define BATCH_SIZE		256
+/** @brief Latency histogram buckets, bucket i counts latencies < 2^i us. */
+#define NB_BUCKETS		24
+/** @brief Default inter-frame delay above which a gap is counted, in ms. */
+#define DEFAULT_GAP_MS		50
+
+typedef struct			bench_device_s
+{
+  char				path[256];
+  char				name[256];
+  int				fd;
+  unsigned long			events;
+  unsigned long			frames;
+  unsigned long			reads;
+  unsigned long			dropped; /**< SYN_DROPPED received. */
+  unsigned long			gaps;
+  double			max_gap_us;
+  double			last_frame_us; /**< Event time of the last frame. */
+  unsigned long			histogram[NB_BUCKETS];
+  double*			latencies; /**< Every frame latency, in us. */
+  unsigned long			nb_latencies;
+  unsigned long			max_latencies;
+}				bench_device_t;
+
+static bench_device_t		devices[MAX_DEVICES];
+static int			nb_devices = 0;
+static clockid_t		clock_id = CLOCK_REALTIME;
+static double			gap_us = DEFAULT_GAP_MS * 1000.0;
+static volatile int		stop = 0;
+static const char*		ctl_path = NULL;
+static struct lumio_stats	stats_before;
+static struct lumio_stats	stats_after;
+
+static double			now_us(void)
+{
+  struct timespec		ts;
+
+  clock_gettime(clock_id, &ts);
+  return (ts.tv_sec * 1e6 + ts.tv_nsec / 1e3);
+}
+
+/**
+ * @brief Opens a device and asks evdev for monotonic timestamps.
+ *
+ *	With a monotonic clock the latency isn't disturbed by NTP adjusting
+ * the time of day. Every device must use the same clock since the clock used
+ * to take the read time is global, the first device decides which one.
+ */
+static int			open_device(const char* path)
+{
+  bench_device_t*		dev = &devices[nb_devices];
+  int				clk = CLOCK_MONOTONIC;
+
+  if (nb_devices == MAX_DEVICES)
+    return (-1);
+
+  memset(dev, 0x0, sizeof (*dev));
+  if ((dev->fd = open(path, O_RDONLY | O_NONBLOCK)) < 0)
+    {
+      fprintf(stderr, "lumio_bench: cannot open %s: %s\n", path, strerror(errno));
+      return (-1);
+    }
+
+#ifdef EVIOCSCLOCKID
+  if (nb_devices == 0 && ioctl(dev->fd, EVIOCSCLOCKID, &clk) == 0)
+    clock_id = CLOCK_MONOTONIC;
+  else if (clock_id == CLOCK_MONOTONIC)
+    ioctl(dev->fd, EVIOCSCLOCKID, &clk);
+#else
+  (void) clk;
+#endif
+
+  snprintf(dev->path, sizeof (dev->path), "%s", path);
+  if (ioctl(dev->fd, EVIOCGNAME(sizeof (dev->name) - 1), dev->name) < 0)
+    snprintf(dev->name, sizeof (dev->name), "unknown");
+  ++nb_devices;
+
+  return (0);
+}
+
+static void			record_latency(bench_device_t* dev, double latency)
+{
+  double*			grown = NULL;
+  int				bucket = 0;
+
+  while (bucket < NB_BUCKETS - 1 && latency >= (double) (1 << bucket))
+    ++bucket;
+  ++dev->histogram[bucket];
+
+  if (dev->nb_latencies == dev->max_latencies)
+    {
+      dev->max_latencies = dev->max_latencies ? dev->max_latencies * 2 : 4096;
+      if (!(grown = realloc(dev->latencies,
+			    dev->max_latencies * sizeof (double))))
+	{
+	  dev->max_latencies = dev->nb_latencies;
+	  return;
+	}
+      dev->latencies = grown;
+    }
+  dev->latencies[dev->nb_latencies++] = latency;
+}
+
+/**
+ * @brief Reads everything a device has to offer.
+ *
+ *	Events are read BATCH_SIZE at a time, the read time being taken once
+ * per batch. A frame's latency is the read time minus the timestamp of its
+ * SYN_REPORT.
+ */
+static void			read_device(bench_device_t* dev)
+{
+  struct input_event		events[BATCH_SIZE];
+  ssize_t			len = 0;
+  double			read_time = 0;
+  double			frame_time = 0;
+  int				n = 0;
+  int				i = 0;
+
+  while ((len = read(dev->fd, events, sizeof (events))) > 0)
+    {
+      read_time = now_us();
+      n = len / sizeof (struct input_event);
+      ++dev->reads;
+      dev->events += n;
+
+      for (i = 0; i < n; ++i)
+	{
+	  if (events[i].type != EV_SYN)
+	    continue;
+	  if (events[i].code == SYN_DROPPED)
+	    {
+	      ++dev->dropped;
+	      continue;
+	    }
+	  if (events[i].code != SYN_REPORT)
+	    continue;
+
+	  frame_time = events[i].input_event_sec * 1e6 +
+	    events[i].input_event_usec;
+	  if (dev->frames > 0 && frame_time - dev->last_frame_us > dev->max_gap_us)
+	    dev->max_gap_us = frame_time - dev->last_frame_us;
+	  if (dev->frames > 0 && frame_time - dev->last_frame_us > gap_us)
+	    ++dev->gaps;
+	  dev->last_frame_us = frame_time;
+	  ++dev->frames;
+	  record_latency(dev, read_time - frame_time);
+	}
+    }
+
+  if (len < 0 && errno == ENODEV)
+    {
+      fprintf(stderr, "lumio_bench: %s is gone.\n", dev->path);
+      close(dev->fd);
+      dev->fd = -1;
+    }
+}
+
+static int			compare_double(const void* a, const void* b)
+{
+  double			da = *(const double*) a;
+  double			db = *(const double*) b;
+
+  return (da < db ? -1 : da > db);
+}
+
+static double			percentile(bench_device_t* dev, double p)
+{
+  if (dev->nb_latencies == 0)
+    return (0);
+  return (dev->latencies[(unsigned long) (p * (dev->nb_latencies - 1))]);
+}
+
+static void			print_summary(bench_device_t* dev, double duration)
+{
+  printf("%s (%s):\n", dev->path, dev->name);
+  printf("\t%lu events, %.1f events/s, %.1f events per read()\n",
+	 dev->events, dev->events / duration,
+	 dev->reads ? (double) dev->events / dev->reads : 0.0);
+  printf("\t%lu frames, %.1f frames/s, %lu dropped\n",
+	 dev->frames, dev->frames / duration, dev->dropped);
+  printf("\t%lu gaps > %.0fms, longest %.1fms\n",
+	 dev->gaps, gap_us / 1000, dev->max_gap_us / 1000);
+  printf("\tlatency (us): p50 %.0f, p90 %.0f, p99 %.0f, max %.0f\n",
+	 percentile(dev, 0.5), percentile(dev, 0.9), percentile(dev, 0.99),
+	 percentile(dev, 1.0));
+}
+
+/**
+ * @brief Reads the driver counters of the -c char device.
+ */
+static int			get_stats(struct lumio_stats* stats)
+{
+  int				fd = -1;
+  int				ret = 0;
+
+  if ((fd = open(ctl_path, O_RDONLY)) < 0)
+    {
+      perror(ctl_path);
+      return (-1);
+    }
+  memset(stats, 0x0, sizeof (*stats));
+  if ((ret = ioctl(fd, IOCTL_GET_STATS, stats)) < 0)
+    perror(ctl_path);
+  close(fd);
+
+  return (ret);
+}
+
+#define STAT_DELTA(Field)	(stats_after.Field - stats_before.Field)
+
+static double			mean_recovery_ms(void)
+{
+  if (STAT_DELTA(recoveries) == 0)
+    return (0);
+
+  return (STAT_DELTA(total_recovery_us) / 1000.0 / STAT_DELTA(recoveries));
+}
+
+static void			print_stats(void)
+{
+  printf("%s: %u reports, %u urb errors (%u transient, %u stalls), "
+	 "%u injected faults\n"
+	 "  %u recoveries, mean %.3f ms, last %.3f ms, max %.3f ms, "
+	 "~%u reports lost\n"
+	 "  rejected: %u on the edges, %u jumps, %u blips; %u positions "
+	 "decimated\n",
+	 ctl_path, STAT_DELTA(reports), STAT_DELTA(urb_errors),
+	 STAT_DELTA(transient_errors), STAT_DELTA(stalls),
+	 STAT_DELTA(faults_injected), STAT_DELTA(recoveries),
+	 mean_recovery_ms(), stats_after.last_recovery_us / 1000.0,
+	 stats_after.max_recovery_us / 1000.0, STAT_DELTA(lost_reports),
+	 STAT_DELTA(rejected_edge), STAT_DELTA(rejected_jump),
+	 STAT_DELTA(rejected_blips), STAT_DELTA(decimated));
+}
+
+/**
+ * @brief Saves the results as JSON.
+ *
+ *	The histogram is saved as the upper bound (exclusive, in us) of each
+ * non empty bucket and its count.
+ */
+static int			save_json(const char* path, double duration)
+{
+  bench_device_t*		dev = NULL;
+  FILE*				out = NULL;
+  int				i = 0;
+  int				j = 0;
+  int				first = 1;
+
+  if (!(out = fopen(path, "w")))
+    {
+      perror("lumio_bench");
+      return (-1);
+    }
+
+  fprintf(out, "{\n  \"duration_s\": %.3f,\n  \"gap_threshold_ms\": %.1f,\n"
+	  "  \"clock\": \"%s\",\n  \"devices\": [\n", duration, gap_us / 1000,
+	  clock_id == CLOCK_MONOTONIC ? "monotonic" : "realtime");
+  for (i = 0; i < nb_devices; ++i)
+    {
+      dev = &devices[i];
+      fprintf(out, "    {\n      \"path\": \"%s\",\n      \"name\": \"%s\",\n"
+	      "      \"events\": %lu,\n      \"frames\": %lu,\n"
+	      "      \"reads\": %lu,\n      \"dropped\": %lu,\n"
+	      "      \"events_per_s\": %.2f,\n      \"frames_per_s\": %.2f,\n"
+	      "      \"gaps\": %lu,\n      \"max_gap_ms\": %.3f,\n"
+	      "      \"latency_us\": {\"p50\": %.1f, \"p90\": %.1f, "
+	      "\"p99\": %.1f, \"max\": %.1f},\n      \"histogram\": [",
+	      dev->path, dev->name, dev->events, dev->frames, dev->reads,
+	      dev->dropped, dev->events / duration, dev->frames / duration,
+	      dev->gaps, dev->max_gap_us / 1000,
+	      percentile(dev, 0.5), percentile(dev, 0.9), percentile(dev, 0.99),
+	      percentile(dev, 1.0));
+      for (j = 0, first = 1; j < NB_BUCKETS; ++j)
+	if (dev->histogram[j])
+	  {
+	    fprintf(out, "%s{\"lt_us\": %u, \"count\": %lu}",
+		    first ? "" : ", ", 1u << j, dev->histogram[j]);
+	    first = 0;
+	  }
+      fprintf(out, "]\n    }%s\n", i + 1 < nb_devices ? "," : "");
+    }
+  fprintf(out, "  ]");
+  if (ctl_path)
+    fprintf(out, ",\n  \"driver\": {\"path\": \"%s\", \"reports\": %u, "
+	    "\"urb_errors\": %u, \"faults_injected\": %u, "
+	    "\"recoveries\": %u, \"mean_recovery_ms\": %.3f, "
+	    "\"max_recovery_ms\": %.3f, \"lost_reports\": %u, "
+	    "\"rejected_edge\": %u, \"rejected_jump\": %u, "
+	    "\"rejected_blips\": %u, \"decimated\": %u}",
+	    ctl_path, STAT_DELTA(reports), STAT_DELTA(urb_errors),
+	    STAT_DELTA(faults_injected), STAT_DELTA(recoveries),
+	    mean_recovery_ms(), stats_after.max_recovery_us / 1000.0,
+	    STAT_DELTA(lost_reports), STAT_DELTA(rejected_edge),
+	    STAT_DELTA(rejected_jump), STAT_DELTA(rejected_blips),
+	    STAT_DELTA(decimated));
+  fprintf(out, "\n}\n");
+  fclose(out);
+
+  return (0);
+}
+
+static void			on_signal(int sig)
+{
+  (void) sig;
+  stop = 1;
+}
+
+static void			usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_bench [-d seconds] [-g gap_ms] [-c /dev/lumioN] "
+	  "[-o results.json] [device ...]\n"
+	  "  Without devices, every /dev/input/lumio* device is opened.\n"
+	  "  -d n  stop after n seconds (default: on ^C)\n"
+	  "  -g n  count inter-frame delays above n ms as gaps (default %d)\n"
+	  "  -c f  report the driver counters of the touchscreen char device f\n"
+	  "  -o f  save the results as JSON in f\n", DEFAULT_GAP_MS);
+}
+
+int				main(int argc, char** argv)
+{
+  struct epoll_event		events[MAX_DEVICES];
+  struct epoll_event		ev;
+  glob_t			links;
+  const char*			output = NULL;
+  double			start = 0;
+  double			duration = 0;
+  double			max_duration = 0;
+  int				epfd = -1;
+  int				opt = 0;
+  int				n = 0;
+  int				i = 0;
+
+  while ((opt = getopt(argc, argv, "d:g:c:o:h")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	max_duration = atof(optarg);
+	break;
+      case 'g':
+	gap_us = atof(optarg) * 1000;
+	break;
+      case 'c':
+	ctl_path = optarg;
+	break;
+      case 'o':
+	output = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+
+  if (optind < argc)
+    for (i = optind; i < argc; ++i)
+      open_device(argv[i]);
+  else if (glob("/dev/input/lumio*", 0, NULL, &links) == 0)
+    {
+      for (i = 0; i < (int) links.gl_pathc; ++i)
+	open_device(links.gl_pathv[i]);
+      globfree(&links);
+    }
+  if (nb_devices == 0)
+    {
+      fprintf(stderr, "lumio_bench: no device to read from.\n");
+      return (1);
+    }
+
+  if ((epfd = epoll_create(MAX_DEVICES)) < 0)
+    {
+      perror("lumio_bench");
+      return (1);
+    }
+  for (i = 0; i < nb_devices; ++i)
+    {
+      memset(&ev, 0x0, sizeof (ev));
+      ev.events = EPOLLIN;
+      ev.data.ptr = &devices[i];
+      epoll_ctl(epfd, EPOLL_CTL_ADD, devices[i].fd, &ev);
+    }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  if (ctl_path && get_stats(&stats_before) < 0)
+    return (1);
+
+  start = now_us();
+  while (!stop && (max_duration <= 0 || now_us() - start < max_duration * 1e6))
+    {
+      n = epoll_wait(epfd, events, MAX_DEVICES, 100);
+      for (i = 0; i < n; ++i)
+	read_device(events[i].data.ptr);
+    }
+  duration = (now_us() - start) / 1e6;
+
+  for (i = 0; i < nb_devices; ++i)
+    {
+      qsort(devices[i].latencies, devices[i].nb_latencies, sizeof (double),
+	    compare_double);
+      print_summary(&devices[i], duration);
+    }
+  if (ctl_path && get_stats(&stats_after) == 0)
+    print_stats();
+  else if (ctl_path)
+    ctl_path = NULL;
+  if (output && save_json(output, duration) != 0)
+    return (1);
+
+  return (0);
+}
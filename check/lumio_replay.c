@@ -0,0 +1,584 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_replay.c
+ * @author Quentin Casasnovas
+ * @brief Benchmarks the driver with the replay device, without hardware.
+ *
+ *	Creates a virtual touchscreen with /dev/lumio_replay and pushes reports
+ * through the driver in batches, either read from a file of raw reports
+ * (as the controller sends them, see lumio_report_size(), lumio_tracegen
+ * writes such files), from a trace (see lumio_trace.h, the firmware is then
+ * the one of the trace) or generated: two fingers drawing circles, lifted
+ * every now and then. The driver measures what
+ * each report costs, from the decoding to the input layer; this program prints
+ * the throughput and the distribution of that cost.
+ *
+ *	The virtual touchscreen has the same input devices as a real one, run
+ * lumio_bench on them meanwhile to include the evdev readers in the picture.
+ *
+ *	With -m, the batches go round-robin to several virtual touchscreens, to
+ * see what the driver costs once many panels share the caches; with -b 1 every
+ * report goes to another touchscreen than the previous one. -c counts the cache
+ * misses of the kernel side with perf events, to compare the layouts of the
+ * driver state.
+ *
+ *	Traces are replayed as fast as the driver goes, unless -s asks for the
+ * pace they were recorded at, sped up or slowed down: each report is then
+ * injected on its own, at its time.
+ */
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "lumio_protocol.h"
+#include "lumio_driver.h"
+#include "lumio_trace.h"
+
+#define DEFAULT_REPORTS		100000
+#define DEFAULT_BATCH		4096
+#define MAX_SCREENS		64
+
+#define PERF_L1D_READ_MISS	(PERF_COUNT_HW_CACHE_L1D |			\
+				 (PERF_COUNT_HW_CACHE_OP_READ << 8) |		\
+				 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+enum
+  {
+    CACHE_REFERENCES,
+    CACHE_MISSES,
+    L1D_MISSES,
+    NB_COUNTERS
+  };
+
+typedef struct		replay_results_s
+{
+  unsigned long		injected;
+  unsigned long		batches;
+  double		elapsed_ns;
+  double		busy_ns;
+  unsigned int		min_ns;
+  unsigned int		max_ns;
+  unsigned long		histogram[LUMIO_REPLAY_HIST_BUCKETS];
+  int			counted; /**< The cache counters below are valid. */
+  unsigned long long	counters[NB_COUNTERS];
+}			replay_results_t;
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_replay [-f firmware] [-n reports] [-b batch] "
+	  "[-p interval_us] [-m screens] [-c] [-r reports.raw|trace] "
+	  "[-s speed] [-o results.json]\n"
+	  "  -f  firmware to emulate, 1, 2 or 3 (default 3)\n"
+	  "  -n  number of reports to replay (default %d, or the whole file)\n"
+	  "  -b  reports per batch (default %d, max %d)\n"
+	  "  -p  inject a report every interval_us instead of back to back\n"
+	  "  -m  spread the batches over that many virtual touchscreens (max "
+	  "%d)\n"
+	  "  -c  count the kernel cache misses (perf events)\n"
+	  "  -r  replay raw reports from a file instead of generated ones, in the"
+	  " layout of the firmware, or a trace\n"
+	  "  -s  replay a trace at the pace it was recorded, times speed\n"
+	  "  -o  save the results as JSON\n",
+	  DEFAULT_REPORTS, DEFAULT_BATCH, LUMIO_REPLAY_MAX_BATCH, MAX_SCREENS);
+}
+
+/**
+ * Generates reports: two fingers drawing circles, lifted every 500 reports.
+ */
+static void		generate(__u8* reports, unsigned long nb_reports,
+				 __u8 firmware)
+{
+  struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+  double		range = lumio_max_coordinate(firmware);
+  double		angle = 0;
+  unsigned long		i = 0;
+  int			c = 0;
+
+  for (i = 0; i < nb_reports; ++i)
+    {
+      angle = i * 0.01;
+      for (c = 0; c < LUMIO_MAX_CONTACTS; ++c)
+	{
+	  contacts[c].x = range / 2 + (c ? -1 : 1) * range / 4 * cos(angle);
+	  contacts[c].y = range / 2 + (c ? -1 : 1) * range / 4 * sin(angle);
+	  contacts[c].tag = c;
+	  contacts[c].down = (i % 500) != 499;
+	}
+      lumio_encode_report(reports + i * LUMIO_REPORT_SIZE, contacts, 2);
+    }
+}
+
+/**
+ * Reads the reports of a trace, with their times, returns how many or 0.
+ */
+static unsigned long		load_trace(FILE* file, const char* path,
+					   __u8** reports, __u64** times,
+					   unsigned long max_reports, int* firmware)
+{
+  struct lumio_trace_info	info;
+  struct lumio_trace_decoder	dec;
+  __u8				header[LUMIO_TRACE_HEADER_SIZE];
+  __u8*				block = NULL;
+  void*				grown = NULL;
+  unsigned long			nb_reports = 0;
+  unsigned long			allocated = 0;
+  unsigned long			damaged = 0;
+  int				ret = 0;
+
+  if (fread(header, sizeof (header), 1, file) != 1 ||
+      lumio_trace_get_header(header, &info) < 0 ||
+      info.firmware < LUMIO_FIRMWARE_1_0 || info.firmware > LUMIO_FIRMWARE_3_0)
+    {
+      fprintf(stderr, "%s: damaged trace, or of a later version\n", path);
+      return (0);
+    }
+  *firmware = info.firmware;
+  if (!(block = malloc(LUMIO_TRACE_BLOCK_HEADER_SIZE + LUMIO_TRACE_MAX_BLOCK)))
+    {
+      perror(path);
+      return (0);
+    }
+
+  dec.left = 0;
+  while (!max_reports || nb_reports < max_reports)
+    {
+      if ((ret = lumio_trace_next(&dec)) <= 0)
+	{
+	  damaged += ret < 0;
+	  if (!lumio_trace_read_block(file, &info, block, &dec, &damaged))
+	    break;
+	  continue;
+	}
+      if (nb_reports == allocated)
+	{
+	  allocated = allocated ? allocated * 2 : 65536;
+	  if ((grown = realloc(*reports, allocated * LUMIO_REPORT_SIZE)))
+	    *reports = grown;
+	  if (!grown ||
+	      !(grown = realloc(*times, allocated * sizeof (**times))))
+	    {
+	      perror(path);
+	      nb_reports = 0;
+	      break;
+	    }
+	  *times = grown;
+	}
+      memcpy(*reports + nb_reports * LUMIO_REPORT_SIZE, dec.report,
+	     LUMIO_REPORT_SIZE);
+      (*times)[nb_reports++] = dec.time_us;
+    }
+  if (damaged)
+    fprintf(stderr, "%s: %lu damaged blocks skipped\n", path, damaged);
+  if (!nb_reports)
+    {
+      free(*reports);
+      free(*times);
+      *reports = NULL;
+      *times = NULL;
+    }
+
+  free(block);
+  return (nb_reports);
+}
+
+/**
+ * Reads raw reports, or a trace, returns how many or 0. Each one is stored in
+ * its own LUMIO_REPORT_SIZE slot, the way the driver takes them. times is set
+ * for traces.
+ */
+static unsigned long	load(const char* path, __u8** reports, __u64** times,
+			     unsigned long max_reports, int* firmware)
+{
+  FILE*			file = NULL;
+  char			magic[8];
+  long			size = 0;
+  unsigned int		report_size = lumio_report_size(*firmware);
+  unsigned long		nb_reports = 0;
+  unsigned long		i = 0;
+
+  if ((file = fopen(path, "rb")) &&
+      fread(magic, sizeof (magic), 1, file) == 1 &&
+      !memcmp(magic, LUMIO_TRACE_MAGIC, sizeof (magic)))
+    {
+      rewind(file);
+      nb_reports = load_trace(file, path, reports, times, max_reports,
+			      firmware);
+      fclose(file);
+      return (nb_reports);
+    }
+
+  if (!file || fseek(file, 0, SEEK_END) != 0 ||
+      (size = ftell(file)) < (long) report_size)
+    {
+      fprintf(stderr, "%s: no report to replay\n", path);
+      if (file)
+	fclose(file);
+      return (0);
+    }
+  rewind(file);
+
+  nb_reports = size / report_size;
+  if (max_reports && nb_reports > max_reports)
+    nb_reports = max_reports;
+  if (!(*reports = calloc(nb_reports, LUMIO_REPORT_SIZE)))
+    {
+      perror(path);
+      nb_reports = 0;
+    }
+  for (i = 0; i < nb_reports; ++i)
+    if (fread(*reports + i * LUMIO_REPORT_SIZE, report_size, 1, file) != 1)
+      {
+	perror(path);
+	free(*reports);
+	*reports = NULL;
+	nb_reports = 0;
+      }
+
+  fclose(file);
+  return (nb_reports);
+}
+
+/**
+ * Opens the cache counters of this process, kernel side only: the replay
+ * ioctl runs the whole report path in our context. Returns the leader of the
+ * group, -1 if perf events are not available.
+ */
+static int			open_counters(int* fds)
+{
+  static const struct
+  {
+    __u32		type;
+    __u64		config;
+  }				events[NB_COUNTERS] =
+    {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+      { PERF_TYPE_HW_CACHE, PERF_L1D_READ_MISS },
+    };
+  struct perf_event_attr	attr;
+  int				i = 0;
+
+  for (i = 0; i < NB_COUNTERS; ++i)
+    {
+      memset(&attr, 0x0, sizeof (attr));
+      attr.size = sizeof (attr);
+      attr.type = events[i].type;
+      attr.config = events[i].config;
+      attr.disabled = i == 0;
+      attr.exclude_user = 1;
+      attr.exclude_hv = 1;
+      if ((fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1,
+			    i ? fds[0] : -1, 0)) < 0)
+	{
+	  perror("perf_event_open");
+	  while (i-- > 0)
+	    close(fds[i]);
+	  return (-1);
+	}
+    }
+
+  return (fds[0]);
+}
+
+static void		read_counters(int* fds, replay_results_t* results)
+{
+  int			i = 0;
+
+  results->counted = 1;
+  for (i = 0; i < NB_COUNTERS; ++i)
+    {
+      if (read(fds[i], &results->counters[i], sizeof (results->counters[i])) !=
+	  sizeof (results->counters[i]))
+	results->counted = 0;
+      close(fds[i]);
+    }
+}
+
+/**
+ * Returns the cost below which a fraction of the reports are, from the
+ * histogram (upper bound of the bucket).
+ */
+static double	percentile(const replay_results_t* results, double fraction)
+{
+  unsigned long	wanted = fraction * results->injected;
+  unsigned long	seen = 0;
+  int		i = 0;
+
+  for (i = 0; i < LUMIO_REPLAY_HIST_BUCKETS; ++i)
+    {
+      seen += results->histogram[i];
+      if (seen > wanted)
+	return (ldexp(1, i + 1));
+    }
+  return (results->max_ns);
+}
+
+static int	save_json(const char* path, const replay_results_t* results,
+			  int firmware, unsigned int interval_us, int screens)
+{
+  FILE*		out = fopen(path, "w");
+  int		i = 0;
+  int		first = 1;
+
+  if (!out)
+    {
+      perror(path);
+      return (-1);
+    }
+
+  fprintf(out, "{\n  \"firmware\": %d,\n  \"interval_us\": %u,\n"
+	  "  \"screens\": %d,\n"
+	  "  \"reports\": %lu,\n  \"batches\": %lu,\n"
+	  "  \"elapsed_ns\": %.0f,\n  \"busy_ns\": %.0f,\n"
+	  "  \"reports_per_s\": %.0f,\n  \"mean_ns\": %.1f,\n"
+	  "  \"min_ns\": %u,\n  \"p50_ns\": %.0f,\n  \"p99_ns\": %.0f,\n"
+	  "  \"max_ns\": %u,\n  \"histogram\": [",
+	  firmware, interval_us, screens, results->injected, results->batches,
+	  results->elapsed_ns, results->busy_ns,
+	  results->injected / (results->elapsed_ns / 1e9),
+	  results->busy_ns / results->injected, results->min_ns,
+	  percentile(results, 0.5), percentile(results, 0.99), results->max_ns);
+  for (i = 0; i < LUMIO_REPLAY_HIST_BUCKETS; ++i)
+    if (results->histogram[i])
+      {
+	fprintf(out, "%s{\"lt_ns\": %.0f, \"count\": %lu}", first ? "" : ", ",
+		ldexp(1, i + 1), results->histogram[i]);
+	first = 0;
+      }
+  fprintf(out, "]");
+  if (results->counted)
+    fprintf(out, ",\n  \"cache_references\": %llu,\n"
+	    "  \"cache_misses\": %llu,\n  \"l1d_read_misses\": %llu",
+	    results->counters[CACHE_REFERENCES], results->counters[CACHE_MISSES],
+	    results->counters[L1D_MISSES]);
+  fprintf(out, "\n}\n");
+
+  fclose(out);
+  return (0);
+}
+
+int				main(int argc, char** argv)
+{
+  struct lumio_replay_batch	batch;
+  replay_results_t		results;
+  const char*			input = NULL;
+  const char*			output = NULL;
+  unsigned long			nb_reports = 0;
+  unsigned long			batch_size = DEFAULT_BATCH;
+  unsigned int			interval_us = 0;
+  __u8*				reports = NULL;
+  __u64*			times = NULL;
+  struct timespec		start;
+  struct timespec		due;
+  double			speed = 0;
+  double			due_ns = 0;
+  unsigned long			i = 0;
+  int				counter_fds[NB_COUNTERS];
+  int				fds[MAX_SCREENS];
+  int				firmware = LUMIO_FIRMWARE_3_0;
+  int				screens = 1;
+  int				count = 0;
+  int				leader = -1;
+  int				opt = 0;
+  int				fd = -1;
+  int				b = 0;
+
+  while ((opt = getopt(argc, argv, "f:n:b:p:m:cr:s:o:h")) != -1)
+    switch (opt)
+      {
+      case 'f':
+	firmware = atoi(optarg);
+	break;
+      case 'n':
+	nb_reports = strtoul(optarg, NULL, 0);
+	break;
+      case 'b':
+	batch_size = strtoul(optarg, NULL, 0);
+	break;
+      case 'p':
+	interval_us = strtoul(optarg, NULL, 0);
+	break;
+      case 'm':
+	screens = atoi(optarg);
+	break;
+      case 'c':
+	count = 1;
+	break;
+      case 'r':
+	input = optarg;
+	break;
+      case 's':
+	speed = atof(optarg);
+	break;
+      case 'o':
+	output = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (firmware < LUMIO_FIRMWARE_1_0 || firmware > LUMIO_FIRMWARE_3_0 ||
+      batch_size == 0 || batch_size > LUMIO_REPLAY_MAX_BATCH ||
+      screens < 1 || screens > MAX_SCREENS || speed < 0)
+    {
+      usage();
+      return (1);
+    }
+
+  if (input)
+    {
+      if (!(nb_reports = load(input, &reports, &times, nb_reports,
+			      &firmware)))
+	return (1);
+      if (speed > 0 && !times)
+	{
+	  fprintf(stderr, "%s: -s needs a trace, raw reports have no time\n",
+		  input);
+	  return (1);
+	}
+    }
+  else
+    {
+      if (nb_reports == 0)
+	nb_reports = DEFAULT_REPORTS;
+      if (!(reports = malloc(nb_reports * LUMIO_REPORT_SIZE)))
+	{
+	  perror("malloc");
+	  return (1);
+	}
+      generate(reports, nb_reports, firmware);
+    }
+
+  for (b = 0; b < screens; ++b)
+    {
+      if ((fds[b] = open("/dev/lumio_replay", O_RDWR)) < 0)
+	{
+	  perror("/dev/lumio_replay");
+	  return (1);
+	}
+      if (ioctl(fds[b], IOCTL_REPLAY_SETUP, firmware) < 0)
+	{
+	  perror("IOCTL_REPLAY_SETUP");
+	  return (1);
+	}
+    }
+
+  memset(&results, 0x0, sizeof (results));
+  results.min_ns = ~0u;
+  if (count && (leader = open_counters(counter_fds)) >= 0)
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < nb_reports; i += batch.injected)
+    {
+      memset(&batch, 0x0, sizeof (batch));
+      batch.nb_reports = nb_reports - i < batch_size ? nb_reports - i : batch_size;
+      batch.reports = (__u64) (unsigned long) (reports +
+					       i * LUMIO_REPORT_SIZE);
+      if (speed > 0)
+	{
+	  batch.nb_reports = 1;
+	  due_ns = start.tv_nsec + (times[i] - times[0]) * 1e3 / speed;
+	  due.tv_sec = start.tv_sec + (time_t) (due_ns / 1e9);
+	  due.tv_nsec = fmod(due_ns, 1e9);
+	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+	}
+      else if (interval_us)
+	{
+	  batch.flags = LUMIO_REPLAY_PACED;
+	  batch.interval_us = interval_us;
+	}
+      fd = fds[results.batches % screens];
+      if (ioctl(fd, IOCTL_REPLAY_BATCH, &batch) < 0)
+	{
+	  perror("IOCTL_REPLAY_BATCH");
+	  return (1);
+	}
+
+      ++results.batches;
+      results.injected += batch.injected;
+      results.elapsed_ns += batch.elapsed_ns;
+      results.busy_ns += batch.busy_ns;
+      if (batch.injected && batch.min_ns < results.min_ns)
+	results.min_ns = batch.min_ns;
+      if (batch.max_ns > results.max_ns)
+	results.max_ns = batch.max_ns;
+      for (b = 0; b < LUMIO_REPLAY_HIST_BUCKETS; ++b)
+	results.histogram[b] += batch.histogram[b];
+      if (batch.injected < batch.nb_reports)
+	break;
+    }
+  if (leader >= 0)
+    {
+      ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      read_counters(counter_fds, &results);
+    }
+  for (b = 0; b < screens; ++b)
+    close(fds[b]);
+
+  if (results.injected == 0)
+    {
+      fprintf(stderr, "no report injected\n");
+      return (1);
+    }
+
+  printf("%lu reports in %lu batches, firmware %d.0, %d touchscreen%s, %s\n",
+	 results.injected, results.batches, firmware, screens,
+	 screens > 1 ? "s" : "", speed > 0 ? "recorded pace" :
+	 interval_us ? "paced" : "max rate");
+  if (times && speed == 0 && results.injected > 1)
+    printf("  %.1f s of trace in %.3f s, %.0f times faster than real time\n",
+	   (times[results.injected - 1] - times[0]) / 1e6,
+	   results.elapsed_ns / 1e9,
+	   (times[results.injected - 1] - times[0]) * 1e3 / results.elapsed_ns);
+  printf("  %.0f reports/s, %.1f ns/report (driver busy %.1f%% of the time)\n",
+	 results.injected / (results.elapsed_ns / 1e9),
+	 results.busy_ns / results.injected,
+	 100.0 * results.busy_ns / results.elapsed_ns);
+  printf("  cost: min %u ns, p50 < %.0f ns, p99 < %.0f ns, max %u ns\n",
+	 results.min_ns, percentile(&results, 0.5), percentile(&results, 0.99),
+	 results.max_ns);
+  if (results.counted)
+    printf("  cache: %.2f misses/report (%.1f%% of the references), "
+	   "%.2f L1d read misses/report\n",
+	   (double) results.counters[CACHE_MISSES] / results.injected,
+	   results.counters[CACHE_REFERENCES] ? 100.0 *
+	   results.counters[CACHE_MISSES] / results.counters[CACHE_REFERENCES] : 0,
+	   (double) results.counters[L1D_MISSES] / results.injected);
+
+  if (output && save_json(output, &results, firmware, interval_us,
+			  screens) != 0)
+    return (1);
+
+  free(reports);
+  free(times);
+  return (0);
+}
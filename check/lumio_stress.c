@@ -0,0 +1,539 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_stress.c
+ * @author Quentin Casasnovas
+ * @brief Races evdev opens and closes against the report path and unplugs.
+ *
+ *	Each panel is a virtual touchscreen of /dev/lumio_replay, fed at full
+ * rate by its own thread, and unplugged (its replay device closed) then
+ * plugged again every few seconds. Meanwhile many reader threads open the
+ * evdev devices of random panels, read them for a random while and close
+ * them: the opens and closes race with the reports, with each other and with
+ * the unplugs, which is what multi-client hosts do to the driver.
+ *
+ *	Both contacts of each report carry its sequence number as their x
+ * coordinate, so that every reader checks, frame by frame, that no report
+ * went missing and none was handled twice or out of order. Frames the evdev
+ * buffer of a reader dropped (SYN_DROPPED, when a reader is starved) are
+ * counted apart, they are not the driver's doing. The program fails if a
+ * single frame was lost or duplicated.
+ *
+ *	Needs CAP_SYS_ADMIN, and a driver loaded without the wall nor partition
+ * parameters, so that the virtual touchscreens get their two fake mice.
+ */
+
+#include <linux/input.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+#include <poll.h>
+#include <time.h>
+
+#include "lumio_protocol.h"
+#include "lumio_driver.h"
+
+#ifndef SYN_DROPPED
+# define SYN_DROPPED		3
+#endif
+
+#define DEFAULT_DURATION	10
+#define DEFAULT_PANELS		2
+#define DEFAULT_READERS		8
+#define DEFAULT_INTERVAL_US	2000
+#define DEFAULT_UNPLUG_MS	2000
+#define MAX_PANELS		16
+#define MAX_READERS		256
+/** @brief Reports injected per batch, a batch can't be interrupted. */
+#define BATCH_REPORTS		64
+/** @brief Longest a reader keeps a device open. */
+#define MAX_SESSION_MS		200
+/** @brief How long a plugged panel may take to show its devices. */
+#define PLUG_TIMEOUT_MS		2000
+/** @brief Longest bus path of a touchscreen, as the driver has it. */
+#define BUS_PATH_SIZE		32
+
+/**
+ * @brief A virtual touchscreen, and the thread feeding it.
+ */
+typedef struct		panel
+{
+  pthread_t		thread;
+  pthread_mutex_t	lock; /**< Protects the nodes. */
+  char			nodes[2][64]; /**< Its evdev devices, while plugged. */
+  int			nb_nodes;
+  unsigned long		plugs;
+  unsigned long		injected;
+  unsigned long long	busy_ns; /**< What the reports cost the driver. */
+}			panel_t;
+
+/**
+ * @brief A reader thread, and what it saw.
+ */
+typedef struct		reader
+{
+  pthread_t		thread;
+  unsigned int		seed;
+  unsigned long		sessions; /**< Devices opened. */
+  unsigned long		open_failures; /**< Devices gone before being opened. */
+  unsigned long		unplugged; /**< Sessions ended by an unplug. */
+  unsigned long		errors; /**< Anything else failing. */
+  unsigned long		frames;
+  unsigned long		lost;
+  unsigned long		duplicated; /**< Handled twice or out of order. */
+  unsigned long		overruns; /**< SYN_DROPPED, the reader was too slow. */
+}			reader_t;
+
+static panel_t		panels[MAX_PANELS];
+static reader_t		readers[MAX_READERS];
+static int		nb_panels = DEFAULT_PANELS;
+static int		nb_readers = DEFAULT_READERS;
+static unsigned int	interval_us = DEFAULT_INTERVAL_US;
+static unsigned int	unplug_ms = DEFAULT_UNPLUG_MS;
+static int		firmware = LUMIO_FIRMWARE_3_0;
+static unsigned int	modulo = 0; /**< Sequence numbers wrap around. */
+static volatile int	stop = 0;
+/** @brief Plugs one panel at a time, to tell which devices are its own. */
+static pthread_mutex_t	plug_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_stress [-d seconds] [-p panels] [-t readers] "
+	  "[-i interval_us] [-u unplug_ms] [-f firmware]\n"
+	  "  -d  duration of the run (default %d s)\n"
+	  "  -p  virtual touchscreens (default %d, max %d)\n"
+	  "  -t  reader threads opening and closing their devices (default %d, "
+	  "max %d)\n"
+	  "  -i  a report every interval_us on each panel (default %d, the rate "
+	  "of firmware 3.0)\n"
+	  "  -u  unplug and plug each panel again every unplug_ms, 0 never "
+	  "(default %d)\n"
+	  "  -f  firmware to emulate, 1, 2 or 3 (default 3)\n",
+	  DEFAULT_DURATION, DEFAULT_PANELS, MAX_PANELS, DEFAULT_READERS,
+	  MAX_READERS, DEFAULT_INTERVAL_US, DEFAULT_UNPLUG_MS);
+}
+
+static double		now_ms(void)
+{
+  struct timespec	ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e3 + ts.tv_nsec / 1e6);
+}
+
+/**
+ * Reads the first line of a sysfs file, returns 0 or -1.
+ */
+static int	read_line(const char* path, char* line, size_t size)
+{
+  FILE*		file = NULL;
+
+  if (!(file = fopen(path, "r")))
+    return (-1);
+  if (!fgets(line, size, file))
+    line[0] = 0;
+  line[strcspn(line, "\n")] = 0;
+  fclose(file);
+
+  return (0);
+}
+
+/**
+ * Lists the bus paths of the virtual touchscreens of the host, one per fake
+ * mouse, in phys; with nodes, only the devices of the one at bus_path.
+ * Returns how many were found.
+ */
+static int		scan(char (*phys)[BUS_PATH_SIZE],
+			     int max, const char* bus_path,
+			     char (*nodes)[64])
+{
+  glob_t		events;
+  char			path[PATH_MAX];
+  char			line[BUS_PATH_SIZE];
+  size_t		i = 0;
+  int			n = 0;
+
+  if (glob("/sys/class/input/event*", 0, NULL, &events) != 0)
+    return (0);
+  for (i = 0; i < events.gl_pathc && n < max; ++i)
+    {
+      snprintf(path, sizeof (path), "%s/device/phys", events.gl_pathv[i]);
+      if (read_line(path, line, sizeof (line)) < 0 ||
+	  strncmp(line, "replay", 6) || (bus_path && strcmp(line, bus_path)))
+	continue;
+      if (phys)
+	strcpy(phys[n], line);
+      if (nodes)
+	snprintf(nodes[n], sizeof (nodes[n]), "/dev/input/%s",
+		 strrchr(events.gl_pathv[i], '/') + 1);
+      ++n;
+    }
+  globfree(&events);
+
+  return (n);
+}
+
+/**
+ * Plugs a panel: creates its virtual touchscreen and finds its devices.
+ * Returns the replay device, or -1.
+ */
+static int		plug(panel_t* panel)
+{
+  char			before[MAX_PANELS * 2][BUS_PATH_SIZE];
+  char			after[MAX_PANELS * 2][BUS_PATH_SIZE];
+  char			nodes[2][64];
+  const char*		bus_path = NULL;
+  double		deadline = now_ms() + PLUG_TIMEOUT_MS;
+  int			nb_before = 0;
+  int			nb_after = 0;
+  int			nb_nodes = 0;
+  int			fd = -1;
+  int			i = 0;
+  int			j = 0;
+
+  pthread_mutex_lock(&plug_lock);
+  nb_before = scan(before, MAX_PANELS * 2, NULL, NULL);
+  if ((fd = open("/dev/lumio_replay", O_RDWR)) < 0 ||
+      ioctl(fd, IOCTL_REPLAY_SETUP, firmware) < 0)
+    {
+      perror("/dev/lumio_replay");
+      goto error;
+    }
+
+  /* Its devices are the new ones, once udev created their nodes */
+  while (now_ms() < deadline)
+    {
+      nb_after = scan(after, MAX_PANELS * 2, NULL, NULL);
+      for (i = 0, bus_path = NULL; i < nb_after && !bus_path; ++i)
+	{
+	  for (j = 0; j < nb_before && strcmp(before[j], after[i]); ++j)
+	    ;
+	  if (j == nb_before)
+	    bus_path = after[i];
+	}
+      if (bus_path && (nb_nodes = scan(NULL, 2, bus_path, nodes)) == 2 &&
+	  access(nodes[0], R_OK) == 0 && access(nodes[1], R_OK) == 0)
+	break;
+      nb_nodes = 0;
+      usleep(10000);
+    }
+  if (nb_nodes != 2)
+    {
+      fprintf(stderr, "lumio_stress: the fake mice of a virtual touchscreen "
+	      "didn't show up (wall or partition parameters?)\n");
+      goto error;
+    }
+  pthread_mutex_unlock(&plug_lock);
+
+  pthread_mutex_lock(&panel->lock);
+  memcpy(panel->nodes, nodes, sizeof (nodes));
+  panel->nb_nodes = 2;
+  ++panel->plugs;
+  pthread_mutex_unlock(&panel->lock);
+
+  return (fd);
+
+ error:
+  if (fd >= 0)
+    close(fd);
+  pthread_mutex_unlock(&plug_lock);
+  return (-1);
+}
+
+/**
+ * Unplugs a panel: its devices go away with its virtual touchscreen.
+ */
+static void	unplug(panel_t* panel, int fd)
+{
+  pthread_mutex_lock(&panel->lock);
+  panel->nb_nodes = 0;
+  pthread_mutex_unlock(&panel->lock);
+  close(fd);
+}
+
+/**
+ * Feeds a panel at full rate, unplugging it every unplug_ms.
+ */
+static void*			feed(void* arg)
+{
+  panel_t*			panel = arg;
+  struct lumio_replay_batch	batch;
+  struct lumio_contact		contacts[LUMIO_MAX_CONTACTS];
+  __u8				reports[BATCH_REPORTS * LUMIO_REPORT_SIZE];
+  unsigned long			seq = 0;
+  double			unplug_at = 0;
+  int				fd = -1;
+  int				i = 0;
+
+  while (!stop)
+    {
+      if (fd < 0)
+	{
+	  if ((fd = plug(panel)) < 0)
+	    {
+	      stop = 1;
+	      break;
+	    }
+	  seq = 0;
+	  unplug_at = now_ms() + unplug_ms;
+	}
+
+      for (i = 0; i < BATCH_REPORTS; ++i, ++seq)
+	{
+	  contacts[0].x = contacts[1].x = seq % modulo;
+	  contacts[0].y = modulo / 4;
+	  contacts[1].y = modulo / 4 * 3;
+	  contacts[0].tag = 0;
+	  contacts[1].tag = 1;
+	  contacts[0].down = contacts[1].down = 1;
+	  lumio_encode_report(reports + i * LUMIO_REPORT_SIZE, contacts, 2);
+	}
+      memset(&batch, 0x0, sizeof (batch));
+      batch.nb_reports = BATCH_REPORTS;
+      batch.flags = LUMIO_REPLAY_PACED;
+      batch.interval_us = interval_us;
+      batch.reports = (__u64) (unsigned long) reports;
+      if (ioctl(fd, IOCTL_REPLAY_BATCH, &batch) < 0)
+	{
+	  perror("IOCTL_REPLAY_BATCH");
+	  stop = 1;
+	  break;
+	}
+      panel->injected += batch.injected;
+      panel->busy_ns += batch.busy_ns;
+
+      if (unplug_ms && now_ms() >= unplug_at)
+	{
+	  unplug(panel, fd);
+	  fd = -1;
+	}
+    }
+  if (fd >= 0)
+    unplug(panel, fd);
+
+  return (NULL);
+}
+
+/**
+ * Reads a device for a while, checking the sequence of its frames.
+ */
+static void		session(reader_t* reader, const char* node,
+				double duration_ms)
+{
+  struct input_event	events[64];
+  struct pollfd		pfd;
+  double		end = now_ms() + duration_ms;
+  long			last = -1;
+  long			x = -1;
+  long			delta = 0;
+  int			dropping = 0;
+  int			n = 0;
+  int			i = 0;
+
+  if ((pfd.fd = open(node, O_RDONLY | O_NONBLOCK)) < 0)
+    {
+      if (errno == ENOENT || errno == ENODEV || errno == ENXIO)
+	++reader->open_failures;
+      else
+	++reader->errors;
+      return;
+    }
+  pfd.events = POLLIN;
+  ++reader->sessions;
+
+  while (!stop && now_ms() < end)
+    {
+      if (poll(&pfd, 1, 10) <= 0)
+	continue;
+      if ((n = read(pfd.fd, events, sizeof (events))) < 0)
+	{
+	  if (errno == EAGAIN)
+	    continue;
+	  if (errno == ENODEV)
+	    ++reader->unplugged;
+	  else
+	    ++reader->errors;
+	  break;
+	}
+      for (i = 0; i < n / (int) sizeof (struct input_event); ++i)
+	if (events[i].type == EV_ABS && events[i].code == ABS_RX)
+	  x = events[i].value;
+	else if (events[i].type == EV_SYN && events[i].code == SYN_DROPPED)
+	  {
+	    /* What is left of the frame goes too, start over after it */
+	    ++reader->overruns;
+	    dropping = 1;
+	    last = -1;
+	  }
+	else if (events[i].type == EV_SYN && events[i].code == SYN_REPORT)
+	  {
+	    if (!dropping)
+	      {
+		++reader->frames;
+		if (x >= 0 && last >= 0)
+		  {
+		    delta = (x - last + modulo) % modulo;
+		    if (delta == 0 || delta > (long) modulo / 2)
+		      ++reader->duplicated;
+		    else
+		      reader->lost += delta - 1;
+		  }
+		if (x >= 0)
+		  last = x;
+	      }
+	    dropping = 0;
+	    x = -1;
+	  }
+    }
+  close(pfd.fd);
+}
+
+/**
+ * Opens and closes the devices of random panels.
+ */
+static void*		hammer(void* arg)
+{
+  reader_t*		reader = arg;
+  panel_t*		panel = NULL;
+  char			node[64];
+
+  while (!stop)
+    {
+      panel = &panels[rand_r(&reader->seed) % nb_panels];
+      node[0] = 0;
+      pthread_mutex_lock(&panel->lock);
+      if (panel->nb_nodes)
+	strcpy(node, panel->nodes[rand_r(&reader->seed) % panel->nb_nodes]);
+      pthread_mutex_unlock(&panel->lock);
+      if (node[0])
+	session(reader, node, rand_r(&reader->seed) % MAX_SESSION_MS);
+      else
+	usleep(1000);
+    }
+
+  return (NULL);
+}
+
+int			main(int argc, char** argv)
+{
+  reader_t		total;
+  unsigned long		injected = 0;
+  unsigned long		plugs = 0;
+  unsigned long long	busy_ns = 0;
+  double		start = 0;
+  double		elapsed = 0;
+  int			duration = DEFAULT_DURATION;
+  int			opt = 0;
+  int			i = 0;
+
+  while ((opt = getopt(argc, argv, "d:p:t:i:u:f:h")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	duration = atoi(optarg);
+	break;
+      case 'p':
+	nb_panels = atoi(optarg);
+	break;
+      case 't':
+	nb_readers = atoi(optarg);
+	break;
+      case 'i':
+	interval_us = strtoul(optarg, NULL, 0);
+	break;
+      case 'u':
+	unplug_ms = strtoul(optarg, NULL, 0);
+	break;
+      case 'f':
+	firmware = atoi(optarg);
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (duration <= 0 || nb_panels < 1 || nb_panels > MAX_PANELS ||
+      nb_readers < 0 || nb_readers > MAX_READERS ||
+      firmware < LUMIO_FIRMWARE_1_0 || firmware > LUMIO_FIRMWARE_3_0)
+    {
+      usage();
+      return (1);
+    }
+  modulo = lumio_max_coordinate(firmware) + 1;
+
+  start = now_ms();
+  for (i = 0; i < nb_panels; ++i)
+    {
+      pthread_mutex_init(&panels[i].lock, NULL);
+      pthread_create(&panels[i].thread, NULL, feed, &panels[i]);
+    }
+  for (i = 0; i < nb_readers; ++i)
+    {
+      readers[i].seed = i + 1;
+      pthread_create(&readers[i].thread, NULL, hammer, &readers[i]);
+    }
+  while (!stop && now_ms() < start + duration * 1e3)
+    usleep(100000);
+  stop = 1;
+  for (i = 0; i < nb_readers; ++i)
+    pthread_join(readers[i].thread, NULL);
+  for (i = 0; i < nb_panels; ++i)
+    pthread_join(panels[i].thread, NULL);
+  elapsed = (now_ms() - start) / 1e3;
+
+  memset(&total, 0x0, sizeof (total));
+  for (i = 0; i < nb_readers; ++i)
+    {
+      total.sessions += readers[i].sessions;
+      total.open_failures += readers[i].open_failures;
+      total.unplugged += readers[i].unplugged;
+      total.errors += readers[i].errors;
+      total.frames += readers[i].frames;
+      total.lost += readers[i].lost;
+      total.duplicated += readers[i].duplicated;
+      total.overruns += readers[i].overruns;
+    }
+  for (i = 0; i < nb_panels; ++i)
+    {
+      plugs += panels[i].plugs;
+      injected += panels[i].injected;
+      busy_ns += panels[i].busy_ns;
+    }
+
+  printf("%d panels, %d readers, %.1f s\n", nb_panels, nb_readers, elapsed);
+  printf("  injected: %lu reports (%.0f/s), %lu plugs, %.0f ns/report\n",
+	 injected, injected / elapsed, plugs,
+	 injected ? (double) busy_ns / injected : 0.0);
+  printf("  read: %lu frames (%.0f/s) in %lu sessions, %lu ended by an "
+	 "unplug, %lu opens too late\n", total.frames, total.frames / elapsed,
+	 total.sessions, total.unplugged, total.open_failures);
+  printf("  lost: %lu, duplicated or out of order: %lu, reader overruns: "
+	 "%lu, errors: %lu\n", total.lost, total.duplicated, total.overruns,
+	 total.errors);
+
+  return (injected == 0 || total.lost || total.duplicated || total.errors);
+}
@@ -0,0 +1,758 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_test.c
+ * @author Quentin Casasnovas
+ * @brief Unit tests of the logic the driver shares with userland.
+ *
+ *	The decoding of the reports of every firmware, the configuration
+ * handshake, the finger assignment, the listener accounting and the motion
+ * prediction live in the shared headers (lumio_protocol.h, lumio_filter.h,
+ * lumio_listeners.h and lumio_predict.h), so
+ * they are tested here, on the build host, with the very code the driver
+ * runs. "make test" in the check directory builds and runs them.
+ *
+ *	The benchmarks at the end fail when decoding a report, or running a
+ * report filter on it, costs more than a threshold: a generous one by
+ * default, so that only real regressions trip it on a slow host. -q skips
+ * them, for valgrind for instance.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "lumio_protocol.h"
+#include "lumio_filter.h"
+#include "lumio_listeners.h"
+#include "lumio_predict.h"
+#include "lumio_reject.h"
+#include "lumio_regions.h"
+#include "lumio_trace.h"
+#include "lumio_decimate.h"
+
+#define DEFAULT_DECODE_NS	50
+#define DEFAULT_FILTER_NS	500
+#define BENCH_REPORTS		10000000
+
+#define CHECK(Cond)							\
+  do									\
+    {									\
+      ++nb_checks;							\
+      if (!(Cond))							\
+	{								\
+	  ++nb_failures;						\
+	  fprintf(stderr, "%s:%d: %s: check failed: %s\n",		\
+		  __FILE__, __LINE__, __func__, #Cond);			\
+	}								\
+    } while (0)
+
+static unsigned int	nb_checks = 0;
+static unsigned int	nb_failures = 0;
+
+/** @brief Contact 1: x 0x5a3, y 0x3c1, down, tag 0. */
+static const __u8	first_half[LUMIO_HALF_REPORT_SIZE] =
+  { 0x00, 0x00, LUMIO_DUAL_REPORT, 0x55, 0xa3, 0xc1, 0x03, 0x00 };
+/** @brief Contact 2: x 0x234, y 0x678, up, tag 1. */
+static const __u8	second_half[LUMIO_HALF_REPORT_SIZE] =
+  { 0x00, 0x20, 0x34, 0x62, 0x78, 0x00, 0x00, 0x00 };
+
+/**
+ * Builds the report the driver sees, the way it gathers it from the urbs:
+ * two halves for firmware 1.0 and 2.0, one 64 bytes report for firmware 3.0.
+ * Bytes after the contacts are filled with garbage, to make sure they are
+ * ignored.
+ */
+static void		build_report(__u8* report, int firmware, int dual)
+{
+  memset(report, 0xff, LUMIO_REPORT_SIZE);
+  if (firmware != LUMIO_FIRMWARE_3_0)
+    memset(report + 2 * LUMIO_HALF_REPORT_SIZE, 0x0,
+	   LUMIO_REPORT_SIZE - 2 * LUMIO_HALF_REPORT_SIZE);
+  memcpy(report, first_half, LUMIO_HALF_REPORT_SIZE);
+  memcpy(report + LUMIO_HALF_REPORT_SIZE, second_half, LUMIO_HALF_REPORT_SIZE);
+  if (!dual)
+    report[2] = 0x00;
+}
+
+static void		test_decode(void)
+{
+  struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+  __u8			report[LUMIO_REPORT_SIZE];
+  int			firmware = 0;
+
+  for (firmware = LUMIO_FIRMWARE_1_0; firmware <= LUMIO_FIRMWARE_3_0; ++firmware)
+    {
+      build_report(report, firmware, 1);
+      memset(contacts, 0x0, sizeof (contacts));
+      CHECK(lumio_decode_report(report, contacts) == 2);
+      CHECK(contacts[0].x == 0x5a3 && contacts[0].y == 0x3c1);
+      CHECK(contacts[0].down == 1 && contacts[0].tag == 0);
+      CHECK(contacts[1].x == 0x234 && contacts[1].y == 0x678);
+      CHECK(contacts[1].down == 0 && contacts[1].tag == 1);
+
+      build_report(report, firmware, 0);
+      CHECK(lumio_decode_report(report, contacts) == 1);
+      CHECK(contacts[0].x == 0x5a3 && contacts[0].y == 0x3c1);
+    }
+
+  CHECK(lumio_report_size(LUMIO_FIRMWARE_1_0) == 16);
+  CHECK(lumio_report_size(LUMIO_FIRMWARE_2_0) == 16);
+  CHECK(lumio_report_size(LUMIO_FIRMWARE_3_0) == LUMIO_REPORT_SIZE);
+  CHECK(lumio_max_coordinate(LUMIO_FIRMWARE_1_0) == 2047);
+  CHECK(lumio_max_coordinate(LUMIO_FIRMWARE_3_0) == 4095);
+}
+
+/**
+ * Every coordinate a firmware reports survives an encoding and a decoding,
+ * in both contacts.
+ */
+static void		test_round_trip(void)
+{
+  struct lumio_contact	in[LUMIO_MAX_CONTACTS];
+  struct lumio_contact	out[LUMIO_MAX_CONTACTS];
+  __u8			report[LUMIO_REPORT_SIZE];
+  unsigned int		bad = 0;
+  int			firmware = 0;
+  int			v = 0;
+
+  for (firmware = LUMIO_FIRMWARE_1_0; firmware <= LUMIO_FIRMWARE_3_0; ++firmware)
+    for (v = 0; v <= lumio_max_coordinate(firmware); ++v)
+      {
+	in[0].x = v;
+	in[0].y = lumio_max_coordinate(firmware) - v;
+	in[0].tag = v & 1;
+	in[0].down = (v >> 1) & 1;
+	in[1].x = in[0].y;
+	in[1].y = v;
+	in[1].tag = !in[0].tag;
+	in[1].down = (v >> 2) & 1;
+	lumio_encode_report(report, in, 2);
+	if (lumio_decode_report(report, out) != 2 ||
+	    memcmp(in, out, sizeof (in)))
+	  ++bad;
+      }
+  CHECK(bad == 0);
+}
+
+static void		test_config(void)
+{
+  static const __u8	dual[LUMIO_MSG_SIZE] = { 0x7f, 0x9b, 0x01, 0x01 };
+  static const __u8	single[LUMIO_MSG_SIZE] = { 0x7f, 0x9b, 0x01, 0x00 };
+  static const __u8	lost[LUMIO_MSG_SIZE] = { 0x00 };
+  static const __u8	report[LUMIO_MSG_SIZE] = { 0x00, 0x00, 0x0d, 0x01 };
+  __u8			msg[LUMIO_REPORT_SIZE];
+
+  CHECK(lumio_config_is_dualtouch(dual) == 1);
+  CHECK(lumio_config_is_dualtouch(single) == 0);
+  CHECK(lumio_config_is_dualtouch(lost) == -1);
+  CHECK(lumio_config_is_dualtouch(report) == -1);
+
+  lumio_build_config_msg(msg, 0);
+  CHECK(msg[0] == 0x7f && msg[1] == 0x9b && msg[2] == 0x00 && msg[3] == 0x00);
+  lumio_build_config_msg(msg, 1);
+  CHECK(!memcmp(msg, dual, LUMIO_MSG_SIZE));
+  CHECK(lumio_config_is_dualtouch(msg) == 1);
+
+  lumio_build_driver_mode_msg(msg);
+  CHECK(msg[0] == 0x75 && msg[1] == 0x76 && msg[2] == 0x00 && msg[7] == 0x00);
+}
+
+/**
+ * Each contact goes to the fake mouse of its tag, whatever its place in the
+ * report.
+ */
+static void		test_fingers(void)
+{
+  struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+  __u8			report[LUMIO_REPORT_SIZE];
+
+  build_report(report, LUMIO_FIRMWARE_3_0, 1);
+  report[3] &= ~LUMIO_TAGID_EVENT_ID1;
+  report[9] |= LUMIO_TAGID_EVENT_ID1 << 4;
+  CHECK(lumio_decode_report(report, contacts) == 2);
+  CHECK(contacts[0].tag == 1 && contacts[1].tag == 0);
+
+  report[3] |= LUMIO_TAGID_EVENT_ID1;
+  CHECK(lumio_decode_report(report, contacts) == 2);
+  CHECK(contacts[0].tag == 0 && contacts[1].tag == 0);
+
+  /* A finger moving keeps its tag */
+  report[3] = (report[3] & ~LUMIO_OPERATION_MASK) | LUMIO_OPERATION_MOVE;
+  CHECK(lumio_decode_report(report, contacts) == 2);
+  CHECK(contacts[0].tag == 0 && contacts[0].down == 1);
+}
+
+/**
+ * The two fake mice share the reports of the touchscreen: they start with the
+ * first open and stop with the last close, in any order.
+ */
+static void		test_listeners(void)
+{
+  unsigned int		listeners = 0;
+
+  CHECK(lumio_listener_get(&listeners) == 1);
+  CHECK(lumio_listener_get(&listeners) == 0);
+  CHECK(lumio_listener_put(&listeners) == 0);
+  CHECK(lumio_listener_get(&listeners) == 0);
+  CHECK(lumio_listener_put(&listeners) == 0);
+  CHECK(lumio_listener_put(&listeners) == 1);
+  CHECK(listeners == 0);
+
+  /* An unbalanced close doesn't wrap the counter around */
+  CHECK(lumio_listener_put(&listeners) == 0);
+  CHECK(listeners == 0);
+  CHECK(lumio_listener_get(&listeners) == 1);
+}
+
+/**
+ * A finger moving at constant speed is predicted where it will be, within the
+ * bounds, and a finger at rest isn't predicted anywhere.
+ */
+static void			test_predict(void)
+{
+  struct lumio_prediction	config = { 20, 4095 };
+  struct lumio_predictor	p;
+  __s32				x = 0;
+  __s32				y = 0;
+  int				i = 0;
+
+  /* 1 unit per ms on x, reports every 10 ms */
+  memset(&p, 0x0, sizeof (p));
+  for (i = 0; i < 50; ++i)
+    lumio_predict_update(&p, 1000 + i * 10, 500, i * 10000);
+  lumio_predict(&p, &config, 4095, &x, &y);
+  CHECK(x >= 1490 + 18 && x <= 1490 + 22 && y == 500);
+
+  config.max_distance = 5;
+  lumio_predict(&p, &config, 4095, &x, &y);
+  CHECK(x == 1495 && y == 500);
+
+  /* The screen bounds the prediction */
+  config.max_distance = 4095;
+  memset(&p, 0x0, sizeof (p));
+  for (i = 0; i < 50; ++i)
+    lumio_predict_update(&p, 3600 + i * 10, 500, i * 10000);
+  lumio_predict(&p, &config, 4095, &x, &y);
+  CHECK(x == 4095);
+
+  /* A resting finger, or one seen once, stays where it is */
+  memset(&p, 0x0, sizeof (p));
+  for (i = 0; i < 10; ++i)
+    lumio_predict_update(&p, 2000, 2000, i * 10000);
+  lumio_predict(&p, &config, 4095, &x, &y);
+  CHECK(x == 2000 && y == 2000);
+  lumio_predict_reset(&p);
+  lumio_predict_update(&p, 100, 100, 100000);
+  lumio_predict(&p, &config, 4095, &x, &y);
+  CHECK(x == 100 && y == 100);
+
+  /* So does one which stopped reporting for a while */
+  memset(&p, 0x0, sizeof (p));
+  for (i = 0; i < 10; ++i)
+    lumio_predict_update(&p, 1000 + i * 10, 500, i * 10000);
+  lumio_predict_update(&p, 1200, 500, 590000);
+  lumio_predict(&p, &config, 4095, &x, &y);
+  CHECK(x == 1200);
+}
+
+static __u32			run_contact(const struct sock_filter*	insns,
+					    __u32			x,
+					    __u32			y,
+					    __u32			max_coord)
+{
+  __u32				mem[LUMIO_FILTER_MEMWORDS];
+
+  memset(mem, 0x0, sizeof (mem));
+  mem[LUMIO_FILTER_M_X] = x;
+  mem[LUMIO_FILTER_M_Y] = y;
+  mem[LUMIO_FILTER_M_MAX_COORD] = max_coord;
+  return (lumio_filter_run(insns, NULL, 0, mem));
+}
+
+static void			test_filter(void)
+{
+  /* helper/filters/edge_deadzone.bpf */
+  static const struct sock_filter	edge_deadzone[] =
+    {
+      { 0x61, 0, 0, 0x00000007 },
+      { 0x60, 0, 0, 0x00000000 },
+      { 0x35, 0, 7, 0x00000020 },
+      { 0x04, 0, 0, 0x00000020 },
+      { 0x2d, 5, 0, 0x00000000 },
+      { 0x60, 0, 0, 0x00000001 },
+      { 0x35, 0, 3, 0x00000020 },
+      { 0x04, 0, 0, 0x00000020 },
+      { 0x2d, 1, 0, 0x00000000 },
+      { 0x06, 0, 0, 0x00000001 },
+      { 0x06, 0, 0, 0x00000000 },
+    };
+  struct sock_filter			shift[] =
+    {
+      { BPF_ALU | BPF_LSH | BPF_K, 0, 0, 31 },
+      { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+
+  CHECK(lumio_filter_check(edge_deadzone, 11, LUMIO_HOOK_CONTACT) == 0);
+  CHECK(run_contact(edge_deadzone, 1000, 1000, 4095) == 1);
+  CHECK(run_contact(edge_deadzone, 31, 1000, 4095) == 0);
+  CHECK(run_contact(edge_deadzone, 4063, 1000, 4095) == 1);
+  CHECK(run_contact(edge_deadzone, 4064, 1000, 4095) == 0);
+  CHECK(run_contact(edge_deadzone, 1000, 2016, 2047) == 0);
+  CHECK(run_contact(edge_deadzone, 2015, 2015, 2047) == 1);
+
+  CHECK(lumio_filter_check(shift, 2, LUMIO_HOOK_CONTACT) == 0);
+  shift[0].k = 32;
+  CHECK(lumio_filter_check(shift, 2, LUMIO_HOOK_CONTACT) == -1);
+  shift[0].code = BPF_ALU | BPF_RSH | BPF_K;
+  CHECK(lumio_filter_check(shift, 2, LUMIO_HOOK_CONTACT) == -1);
+}
+
+static int			reject(const struct lumio_rejection*	config,
+				       struct lumio_reject_state*	s,
+				       __u16				x,
+				       __u16				y,
+				       __u8				down)
+{
+  struct lumio_contact		contact = { x, y, 0, down };
+
+  return (lumio_reject(config, s, &contact, 4095));
+}
+
+static void			test_reject(void)
+{
+  struct lumio_rejection	config = { 100, 300, 3 };
+  struct lumio_reject_state	s;
+  struct lumio_contact		lift = { 2000, 2000, 0, 0 };
+  int				i = 0;
+
+  memset(&s, 0x0, sizeof (s));
+  CHECK(!lumio_reject_enabled(&(struct lumio_rejection) { 0, 0, 1 }));
+  CHECK(lumio_reject_enabled(&config));
+
+  /* Down on the edge: dropped until lifted, even once inside */
+  CHECK(reject(&config, &s, 50, 2000, 1) == LUMIO_REJECT_EDGE);
+  CHECK(reject(&config, &s, 2000, 2000, 1) == LUMIO_REJECT_EDGE);
+  CHECK(reject(&config, &s, 2000, 2000, 0) == LUMIO_REJECT_EDGE);
+  CHECK(reject(&config, &s, 4000, 2000, 1) == LUMIO_REJECT_EDGE);
+  CHECK(reject(&config, &s, 4000, 2000, 0) == LUMIO_REJECT_EDGE);
+
+  /* Blip: lifted before its third report */
+  CHECK(reject(&config, &s, 2000, 2000, 1) == LUMIO_REJECT_HELD);
+  CHECK(reject(&config, &s, 2000, 2000, 1) == LUMIO_REJECT_HELD);
+  CHECK(reject(&config, &s, 2000, 2000, 0) == LUMIO_REJECT_BLIP);
+
+  /* A finger: reported from its third report on */
+  for (i = 0; i < 2; ++i)
+    CHECK(reject(&config, &s, 2000, 2000 + i, 1) == LUMIO_REJECT_HELD);
+  for (i = 2; i < 10; ++i)
+    CHECK(reject(&config, &s, 2000, 2000 + i * 10, 1) == LUMIO_REJECT_NONE);
+
+  /* A jump is dropped, unless the next report confirms it */
+  CHECK(reject(&config, &s, 3000, 2100, 1) == LUMIO_REJECT_JUMP);
+  CHECK(reject(&config, &s, 2000, 2100, 1) == LUMIO_REJECT_NONE);
+  CHECK(reject(&config, &s, 3000, 2100, 1) == LUMIO_REJECT_JUMP);
+  CHECK(reject(&config, &s, 3010, 2100, 1) == LUMIO_REJECT_NONE);
+
+  /* Lifted where it was last reported */
+  CHECK(reject(&config, &s, 500, 500, 1) == LUMIO_REJECT_JUMP);
+  CHECK(lumio_reject(&config, &s, &lift, 4095) == LUMIO_REJECT_NONE);
+  CHECK(lift.x == 3010 && lift.y == 2100 && s.state == LUMIO_REJECT_IDLE);
+
+  /* Thresholds changed while down: let through, lift included */
+  lumio_reject_resync(&s);
+  CHECK(reject(&config, &s, 50, 50, 1) == LUMIO_REJECT_NONE);
+  CHECK(reject(&config, &s, 60, 50, 1) == LUMIO_REJECT_NONE);
+  CHECK(reject(&config, &s, 60, 50, 0) == LUMIO_REJECT_NONE);
+}
+
+static void			test_regions(void)
+{
+  static const struct lumio_region	regions[] =
+    {
+      { 0, 0, 256, 256, 30, LUMIO_REGION_PRESS },
+      { 100, 100, 2000, 2000, 48, LUMIO_REGION_CLICK },
+      { 255, 3000, 2, 1096, 46, LUMIO_REGION_PRESS },
+    };
+  struct lumio_region_index*	index = NULL;
+  struct lumio_region		bad = { 4000, 0, 96, 10, 30, LUMIO_REGION_PRESS };
+  int				size = 0;
+
+  /* 1 cell, 9x9 cells and 2x5 cells across the 255/256 boundary */
+  size = lumio_regions_size(regions, 3, 4095);
+  CHECK(size == 1 + 81 + 10);
+  index = malloc(sizeof (*index) + size);
+  lumio_regions_build(index, regions, 3, LUMIO_REGIONS_ONLY, 4095);
+  CHECK(index->cells[LUMIO_REGION_CELLS] == size);
+  CHECK(index->flags == LUMIO_REGIONS_ONLY);
+
+  /* First given wins where they overlap */
+  CHECK(lumio_region_find(index, 0, 0) == 0);
+  CHECK(lumio_region_find(index, 150, 150) == 0);
+  CHECK(lumio_region_find(index, 256, 150) == 1);
+  CHECK(lumio_region_find(index, 2099, 2099) == 1);
+  CHECK(lumio_region_find(index, 2100, 2099) == -1);
+  CHECK(lumio_region_find(index, 255, 4095) == 2);
+  CHECK(lumio_region_find(index, 256, 3000) == 2);
+  CHECK(lumio_region_find(index, 257, 3000) == -1);
+  CHECK(lumio_region_find(index, 4096, 0) == -1);
+  free(index);
+
+  /* Off the screen, empty, or with a key out of range */
+  CHECK(lumio_region_check(&bad, 4095) == 0);
+  bad.width = 97;
+  CHECK(lumio_region_check(&bad, 4095) < 0);
+  CHECK(lumio_regions_size(&bad, 1, 4095) < 0);
+  bad.width = 0;
+  CHECK(lumio_region_check(&bad, 4095) < 0);
+  bad.width = 96;
+  bad.key = LUMIO_REGION_MAX_KEY;
+  CHECK(lumio_region_check(&bad, 4095) < 0);
+  bad.key = 30;
+  bad.mode = LUMIO_REGION_CLICK + 1;
+  CHECK(lumio_region_check(&bad, 4095) < 0);
+  CHECK(lumio_regions_size(regions, LUMIO_MAX_REGIONS + 1, 4095) < 0);
+}
+
+static void			test_trace(void)
+{
+  static struct lumio_trace_encoder	enc;
+  struct lumio_trace_decoder	dec;
+  struct lumio_trace_info	info = { 0x202e, 0x0005, LUMIO_FIRMWARE_3_0, 0,
+					 LUMIO_REPORT_SIZE, 100, 1234567, "test" };
+  struct lumio_trace_info	read;
+  struct lumio_contact		contact = { 1000, 1000, 0, 1 };
+  __u8				header[LUMIO_TRACE_HEADER_SIZE];
+  __u8				report[LUMIO_REPORT_SIZE];
+  __u8*				blocks[2];
+  __u32				sizes[2];
+  __u8*				image = NULL;
+  const __u8*			p = NULL;
+  unsigned long			damaged = 0;
+  __u32				size = 0;
+  int				nb_blocks = 0;
+  int				ok = 1;
+  int				i = 0;
+
+  lumio_trace_put_header(header, &info);
+  CHECK(lumio_trace_get_header(header, &read) == 0);
+  CHECK(read.vid == 0x202e && read.report_size == LUMIO_REPORT_SIZE &&
+	read.tick_us == 100 && read.start_us == 1234567 &&
+	!strcmp(read.source, "test"));
+  header[13] ^= 1;
+  CHECK(lumio_trace_get_header(header, &read) < 0);
+
+  /* A finger moving, resting, then coming back hours later */
+  lumio_trace_encoder_init(&enc, &info);
+  for (i = 0; i < 3000; ++i)
+    {
+      contact.x = 1000 + (i < 1000 ? i : 1000);
+      lumio_encode_report(report, &contact, 1);
+      if (lumio_trace_encode(&enc, report, i < 2000 ?
+			     (__u64) (i * 2000 + i % 3) : 1ULL << 40 | i) < 0)
+	{
+	  size = lumio_trace_seal(&enc);
+	  blocks[nb_blocks] = malloc(size);
+	  sizes[nb_blocks] = size;
+	  memcpy(blocks[nb_blocks++], enc.block, size);
+	  CHECK(lumio_trace_encode(&enc, report, 1ULL << 40 | i) == 0);
+	}
+      if (i == 1000)
+	size = enc.size;
+      if (i == 1999)
+	CHECK(enc.size - size < 16);
+    }
+  size = lumio_trace_seal(&enc);
+  blocks[nb_blocks] = malloc(size);
+  sizes[nb_blocks] = size;
+  memcpy(blocks[nb_blocks++], enc.block, size);
+  CHECK(nb_blocks == 2);
+
+  /* Read back byte for byte, to the tick */
+  for (i = 0; nb_blocks == 2 && i < 3000; ++i)
+    {
+      if (i == 0 || i == 2000)
+	CHECK(lumio_trace_begin(&dec, &info, blocks[i / 2000]) == 0);
+      contact.x = 1000 + (i < 1000 ? i : 1000);
+      lumio_encode_report(report, &contact, 1);
+      if (lumio_trace_next(&dec) != 1 || memcmp(dec.report, report, 64) ||
+	  dec.time_us != (i < 2000 ? (__u64) (i * 2000 + i % 3) / 100 * 100 :
+			  (1ULL << 40 | i) / 100 * 100))
+	ok = 0;
+      if (i == 1999 || i == 2999)
+	CHECK(lumio_trace_next(&dec) == 0);
+    }
+  CHECK(ok);
+
+  /* A damaged block is told apart */
+  blocks[0][LUMIO_TRACE_BLOCK_HEADER_SIZE + 10] ^= 0x40;
+  CHECK(lumio_trace_begin(&dec, &info, blocks[0]) < 0);
+
+  /* In memory: garbage, the damaged block, the good one, a truncated header */
+  image = malloc(5 + sizes[0] + sizes[1] + 7);
+  memset(image, 0x55, 5);
+  memcpy(image + 5, blocks[0], sizes[0]);
+  memcpy(image + 5 + sizes[0], blocks[1], sizes[1]);
+  memcpy(image + 5 + sizes[0] + sizes[1], blocks[1], 7);
+  p = image;
+  CHECK(lumio_trace_next_block(&p, image + 5 + sizes[0] + sizes[1] + 7, &info,
+			       &dec, &damaged) == 1);
+  CHECK(damaged == 2 && dec.left == 1000 && lumio_trace_next(&dec) == 1 &&
+	dec.time_us == (1ULL << 40 | 2000) / 100 * 100);
+  CHECK(lumio_trace_next_block(&p, image + 5 + sizes[0] + sizes[1] + 7, &info,
+			       &dec, &damaged) == 0);
+  CHECK(damaged == 2);
+  free(image);
+  free(blocks[0]);
+  free(blocks[1]);
+}
+
+/**
+ * Runs the decimation over a stroke of nb positions, lifted at the last one,
+ * stores the positions reported in out and returns how many.
+ */
+static int			decimate(const struct lumio_decimation*	config,
+					 const __u16*			xs,
+					 const __u16*			ys,
+					 int				nb,
+					 struct lumio_contact*		out)
+{
+  struct lumio_decimate_state	s;
+  struct lumio_contact		contact = { 0, 0, 0, 1 };
+  int				n = 0;
+  int				i = 0;
+
+  lumio_decimate_reset(&s);
+  for (i = 0; i <= nb; ++i)
+    {
+      contact.x = xs[i < nb ? i : nb - 1];
+      contact.y = ys[i < nb ? i : nb - 1];
+      contact.down = i < nb;
+      n += lumio_decimate(config, &s, &contact, out + n);
+    }
+
+  return (n);
+}
+
+static void			test_decimate(void)
+{
+  struct lumio_decimation	config = { 4 };
+  struct lumio_contact		out[512];
+  __u16				xs[400];
+  __u16				ys[400];
+  int				near = 0;
+  int				ok = 1;
+  int				n = 0;
+  int				i = 0;
+  int				j = 0;
+
+  CHECK(!lumio_decimate_enabled(&(struct lumio_decimation) { 0 }));
+  CHECK(lumio_decimate_enabled(&config));
+
+  /* A jittered straight line: where it comes down and where it is lifted */
+  for (i = 0; i < 10; ++i)
+    {
+      xs[i] = 1000 + i * 10;
+      ys[i] = 1000 + (i % 3) - 1;
+    }
+  n = decimate(&config, xs, ys, 10, out);
+  CHECK(n == 2);
+  CHECK(out[0].x == 1000 && out[0].down);
+  CHECK(out[1].x == 1090 && !out[1].down);
+
+  /* A longer one: a position every window at most */
+  for (i = 0; i < 100; ++i)
+    {
+      xs[i] = 1000 + i * 10;
+      ys[i] = 1000 + (i % 3) - 1;
+    }
+  n = decimate(&config, xs, ys, 100, out);
+  CHECK(n <= 100 / LUMIO_DECIMATE_WINDOW + 3);
+  for (i = 1, ok = 1; i < n; ++i)
+    ok &= out[i].x - out[i - 1].x <= LUMIO_DECIMATE_WINDOW * 10;
+  CHECK(ok);
+
+  /* A right angle: the corner is reported */
+  for (i = 0; i < 50; ++i)
+    {
+      xs[i] = 1000 + i * 10;
+      ys[i] = 1000;
+      xs[50 + i] = 1500;
+      ys[50 + i] = 1000 + i * 10;
+    }
+  n = decimate(&config, xs, ys, 100, out);
+  for (i = 0, near = 0; i < n; ++i)
+    near |= out[i].x == 1500 && out[i].y == 1000;
+  CHECK(near);
+
+  /* Turning back: the point it turned at is reported */
+  for (i = 0; i < 10; ++i)
+    {
+      xs[i] = 1000 + i * 10;
+      xs[10 + i] = 1090 - i * 10;
+      ys[i] = ys[10 + i] = 1000;
+    }
+  n = decimate(&config, xs, ys, 20, out);
+  for (i = 0, near = 0; i < n; ++i)
+    near |= out[i].x == 1090;
+  CHECK(near);
+
+  /* A parabola: every position within tolerance of what is reported */
+  for (i = 0; i < 400; ++i)
+    {
+      xs[i] = 100 + i * 8;
+      ys[i] = 3000 - (i - 200) * (i - 200) / 16;
+    }
+  n = decimate(&config, xs, ys, 400, out);
+  for (i = 0, ok = 1; i < 400; ++i)
+    {
+      for (j = 0, near = 0; j + 1 < n && !near; ++j)
+	near = lumio_decimate_near(out[j].x, out[j].y, out[j + 1].x,
+				   out[j + 1].y, xs[i], ys[i],
+				   config.tolerance);
+      ok &= near;
+    }
+  CHECK(ok);
+  CHECK(n > 2 && n < 400 / 4);
+}
+
+static double		now_ns(void)
+{
+  struct timespec	ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+/**
+ * Decodes, or filters, BENCH_REPORTS reports, going through a batch of
+ * different reports so that the branches aren't always predicted the same way.
+ */
+static double		bench(int filter)
+{
+  /* helper/filters/drop_origin.bpf */
+  static const struct sock_filter	drop_origin[] =
+    {
+      { 0x30, 0, 0, 0x00000003 },
+      { 0x45, 4, 0, 0x000000f0 },
+      { 0x28, 0, 0, 0x00000004 },
+      { 0x15, 0, 2, 0x00000000 },
+      { 0x30, 0, 0, 0x00000006 },
+      { 0x45, 0, 1, 0x0000000f },
+      { 0x06, 0, 0, 0x00000001 },
+      { 0x06, 0, 0, 0x00000000 },
+    };
+  static __u8		reports[256][LUMIO_REPORT_SIZE];
+  struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+  __u32			mem[LUMIO_FILTER_MEMWORDS];
+  volatile __u32	sink = 0;
+  double		start = 0;
+  unsigned long		i = 0;
+  int			n = 0;
+
+  for (n = 0; n < 256; ++n)
+    {
+      contacts[0].x = n * 16;
+      contacts[0].y = 4095 - n * 16;
+      contacts[0].tag = n & 1;
+      contacts[0].down = (n % 7) != 0;
+      contacts[1] = contacts[0];
+      contacts[1].tag = !contacts[0].tag;
+      lumio_encode_report(reports[n], contacts, 1 + (n % 3 != 0));
+    }
+  CHECK(lumio_filter_check(drop_origin, 8, LUMIO_HOOK_REPORT) == 0);
+
+  start = now_ns();
+  for (i = 0; i < BENCH_REPORTS; ++i)
+    {
+      if (filter)
+	sink += lumio_filter_run(drop_origin, reports[i & 255],
+				 LUMIO_REPORT_SIZE, mem);
+      else
+	sink += lumio_decode_report(reports[i & 255], contacts) +
+	  contacts[0].x;
+    }
+  (void) sink;
+
+  return ((now_ns() - start) / BENCH_REPORTS);
+}
+
+static void		usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_test [-q] [-d decode_ns] [-f filter_ns]\n"
+	  "  -q  skip the benchmarks\n"
+	  "  -d  fail if decoding a report costs more (default %d ns)\n"
+	  "  -f  fail if filtering a report costs more (default %d ns)\n",
+	  DEFAULT_DECODE_NS, DEFAULT_FILTER_NS);
+}
+
+int			main(int argc, char** argv)
+{
+  double		decode_ns = DEFAULT_DECODE_NS;
+  double		filter_ns = DEFAULT_FILTER_NS;
+  double		cost = 0;
+  int			benchmarks = 1;
+  int			opt = 0;
+
+  while ((opt = getopt(argc, argv, "qd:f:h")) != -1)
+    switch (opt)
+      {
+      case 'q':
+	benchmarks = 0;
+	break;
+      case 'd':
+	decode_ns = atof(optarg);
+	break;
+      case 'f':
+	filter_ns = atof(optarg);
+	break;
+      default:
+	usage();
+	return (1);
+      }
+
+  test_decode();
+  test_round_trip();
+  test_config();
+  test_fingers();
+  test_listeners();
+  test_filter();
+  test_predict();
+  test_reject();
+  test_regions();
+  test_trace();
+  test_decimate();
+
+  if (benchmarks)
+    {
+      cost = bench(0);
+      printf("decode: %.2f ns/report (limit %.0f)\n", cost, decode_ns);
+      CHECK(cost <= decode_ns);
+      cost = bench(1);
+      printf("report filter: %.2f ns/report (limit %.0f)\n", cost, filter_ns);
+      CHECK(cost <= filter_ns);
+    }
+
+  printf("%u checks, %u failed\n", nb_checks, nb_failures);
+  return (nb_failures != 0);
+}
@@ -0,0 +1,792 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_trace.c
+ * @author Quentin Casasnovas
+ * @brief Records, converts and reads lumio traces.
+ *
+ *	See lumio_trace.h for the format. The commands are:
+ * - record: records a touchscreen driven by lumio_driver from usbmon, the
+ *   reports are seen as the usb core completes them, at no cost for the
+ *   driver. Blocks are written at least every second, a recording cut short
+ *   loses at most that;
+ * - import: rebuilds a trace from the dmesg of a driver built with
+ *   LUMIO_DEBUG. The driver only prints the first 8 bytes of each report
+ *   along with the contacts it decoded, the other bytes are encoded again
+ *   from the contacts and the trace is flagged LUMIO_TRACE_REBUILT;
+ * - convert: raw reports, as written by lumio_tracegen, to a trace;
+ * - export: a trace to raw reports, for lumio_replay -r and the other tools
+ *   reading them;
+ * - info: what the header tells, and how many reports, damaged blocks and
+ *   bytes per report the trace has;
+ * - dump: prints the reports, one per line.
+ *
+ *	lumiod -w records the touchscreens it drives, lumio_replay -r replays
+ * traces as well as raw reports. "-" stands for the standard input or output.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "lumio_protocol.h"
+#include "lumio_trace.h"
+
+#define DEFAULT_RATE		200
+#define USB_DEVICES		"/sys/bus/usb/devices"
+
+/*
+ * The binary interface of usbmon, see Documentation/usb/usbmon.txt: there's no
+ * header for it.
+ */
+#define MON_IOC_MAGIC		0x92
+#define MON_IOCX_GETX		_IOW(MON_IOC_MAGIC, 10, struct mon_get_arg)
+#define USBMON_INTERRUPT	1
+
+struct			usbmon_packet
+{
+  __u64			id;
+  unsigned char		type; /**< 'S'ubmission, 'C'allback or 'E'rror. */
+  unsigned char		xfer_type;
+  unsigned char		epnum; /**< With the direction bit. */
+  unsigned char		devnum;
+  __u16			busnum;
+  char			flag_setup;
+  char			flag_data;
+  __s64			ts_sec;
+  __s32			ts_usec;
+  __s32			status;
+  __u32			length;
+  __u32			len_cap;
+  __u8			setup[8];
+  __s32			interval;
+  __s32			start_frame;
+  __u32			xfer_flags;
+  __u32			ndesc;
+};
+
+struct			mon_get_arg
+{
+  struct usbmon_packet*	hdr;
+  void*			data;
+  size_t		alloc;
+};
+
+typedef struct		trace_out_s
+{
+  FILE*			file;
+  const char*		path;
+  struct lumio_trace_encoder	enc;
+  unsigned long		reports;
+}			trace_out_t;
+
+typedef struct		trace_in_s
+{
+  FILE*			file;
+  const char*		path;
+  struct lumio_trace_info	info;
+  struct lumio_trace_decoder	dec;
+  __u8			block[LUMIO_TRACE_BLOCK_HEADER_SIZE + LUMIO_TRACE_MAX_BLOCK];
+  unsigned long		blocks;
+  unsigned long		damaged;
+}			trace_in_t;
+
+static volatile int	stop = 0;
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_trace record [-D bus:device] [-t tick_us] trace\n"
+	  "       lumio_trace import [-f firmware] [-i vid:pid] [-r rate] "
+	  "[-t tick_us] dmesg.log trace\n"
+	  "       lumio_trace convert [-f firmware] [-r rate] reports.raw trace\n"
+	  "       lumio_trace export trace reports.raw\n"
+	  "       lumio_trace info trace\n"
+	  "       lumio_trace dump trace\n"
+	  "  -D  the touchscreen to record (default the first one found)\n"
+	  "  -t  resolution of the timestamps (default %d us)\n"
+	  "  -f  firmware of the touchscreen, 1, 2 or 3 (default 3)\n"
+	  "  -i  usb ids of the touchscreen, in hex\n"
+	  "  -r  reports per second, when the input has no timestamps "
+	  "(default %d)\n", LUMIO_TRACE_DEFAULT_TICK, DEFAULT_RATE);
+}
+
+static void	on_signal(int sig)
+{
+  (void) sig;
+  stop = 1;
+}
+
+/**
+ * Returns the firmware of a usb id, 0 if it's not a lumio one.
+ */
+static int	firmware_of(unsigned int vid, unsigned int pid)
+{
+  if ((vid == USB_VID_MM && pid == USB_PID_MM) ||
+      (vid == USB_VID_DM && pid == USB_PID_DM))
+    return (LUMIO_FIRMWARE_1_0);
+  if (vid != USB_VID_LUMIO)
+    return (0);
+  switch (pid)
+    {
+    case USB_PID_DM_2_0:
+    case USB_PID_MM_2_0:
+      return (LUMIO_FIRMWARE_2_0);
+    case USB_PID_DUAL_MODE_3_0:
+    case USB_PID_4_SENSORS_3_0:
+      return (LUMIO_FIRMWARE_3_0);
+    }
+  return (0);
+}
+
+static FILE*	open_file(const char* path, const char* mode)
+{
+  FILE*		file = NULL;
+
+  if (!strcmp(path, "-"))
+    return (mode[0] == 'r' ? stdin : stdout);
+  if (!(file = fopen(path, mode)))
+    perror(path);
+  return (file);
+}
+
+static int	open_output(trace_out_t*			out,
+			    const char*				path,
+			    const struct lumio_trace_info*	info)
+{
+  __u8		header[LUMIO_TRACE_HEADER_SIZE];
+
+  out->path = path;
+  out->reports = 0;
+  if (!(out->file = open_file(path, "wb")))
+    return (-1);
+  lumio_trace_encoder_init(&out->enc, info);
+  lumio_trace_put_header(header, info);
+  if (fwrite(header, sizeof (header), 1, out->file) != 1)
+    {
+      perror(path);
+      return (-1);
+    }
+  return (0);
+}
+
+/**
+ * Writes the block being filled, if any.
+ */
+static int	flush_output(trace_out_t* out)
+{
+  __u32		size = lumio_trace_seal(&out->enc);
+
+  if ((size && fwrite(out->enc.block, size, 1, out->file) != 1) ||
+      fflush(out->file) != 0)
+    {
+      perror(out->path);
+      return (-1);
+    }
+  return (0);
+}
+
+static int	write_report(trace_out_t* out, const __u8* report, __u64 time_us)
+{
+  if (lumio_trace_encode(&out->enc, report, time_us) < 0 &&
+      (flush_output(out) < 0 ||
+       lumio_trace_encode(&out->enc, report, time_us) < 0))
+    return (-1);
+
+  ++out->reports;
+  return (0);
+}
+
+static int	close_output(trace_out_t* out)
+{
+  int		ret = flush_output(out);
+
+  if (out->file != stdout && fclose(out->file) != 0)
+    {
+      perror(out->path);
+      ret = -1;
+    }
+  return (ret);
+}
+
+static int	open_input(trace_in_t* in, const char* path)
+{
+  __u8		header[LUMIO_TRACE_HEADER_SIZE];
+
+  in->path = path;
+  in->blocks = 0;
+  in->damaged = 0;
+  in->dec.left = 0;
+  if (!(in->file = open_file(path, "rb")))
+    return (-1);
+  if (fread(header, sizeof (header), 1, in->file) != 1 ||
+      lumio_trace_get_header(header, &in->info) < 0)
+    {
+      fprintf(stderr, "%s: not a lumio trace, or of a later version\n", path);
+      return (-1);
+    }
+  return (0);
+}
+
+/**
+ * Reads the next report in in->dec.report, returns 1 or 0 at the end.
+ */
+static int	read_report(trace_in_t* in)
+{
+  int		ret = 0;
+
+  while ((ret = lumio_trace_next(&in->dec)) <= 0)
+    {
+      if (ret < 0)
+	++in->damaged;
+      if (!lumio_trace_read_block(in->file, &in->info, in->block, &in->dec,
+				  &in->damaged))
+	return (0);
+      ++in->blocks;
+    }
+  return (1);
+}
+
+static void	close_input(trace_in_t* in)
+{
+  if (in->damaged)
+    fprintf(stderr, "%s: %lu damaged blocks skipped\n", in->path, in->damaged);
+  if (in->file != stdin)
+    fclose(in->file);
+}
+
+/**
+ * Finds the touchscreen to record in sysfs.
+ */
+static int	find_panel(unsigned int* bus, unsigned int* device,
+			   struct lumio_trace_info* info)
+{
+  static const char*	files[] = { "busnum", "devnum", "idVendor",
+				    "idProduct" };
+  unsigned int		values[4];
+  char			path[PATH_MAX];
+  struct dirent*	entry = NULL;
+  FILE*			file = NULL;
+  DIR*			dir = NULL;
+  int			found = 0;
+  int			i = 0;
+
+  if (!(dir = opendir(USB_DEVICES)))
+    {
+      perror(USB_DEVICES);
+      return (-1);
+    }
+  while (!found && (entry = readdir(dir)))
+    {
+      if (entry->d_name[0] == '.' || strchr(entry->d_name, ':'))
+	continue;
+      for (i = 0; i < 4; ++i)
+	{
+	  snprintf(path, sizeof (path), "%s/%s/%s", USB_DEVICES, entry->d_name,
+		   files[i]);
+	  if (!(file = fopen(path, "r")))
+	    break;
+	  if (fscanf(file, i < 2 ? "%u" : "%x", &values[i]) != 1)
+	    values[i] = 0;
+	  fclose(file);
+	}
+      if (i < 4 || !firmware_of(values[2], values[3]) ||
+	  (*bus && (values[0] != *bus || values[1] != *device)))
+	continue;
+
+      *bus = values[0];
+      *device = values[1];
+      info->vid = values[2];
+      info->pid = values[3];
+      info->firmware = firmware_of(values[2], values[3]);
+      snprintf(info->source, sizeof (info->source), "usbmon %.20s", entry->d_name);
+      found = 1;
+    }
+  closedir(dir);
+
+  if (!found)
+    fprintf(stderr, "no lumio touchscreen found\n");
+  return (found ? 0 : -1);
+}
+
+static int			record(const char*			path,
+				       unsigned int			bus,
+				       unsigned int			device,
+				       struct lumio_trace_info*		info)
+{
+  struct usbmon_packet		packet;
+  struct mon_get_arg		arg;
+  struct sigaction		action;
+  struct pollfd			pfd;
+  struct timeval		tv;
+  trace_out_t			out;
+  __u8				data[LUMIO_REPORT_SIZE];
+  __u8				report[LUMIO_REPORT_SIZE];
+  char				mon[32];
+  __u64				now_us = 0;
+  __u64				flushed_us = 0;
+  unsigned int			half = 0;
+  unsigned long			lost = 0;
+  int				ret = 0;
+
+  if (find_panel(&bus, &device, info) < 0)
+    return (1);
+  info->report_size = lumio_report_size(info->firmware);
+  gettimeofday(&tv, NULL);
+  info->start_us = tv.tv_sec * 1000000ULL + tv.tv_usec;
+
+  snprintf(mon, sizeof (mon), "/dev/usbmon%u", bus);
+  if ((pfd.fd = open(mon, O_RDONLY)) < 0)
+    {
+      fprintf(stderr, "%s: %s (is the usbmon module loaded?)\n", mon,
+	      strerror(errno));
+      return (1);
+    }
+  pfd.events = POLLIN;
+  if (open_output(&out, path, info) < 0)
+    return (1);
+
+  /* No SA_RESTART, so that poll() gives up on ^C */
+  memset(&action, 0x0, sizeof (action));
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  fprintf(stderr, "recording %04x:%04x (bus %u, device %u, firmware %d.0), "
+	  "^C to stop\n", info->vid, info->pid, bus, device, info->firmware);
+  flushed_us = info->start_us;
+  memset(report, 0x0, sizeof (report));
+  while (!stop && ret >= 0)
+    {
+      gettimeofday(&tv, NULL);
+      now_us = tv.tv_sec * 1000000ULL + tv.tv_usec;
+      if (now_us - flushed_us >= 1000000)
+	{
+	  ret = flush_output(&out);
+	  flushed_us = now_us;
+	}
+      if (poll(&pfd, 1, 1000) <= 0)
+	continue;
+
+      arg.hdr = &packet;
+      arg.data = data;
+      arg.alloc = sizeof (data);
+      if (ioctl(pfd.fd, MON_IOCX_GETX, &arg) < 0)
+	{
+	  if (errno != EINTR)
+	    {
+	      perror(mon);
+	      ret = -1;
+	    }
+	  continue;
+	}
+      if (packet.type != 'C' || packet.xfer_type != USBMON_INTERRUPT ||
+	  !(packet.epnum & 0x80) || packet.devnum != device ||
+	  packet.status != 0 || packet.len_cap == 0)
+	continue;
+
+      /*
+       * Halves are reassembled the way the driver does. usbmon may miss a
+       * packet though, so a half carrying the dual marker always starts a
+       * report: a first half left waiting is dropped rather than every
+       * report after it being shifted by one half.
+       */
+      if (info->firmware == LUMIO_FIRMWARE_3_0)
+	memcpy(report, data, packet.len_cap < sizeof (report) ?
+	       packet.len_cap : sizeof (report));
+      else
+	{
+	  if (data[2] == LUMIO_DUAL_REPORT && half)
+	    {
+	      ++lost;
+	      half = 0;
+	    }
+	  memcpy(report + half * LUMIO_HALF_REPORT_SIZE, data,
+		 LUMIO_HALF_REPORT_SIZE);
+	  half = !half;
+	  if (half)
+	    continue;
+	}
+      now_us = packet.ts_sec * 1000000ULL + packet.ts_usec;
+      ret = write_report(&out, report, now_us > info->start_us ?
+			 now_us - info->start_us : 0);
+    }
+  close(pfd.fd);
+
+  if (close_output(&out) < 0 || ret < 0)
+    return (1);
+  fprintf(stderr, "%lu reports recorded\n", out.reports);
+  if (lost)
+    fprintf(stderr, "%lu report halves dropped, their other half was missed\n",
+	    lost);
+  return (0);
+}
+
+/**
+ * Parses the timestamp printk puts in front of a dmesg line, in us.
+ */
+static int	line_time(const char* line, double* time_us)
+{
+  double	seconds = 0;
+
+  if (sscanf(line, " [ %lf]", &seconds) != 1 &&
+      sscanf(line, "<%*d>[ %lf]", &seconds) != 1)
+    return (-1);
+  *time_us = seconds * 1e6;
+  return (0);
+}
+
+typedef struct		pending_s
+{
+  struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+  __u8			first[LUMIO_HALF_REPORT_SIZE];
+  int			nb_contacts;
+  int			expected;
+  double		time_us;
+}			pending_t;
+
+static int	emit_pending(trace_out_t*	out,
+			     pending_t*		pending,
+			     double		start_us,
+			     unsigned long*	incomplete)
+{
+  __u8		report[LUMIO_REPORT_SIZE];
+  int		ret = 0;
+
+  if (pending->nb_contacts == 0)
+    return (0);
+  if (pending->nb_contacts < pending->expected)
+    ++*incomplete;
+
+  lumio_encode_report(report, pending->contacts, pending->nb_contacts);
+  memcpy(report, pending->first, LUMIO_HALF_REPORT_SIZE);
+  ret = write_report(out, report, pending->time_us > start_us ?
+		     pending->time_us - start_us : 0);
+  pending->nb_contacts = 0;
+  return (ret);
+}
+
+/**
+ * Rebuilds reports from the lines PRINT_RECEIVED_DEBUG_TRACE() prints, one
+ * block per contact: the event type, the first 8 bytes of the report, the
+ * contact and whether it is down. Both contacts of a dualtouch report share
+ * the same first 8 bytes.
+ */
+static int			import(const char*		dmesg_path,
+				       const char*		path,
+				       struct lumio_trace_info*	info,
+				       double			rate)
+{
+  pending_t			pending;
+  trace_out_t			out;
+  __u8				bytes[LUMIO_HALF_REPORT_SIZE];
+  char				line[512];
+  unsigned long long		first = 0;
+  unsigned long			incomplete = 0;
+  unsigned long			lines = 0;
+  unsigned int			tag = 0;
+  unsigned int			x = 0;
+  unsigned int			y = 0;
+  double			time_us = 0;
+  double			start_us = -1;
+  const char*			p = NULL;
+  FILE*				in = NULL;
+  int				have_contact = 0;
+  int				dual = 0;
+  int				ret = 0;
+  int				i = 0;
+
+  info->report_size = lumio_report_size(info->firmware);
+  info->flags |= LUMIO_TRACE_REBUILT;
+  snprintf(info->source, sizeof (info->source), "dmesg");
+  if (!(in = open_file(dmesg_path, "r")) || open_output(&out, path, info) < 0)
+    return (1);
+
+  memset(&pending, 0x0, sizeof (pending));
+  while (ret >= 0 && fgets(line, sizeof (line), in))
+    {
+      if (!strstr(line, "lumio_driver:") && !strstr(line, "touch event"))
+	continue;
+      ++lines;
+
+      if (strstr(line, "dualtouch event"))
+	dual = 1;
+      else if (strstr(line, "singletouch event"))
+	dual = 0;
+      else if ((p = strstr(line, "first 8bytes 0x")) &&
+	       sscanf(p + 15, "%16llx", &first) == 1)
+	{
+	  for (i = 0; i < LUMIO_HALF_REPORT_SIZE; ++i)
+	    bytes[i] = first >> (8 * (LUMIO_HALF_REPORT_SIZE - 1 - i));
+	  if (line_time(line, &time_us) < 0)
+	    time_us = 1e6 / rate * out.reports;
+	  if (start_us < 0)
+	    start_us = time_us;
+	  if (pending.nb_contacts && memcmp(bytes, pending.first, sizeof (bytes)))
+	    ret = emit_pending(&out, &pending, start_us, &incomplete);
+	  if (pending.nb_contacts == 0)
+	    {
+	      memcpy(pending.first, bytes, sizeof (bytes));
+	      pending.expected = dual ? 2 : 1;
+	      pending.time_us = time_us;
+	    }
+	  have_contact = 0;
+	}
+      else if ((p = strstr(line, "Fingers[")) &&
+	       sscanf(p, "Fingers[%u](x, y) = (%u, %u)", &tag, &x, &y) == 3)
+	have_contact = 1;
+      else if ((p = strstr(line, "Operation: ")) && have_contact &&
+	       pending.nb_contacts < LUMIO_MAX_CONTACTS)
+	{
+	  pending.contacts[pending.nb_contacts].x = x;
+	  pending.contacts[pending.nb_contacts].y = y;
+	  pending.contacts[pending.nb_contacts].tag = tag & 1;
+	  pending.contacts[pending.nb_contacts].down = !strncmp(p + 11, "DOWN", 4);
+	  ++pending.nb_contacts;
+	  have_contact = 0;
+	  if (pending.nb_contacts == pending.expected)
+	    ret = emit_pending(&out, &pending, start_us, &incomplete);
+	}
+    }
+  if (ret >= 0)
+    ret = emit_pending(&out, &pending, start_us, &incomplete);
+  if (in != stdin)
+    fclose(in);
+
+  if (close_output(&out) < 0 || ret < 0)
+    return (1);
+  fprintf(stderr, "%lu reports rebuilt from %lu lines", out.reports, lines);
+  if (incomplete)
+    fprintf(stderr, ", %lu dualtouch reports with a single contact", incomplete);
+  fprintf(stderr, "\n");
+  return (0);
+}
+
+static int			convert(const char*		raw_path,
+					const char*		path,
+					struct lumio_trace_info*	info,
+					double			rate)
+{
+  trace_out_t			out;
+  __u8				report[LUMIO_REPORT_SIZE];
+  FILE*				in = NULL;
+  int				ret = 0;
+
+  info->report_size = lumio_report_size(info->firmware);
+  snprintf(info->source, sizeof (info->source), "raw %.0f Hz", rate);
+  if (!(in = open_file(raw_path, "rb")) || open_output(&out, path, info) < 0)
+    return (1);
+
+  memset(report, 0x0, sizeof (report));
+  while (ret >= 0 && fread(report, info->report_size, 1, in) == 1)
+    ret = write_report(&out, report, 1e6 / rate * out.reports);
+  if (in != stdin)
+    fclose(in);
+
+  if (close_output(&out) < 0 || ret < 0)
+    return (1);
+  fprintf(stderr, "%lu reports\n", out.reports);
+  return (0);
+}
+
+static int	export(const char* path, const char* raw_path)
+{
+  trace_in_t*	in = malloc(sizeof (*in));
+  FILE*		out = NULL;
+  int		ret = 0;
+
+  if (!in || open_input(in, path) < 0 || !(out = open_file(raw_path, "wb")))
+    return (1);
+
+  while (ret == 0 && read_report(in))
+    if (fwrite(in->dec.report, in->info.report_size, 1, out) != 1)
+      {
+	perror(raw_path);
+	ret = 1;
+      }
+  close_input(in);
+  if (out != stdout && fclose(out) != 0)
+    {
+      perror(raw_path);
+      ret = 1;
+    }
+  free(in);
+  return (ret);
+}
+
+static int	info(const char* path)
+{
+  trace_in_t*	in = malloc(sizeof (*in));
+  unsigned long	reports = 0;
+  unsigned long	downs = 0;
+  __u64		last_us = 0;
+  long		size = 0;
+
+  if (!in || open_input(in, path) < 0)
+    return (1);
+
+  printf("%s: lumio trace version %d, %s\n", path, LUMIO_TRACE_VERSION,
+	 in->info.source);
+  printf("  touchscreen %04x:%04x, firmware %d.0, %u bytes reports%s\n",
+	 in->info.vid, in->info.pid, in->info.firmware, in->info.report_size,
+	 in->info.flags & LUMIO_TRACE_REBUILT ? " (partly rebuilt)" : "");
+  if (in->info.start_us)
+    printf("  started at %llu.%06llu, timestamps every %u us\n",
+	   (unsigned long long) in->info.start_us / 1000000,
+	   (unsigned long long) in->info.start_us % 1000000, in->info.tick_us);
+  else
+    printf("  timestamps every %u us\n", in->info.tick_us);
+
+  while (read_report(in))
+    {
+      struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+
+      ++reports;
+      if (lumio_decode_report(in->dec.report, contacts) && contacts[0].down)
+	++downs;
+      last_us = in->dec.time_us;
+    }
+  if (in->file != stdin && fseek(in->file, 0, SEEK_END) == 0)
+    size = ftell(in->file);
+
+  printf("  %lu reports in %lu blocks over %.1f s (%.1f reports/s), "
+	 "%lu with a contact down\n", reports, in->blocks, last_us / 1e6,
+	 last_us ? reports / (last_us / 1e6) : 0.0, downs);
+  if (size > 0 && reports)
+    printf("  %ld bytes, %.2f bytes per report\n", size,
+	   (double) size / reports);
+  close_input(in);
+  free(in);
+  return (0);
+}
+
+static int			dump(const char* path)
+{
+  struct lumio_contact		contacts[LUMIO_MAX_CONTACTS];
+  trace_in_t*			in = malloc(sizeof (*in));
+  int				nb_contacts = 0;
+  int				i = 0;
+
+  if (!in || open_input(in, path) < 0)
+    return (1);
+
+  while (read_report(in))
+    {
+      printf("%llu.%06llu ", (unsigned long long) in->dec.time_us / 1000000,
+	     (unsigned long long) in->dec.time_us % 1000000);
+      for (i = 0; i < in->info.report_size; ++i)
+	printf("%02x", in->dec.report[i]);
+      nb_contacts = lumio_decode_report(in->dec.report, contacts);
+      for (i = 0; i < nb_contacts; ++i)
+	printf(" | %u %u %u %s", contacts[i].tag, contacts[i].x, contacts[i].y,
+	       contacts[i].down ? "down" : "up");
+      printf("\n");
+    }
+  close_input(in);
+  free(in);
+  return (0);
+}
+
+int				main(int argc, char** argv)
+{
+  struct lumio_trace_info	trace;
+  const char*			command = NULL;
+  unsigned int			bus = 0;
+  unsigned int			device = 0;
+  unsigned int			vid = 0;
+  unsigned int			pid = 0;
+  double			rate = DEFAULT_RATE;
+  int				firmware = LUMIO_FIRMWARE_3_0;
+  int				opt = 0;
+  int				nb_args = 0;
+
+  if (argc < 2)
+    {
+      usage();
+      return (1);
+    }
+  command = argv[1];
+  --argc;
+  ++argv;
+
+  memset(&trace, 0x0, sizeof (trace));
+  trace.tick_us = LUMIO_TRACE_DEFAULT_TICK;
+  while ((opt = getopt(argc, argv, "D:t:f:i:r:h")) != -1)
+    switch (opt)
+      {
+      case 'D':
+	if (sscanf(optarg, "%u:%u", &bus, &device) != 2)
+	  bus = 0;
+	break;
+      case 't':
+	trace.tick_us = atoi(optarg);
+	break;
+      case 'f':
+	firmware = atoi(optarg);
+	break;
+      case 'i':
+	if (sscanf(optarg, "%x:%x", &vid, &pid) != 2)
+	  vid = pid = 0;
+	break;
+      case 'r':
+	rate = atof(optarg);
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  nb_args = argc - optind;
+  if (firmware < LUMIO_FIRMWARE_1_0 || firmware > LUMIO_FIRMWARE_3_0 ||
+      trace.tick_us < 1 || trace.tick_us > 60000 || rate <= 0)
+    {
+      usage();
+      return (1);
+    }
+  trace.firmware = firmware;
+  trace.vid = vid;
+  trace.pid = pid;
+  if (vid && firmware_of(vid, pid))
+    trace.firmware = firmware_of(vid, pid);
+
+  if (!strcmp(command, "record") && nb_args == 1)
+    return (record(argv[optind], bus, device, &trace));
+  if (!strcmp(command, "import") && nb_args == 2)
+    return (import(argv[optind], argv[optind + 1], &trace, rate));
+  if (!strcmp(command, "convert") && nb_args == 2)
+    return (convert(argv[optind], argv[optind + 1], &trace, rate));
+  if (!strcmp(command, "export") && nb_args == 2)
+    return (export(argv[optind], argv[optind + 1]));
+  if (!strcmp(command, "info") && nb_args == 1)
+    return (info(argv[optind]));
+  if (!strcmp(command, "dump") && nb_args == 1)
+    return (dump(argv[optind]));
+
+  usage();
+  return (1);
+}
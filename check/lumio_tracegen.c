@@ -0,0 +1,392 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_tracegen.c
+ * @author Quentin Casasnovas
+ * @brief Generates synthetic touch traces.
+ *
+ *	Writes the reports a controller would send for scripted scenarios, byte
+ * for byte: 16 bytes per report (the two 8 bytes halves) for firmware 1.0 and
+ * 2.0, 64 bytes for firmware 3.0. lumio_replay -r replays them through the
+ * driver.
+ *
+ *	A scenario is a list of strokes, each one a finger coming down, moving in
+ * a straight line and lifted. Like the controller, at most LUMIO_MAX_CONTACTS
+ * fingers are down at once, each one keeping the tag it came down with. The
+ * same seed always gives the same trace.
+ *
+ *	Alongside the reports, the ground truth is saved as text, one line per
+ * reported contact:
+ *	report time_us tag id x y down
+ * where id identifies the finger for the whole trace and x, y is its true
+ * position, before the IR jitter. It lets trackers be scored on accuracy as
+ * well as speed.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "lumio_protocol.h"
+
+#define DEFAULT_RATE		200
+#define DEFAULT_DURATION	10
+/** @brief Idle time between two scenarios, in us. */
+#define SCENARIO_GAP_US		100000
+/** @brief Longest an IR dropout lasts, in reports. */
+#define MAX_DROPOUT		8
+
+typedef struct		stroke_s
+{
+  unsigned int		id;
+  double		start_us;
+  double		end_us;
+  double		x0;
+  double		y0;
+  double		x1;
+  double		y1;
+}			stroke_t;
+
+typedef struct		finger_s
+{
+  const stroke_t*	stroke; /**< NULL when the tag is free. */
+  unsigned int		dropout; /**< Reports left before being seen again. */
+}			finger_t;
+
+static stroke_t*	strokes = NULL;
+static unsigned int	nb_strokes = 0;
+static unsigned int	max_strokes = 0;
+static unsigned int	next_id = 0;
+static unsigned long	seed = 42;
+static double		range = 4095;
+
+static const char*	scenarios[] =
+  { "tap", "drag", "cross", "pinch", "quad", NULL };
+
+/**
+ * xorshift, so that a seed gives the same trace everywhere.
+ */
+static double		random_unit(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return ((seed >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static double		random_coordinate(void)
+{
+  return (range * (0.1 + 0.8 * random_unit()));
+}
+
+static double		random_gaussian(void)
+{
+  double		u = 1 - random_unit();
+
+  return (sqrt(-2 * log(u)) * cos(2 * M_PI * random_unit()));
+}
+
+static int		add_stroke(double start_us, double end_us,
+				   double x0, double y0, double x1, double y1)
+{
+  stroke_t*		stroke = NULL;
+
+  if (nb_strokes == max_strokes)
+    {
+      max_strokes = max_strokes ? max_strokes * 2 : 256;
+      if (!(strokes = realloc(strokes, max_strokes * sizeof (*strokes))))
+	{
+	  perror("realloc");
+	  return (-1);
+	}
+    }
+  stroke = &strokes[nb_strokes++];
+  stroke->id = next_id++;
+  stroke->start_us = start_us;
+  stroke->end_us = end_us;
+  stroke->x0 = fmin(fmax(x0, 0), range);
+  stroke->y0 = fmin(fmax(y0, 0), range);
+  stroke->x1 = fmin(fmax(x1, 0), range);
+  stroke->y1 = fmin(fmax(y1, 0), range);
+
+  return (0);
+}
+
+/**
+ * @brief Adds the strokes of a scenario.
+ *
+ * @param scenario Index in scenarios.
+ * @param t The time the scenario starts at, in us.
+ * @return The time it ends at, or a negative number on failure.
+ */
+static double		add_scenario(int scenario, double t)
+{
+  double		x = random_coordinate();
+  double		y = random_coordinate();
+  double		x2 = random_coordinate();
+  double		y2 = random_coordinate();
+  double		r = range * (0.05 + 0.1 * random_unit());
+  int			ret = 0;
+
+  switch (scenario)
+    {
+    case 0: /* tap: a short stationary touch */
+      ret = add_stroke(t, t + 80000, x, y, x, y);
+      t += 80000;
+      break;
+    case 1: /* drag: one finger across the screen */
+      ret = add_stroke(t, t + 800000, x, y, x2, y2);
+      t += 800000;
+      break;
+    case 2: /* cross: two fingers whose paths cross half way */
+      ret = add_stroke(t, t + 1000000, x, y, x2, y2) ||
+	add_stroke(t + 50000, t + 1000000, x2, y, x, y2);
+      t += 1000000;
+      break;
+    case 3: /* pinch: two fingers moving apart around a center */
+      ret = add_stroke(t, t + 600000, x - r, y, x - 3 * r, y) ||
+	add_stroke(t + 20000, t + 600000, x + r, y, x + 3 * r, y);
+      t += 600000;
+      break;
+    case 4: /* quad: four fingers, two at a time, each one taking the tag of
+	       the one lifted just before */
+      ret = add_stroke(t, t + 600000, x, y, x2, y) ||
+	add_stroke(t + 300000, t + 900000, x, y2, x2, y2) ||
+	add_stroke(t + 650000, t + 1250000, x2, y, x, y) ||
+	add_stroke(t + 950000, t + 1550000, x2, y2, x, y2);
+      t += 1550000;
+      break;
+    }
+
+  return (ret ? -1 : t);
+}
+
+static void		usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_tracegen [-f firmware] [-s scenario] [-r rate_hz] "
+	  "[-d seconds] [-j jitter] [-D dropout] [-S seed] [-t truth] "
+	  "trace.raw\n"
+	  "  -f  firmware layout, 1, 2 or 3 (default 3)\n"
+	  "  -s  tap, drag, cross, pinch, quad or mix (default mix, all of them"
+	  " in turn)\n"
+	  "  -r  reports per second while a finger is down (default %d)\n"
+	  "  -d  length of the trace, in seconds (default %d)\n"
+	  "  -j  standard deviation of the IR jitter, in controller units "
+	  "(default 0)\n"
+	  "  -D  probability for a finger to go unseen for up to %d reports "
+	  "(default 0)\n"
+	  "  -S  seed of the random generator (default 42)\n"
+	  "  -t  ground truth file (default trace.raw.truth)\n",
+	  DEFAULT_RATE, DEFAULT_DURATION, MAX_DROPOUT);
+}
+
+/**
+ * @brief Emits the report of time t, if any finger is to be reported.
+ *
+ * @return 1 if a report has been written, 0 if not, -1 on failure.
+ */
+static int		emit_report(FILE* trace, FILE* truth, finger_t* fingers,
+				    unsigned long index, double t,
+				    int firmware, double jitter, double dropout)
+{
+  struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+  __u8			report[LUMIO_REPORT_SIZE];
+  const stroke_t*	stroke = NULL;
+  double		progress = 0;
+  double		x[LUMIO_MAX_CONTACTS];
+  double		y[LUMIO_MAX_CONTACTS];
+  unsigned int		id[LUMIO_MAX_CONTACTS];
+  int			nb_contacts = 0;
+  int			tag = 0;
+  int			i = 0;
+
+  for (tag = 0; tag < LUMIO_MAX_CONTACTS; ++tag)
+    {
+      if (!(stroke = fingers[tag].stroke))
+	continue;
+
+      progress = (t - stroke->start_us) / (stroke->end_us - stroke->start_us);
+      if (progress > 1)
+	progress = 1;
+      x[nb_contacts] = stroke->x0 + (stroke->x1 - stroke->x0) * progress;
+      y[nb_contacts] = stroke->y0 + (stroke->y1 - stroke->y0) * progress;
+      id[nb_contacts] = stroke->id;
+      contacts[nb_contacts].tag = tag;
+      contacts[nb_contacts].down = t < stroke->end_us;
+      if (!contacts[nb_contacts].down)
+	fingers[tag].stroke = NULL;
+
+      /* A lifted finger is always seen, the controller reports the lift. */
+      if (fingers[tag].dropout && contacts[nb_contacts].down)
+	{
+	  --fingers[tag].dropout;
+	  continue;
+	}
+      if (dropout > 0 && random_unit() < dropout)
+	fingers[tag].dropout = random_unit() * MAX_DROPOUT;
+
+      contacts[nb_contacts].x = lround(fmin(fmax(x[nb_contacts] + jitter *
+						random_gaussian(), 0), range));
+      contacts[nb_contacts].y = lround(fmin(fmax(y[nb_contacts] + jitter *
+						random_gaussian(), 0), range));
+      ++nb_contacts;
+    }
+  if (nb_contacts == 0)
+    return (0);
+
+  lumio_encode_report(report, contacts, nb_contacts);
+  if (fwrite(report, lumio_report_size(firmware), 1, trace) != 1)
+    return (-1);
+  for (i = 0; i < nb_contacts; ++i)
+    fprintf(truth, "%lu %.0f %d %u %.1f %.1f %d\n", index, t, contacts[i].tag,
+	    id[i], x[i], y[i], contacts[i].down);
+
+  return (1);
+}
+
+int			main(int argc, char** argv)
+{
+  finger_t		fingers[LUMIO_MAX_CONTACTS];
+  const char*		scenario = "mix";
+  const char*		truth_path = NULL;
+  char			default_truth[1024];
+  FILE*			trace = NULL;
+  FILE*			truth = NULL;
+  double		rate = DEFAULT_RATE;
+  double		duration_us = DEFAULT_DURATION * 1e6;
+  double		jitter = 0;
+  double		dropout = 0;
+  double		t = 0;
+  double		end = 0;
+  unsigned long		nb_reports = 0;
+  unsigned long		first_seed = seed;
+  unsigned int		s = 0;
+  int			firmware = LUMIO_FIRMWARE_3_0;
+  int			nb_scenarios = 0;
+  int			first = -1;
+  int			opt = 0;
+  int			ret = 0;
+  int			i = 0;
+
+  while ((opt = getopt(argc, argv, "f:s:r:d:j:D:S:t:h")) != -1)
+    switch (opt)
+      {
+      case 'f':
+	firmware = atoi(optarg);
+	break;
+      case 's':
+	scenario = optarg;
+	break;
+      case 'r':
+	rate = atof(optarg);
+	break;
+      case 'd':
+	duration_us = atof(optarg) * 1e6;
+	break;
+      case 'j':
+	jitter = atof(optarg);
+	break;
+      case 'D':
+	dropout = atof(optarg);
+	break;
+      case 'S':
+	seed = first_seed = strtoul(optarg, NULL, 0);
+	break;
+      case 't':
+	truth_path = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+
+  for (nb_scenarios = 0; scenarios[nb_scenarios]; ++nb_scenarios)
+    if (!strcmp(scenario, scenarios[nb_scenarios]))
+      first = nb_scenarios;
+  if (optind + 1 != argc || rate <= 0 || seed == 0 ||
+      firmware < LUMIO_FIRMWARE_1_0 || firmware > LUMIO_FIRMWARE_3_0 ||
+      (first < 0 && strcmp(scenario, "mix")))
+    {
+      usage();
+      return (1);
+    }
+  range = lumio_max_coordinate(firmware);
+
+  /* Script the whole trace first */
+  for (t = 0, i = 0; t < duration_us; ++i)
+    {
+      if ((t = add_scenario(first < 0 ? i % nb_scenarios : first, t)) < 0)
+	return (1);
+      t += SCENARIO_GAP_US;
+    }
+  end = t;
+
+  if (!truth_path)
+    {
+      snprintf(default_truth, sizeof (default_truth), "%s.truth", argv[optind]);
+      truth_path = default_truth;
+    }
+  if (!(trace = fopen(argv[optind], "wb")))
+    {
+      perror(argv[optind]);
+      return (1);
+    }
+  if (!(truth = fopen(truth_path, "w")))
+    {
+      perror(truth_path);
+      return (1);
+    }
+  fprintf(truth, "# firmware %d, %s, %.0f Hz, seed %lu\n"
+	  "# report time_us tag id x y down\n", firmware, scenario, rate, first_seed);
+
+  /* Then sample it, giving each new finger the first free tag. At very low
+     rates a finger may have to wait for the lift of the previous one. */
+  memset(fingers, 0x0, sizeof (fingers));
+  for (t = 0; t < end && ret >= 0; t += 1e6 / rate)
+    {
+      while (s < nb_strokes && strokes[s].start_us <= t)
+	{
+	  for (i = 0; i < LUMIO_MAX_CONTACTS && fingers[i].stroke; ++i)
+	    ;
+	  if (i == LUMIO_MAX_CONTACTS)
+	    break;
+	  fingers[i].stroke = &strokes[s++];
+	  fingers[i].dropout = 0;
+	}
+      ret = emit_report(trace, truth, fingers, nb_reports, t, firmware,
+			jitter, dropout);
+      if (ret > 0)
+	nb_reports += ret;
+    }
+
+  if (ret < 0 || fclose(trace) != 0 || fclose(truth) != 0)
+    {
+      perror("lumio_tracegen");
+      return (1);
+    }
+  fprintf(stderr, "%lu reports, %u fingers, %.1f s\n", nb_reports, nb_strokes,
+	  end / 1e6);
+  free(strokes);
+
+  return (0);
+}
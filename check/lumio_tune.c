@@ -0,0 +1,916 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_tune.c
+ * @author Quentin Casasnovas
+ * @brief Tunes the report pipeline of the driver on labelled traces.
+ *
+ *	Each trace comes with its ground truth, trace.truth, in the format
+ * lumio_tracegen writes: one line per contact of each report, with the finger
+ * it really is and where it really was. The contacts of a report without a
+ * line are spurious. Traces are lumio traces (see lumio_trace.h) or raw
+ * reports, whose timestamps are then taken from the truth.
+ *
+ *	Every combination of the values given for the rejection, the prediction
+ * and the decimation is run through the very code of the driver (lumio_reject.h,
+ * lumio_predict.h, lumio_decimate.h, in the order lumio_treat_event() runs
+ * them), on every trace, by as many threads as there are processors. What
+ * the fake mice would show is compared to the truth, report by report, where
+ * the fingers are once the report is shown: the report reaches the mice a
+ * report interval after the fingers were where it tells (the median interval of
+ * each trace), or -L ms after:
+ * - the latency added: how far behind (or ahead of, when the prediction
+ *   overshoots) the fingers the mice are, in ms, along their moves, plus the
+ *   time a finger takes to be reported once down, both compared to no
+ *   processing at all;
+ * - the jitter left: the RMS distance between the mice and the fingers, once
+ *   the lag is accounted for;
+ * - the swaps: the reports where a mouse is closer to the other finger than
+ *   to its own;
+ * - the false clicks, strokes of the mice which aren't a finger coming down
+ *   (spurious contacts, strokes cut in two), and the ones missed, fingers
+ *   never reported.
+ *
+ *	The combinations no other beats on all four make the Pareto front,
+ * printed in CSV. The one closest to the best of each (all four scaled to the
+ * front), or the one picked with -c, is written with -o as a struct
+ * lumio_config, which lumio_config loads with IOCTL_SET_CONFIG.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#include "lumio_protocol.h"
+#include "lumio_driver.h"
+#include "lumio_reject.h"
+#include "lumio_predict.h"
+#include "lumio_decimate.h"
+#include "lumio_trace.h"
+
+#define MAX_VALUES		16
+#define DEFAULT_FIRMWARE	LUMIO_FIRMWARE_3_0
+
+/**
+ * @brief What a contact of a report really is.
+ */
+typedef struct		truth_s
+{
+  __u8			present; /**< 0 if the contact is spurious. */
+  __u8			down;
+  __u32			id; /**< The finger. */
+  float			x;
+  float			y;
+  float			vx; /**< Its speed, in units per ms. */
+  float			vy;
+}			truth_t;
+
+typedef struct		sample_s
+{
+  __u64			time_us;
+  struct lumio_contact	contacts[LUMIO_MAX_CONTACTS];
+  int			nb_contacts;
+  truth_t		truth[LUMIO_MAX_CONTACTS]; /**< By tag. */
+}			sample_t;
+
+typedef struct		trace_s
+{
+  const char*		path;
+  __u8			firmware;
+  sample_t*		samples;
+  unsigned long		nb_samples;
+  __u64*		start_us; /**< By finger, when it came down. */
+  __u32			nb_ids;
+  double		latency_ms; /**< How late its reports are shown. */
+}			trace_t;
+
+/**
+ * @brief How a configuration does, summed over the traces.
+ */
+typedef struct		score_s
+{
+  struct lumio_config	config;
+  double		ee; /**< Sum of the squared errors... */
+  double		ev; /**< ... of their dot product with the speed... */
+  double		vv; /**< ... and of the squared speeds. */
+  __u64			samples;
+  __u64			swaps;
+  __u64			strokes; /**< Fingers coming down. */
+  __u64			false_clicks;
+  __u64			missed;
+  double		delay_us; /**< Sum of the times to report the fingers. */
+  /* The objectives, all the lower the better */
+  double		latency_ms;
+  double		jitter;
+  double		swap_rate;
+  double		click_errors;
+  int			dominated;
+}			score_t;
+
+/**
+ * @brief What the fake mouse of a tag shows.
+ */
+typedef struct		mouse_s
+{
+  int			down;
+  double		x;
+  double		y;
+}			mouse_t;
+
+typedef struct		values_s
+{
+  __u32			v[MAX_VALUES];
+  int			nb;
+}			values_t;
+
+static trace_t*		traces = NULL;
+static unsigned int	nb_traces = 0;
+static score_t*		scores = NULL;
+static unsigned int	nb_scores = 0;
+static unsigned int	next_score = 0;
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_tune [-j threads] [-f firmware] [-e edges] [-J jumps] "
+	  "[-m min_reports] [-l lookaheads] [-M max_distances] [-t tolerances] "
+	  "[-L latency] [-c choice] [-o config] trace...\n"
+	  "  -j  threads running the pipeline (default one per processor)\n"
+	  "  -f  firmware of the raw traces without one in their truth "
+	  "(default 3)\n"
+	  "  -L  how late the reports are shown, in ms (default the report "
+	  "interval of each trace)\n"
+	  "  -e, -J, -m  values tried for the rejection (default 0,32,128 "
+	  "0,128,512 1,2,3,5)\n"
+	  "  -l, -M  for the prediction (default 0,4,8,12,16,24 32,128,512)\n"
+	  "  -t  for the decimation (default 0,2,4,8,16)\n"
+	  "  -c  the row of the front written with -o (default the balanced "
+	  "one)\n"
+	  "  -o  writes the configuration chosen, for lumio_config\n"
+	  "Values are separated by commas, the truth of each trace is in "
+	  "trace.truth.\n");
+}
+
+static int	parse_values(values_t* values, const char* s)
+{
+  char*		end = NULL;
+
+  values->nb = 0;
+  do
+    {
+      if (values->nb == MAX_VALUES)
+	return (-1);
+      values->v[values->nb++] = strtoul(s, &end, 0);
+      if (end == s || (*end && *end != ','))
+	return (-1);
+      s = end + 1;
+    }
+  while (*end);
+  return (0);
+}
+
+static void	set_values(values_t* values, int nb, const __u32* v)
+{
+  memcpy(values->v, v, nb * sizeof (*v));
+  values->nb = nb;
+}
+
+/**
+ * Returns room for one more sample.
+ */
+static sample_t*	new_sample(trace_t* trace, unsigned long* size)
+{
+  sample_t*		more = NULL;
+
+  if (trace->nb_samples == *size)
+    {
+      *size = *size ? *size * 2 : 4096;
+      if (!(more = realloc(trace->samples, *size * sizeof (*more))))
+	return (NULL);
+      trace->samples = more;
+    }
+  more = &trace->samples[trace->nb_samples++];
+  memset(more, 0x0, sizeof (*more));
+  return (more);
+}
+
+/**
+ * Reads the reports of a lumio trace, or of raw reports.
+ */
+static int			load_reports(trace_t* trace, FILE* file)
+{
+  struct lumio_trace_info	info;
+  struct lumio_trace_decoder	dec;
+  unsigned long			damaged = 0;
+  unsigned long			size = 0;
+  unsigned long			room = 0;
+  unsigned long			n = 0;
+  unsigned int			report_size = 0;
+  const __u8*			p = NULL;
+  __u8*				data = NULL;
+  sample_t*			sample = NULL;
+  int				ret = -1;
+
+  if (fseek(file, 0, SEEK_END) < 0 || (long) (size = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) < 0 || !(data = malloc(size + 1)) ||
+      (size && fread(data, size, 1, file) != 1))
+    {
+      perror(trace->path);
+      free(data);
+      return (-1);
+    }
+
+  if (size >= LUMIO_TRACE_HEADER_SIZE &&
+      !memcmp(data, LUMIO_TRACE_MAGIC, strlen(LUMIO_TRACE_MAGIC)))
+    {
+      if (lumio_trace_get_header(data, &info) < 0)
+	{
+	  fprintf(stderr, "%s: not a lumio trace, or of a later version\n",
+		  trace->path);
+	  free(data);
+	  return (-1);
+	}
+      trace->firmware = info.firmware;
+      p = data + LUMIO_TRACE_HEADER_SIZE;
+      while (lumio_trace_next_block(&p, data + size, &info, &dec, &damaged))
+	while (lumio_trace_next(&dec) > 0)
+	  {
+	    if (!(sample = new_sample(trace, &room)))
+	      goto out;
+	    sample->time_us = dec.time_us;
+	    sample->nb_contacts = lumio_decode_report(dec.report,
+						      sample->contacts);
+	  }
+      if (damaged)
+	fprintf(stderr, "%s: %lu damaged blocks skipped\n", trace->path,
+		damaged);
+    }
+  else
+    {
+      report_size = lumio_report_size(trace->firmware);
+      for (n = 0; (n + 1) * report_size <= size; ++n)
+	{
+	  if (!(sample = new_sample(trace, &room)))
+	    goto out;
+	  sample->time_us = (__u64) -1;
+	  sample->nb_contacts = lumio_decode_report(data + n * report_size,
+						    sample->contacts);
+	}
+    }
+  ret = 0;
+
+ out:
+  if (ret < 0)
+    perror(trace->path);
+  free(data);
+  return (ret);
+}
+
+/**
+ * Reads the truth of a trace, works out the speed and the start of each
+ * finger.
+ */
+static int	load_truth(trace_t* trace, FILE* file)
+{
+  char		line[256];
+  truth_t	last[LUMIO_MAX_CONTACTS];
+  __u64		last_us[LUMIO_MAX_CONTACTS];
+  unsigned long	index = 0;
+  unsigned long	i = 0;
+  double	time_us = 0;
+  double	x = 0;
+  double	y = 0;
+  double	dt_ms = 0;
+  unsigned int	id = 0;
+  truth_t*	truth = NULL;
+  int		tag = 0;
+  int		down = 0;
+
+  while (fgets(line, sizeof (line), file))
+    {
+      if (line[0] == '#')
+	continue;
+      if (sscanf(line, "%lu %lf %d %u %lf %lf %d", &index, &time_us, &tag,
+		 &id, &x, &y, &down) != 7 ||
+	  tag < 0 || tag >= LUMIO_MAX_CONTACTS || id > 1000000)
+	{
+	  fprintf(stderr, "%s.truth: bad line: %s", trace->path, line);
+	  return (-1);
+	}
+      if (index >= trace->nb_samples)
+	continue;
+      if (trace->samples[index].time_us == (__u64) -1)
+	trace->samples[index].time_us = time_us;
+      truth = &trace->samples[index].truth[tag];
+      truth->present = 1;
+      truth->down = down;
+      truth->id = id;
+      truth->x = x;
+      truth->y = y;
+      if (id >= trace->nb_ids)
+	trace->nb_ids = id + 1;
+    }
+
+  if (!(trace->start_us = calloc(trace->nb_ids + 1, sizeof (__u64))))
+    return (-1);
+  for (i = 0; i < trace->nb_ids; ++i)
+    trace->start_us[i] = (__u64) -1;
+  memset(last, 0x0, sizeof (last));
+  for (i = 0; i < trace->nb_samples; ++i)
+    {
+      /* Raw reports without truth: as late as the previous one */
+      if (trace->samples[i].time_us == (__u64) -1)
+	trace->samples[i].time_us = i ? trace->samples[i - 1].time_us : 0;
+      for (tag = 0; tag < LUMIO_MAX_CONTACTS; ++tag)
+	{
+	  truth = &trace->samples[i].truth[tag];
+	  if (!truth->present)
+	    continue;
+	  if (truth->down && trace->start_us[truth->id] == (__u64) -1)
+	    trace->start_us[truth->id] = trace->samples[i].time_us;
+	  dt_ms = (trace->samples[i].time_us - last_us[tag]) / 1000.0;
+	  if (last[tag].present && last[tag].down && last[tag].id == truth->id &&
+	      dt_ms > 0)
+	    {
+	      truth->vx = (truth->x - last[tag].x) / dt_ms;
+	      truth->vy = (truth->y - last[tag].y) / dt_ms;
+	    }
+	  last[tag] = *truth;
+	  last_us[tag] = trace->samples[i].time_us;
+	}
+    }
+
+  return (0);
+}
+
+static int	by_time(const void* a, const void* b)
+{
+  __u64		ta = *(const __u64*) a;
+  __u64		tb = *(const __u64*) b;
+
+  return (ta < tb ? -1 : ta > tb);
+}
+
+/**
+ * Returns the median interval between the reports of a trace, in ms.
+ */
+static double	report_interval(const trace_t* trace)
+{
+  __u64*	dt = NULL;
+  unsigned long	n = 0;
+  unsigned long	i = 0;
+  double	ms = 0;
+
+  if (trace->nb_samples < 2 ||
+      !(dt = malloc((trace->nb_samples - 1) * sizeof (*dt))))
+    return (0);
+  for (i = 1; i < trace->nb_samples; ++i)
+    if (trace->samples[i].time_us > trace->samples[i - 1].time_us)
+      dt[n++] = trace->samples[i].time_us - trace->samples[i - 1].time_us;
+  if (n)
+    {
+      qsort(dt, n, sizeof (*dt), by_time);
+      ms = dt[n / 2] / 1000.0;
+    }
+  free(dt);
+  return (ms);
+}
+
+static int	load_trace(trace_t* trace, const char* path, int firmware,
+			   double latency_ms)
+{
+  char		truth_path[4096];
+  char		line[256];
+  FILE*		reports = NULL;
+  FILE*		file = NULL;
+  int		ret = -1;
+
+  trace->path = path;
+  trace->firmware = firmware;
+  snprintf(truth_path, sizeof (truth_path), "%s.truth", path);
+
+  /* lumio_tracegen tells the firmware in the first line of the truth */
+  if (!(file = fopen(truth_path, "r")))
+    {
+      perror(truth_path);
+      return (-1);
+    }
+  if (fgets(line, sizeof (line), file) &&
+      sscanf(line, "# firmware %d", &firmware) == 1 &&
+      firmware >= LUMIO_FIRMWARE_1_0 && firmware <= LUMIO_FIRMWARE_3_0)
+    trace->firmware = firmware;
+  rewind(file);
+
+  if (!(reports = fopen(path, "rb")))
+    perror(path);
+  else
+    {
+      ret = load_reports(trace, reports);
+      fclose(reports);
+    }
+  if (ret == 0)
+    ret = load_truth(trace, file);
+  fclose(file);
+  if (ret == 0)
+    trace->latency_ms = latency_ms >= 0 ? latency_ms : report_interval(trace);
+  return (ret);
+}
+
+/**
+ * Tells what a contact shown by a mouse is, once it comes down.
+ */
+static void	mouse_down(score_t*		score,
+			   const trace_t*	trace,
+			   const sample_t*	sample,
+			   int			tag,
+			   __u8*		reported)
+{
+  const truth_t*	truth = &sample->truth[tag];
+
+  if (!truth->present || !truth->down || reported[truth->id])
+    {
+      ++score->false_clicks;
+      return;
+    }
+  reported[truth->id] = 1;
+  score->delay_us += sample->time_us - trace->start_us[truth->id];
+}
+
+static void	show(score_t* score, const trace_t* trace, const sample_t* sample,
+		     mouse_t* mice, const struct lumio_contact* contact,
+		     double x, double y, __u8* reported)
+{
+  mouse_t*	mouse = &mice[contact->tag];
+
+  if (contact->down && !mouse->down)
+    mouse_down(score, trace, sample, contact->tag, reported);
+  mouse->down = contact->down;
+  mouse->x = x;
+  mouse->y = y;
+}
+
+/**
+ * @brief Runs a trace through the pipeline of a configuration.
+ *
+ *	Mirrors lumio_treat_event(): the rejection first, then the decimation,
+ * or else the prediction.
+ */
+static void			run(score_t* score, const trace_t* trace)
+{
+  const struct lumio_config*	config = &score->config;
+  struct lumio_reject_state	reject[LUMIO_MAX_CONTACTS];
+  struct lumio_predictor	predictor[LUMIO_MAX_CONTACTS];
+  struct lumio_decimate_state	decimate[LUMIO_MAX_CONTACTS];
+  struct lumio_contact		contacts[LUMIO_MAX_CONTACTS];
+  struct lumio_contact		out[2];
+  mouse_t			mice[LUMIO_MAX_CONTACTS];
+  const sample_t*		sample = NULL;
+  const truth_t*		truth = NULL;
+  const truth_t*		other = NULL;
+  const double			late = trace->latency_ms;
+  __u8*				reported = calloc(trace->nb_ids + 1, 1);
+  __u32				max_coord = lumio_max_coordinate(trace->firmware);
+  __s32				px = 0;
+  __s32				py = 0;
+  double			ex = 0;
+  double			ey = 0;
+  double			ox = 0;
+  double			oy = 0;
+  unsigned long			i = 0;
+  unsigned int			id = 0;
+  int				nb_contacts = 0;
+  int				kept = 0;
+  int				n = 0;
+  int				j = 0;
+  int				k = 0;
+
+  if (!reported)
+    return;
+  memset(mice, 0x0, sizeof (mice));
+  for (j = 0; j < LUMIO_MAX_CONTACTS; ++j)
+    {
+      lumio_reject_reset(&reject[j]);
+      lumio_predict_reset(&predictor[j]);
+      lumio_decimate_reset(&decimate[j]);
+    }
+
+  for (i = 0; i < trace->nb_samples; ++i)
+    {
+      sample = &trace->samples[i];
+      nb_contacts = sample->nb_contacts;
+      memcpy(contacts, sample->contacts, sizeof (contacts));
+
+      if (lumio_reject_enabled(&config->rejection))
+	{
+	  for (kept = 0, j = 0; j < nb_contacts; ++j)
+	    if (lumio_reject(&config->rejection, &reject[contacts[j].tag],
+			     &contacts[j], max_coord) == LUMIO_REJECT_NONE)
+	      contacts[kept++] = contacts[j];
+	  nb_contacts = kept;
+	}
+
+      for (j = 0; j < nb_contacts; ++j)
+	if (lumio_decimate_enabled(&config->decimation))
+	  {
+	    n = lumio_decimate(&config->decimation,
+			       &decimate[contacts[j].tag], &contacts[j], out);
+	    for (k = 0; k < n; ++k)
+	      show(score, trace, sample, mice, &out[k], out[k].x, out[k].y,
+		   reported);
+	  }
+	else if (config->prediction.lookahead_ms && contacts[j].down)
+	  {
+	    lumio_predict_update(&predictor[contacts[j].tag], contacts[j].x,
+				 contacts[j].y, sample->time_us);
+	    lumio_predict(&predictor[contacts[j].tag], &config->prediction,
+			  max_coord, &px, &py);
+	    show(score, trace, sample, mice, &contacts[j], px, py, reported);
+	  }
+	else
+	  {
+	    lumio_predict_reset(&predictor[contacts[j].tag]);
+	    show(score, trace, sample, mice, &contacts[j], contacts[j].x,
+		 contacts[j].y, reported);
+	  }
+
+      /* Where the mice are against where the fingers are once shown */
+      for (j = 0; j < LUMIO_MAX_CONTACTS; ++j)
+	{
+	  truth = &sample->truth[j];
+	  if (!truth->present || !truth->down || !mice[j].down)
+	    continue;
+	  ex = truth->x + truth->vx * late - mice[j].x;
+	  ey = truth->y + truth->vy * late - mice[j].y;
+	  score->ee += ex * ex + ey * ey;
+	  score->ev += ex * truth->vx + ey * truth->vy;
+	  score->vv += truth->vx * truth->vx + truth->vy * truth->vy;
+	  ++score->samples;
+	  other = &sample->truth[!j];
+	  ox = other->x + other->vx * late - mice[j].x;
+	  oy = other->y + other->vy * late - mice[j].y;
+	  if (other->present && other->down && other->id != truth->id &&
+	      ox * ox + oy * oy < ex * ex + ey * ey)
+	    ++score->swaps;
+	}
+    }
+
+  for (id = 0; id < trace->nb_ids; ++id)
+    if (trace->start_us[id] != (__u64) -1)
+      {
+	++score->strokes;
+	if (!reported[id])
+	  ++score->missed;
+      }
+  free(reported);
+}
+
+static void*		work(void* data)
+{
+  unsigned int		i = 0;
+  unsigned int		t = 0;
+
+  (void) data;
+  while ((i = __sync_fetch_and_add(&next_score, 1)) < nb_scores)
+    for (t = 0; t < nb_traces; ++t)
+      run(&scores[i], &traces[t]);
+  return (NULL);
+}
+
+/**
+ * Works out the objectives, against no processing at all.
+ */
+static void	objectives(score_t* score, const score_t* raw)
+{
+  double	lag = score->vv > 0 ? score->ev / score->vv : 0;
+  double	raw_lag = raw->vv > 0 ? raw->ev / raw->vv : 0;
+  __u64		found = score->strokes - score->missed;
+  __u64		raw_found = raw->strokes - raw->missed;
+  double	residual = score->ee - lag * score->ev;
+
+  score->latency_ms = fabs(lag) - fabs(raw_lag) +
+    ((found ? score->delay_us / found : 0) -
+     (raw_found ? raw->delay_us / raw_found : 0)) / 1000;
+  score->jitter = score->samples && residual > 0 ?
+    sqrt(residual / score->samples) : 0;
+  score->swap_rate = score->samples ?
+    (double) score->swaps / score->samples : 0;
+  score->click_errors = score->strokes ?
+    (double) (score->false_clicks + score->missed) / score->strokes : 0;
+}
+
+static void	add_score(const struct lumio_config* config)
+{
+  scores[nb_scores++].config = *config;
+}
+
+static int	same(const score_t* a, const score_t* b)
+{
+  return (a->latency_ms == b->latency_ms && a->jitter == b->jitter &&
+	  a->swap_rate == b->swap_rate && a->click_errors == b->click_errors);
+}
+
+static int	dominates(const score_t* a, const score_t* b)
+{
+  return (a->latency_ms <= b->latency_ms && a->jitter <= b->jitter &&
+	  a->swap_rate <= b->swap_rate && a->click_errors <= b->click_errors &&
+	  (a->latency_ms < b->latency_ms || a->jitter < b->jitter ||
+	   a->swap_rate < b->swap_rate || a->click_errors < b->click_errors));
+}
+
+static int	by_latency(const void* a, const void* b)
+{
+  const score_t*	sa = *(const score_t* const*) a;
+  const score_t*	sb = *(const score_t* const*) b;
+
+  if (sa->latency_ms != sb->latency_ms)
+    return (sa->latency_ms < sb->latency_ms ? -1 : 1);
+  return (sa->jitter < sb->jitter ? -1 : sa->jitter > sb->jitter);
+}
+
+/**
+ * Returns the row of the front closest to the best of each objective, all of
+ * them scaled to the front.
+ */
+static int	balanced(score_t** front, int nb_front)
+{
+  double	min[4];
+  double	max[4];
+  double	v[4];
+  double	d = 0;
+  double	best_d = 0;
+  int		best = 0;
+  int		i = 0;
+  int		k = 0;
+
+  for (i = 0; i < nb_front; ++i)
+    {
+      v[0] = front[i]->latency_ms;
+      v[1] = front[i]->jitter;
+      v[2] = front[i]->swap_rate;
+      v[3] = front[i]->click_errors;
+      for (k = 0; k < 4; ++k)
+	{
+	  if (!i || v[k] < min[k])
+	    min[k] = v[k];
+	  if (!i || v[k] > max[k])
+	    max[k] = v[k];
+	}
+    }
+  for (i = 0; i < nb_front; ++i)
+    {
+      v[0] = front[i]->latency_ms;
+      v[1] = front[i]->jitter;
+      v[2] = front[i]->swap_rate;
+      v[3] = front[i]->click_errors;
+      for (d = 0, k = 0; k < 4; ++k)
+	if (max[k] > min[k])
+	  d += (v[k] - min[k]) / (max[k] - min[k]) *
+	    (v[k] - min[k]) / (max[k] - min[k]);
+      if (!i || d < best_d)
+	{
+	  best_d = d;
+	  best = i;
+	}
+    }
+  return (best);
+}
+
+int			main(int argc, char** argv)
+{
+  static const __u32	edges[] = { 0, 32, 128 };
+  static const __u32	jumps[] = { 0, 128, 512 };
+  static const __u32	min_reports[] = { 1, 2, 3, 5 };
+  static const __u32	lookaheads[] = { 0, 4, 8, 12, 16, 24 };
+  static const __u32	distances[] = { 32, 128, 512 };
+  static const __u32	tolerances[] = { 0, 2, 4, 8, 16 };
+  values_t		v[6];
+  struct lumio_config	config;
+  pthread_t*		threads = NULL;
+  score_t**		front = NULL;
+  score_t		raw;
+  const char*		output = NULL;
+  FILE*			file = NULL;
+  __u32			max_coord = 4095;
+  double		latency_ms = -1;
+  char*			end = NULL;
+  long			nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int			firmware = DEFAULT_FIRMWARE;
+  int			choice = -1;
+  int			nb_front = 0;
+  int			opt = 0;
+  int			ok = 1;
+  int			i = 0;
+  int			a = 0;
+  int			b = 0;
+
+  set_values(&v[0], 3, edges);
+  set_values(&v[1], 3, jumps);
+  set_values(&v[2], 4, min_reports);
+  set_values(&v[3], 6, lookaheads);
+  set_values(&v[4], 3, distances);
+  set_values(&v[5], 5, tolerances);
+  while ((opt = getopt(argc, argv, "j:f:e:J:m:l:M:t:L:c:o:h")) != -1)
+    switch (opt)
+      {
+      case 'j':
+	nb_threads = atoi(optarg);
+	break;
+      case 'f':
+	firmware = atoi(optarg);
+	break;
+      case 'e':
+	ok = ok && parse_values(&v[0], optarg) == 0;
+	break;
+      case 'J':
+	ok = ok && parse_values(&v[1], optarg) == 0;
+	break;
+      case 'm':
+	ok = ok && parse_values(&v[2], optarg) == 0;
+	break;
+      case 'l':
+	ok = ok && parse_values(&v[3], optarg) == 0;
+	break;
+      case 'M':
+	ok = ok && parse_values(&v[4], optarg) == 0;
+	break;
+      case 't':
+	ok = ok && parse_values(&v[5], optarg) == 0;
+	break;
+      case 'L':
+	latency_ms = strtod(optarg, &end);
+	ok = ok && end != optarg && !*end && latency_ms >= 0;
+	break;
+      case 'c':
+	choice = atoi(optarg);
+	break;
+      case 'o':
+	output = optarg;
+	break;
+      default:
+	ok = 0;
+      }
+  if (!ok || optind == argc || nb_threads < 1 ||
+      firmware < LUMIO_FIRMWARE_1_0 || firmware > LUMIO_FIRMWARE_3_0)
+    {
+      usage();
+      return (1);
+    }
+
+  nb_traces = argc - optind;
+  if (!(traces = calloc(nb_traces, sizeof (*traces))))
+    {
+      perror("lumio_tune");
+      return (1);
+    }
+  for (i = 0; i < (int) nb_traces; ++i)
+    {
+      if (load_trace(&traces[i], argv[optind + i], firmware, latency_ms) < 0)
+	return (1);
+      if (lumio_max_coordinate(traces[i].firmware) < max_coord)
+	max_coord = lumio_max_coordinate(traces[i].firmware);
+    }
+
+  /* Every combination the driver would take, without the duplicates */
+  if (!(scores = calloc(v[0].nb * v[1].nb * v[2].nb *
+			(1 + v[3].nb * v[4].nb + v[5].nb), sizeof (*scores))))
+    {
+      perror("lumio_tune");
+      return (1);
+    }
+  for (a = 0; a < v[0].nb * v[1].nb * v[2].nb; ++a)
+    {
+      memset(&config, 0x0, sizeof (config));
+      config.magic = LUMIO_CONFIG_MAGIC;
+      config.version = LUMIO_CONFIG_VERSION;
+      config.rejection.edge = v[0].v[a % v[0].nb];
+      config.rejection.max_jump = v[1].v[a / v[0].nb % v[1].nb];
+      config.rejection.min_reports = v[2].v[a / v[0].nb / v[1].nb];
+
+      /* Then the decimation, or the prediction (they don't go together) */
+      for (b = 0; b < v[5].nb; ++b)
+	if ((config.decimation.tolerance = v[5].v[b]))
+	  add_score(&config);
+      config.decimation.tolerance = 0;
+      for (b = 0; b < v[3].nb * v[4].nb; ++b)
+	if ((config.prediction.lookahead_ms = v[3].v[b % v[3].nb]))
+	  {
+	    config.prediction.max_distance = v[4].v[b / v[3].nb];
+	    add_score(&config);
+	  }
+      memset(&config.prediction, 0x0, sizeof (config.prediction));
+      add_score(&config);
+    }
+  for (a = 0; a < (int) nb_scores; ++a)
+    {
+      config = scores[a].config;
+      if (config.rejection.edge > max_coord / 4 ||
+	  config.rejection.max_jump > max_coord ||
+	  config.rejection.min_reports > LUMIO_REJECT_MAX_REPORTS ||
+	  config.prediction.lookahead_ms > LUMIO_PREDICT_MAX_LOOKAHEAD ||
+	  config.prediction.max_distance > max_coord ||
+	  config.decimation.tolerance > LUMIO_DECIMATE_MAX_TOLERANCE)
+	{
+	  fprintf(stderr, "lumio_tune: values out of the bounds of the "
+		  "driver, see lumio_driver.h\n");
+	  return (1);
+	}
+    }
+
+  memset(&raw, 0x0, sizeof (raw));
+  for (i = 0; i < (int) nb_traces; ++i)
+    run(&raw, &traces[i]);
+
+  if (nb_threads > nb_scores)
+    nb_threads = nb_scores;
+  if (!(threads = malloc(nb_threads * sizeof (*threads))) ||
+      !(front = malloc(nb_scores * sizeof (*front))))
+    {
+      perror("lumio_tune");
+      return (1);
+    }
+  for (i = 0; i < nb_threads; ++i)
+    if (pthread_create(&threads[i], NULL, work, NULL) != 0)
+      {
+	perror("pthread_create");
+	return (1);
+      }
+  for (i = 0; i < nb_threads; ++i)
+    pthread_join(threads[i], NULL);
+
+  objectives(&raw, &raw);
+  for (i = 0; i < (int) nb_scores; ++i)
+    objectives(&scores[i], &raw);
+  for (i = 0; i < (int) nb_scores; ++i)
+    for (a = 0; a < (int) nb_scores && !scores[i].dominated; ++a)
+      /* Of the ones doing the same, the first tried is kept */
+      if (a != i && (dominates(&scores[a], &scores[i]) ||
+		     (a < i && same(&scores[a], &scores[i]))))
+	scores[i].dominated = 1;
+  for (i = 0; i < (int) nb_scores; ++i)
+    if (!scores[i].dominated)
+      front[nb_front++] = &scores[i];
+  qsort(front, nb_front, sizeof (*front), by_latency);
+
+  printf("row,edge,max_jump,min_reports,lookahead_ms,max_distance,tolerance,"
+	 "latency_ms,jitter,jitter_removed_pct,swap_pct,false_clicks,missed\n");
+  for (i = 0; i < nb_front; ++i)
+    printf("%d,%u,%u,%u,%u,%u,%u,%.2f,%.2f,%.1f,%.3f,%llu,%llu\n", i,
+	   front[i]->config.rejection.edge, front[i]->config.rejection.max_jump,
+	   front[i]->config.rejection.min_reports,
+	   front[i]->config.prediction.lookahead_ms,
+	   front[i]->config.prediction.max_distance,
+	   front[i]->config.decimation.tolerance, front[i]->latency_ms,
+	   front[i]->jitter, raw.jitter > 0 ?
+	   (raw.jitter - front[i]->jitter) * 100 / raw.jitter : 0,
+	   front[i]->swap_rate * 100,
+	   (unsigned long long) front[i]->false_clicks,
+	   (unsigned long long) front[i]->missed);
+
+  if (choice < 0)
+    choice = balanced(front, nb_front);
+  if (choice >= nb_front)
+    {
+      fprintf(stderr, "lumio_tune: no row %d in the front\n", choice);
+      return (1);
+    }
+  fprintf(stderr, "%u traces, %u configurations, %d on the front; "
+	  "unprocessed: jitter %.2f, swaps %.3f%%, %llu false clicks, "
+	  "%llu missed; row %d chosen\n", nb_traces, nb_scores, nb_front,
+	  raw.jitter, raw.swap_rate * 100,
+	  (unsigned long long) raw.false_clicks,
+	  (unsigned long long) raw.missed, choice);
+
+  if (output)
+    {
+      if (!(file = fopen(output, "wb")) ||
+	  fwrite(&front[choice]->config, sizeof (struct lumio_config), 1,
+		 file) != 1 || fclose(file) != 0)
+	{
+	  perror(output);
+	  return (1);
+	}
+    }
+
+  return (0);
+}
@@ -0,0 +1,127 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_config.c
+ * @author Quentin Casasnovas
+ * @brief Loads a configuration written by lumio_tune on a touchscreen.
+ *
+ *	See IOCTL_SET_CONFIG in lumio_driver.h. -p prints the configuration
+ * instead of loading it.
+ */
+
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lumio_driver.h"
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_config [-d device] [-p] config\n"
+	  "  -d  the touchscreen char device (default /dev/lumio0)\n"
+	  "  -p  prints the configuration instead of loading it\n");
+}
+
+static int	read_config(const char* path, struct lumio_config* config)
+{
+  FILE*		file = NULL;
+  int		ret = 0;
+
+  if (!(file = fopen(path, "rb")))
+    {
+      perror(path);
+      return (-1);
+    }
+  if (fread(config, sizeof (*config), 1, file) != 1 ||
+      config->magic != LUMIO_CONFIG_MAGIC)
+    {
+      fprintf(stderr, "%s: not a lumio configuration\n", path);
+      ret = -1;
+    }
+  else if (config->version != LUMIO_CONFIG_VERSION)
+    {
+      fprintf(stderr, "%s: configuration version %u, this is version %d\n",
+	      path, config->version, LUMIO_CONFIG_VERSION);
+      ret = -1;
+    }
+  fclose(file);
+  return (ret);
+}
+
+int			main(int argc, char** argv)
+{
+  struct lumio_config	config;
+  const char*		device = "/dev/lumio0";
+  int			print = 0;
+  int			opt = 0;
+  int			fd = -1;
+
+  while ((opt = getopt(argc, argv, "d:ph")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	device = optarg;
+	break;
+      case 'p':
+	print = 1;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (argc - optind != 1)
+    {
+      usage();
+      return (1);
+    }
+
+  if (read_config(argv[optind], &config) < 0)
+    return (1);
+  if (print)
+    {
+      printf("rejection: edge %u, max_jump %u, min_reports %u\n"
+	     "prediction: lookahead_ms %u, max_distance %u\n"
+	     "decimation: tolerance %u\n", config.rejection.edge,
+	     config.rejection.max_jump, config.rejection.min_reports,
+	     config.prediction.lookahead_ms, config.prediction.max_distance,
+	     config.decimation.tolerance);
+      return (0);
+    }
+
+  if ((fd = open(device, O_RDWR)) < 0)
+    {
+      perror(device);
+      return (1);
+    }
+  if (ioctl(fd, IOCTL_SET_CONFIG, &config) < 0)
+    {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+      close(fd);
+      return (1);
+    }
+  close(fd);
+
+  return (0);
+}
@@ -0,0 +1,257 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_cursors.c
+ * @author Quentin Casasnovas
+ * @brief Gives each lumio pointer its own cursor.
+ *
+ *	Every lumio slave pointer X knows of (the fake mice of each touchscreen,
+ * the video wall, the partitions and the lumiod devices) gets a master pointer
+ * of its own, named "lumio<id of the slave>". The daemon listens to
+ * XI_HierarchyChanged: when a touchscreen is plugged, its master is created as
+ * soon as X adds its devices, and the slave is attached once X has created the
+ * master, a couple of round trips later. Masters whose slave has gone are
+ * removed.
+ *
+ *	Nothing is remembered between events, each one reconciles the whole
+ * hierarchy from XIQueryDevice(), so the daemon may start before or after the
+ * touchscreens, and be restarted at will. It lives as long as the X server:
+ * run it from the session start up (xinitrc, display manager, ...).
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XInput2.h>
+
+/** @brief Prefix of the masters the daemon creates. */
+#define MASTER_PREFIX		"lumio"
+/** @brief Suffix X gives to the pointer of a master. */
+#define MASTER_POINTER		" pointer"
+/** @brief Most changes sent at once. */
+#define MAX_CHANGES		128
+
+static int			verbose = 0;
+
+/**
+ * @brief Tells whether a device is created by the driver or lumiod.
+ */
+static int			is_lumio(const XIDeviceInfo* device)
+{
+  return (device->use != XIMasterPointer &&
+	  device->use != XIMasterKeyboard &&
+	  device->use != XISlaveKeyboard &&
+	  !strncmp(device->name, "Lumio ", 6));
+}
+
+/**
+ * @brief Returns the slave a master has been created for, 0 if none.
+ */
+static int			master_slave(const XIDeviceInfo* device)
+{
+  const char*			name = device->name;
+  char*				end = NULL;
+  long				id = 0;
+
+  if (device->use != XIMasterPointer ||
+      strncmp(name, MASTER_PREFIX, strlen(MASTER_PREFIX)))
+    return (0);
+  id = strtol(name + strlen(MASTER_PREFIX), &end, 10);
+  if (end == name + strlen(MASTER_PREFIX) || strcmp(end, MASTER_POINTER))
+    return (0);
+
+  return (id);
+}
+
+static const XIDeviceInfo*	find_device(const XIDeviceInfo*	devices,
+					    int			nb_devices,
+					    int			id)
+{
+  int				i = 0;
+
+  for (i = 0; i < nb_devices; ++i)
+    if (devices[i].deviceid == id)
+      return (&devices[i]);
+
+  return (NULL);
+}
+
+/**
+ * @brief Brings the hierarchy in line with the lumio devices.
+ *
+ * @return The number of changes requested.
+ */
+static int			reconcile(Display* dpy)
+{
+  XIAnyHierarchyChangeInfo	changes[MAX_CHANGES];
+  char				names[MAX_CHANGES][32];
+  const XIDeviceInfo*		slave = NULL;
+  XIDeviceInfo*			devices = NULL;
+  int				nb_devices = 0;
+  int				nb_changes = 0;
+  int				found = 0;
+  int				i = 0;
+  int				j = 0;
+
+  devices = XIQueryDevice(dpy, XIAllDevices, &nb_devices);
+
+  /* Masters of the slaves which are gone */
+  for (i = 0; i < nb_devices && nb_changes < MAX_CHANGES; ++i)
+    if ((found = master_slave(&devices[i])) &&
+	(!(slave = find_device(devices, nb_devices, found)) ||
+	 !is_lumio(slave)))
+      {
+	changes[nb_changes].remove.type = XIRemoveMaster;
+	changes[nb_changes].remove.deviceid = devices[i].deviceid;
+	changes[nb_changes].remove.return_mode = XIFloating;
+	++nb_changes;
+	if (verbose)
+	  printf("removing %s\n", devices[i].name);
+      }
+
+  /* Slaves without their own master yet */
+  for (i = 0; i < nb_devices && nb_changes < MAX_CHANGES; ++i)
+    {
+      if (!is_lumio(&devices[i]))
+	continue;
+
+      for (j = 0; j < nb_devices; ++j)
+	if (master_slave(&devices[j]) == devices[i].deviceid)
+	  break;
+      if (j == nb_devices)
+	{
+	  snprintf(names[nb_changes], sizeof (names[nb_changes]), "%s%d",
+		   MASTER_PREFIX, devices[i].deviceid);
+	  changes[nb_changes].add.type = XIAddMaster;
+	  changes[nb_changes].add.name = names[nb_changes];
+	  changes[nb_changes].add.send_core = True;
+	  changes[nb_changes].add.enable = True;
+	  ++nb_changes;
+	  if (verbose)
+	    printf("creating a cursor for %s (%d)\n", devices[i].name,
+		   devices[i].deviceid);
+	}
+      else if (devices[i].attachment != devices[j].deviceid ||
+	       devices[i].use == XIFloatingSlave)
+	{
+	  changes[nb_changes].attach.type = XIAttachSlave;
+	  changes[nb_changes].attach.deviceid = devices[i].deviceid;
+	  changes[nb_changes].attach.new_master = devices[j].deviceid;
+	  ++nb_changes;
+	  if (verbose)
+	    printf("attaching %s (%d) to %s\n", devices[i].name,
+		   devices[i].deviceid, devices[j].name);
+	}
+    }
+
+  if (nb_changes > 0)
+    {
+      XIChangeHierarchy(dpy, changes, nb_changes);
+      XFlush(dpy);
+    }
+  XIFreeDeviceInfo(devices);
+
+  return (nb_changes);
+}
+
+static void			usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_cursors [-1] [-v]\n"
+	  "  -1  set up the cursors of the devices already there and exit\n"
+	  "  -v  print the changes made to the hierarchy\n");
+}
+
+int				main(int argc, char** argv)
+{
+  unsigned char			mask[XIMaskLen(XI_LASTEVENT)];
+  XIEventMask			evmask;
+  XEvent			ev;
+  Display*			dpy = NULL;
+  int				xi_opcode = 0;
+  int				event = 0;
+  int				error = 0;
+  int				major = 2;
+  int				minor = 0;
+  int				once = 0;
+  int				opt = 0;
+  int				i = 0;
+
+  while ((opt = getopt(argc, argv, "1vh")) != -1)
+    switch (opt)
+      {
+      case '1':
+	once = 1;
+	break;
+      case 'v':
+	verbose = 1;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+
+  if (!(dpy = XOpenDisplay(NULL)))
+    {
+      fprintf(stderr, "lumio_cursors: unable to open the display.\n");
+      return (1);
+    }
+  if (!XQueryExtension(dpy, "XInputExtension", &xi_opcode, &event, &error) ||
+      XIQueryVersion(dpy, &major, &minor) != Success)
+    {
+      fprintf(stderr, "lumio_cursors: the X server has no XI2 support.\n");
+      XCloseDisplay(dpy);
+      return (1);
+    }
+
+  memset(mask, 0x0, sizeof (mask));
+  XISetMask(mask, XI_HierarchyChanged);
+  evmask.deviceid = XIAllDevices;
+  evmask.mask_len = sizeof (mask);
+  evmask.mask = mask;
+  XISelectEvents(dpy, DefaultRootWindow(dpy), &evmask, 1);
+
+  /*
+   * Masters are created first and the slaves attached once they exist, so
+   * the hierarchy takes two passes to settle.
+   */
+  if (once)
+    {
+      for (i = 0; i < 3 && reconcile(dpy) > 0; ++i)
+	XSync(dpy, False);
+      XCloseDisplay(dpy);
+      return (0);
+    }
+
+  reconcile(dpy);
+  for (;;)
+    {
+      XNextEvent(dpy, &ev);
+      if (ev.xcookie.type != GenericEvent ||
+	  ev.xcookie.extension != xi_opcode ||
+	  ev.xcookie.evtype != XI_HierarchyChanged)
+	continue;
+      reconcile(dpy);
+    }
+
+  return (0);
+}
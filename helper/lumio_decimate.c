@@ -0,0 +1,88 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_decimate.c
+ * @author Quentin Casasnovas
+ * @brief Sets the stroke decimation of a touchscreen.
+ *
+ *	See IOCTL_SET_DECIMATION in lumio_driver.h and lumio_decimate.h.
+ */
+
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lumio_driver.h"
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_decimate [-d device] tolerance\n"
+	  "  -d  the touchscreen char device (default /dev/lumio0)\n"
+	  "  tolerance  how far from the stroke drawn a position may be, in "
+	  "controller units, up to %d (0 disables the decimation)\n",
+	  LUMIO_DECIMATE_MAX_TOLERANCE);
+}
+
+int				main(int argc, char** argv)
+{
+  struct lumio_decimation	decimation;
+  const char*			device = "/dev/lumio0";
+  int				opt = 0;
+  int				fd = -1;
+
+  while ((opt = getopt(argc, argv, "d:h")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	device = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (argc - optind != 1)
+    {
+      usage();
+      return (1);
+    }
+
+  memset(&decimation, 0x0, sizeof (decimation));
+  decimation.tolerance = strtoul(argv[optind], NULL, 0);
+
+  if ((fd = open(device, O_RDWR)) < 0)
+    {
+      perror(device);
+      return (1);
+    }
+  if (ioctl(fd, IOCTL_SET_DECIMATION, &decimation) < 0)
+    {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+      close(fd);
+      return (1);
+    }
+  close(fd);
+
+  return (0);
+}
@@ -0,0 +1,169 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_filter.c
+ * @author Quentin Casasnovas
+ * @brief Loads report and contact filters in the driver.
+ *
+ *	Programs are read in the format bpf_asm -c outputs, one
+ * { code, jt, jf, k } instruction per line, lines starting with # being
+ * comments. They are checked with the same code as the driver before being
+ * loaded, see lumio_filter.h.
+ */
+
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lumio_filter.h"
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_filter [-d device] [-n] report|contact program|clear\n"
+	  "  -d  the touchscreen char device (default /dev/lumio0)\n"
+	  "  -n  only check the program, don't load it\n");
+}
+
+/**
+ * Reads a program, returns its number of instructions or -1.
+ */
+static int		read_program(const char*		path,
+				     struct sock_filter*	insns)
+{
+  FILE*			file = NULL;
+  char			line[256];
+  unsigned int		code, jt, jf, k;
+  int			len = 0;
+  int			nb_line = 0;
+
+  if (!(file = fopen(path, "r")))
+    {
+      perror(path);
+      return (-1);
+    }
+
+  while (fgets(line, sizeof (line), file))
+    {
+      ++nb_line;
+      if (line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\n")] == 0)
+	continue;
+      if (sscanf(line, " { %i , %i , %i , %i }", &code, &jt, &jf, &k) != 4)
+	{
+	  fprintf(stderr, "%s:%d: expected { code, jt, jf, k }\n", path, nb_line);
+	  len = -1;
+	  break;
+	}
+      if (len == LUMIO_FILTER_MAX_INSNS)
+	{
+	  fprintf(stderr, "%s: more than %d instructions\n", path,
+		  LUMIO_FILTER_MAX_INSNS);
+	  len = -1;
+	  break;
+	}
+      insns[len].code = code;
+      insns[len].jt = jt;
+      insns[len].jf = jf;
+      insns[len].k = k;
+      ++len;
+    }
+
+  fclose(file);
+  return (len);
+}
+
+int			main(int argc, char** argv)
+{
+  struct sock_filter	insns[LUMIO_FILTER_MAX_INSNS];
+  struct lumio_filter_prog	prog;
+  const char*		device = "/dev/lumio0";
+  int			check_only = 0;
+  int			len = 0;
+  int			opt = 0;
+  int			fd = -1;
+
+  while ((opt = getopt(argc, argv, "d:nh")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	device = optarg;
+	break;
+      case 'n':
+	check_only = 1;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (argc - optind != 2)
+    {
+      usage();
+      return (1);
+    }
+
+  memset(&prog, 0x0, sizeof (prog));
+  if (!strcmp(argv[optind], "report"))
+    prog.hook = LUMIO_HOOK_REPORT;
+  else if (!strcmp(argv[optind], "contact"))
+    prog.hook = LUMIO_HOOK_CONTACT;
+  else
+    {
+      usage();
+      return (1);
+    }
+
+  if (strcmp(argv[optind + 1], "clear"))
+    {
+      if ((len = read_program(argv[optind + 1], insns)) < 0)
+	return (1);
+      if (lumio_filter_check(insns, len, prog.hook) < 0)
+	{
+	  fprintf(stderr, "%s: rejected, see lumio_filter.h for what %s "
+		  "programs may do\n", argv[optind + 1], argv[optind]);
+	  return (1);
+	}
+      prog.len = len;
+      prog.filter = (__u64) (unsigned long) insns;
+    }
+  if (check_only)
+    {
+      printf("%s: %d instructions, ok\n", argv[optind + 1], len);
+      return (0);
+    }
+
+  if ((fd = open(device, O_RDWR)) < 0)
+    {
+      perror(device);
+      return (1);
+    }
+  if (ioctl(fd, IOCTL_SET_FILTER, &prog) < 0)
+    {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+      close(fd);
+      return (1);
+    }
+  close(fd);
+
+  return (0);
+}
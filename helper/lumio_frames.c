@@ -0,0 +1,125 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_frames.c
+ * @author Quentin Casasnovas
+ * @brief Prints the cooked frames of a touchscreen.
+ *
+ *	Reads the lumio%d char device (see struct lumio_cooked_frame in
+ * lumio_driver.h), up to -b frames per read(), and prints a line per frame:
+ * its time, sequence number and contacts, each as id:x,y followed by "down"
+ * or "up". Frames the driver had to drop are reported before the next one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lumio_driver.h"
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_frames [-d device] [-b batch] [-n count]\n"
+	  "  -d  the touchscreen char device (default /dev/lumio0)\n"
+	  "  -b  frames per read, up to %d (default 16)\n"
+	  "  -n  exit after count frames\n", LUMIO_COOKED_QUEUE);
+}
+
+static void	print_frame(const struct lumio_cooked_frame* frame)
+{
+  const struct lumio_cooked_contact*	contact = NULL;
+  int					i = 0;
+
+  if (frame->overruns)
+    printf("-- %u frames lost\n", frame->overruns);
+  printf("%llu.%06llu #%u", (unsigned long long) frame->time_us / 1000000,
+	 (unsigned long long) frame->time_us % 1000000, frame->sequence);
+  for (i = 0; i < frame->nb_contacts && i < LUMIO_COOKED_MAX_CONTACTS; ++i)
+    {
+      contact = &frame->contacts[i];
+      printf(" %u:%u,%u %s", contact->id, contact->x, contact->y,
+	     contact->state & LUMIO_COOKED_DOWN ? "down" : "up");
+    }
+  printf("\n");
+}
+
+int				main(int argc, char** argv)
+{
+  struct lumio_cooked_frame	frames[LUMIO_COOKED_QUEUE];
+  const char*			device = "/dev/lumio0";
+  unsigned long			count = 0;
+  unsigned long			printed = 0;
+  int				batch = 16;
+  ssize_t			len = 0;
+  int				opt = 0;
+  int				fd = -1;
+  int				i = 0;
+
+  while ((opt = getopt(argc, argv, "d:b:n:h")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	device = optarg;
+	break;
+      case 'b':
+	batch = atoi(optarg);
+	break;
+      case 'n':
+	count = strtoul(optarg, NULL, 0);
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (optind != argc || batch < 1 || batch > LUMIO_COOKED_QUEUE)
+    {
+      usage();
+      return (1);
+    }
+
+  if ((fd = open(device, O_RDONLY)) < 0)
+    {
+      perror(device);
+      return (1);
+    }
+  while (!count || printed < count)
+    {
+      len = read(fd, frames, batch * sizeof (struct lumio_cooked_frame));
+      if (len < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf(stderr, "%s: %s\n", device, strerror(errno));
+	  close(fd);
+	  return (1);
+	}
+      for (i = 0; i < len / (ssize_t) sizeof (struct lumio_cooked_frame) &&
+	     (!count || printed < count); ++i, ++printed)
+	print_frame(&frames[i]);
+      fflush(stdout);
+    }
+  close(fd);
+
+  return (0);
+}
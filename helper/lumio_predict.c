@@ -0,0 +1,93 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_predict.c
+ * @author Quentin Casasnovas
+ * @brief Sets the motion prediction of a touchscreen.
+ *
+ *	See IOCTL_SET_PREDICTION in lumio_driver.h and lumio_predict.h.
+ */
+
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lumio_driver.h"
+
+#define DEFAULT_MAX_DISTANCE	256
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_predict [-d device] lookahead_ms [max_distance]\n"
+	  "  -d  the touchscreen char device (default /dev/lumio0)\n"
+	  "  lookahead_ms  how far ahead to extrapolate, up to %d ms, 0 to "
+	  "disable\n"
+	  "  max_distance  bound of the extrapolation, in controller units "
+	  "(default %d)\n", LUMIO_PREDICT_MAX_LOOKAHEAD, DEFAULT_MAX_DISTANCE);
+}
+
+int				main(int argc, char** argv)
+{
+  struct lumio_prediction	prediction;
+  const char*			device = "/dev/lumio0";
+  int				opt = 0;
+  int				fd = -1;
+
+  while ((opt = getopt(argc, argv, "d:h")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	device = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (argc - optind < 1 || argc - optind > 2)
+    {
+      usage();
+      return (1);
+    }
+
+  memset(&prediction, 0x0, sizeof (prediction));
+  prediction.lookahead_ms = strtoul(argv[optind], NULL, 0);
+  prediction.max_distance = argc - optind == 2 ?
+    strtoul(argv[optind + 1], NULL, 0) : DEFAULT_MAX_DISTANCE;
+
+  if ((fd = open(device, O_RDWR)) < 0)
+    {
+      perror(device);
+      return (1);
+    }
+  if (ioctl(fd, IOCTL_SET_PREDICTION, &prediction) < 0)
+    {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+      close(fd);
+      return (1);
+    }
+  close(fd);
+
+  return (0);
+}
@@ -0,0 +1,188 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_regions.c
+ * @author Quentin Casasnovas
+ * @brief Loads hot regions in the driver.
+ *
+ *	Regions are read one per line, "x y width height key [press|click]", in
+ * controller coordinates, key being a KEY_* code of linux/input.h (28 for
+ * KEY_ENTER for instance); # starts a comment. They are checked with the same
+ * code as the driver before being loaded, see lumio_regions.h and
+ * IOCTL_SET_REGIONS.
+ */
+
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lumio_regions.h"
+
+/** @brief Highest coordinate the regions are checked against. */
+#define DEFAULT_MAX_COORD	4095
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_regions [-d device] [-o] [-n] [-m max] regions|clear\n"
+	  "  -d  the touchscreen char device (default /dev/lumio0)\n"
+	  "  -o  only send the keys, not the contacts\n"
+	  "  -n  only check the regions, don't load them\n"
+	  "  -m  highest coordinate of the touchscreen (default %d, 2047 for "
+	  "firmware 1.0)\n", DEFAULT_MAX_COORD);
+}
+
+/**
+ * Reads the regions, returns how many or -1.
+ */
+static int		read_regions(const char*		path,
+				     struct lumio_region*	regions,
+				     unsigned int		max_coord)
+{
+  FILE*			file = NULL;
+  char			line[256];
+  char			mode[16];
+  unsigned int		x, y, width, height, key;
+  int			nb_regions = 0;
+  int			nb_line = 0;
+  int			nb_fields = 0;
+
+  if (!(file = fopen(path, "r")))
+    {
+      perror(path);
+      return (-1);
+    }
+
+  while (fgets(line, sizeof (line), file))
+    {
+      ++nb_line;
+      if (line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\n")] == 0)
+	continue;
+      strcpy(mode, "press");
+      nb_fields = sscanf(line, " %u %u %u %u %i %15s", &x, &y, &width, &height,
+			 &key, mode);
+      if (mode[0] == '#')
+	strcpy(mode, "press");
+      if (nb_fields < 5 || (strcmp(mode, "press") && strcmp(mode, "click")))
+	{
+	  fprintf(stderr, "%s:%d: expected x y width height key "
+		  "[press|click]\n", path, nb_line);
+	  nb_regions = -1;
+	  break;
+	}
+      if (nb_regions == LUMIO_MAX_REGIONS)
+	{
+	  fprintf(stderr, "%s: more than %d regions\n", path, LUMIO_MAX_REGIONS);
+	  nb_regions = -1;
+	  break;
+	}
+      regions[nb_regions].x = x;
+      regions[nb_regions].y = y;
+      regions[nb_regions].width = width;
+      regions[nb_regions].height = height;
+      regions[nb_regions].key = key;
+      regions[nb_regions].mode = strcmp(mode, "click") ? LUMIO_REGION_PRESS :
+	LUMIO_REGION_CLICK;
+      if (x > 0xffff || y > 0xffff || width > 0xffff || height > 0xffff ||
+	  lumio_region_check(&regions[nb_regions], max_coord) < 0)
+	{
+	  fprintf(stderr, "%s:%d: region out of the screen (0-%u), empty, or "
+		  "key not below %d\n", path, nb_line, max_coord,
+		  LUMIO_REGION_MAX_KEY);
+	  nb_regions = -1;
+	  break;
+	}
+      ++nb_regions;
+    }
+
+  fclose(file);
+  return (nb_regions);
+}
+
+int			main(int argc, char** argv)
+{
+  struct lumio_region	regions[LUMIO_MAX_REGIONS];
+  struct lumio_regions	arg;
+  const char*		device = "/dev/lumio0";
+  unsigned int		max_coord = DEFAULT_MAX_COORD;
+  int			check_only = 0;
+  int			nb_regions = 0;
+  int			opt = 0;
+  int			fd = -1;
+
+  memset(&arg, 0x0, sizeof (arg));
+  while ((opt = getopt(argc, argv, "d:onm:h")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	device = optarg;
+	break;
+      case 'o':
+	arg.flags |= LUMIO_REGIONS_ONLY;
+	break;
+      case 'n':
+	check_only = 1;
+	break;
+      case 'm':
+	max_coord = strtoul(optarg, NULL, 0);
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (argc - optind != 1)
+    {
+      usage();
+      return (1);
+    }
+
+  if (strcmp(argv[optind], "clear"))
+    {
+      if ((nb_regions = read_regions(argv[optind], regions, max_coord)) < 0)
+	return (1);
+      arg.nb_regions = nb_regions;
+      arg.regions = (__u64) (unsigned long) regions;
+    }
+  if (check_only)
+    {
+      printf("%s: %d regions, %d grid entries, ok\n", argv[optind], nb_regions,
+	     lumio_regions_size(regions, nb_regions, max_coord));
+      return (0);
+    }
+
+  if ((fd = open(device, O_RDWR)) < 0)
+    {
+      perror(device);
+      return (1);
+    }
+  if (ioctl(fd, IOCTL_SET_REGIONS, &arg) < 0)
+    {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+      close(fd);
+      return (1);
+    }
+  close(fd);
+
+  return (0);
+}
@@ -0,0 +1,95 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_reject.c
+ * @author Quentin Casasnovas
+ * @brief Sets the rejection of spurious contacts of a touchscreen.
+ *
+ *	See IOCTL_SET_REJECTION in lumio_driver.h and lumio_reject.h.
+ */
+
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lumio_driver.h"
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_reject [-d device] edge [max_jump [min_reports]]\n"
+	  "  -d  the touchscreen char device (default /dev/lumio0)\n"
+	  "  edge         width of the dead-zone along the borders\n"
+	  "  max_jump     longest move between two reports\n"
+	  "  min_reports  reports a contact lasts before being reported, up to "
+	  "%d\n"
+	  "Distances are in controller units, 0 disables a check.\n",
+	  LUMIO_REJECT_MAX_REPORTS);
+}
+
+int				main(int argc, char** argv)
+{
+  struct lumio_rejection	rejection;
+  const char*			device = "/dev/lumio0";
+  int				opt = 0;
+  int				fd = -1;
+
+  while ((opt = getopt(argc, argv, "d:h")) != -1)
+    switch (opt)
+      {
+      case 'd':
+	device = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (argc - optind < 1 || argc - optind > 3)
+    {
+      usage();
+      return (1);
+    }
+
+  memset(&rejection, 0x0, sizeof (rejection));
+  rejection.edge = strtoul(argv[optind], NULL, 0);
+  if (argc - optind > 1)
+    rejection.max_jump = strtoul(argv[optind + 1], NULL, 0);
+  if (argc - optind > 2)
+    rejection.min_reports = strtoul(argv[optind + 2], NULL, 0);
+
+  if ((fd = open(device, O_RDWR)) < 0)
+    {
+      perror(device);
+      return (1);
+    }
+  if (ioctl(fd, IOCTL_SET_REJECTION, &rejection) < 0)
+    {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+      close(fd);
+      return (1);
+    }
+  close(fd);
+
+  return (0);
+}
@@ -0,0 +1,325 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_telemetry.c
+ * @author Quentin Casasnovas
+ * @brief Prints the telemetry the driver multicasts.
+ *
+ *	Subscribes to the LUMIO_TELEMETRY_GROUP group of the generic netlink
+ * family of the driver, and prints a line per message received, one message
+ * per touchscreen every telemetry_ms milliseconds (see lumio_driver.h). -j
+ * prints JSON objects instead, for the monitoring daemons. The driver sends
+ * nothing while no one subscribed.
+ */
+
+#include <sys/socket.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "lumio_driver.h"
+
+/** @brief Large enough for any message of the family or the controller. */
+#define BUFFER_SIZE	8192
+
+/**
+ * @brief A telemetry message, as received.
+ */
+struct			telemetry
+{
+  char			bus_path[64];
+  unsigned int		firmware;
+  unsigned int		interval_ms;
+  unsigned int		reports_per_sec;
+  unsigned int		drops;
+  unsigned int		urb_errors;
+  unsigned int		recoveries;
+  unsigned int		mode_switch_us;
+  unsigned int		contacts;
+};
+
+static void	usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumio_telemetry [-j] [-b bus_path] [-n count]\n"
+	  "  -j  print JSON objects, one per line\n"
+	  "  -b  only print the touchscreen plugged at bus_path\n"
+	  "  -n  exit after count messages\n");
+}
+
+/**
+ * Sends a request to the generic netlink controller, returns 0 or -1.
+ */
+static int		send_ctrl(int fd, __u8 cmd, __u16 attr, const char* value)
+{
+  char			buffer[256];
+  struct nlmsghdr*	nlh = (struct nlmsghdr*) buffer;
+  struct genlmsghdr*	genl = NLMSG_DATA(nlh);
+  struct nlattr*	nla = (struct nlattr*) ((char*) genl + GENL_HDRLEN);
+  struct sockaddr_nl	kernel;
+
+  memset(buffer, 0x0, sizeof (buffer));
+  nla->nla_type = attr;
+  nla->nla_len = NLA_HDRLEN + strlen(value) + 1;
+  strcpy((char*) nla + NLA_HDRLEN, value);
+  nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(nla->nla_len));
+  nlh->nlmsg_type = GENL_ID_CTRL;
+  nlh->nlmsg_flags = NLM_F_REQUEST;
+  nlh->nlmsg_seq = 1;
+  genl->cmd = cmd;
+  genl->version = 1;
+
+  memset(&kernel, 0x0, sizeof (kernel));
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(fd, buffer, nlh->nlmsg_len, 0, (struct sockaddr*) &kernel,
+	     sizeof (kernel)) < 0)
+    return (-1);
+
+  return (0);
+}
+
+/**
+ * Finds the id of the telemetry group, returns it or -1.
+ */
+static int		find_group(int fd)
+{
+  static char		buffer[BUFFER_SIZE];
+  struct nlmsghdr*	nlh = (struct nlmsghdr*) buffer;
+  struct nlattr*	nla = NULL;
+  struct nlattr*	grp = NULL;
+  struct nlattr*	field = NULL;
+  const char*		name = NULL;
+  int			id = -1;
+  int			len = 0;
+  int			grp_len = 0;
+  int			field_len = 0;
+  int			ret = 0;
+
+  if (send_ctrl(fd, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+		LUMIO_TELEMETRY_FAMILY) < 0 ||
+      (ret = recv(fd, buffer, sizeof (buffer), 0)) < 0)
+    return (-1);
+  if (!NLMSG_OK(nlh, (unsigned int) ret) || nlh->nlmsg_type == NLMSG_ERROR)
+    {
+      errno = ENOENT;
+      return (-1);
+    }
+
+  /* CTRL_ATTR_MCAST_GROUPS nests a list of groups, each nesting its fields */
+  len = NLMSG_PAYLOAD(nlh, GENL_HDRLEN);
+  for (nla = (struct nlattr*) ((char*) NLMSG_DATA(nlh) + GENL_HDRLEN);
+       len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len;
+       len -= NLA_ALIGN(nla->nla_len),
+	 nla = (struct nlattr*) ((char*) nla + NLA_ALIGN(nla->nla_len)))
+    {
+      if ((nla->nla_type & NLA_TYPE_MASK) != CTRL_ATTR_MCAST_GROUPS)
+	continue;
+      grp_len = nla->nla_len - NLA_HDRLEN;
+      for (grp = (struct nlattr*) ((char*) nla + NLA_HDRLEN);
+	   grp_len >= NLA_HDRLEN && grp->nla_len >= NLA_HDRLEN &&
+	     grp->nla_len <= grp_len;
+	   grp_len -= NLA_ALIGN(grp->nla_len),
+	     grp = (struct nlattr*) ((char*) grp + NLA_ALIGN(grp->nla_len)))
+	{
+	  name = NULL;
+	  id = -1;
+	  field_len = grp->nla_len - NLA_HDRLEN;
+	  for (field = (struct nlattr*) ((char*) grp + NLA_HDRLEN);
+	       field_len >= NLA_HDRLEN && field->nla_len >= NLA_HDRLEN &&
+		 field->nla_len <= field_len;
+	       field_len -= NLA_ALIGN(field->nla_len),
+		 field = (struct nlattr*) ((char*) field +
+					   NLA_ALIGN(field->nla_len)))
+	    if (field->nla_type == CTRL_ATTR_MCAST_GRP_NAME)
+	      name = (const char*) field + NLA_HDRLEN;
+	    else if (field->nla_type == CTRL_ATTR_MCAST_GRP_ID)
+	      id = *(__u32*) ((char*) field + NLA_HDRLEN);
+	  if (name && id >= 0 && !strcmp(name, LUMIO_TELEMETRY_GROUP))
+	    return (id);
+	}
+    }
+
+  errno = ENOENT;
+  return (-1);
+}
+
+/**
+ * Reads a telemetry message, returns 0 or -1 if it isn't one.
+ */
+static int		parse_telemetry(struct nlmsghdr*	nlh,
+					struct telemetry*	t)
+{
+  struct genlmsghdr*	genl = NLMSG_DATA(nlh);
+  struct nlattr*	nla = NULL;
+  void*			value = NULL;
+  int			len = 0;
+
+  if (nlh->nlmsg_type < NLMSG_MIN_TYPE ||
+      genl->cmd != LUMIO_TELEMETRY_CMD_STATS)
+    return (-1);
+
+  memset(t, 0x0, sizeof (*t));
+  len = NLMSG_PAYLOAD(nlh, GENL_HDRLEN);
+  for (nla = (struct nlattr*) ((char*) genl + GENL_HDRLEN);
+       len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len;
+       len -= NLA_ALIGN(nla->nla_len),
+	 nla = (struct nlattr*) ((char*) nla + NLA_ALIGN(nla->nla_len)))
+    {
+      value = (char*) nla + NLA_HDRLEN;
+      switch (nla->nla_type)
+	{
+	case LUMIO_TELEMETRY_A_BUS_PATH:
+	  snprintf(t->bus_path, sizeof (t->bus_path), "%.*s",
+		   (int) (nla->nla_len - NLA_HDRLEN), (const char*) value);
+	  break;
+	case LUMIO_TELEMETRY_A_FIRMWARE:
+	  t->firmware = *(__u8*) value;
+	  break;
+	case LUMIO_TELEMETRY_A_INTERVAL_MS:
+	  t->interval_ms = *(__u32*) value;
+	  break;
+	case LUMIO_TELEMETRY_A_REPORTS_PER_SEC:
+	  t->reports_per_sec = *(__u32*) value;
+	  break;
+	case LUMIO_TELEMETRY_A_DROPS:
+	  t->drops = *(__u32*) value;
+	  break;
+	case LUMIO_TELEMETRY_A_URB_ERRORS:
+	  t->urb_errors = *(__u32*) value;
+	  break;
+	case LUMIO_TELEMETRY_A_RECOVERIES:
+	  t->recoveries = *(__u32*) value;
+	  break;
+	case LUMIO_TELEMETRY_A_MODE_SWITCH_US:
+	  t->mode_switch_us = *(__u32*) value;
+	  break;
+	case LUMIO_TELEMETRY_A_CONTACTS:
+	  t->contacts = *(__u8*) value;
+	  break;
+	default:
+	  break;
+	}
+    }
+
+  return (0);
+}
+
+static void		print_telemetry(const struct telemetry* t, int json)
+{
+  if (json)
+    printf("{\"bus_path\": \"%s\", \"firmware\": %u, \"interval_ms\": %u, "
+	   "\"reports_per_sec\": %u, \"drops\": %u, \"urb_errors\": %u, "
+	   "\"recoveries\": %u, \"mode_switch_us\": %u, \"contacts\": %u}\n",
+	   t->bus_path, t->firmware, t->interval_ms, t->reports_per_sec,
+	   t->drops, t->urb_errors, t->recoveries, t->mode_switch_us,
+	   t->contacts);
+  else
+    printf("%s (firmware %u, %u ms): %u reports/s, %u dropped, %u urb "
+	   "errors, %u recoveries, mode switch %u us, %u contacts\n",
+	   t->bus_path, t->firmware, t->interval_ms, t->reports_per_sec,
+	   t->drops, t->urb_errors, t->recoveries, t->mode_switch_us,
+	   t->contacts);
+  fflush(stdout);
+}
+
+int			main(int argc, char** argv)
+{
+  static char		buffer[BUFFER_SIZE];
+  struct sockaddr_nl	local;
+  struct telemetry	t;
+  struct nlmsghdr*	nlh = NULL;
+  const char*		bus_path = NULL;
+  int			json = 0;
+  int			count = -1;
+  int			group = -1;
+  int			opt = 0;
+  int			fd = -1;
+  int			ret = 0;
+
+  while ((opt = getopt(argc, argv, "jb:n:h")) != -1)
+    switch (opt)
+      {
+      case 'j':
+	json = 1;
+	break;
+      case 'b':
+	bus_path = optarg;
+	break;
+      case 'n':
+	count = atoi(optarg);
+	break;
+      default:
+	usage();
+	return (1);
+      }
+
+  if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC)) < 0)
+    {
+      perror("socket");
+      return (1);
+    }
+  memset(&local, 0x0, sizeof (local));
+  local.nl_family = AF_NETLINK;
+  if (bind(fd, (struct sockaddr*) &local, sizeof (local)) < 0)
+    {
+      perror("bind");
+      close(fd);
+      return (1);
+    }
+  if ((group = find_group(fd)) < 0)
+    {
+      fprintf(stderr, "%s family: %s (is lumio_driver loaded?)\n",
+	      LUMIO_TELEMETRY_FAMILY, strerror(errno));
+      close(fd);
+      return (1);
+    }
+  if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group,
+		 sizeof (group)) < 0)
+    {
+      perror("NETLINK_ADD_MEMBERSHIP");
+      close(fd);
+      return (1);
+    }
+
+  while (count != 0 && (ret = recv(fd, buffer, sizeof (buffer), 0)) >= 0)
+    for (nlh = (struct nlmsghdr*) buffer;
+	 count != 0 && NLMSG_OK(nlh, (unsigned int) ret);
+	 nlh = NLMSG_NEXT(nlh, ret))
+      if (parse_telemetry(nlh, &t) == 0 &&
+	  (!bus_path || !strcmp(bus_path, t.bus_path)))
+	{
+	  print_telemetry(&t, json);
+	  if (count > 0)
+	    --count;
+	}
+  if (ret < 0)
+    {
+      perror("recv");
+      close(fd);
+      return (1);
+    }
+  close(fd);
+
+  return (0);
+}
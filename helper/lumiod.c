@@ -0,0 +1,891 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumiod.c
+ * @author Quentin Casasnovas
+ * @brief Userland driver for the lumio touchscreen.
+ *
+ *	For hosts which can't load lumio_driver, this daemon drives the
+ * touchscreens from userland with libusb-1.0, and sends the contacts to the
+ * input layer through uinput, as a multitouch device. It speaks the same
+ * protocol as the kernel driver (see lumio_protocol.h): the controller is
+ * switched to driver mode and then to dualtouch configuration exactly the
+ * way lumio_probe() does it.
+ *
+ *	Reports are received with a pool of asynchronous interrupt transfers,
+ * so that there's always a transfer queued on the endpoint while the
+ * previous one is being handled. Touchscreens are picked up and released
+ * using libusb hotplug callbacks.
+ *
+ *	With -w, the reports of each touchscreen are also recorded as a trace
+ * (see lumio_trace.h) in the given directory, written at least every second.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include <libusb.h>
+
+#include "lumio_protocol.h"
+#include "lumio_trace.h"
+
+/** @brief Default number of interrupt transfers queued per touchscreen. */
+#define LUMIOD_POOL_SIZE	4
+#define LUMIOD_MAX_POOL_SIZE	16
+#define LUMIOD_MAX_PANELS	16
+/** @brief Timeout of the handshake transfers, in milliseconds. */
+#define LUMIOD_TIMEOUT		1000
+/** @brief Transfer errors resubmitted before clearing the endpoint halt. */
+#define LUMIOD_QUICK_RETRIES	3
+
+/**
+ * @brief A supported usb id.
+ */
+typedef struct			lumiod_id_s
+{
+  unsigned short		vid;
+  unsigned short		pid;
+  unsigned char			firmware;
+  unsigned char			driver_mode; /**< 0 if the controller is in mouse mode. */
+}				lumiod_id_t;
+
+static const lumiod_id_t	lumiod_ids[] =
+  {
+    {USB_VID_MM, USB_PID_MM, LUMIO_FIRMWARE_1_0, 0},
+    {USB_VID_DM, USB_PID_DM, LUMIO_FIRMWARE_1_0, 1},
+    {USB_VID_LUMIO, USB_PID_DM_2_0, LUMIO_FIRMWARE_2_0, 1},
+    {USB_VID_LUMIO, USB_PID_MM_2_0, LUMIO_FIRMWARE_2_0, 0},
+    {USB_VID_LUMIO, USB_PID_DUAL_MODE_3_0, LUMIO_FIRMWARE_3_0, 1},
+    {USB_VID_LUMIO, USB_PID_4_SENSORS_3_0, LUMIO_FIRMWARE_3_0, 1},
+    {0, 0, 0, 0}
+  };
+
+/**
+ * @brief A touchscreen driven by the daemon.
+ */
+typedef struct			lumiod_panel_s
+{
+  libusb_device*		dev;
+  libusb_device_handle*		handle;
+  const lumiod_id_t*		id;
+  struct libusb_transfer*	transfers[LUMIOD_MAX_POOL_SIZE];
+  unsigned char			busy[LUMIOD_MAX_POOL_SIZE]; /**< Transfer is queued. */
+  unsigned char			buffers[LUMIOD_MAX_POOL_SIZE][LUMIO_REPORT_SIZE];
+  unsigned char			report[LUMIO_REPORT_SIZE]; /**< Report being reassembled. */
+  unsigned int			half; /**< Next half of the report (fw 1.0/2.0). */
+  struct lumio_contact		contacts[LUMIO_MAX_CONTACTS]; /**< Last state of each tag. */
+  int				tracking_id[LUMIO_MAX_CONTACTS];
+  int				uinput;
+  unsigned char			in_endpoint;
+  unsigned char			out_endpoint;
+  int				in_flight; /**< Number of queued transfers. */
+  int				gone; /**< The touchscreen has been unplugged. */
+  int				recover; /**< The in endpoint must be cleared. */
+  unsigned int			errors; /**< Transfer errors in a row. */
+
+  FILE*				trace; /**< NULL when not recording. */
+  struct lumio_trace_encoder*	encoder;
+  double			trace_start;
+  double			trace_flushed;
+
+  unsigned long			reports;
+  unsigned long			transfer_errors;
+  double			latency_sum; /**< Callback to uinput, in us. */
+  double			latency_max;
+}				lumiod_panel_t;
+
+static lumiod_panel_t*		panels[LUMIOD_MAX_PANELS];
+static libusb_device*		arrivals[LUMIOD_MAX_PANELS];
+static unsigned int		nb_arrivals = 0;
+static int			pool_size = LUMIOD_POOL_SIZE;
+static int			next_tracking_id = 0;
+static const char*		trace_dir = NULL;
+static volatile int		stop = 0;
+
+static double			now_us(void)
+{
+  struct timespec		ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e6 + ts.tv_nsec / 1e3);
+}
+
+static const lumiod_id_t*	find_id(libusb_device* dev)
+{
+  struct libusb_device_descriptor	desc;
+  unsigned int				i = 0;
+
+  if (libusb_get_device_descriptor(dev, &desc) != 0)
+    return (NULL);
+
+  for (i = 0; lumiod_ids[i].vid != 0; ++i)
+    if (desc.idVendor == lumiod_ids[i].vid &&
+	desc.idProduct == lumiod_ids[i].pid)
+      return (&lumiod_ids[i]);
+
+  return (NULL);
+}
+
+/**
+ * @brief Sends a message to the controller.
+ *
+ *	Same as lumio_send_8_bytes() and lumio_send_64_bytes() in the kernel
+ * driver: firmware 3.0 receives its messages on the interrupt out endpoint,
+ * the older ones as a SET_REPORT control request.
+ */
+static int			send_msg(lumiod_panel_t*	panel,
+					 unsigned int		hid_type,
+					 unsigned char*		msg)
+{
+  int				transferred = 0;
+
+  if (panel->id->firmware == LUMIO_FIRMWARE_3_0)
+    return (libusb_interrupt_transfer(panel->handle, panel->out_endpoint,
+				      msg, LUMIO_REPORT_SIZE, &transferred,
+				      LUMIOD_TIMEOUT));
+
+  return (libusb_control_transfer(panel->handle,
+				  LIBUSB_ENDPOINT_OUT |
+				  LIBUSB_REQUEST_TYPE_CLASS |
+				  LIBUSB_RECIPIENT_INTERFACE,
+				  HID_REQ_SET_REPORT, hid_type, 0,
+				  msg, LUMIO_MSG_SIZE, LUMIOD_TIMEOUT));
+}
+
+/**
+ * @brief Same as lumio_actual_conf() in the kernel driver.
+ *
+ * @return 1 if the controller reports dualtouch events, 0 if it reports
+ * singletouch events and a negative number if it can't be asked.
+ */
+static int			is_dualtouch(lumiod_panel_t* panel)
+{
+  unsigned char			msg[LUMIO_REPORT_SIZE];
+  int				ret = 0;
+
+  if (panel->id->firmware == LUMIO_FIRMWARE_3_0)
+    return (1);
+
+  lumio_build_config_msg(msg, 0);
+  if ((ret = send_msg(panel, HID_REQ_SET_REPORT, msg)) < 0)
+    return (ret);
+
+  usleep(50000);
+
+  memset(msg, 0x0, sizeof (msg));
+  ret = libusb_control_transfer(panel->handle,
+				LIBUSB_ENDPOINT_IN |
+				LIBUSB_REQUEST_TYPE_CLASS |
+				LIBUSB_RECIPIENT_INTERFACE,
+				HID_REQ_GET_REPORT, HID_REQ_GET_REPORT, 0,
+				msg, LUMIO_MSG_SIZE, LUMIOD_TIMEOUT);
+  if (ret < 0)
+    return (ret);
+
+  return (lumio_config_is_dualtouch(msg));
+}
+
+/**
+ * @brief Same as lumio_switch_to_dualtouch_mode() in the kernel driver.
+ */
+static int			switch_to_dualtouch(lumiod_panel_t* panel)
+{
+  unsigned char			msg[LUMIO_REPORT_SIZE];
+  int				nb_try = 0;
+
+  do
+    {
+      lumio_build_config_msg(msg, 1);
+      if (send_msg(panel, HID_REQ_SET_REPORT, msg) < 0)
+	fprintf(stderr, "lumiod: Can't set to dual touch mode... Retrying.\n");
+
+      usleep(10000);
+      ++nb_try;
+    } while (nb_try < 3 && is_dualtouch(panel) != 1);
+
+  if (nb_try == 3)
+    return (-1);
+
+  return (0);
+}
+
+static int			find_endpoints(lumiod_panel_t* panel)
+{
+  struct libusb_config_descriptor*		config = NULL;
+  const struct libusb_interface_descriptor*	iface = NULL;
+  const struct libusb_endpoint_descriptor*	endpoint = NULL;
+  int						i = 0;
+
+  if (libusb_get_active_config_descriptor(panel->dev, &config) != 0)
+    return (-1);
+
+  iface = &config->interface[0].altsetting[0];
+  for (i = 0; i < iface->bNumEndpoints; ++i)
+    {
+      endpoint = &iface->endpoint[i];
+      if ((endpoint->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) !=
+	  LIBUSB_TRANSFER_TYPE_INTERRUPT)
+	continue;
+      if (endpoint->bEndpointAddress & LIBUSB_ENDPOINT_IN)
+	panel->in_endpoint = endpoint->bEndpointAddress;
+      else
+	panel->out_endpoint = endpoint->bEndpointAddress;
+    }
+  libusb_free_config_descriptor(config);
+
+  return (panel->in_endpoint ? 0 : -1);
+}
+
+/**
+ * @brief Creates the uinput multitouch device of a touchscreen.
+ */
+static int			create_uinput(lumiod_panel_t* panel)
+{
+  struct uinput_user_dev	dev;
+  int				fd = -1;
+  int				max = lumio_max_coordinate(panel->id->firmware);
+
+  if ((fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK)) < 0 &&
+      (fd = open("/dev/input/uinput", O_WRONLY | O_NONBLOCK)) < 0)
+    {
+      perror("lumiod: uinput");
+      return (-1);
+    }
+
+  ioctl(fd, UI_SET_EVBIT, EV_SYN);
+  ioctl(fd, UI_SET_EVBIT, EV_KEY);
+  ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH);
+  ioctl(fd, UI_SET_EVBIT, EV_ABS);
+  ioctl(fd, UI_SET_ABSBIT, ABS_X);
+  ioctl(fd, UI_SET_ABSBIT, ABS_Y);
+  ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_X);
+  ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y);
+  ioctl(fd, UI_SET_ABSBIT, ABS_MT_TRACKING_ID);
+
+  memset(&dev, 0x0, sizeof (dev));
+  snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "Lumio touchscreen");
+  dev.id.bustype = BUS_USB;
+  dev.id.vendor = panel->id->vid;
+  dev.id.product = panel->id->pid;
+  dev.absmax[ABS_X] = max;
+  dev.absmax[ABS_Y] = max;
+  dev.absmax[ABS_MT_POSITION_X] = max;
+  dev.absmax[ABS_MT_POSITION_Y] = max;
+  dev.absmax[ABS_MT_TRACKING_ID] = 0xffff;
+
+  if (write(fd, &dev, sizeof (dev)) != sizeof (dev) ||
+      ioctl(fd, UI_DEV_CREATE) < 0)
+    {
+      perror("lumiod: uinput");
+      close(fd);
+      return (-1);
+    }
+
+  panel->uinput = fd;
+  return (0);
+}
+
+static void			add_event(struct input_event*	events,
+					  int*			n,
+					  unsigned short	type,
+					  unsigned short	code,
+					  int			value)
+{
+  memset(&events[*n], 0x0, sizeof (struct input_event));
+  events[*n].type = type;
+  events[*n].code = code;
+  events[*n].value = value;
+  ++*n;
+}
+
+/**
+ * @brief Sends a decoded report to uinput.
+ *
+ *	The whole frame (every contact still down, followed by the single
+ * touch emulation) is written with a single write() call. Contacts are
+ * reported with the multitouch protocol A, a new tracking id being given to
+ * each contact going down.
+ */
+static void			emit_report(lumiod_panel_t*		panel,
+					    struct lumio_contact*	contacts,
+					    int				nb_contacts)
+{
+  struct input_event		events[8 * LUMIO_MAX_CONTACTS + 8];
+  struct lumio_contact*		state = NULL;
+  int				n = 0;
+  int				i = 0;
+  int				touching = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      state = &panel->contacts[contacts[i].tag];
+      if (contacts[i].down && !state->down)
+	panel->tracking_id[contacts[i].tag] = next_tracking_id++ & 0xffff;
+      *state = contacts[i];
+    }
+
+  for (i = 0; i < LUMIO_MAX_CONTACTS; ++i)
+    {
+      state = &panel->contacts[i];
+      if (!state->down)
+	continue;
+      add_event(events, &n, EV_ABS, ABS_MT_TRACKING_ID, panel->tracking_id[i]);
+      add_event(events, &n, EV_ABS, ABS_MT_POSITION_X, state->x);
+      add_event(events, &n, EV_ABS, ABS_MT_POSITION_Y, state->y);
+      add_event(events, &n, EV_SYN, SYN_MT_REPORT, 0);
+      ++touching;
+    }
+  if (!touching)
+    add_event(events, &n, EV_SYN, SYN_MT_REPORT, 0);
+
+  add_event(events, &n, EV_KEY, BTN_TOUCH, touching != 0);
+  add_event(events, &n, EV_ABS, ABS_X, contacts[0].x);
+  add_event(events, &n, EV_ABS, ABS_Y, contacts[0].y);
+  add_event(events, &n, EV_SYN, SYN_REPORT, 0);
+
+  if (write(panel->uinput, events, n * sizeof (struct input_event)) < 0)
+    perror("lumiod: uinput write");
+}
+
+/**
+ * @brief Starts recording a touchscreen.
+ *
+ *	The trace is named after the usb bus and address of the touchscreen and
+ * the time it was plugged. The touchscreen is driven all the same if the trace
+ * can't be written.
+ */
+static void			open_trace(lumiod_panel_t* panel)
+{
+  struct lumio_trace_info	info;
+  struct timeval		tv;
+  __u8				header[LUMIO_TRACE_HEADER_SIZE];
+  char				path[PATH_MAX];
+
+  gettimeofday(&tv, NULL);
+  memset(&info, 0x0, sizeof (info));
+  info.vid = panel->id->vid;
+  info.pid = panel->id->pid;
+  info.firmware = panel->id->firmware;
+  info.report_size = lumio_report_size(panel->id->firmware);
+  info.tick_us = LUMIO_TRACE_DEFAULT_TICK;
+  info.start_us = tv.tv_sec * 1000000ULL + tv.tv_usec;
+  snprintf(info.source, sizeof (info.source), "lumiod");
+  snprintf(path, sizeof (path), "%s/lumio-%d-%d-%ld.ltr", trace_dir,
+	   libusb_get_bus_number(panel->dev),
+	   libusb_get_device_address(panel->dev), (long) tv.tv_sec);
+
+  lumio_trace_put_header(header, &info);
+  if (!(panel->encoder = malloc(sizeof (*panel->encoder))) ||
+      !(panel->trace = fopen(path, "wb")) ||
+      fwrite(header, sizeof (header), 1, panel->trace) != 1)
+    {
+      perror(path);
+      if (panel->trace)
+	fclose(panel->trace);
+      panel->trace = NULL;
+      free(panel->encoder);
+      panel->encoder = NULL;
+      return;
+    }
+  lumio_trace_encoder_init(panel->encoder, &info);
+  panel->trace_start = now_us();
+  panel->trace_flushed = panel->trace_start;
+  printf("lumiod: recording to %s.\n", path);
+}
+
+/**
+ * @brief Writes the reports recorded since the last time.
+ */
+static void			flush_trace(lumiod_panel_t* panel)
+{
+  __u32				size = lumio_trace_seal(panel->encoder);
+
+  panel->trace_flushed = now_us();
+  if ((size && fwrite(panel->encoder->block, size, 1, panel->trace) != 1) ||
+      fflush(panel->trace) != 0)
+    {
+      perror("lumiod: trace");
+      fclose(panel->trace);
+      panel->trace = NULL;
+    }
+}
+
+static void			close_trace(lumiod_panel_t* panel)
+{
+  if (panel->trace)
+    {
+      flush_trace(panel);
+      if (panel->trace)
+	fclose(panel->trace);
+    }
+  panel->trace = NULL;
+  free(panel->encoder);
+  panel->encoder = NULL;
+}
+
+static void			record_report(lumiod_panel_t* panel, double time)
+{
+  __u64				time_us = time - panel->trace_start;
+
+  if (lumio_trace_encode(panel->encoder, panel->report, time_us) < 0)
+    {
+      flush_trace(panel);
+      if (panel->trace)
+	lumio_trace_encode(panel->encoder, panel->report, time_us);
+    }
+}
+
+/**
+ * @brief Handles a completed interrupt transfer.
+ *
+ *	Firmware 3.0 sends a whole report per transfer. Firmware 1.0 and 2.0
+ * send it in two 8 bytes halves which are reassembled the same way the kernel
+ * driver does with urb_in and urb_in2.
+ *
+ *	The latency is timed from the moment the callback runs: libusb doesn't
+ * tell when the transfer completed, the time it spent in the event loop before
+ * being handed to us isn't counted.
+ */
+static void			treat_transfer(lumiod_panel_t*		panel,
+					       struct libusb_transfer*	transfer)
+{
+  struct lumio_contact		contacts[LUMIO_MAX_CONTACTS];
+  int				nb_contacts = 0;
+  double			start = now_us();
+  double			latency = 0;
+
+  if (panel->id->firmware == LUMIO_FIRMWARE_3_0)
+    memcpy(panel->report, transfer->buffer, LUMIO_REPORT_SIZE);
+  else
+    {
+      memcpy(panel->report + panel->half * LUMIO_HALF_REPORT_SIZE,
+	     transfer->buffer, LUMIO_HALF_REPORT_SIZE);
+      panel->half = !panel->half;
+      if (panel->half)
+	return;
+    }
+
+  if (panel->trace)
+    record_report(panel, start);
+  nb_contacts = lumio_decode_report(panel->report, contacts);
+  emit_report(panel, contacts, nb_contacts);
+
+  latency = now_us() - start;
+  panel->latency_sum += latency;
+  if (latency > panel->latency_max)
+    panel->latency_max = latency;
+  ++panel->reports;
+}
+
+static int			submit(lumiod_panel_t* panel, int i)
+{
+  if (libusb_submit_transfer(panel->transfers[i]) != 0)
+    return (-1);
+
+  panel->busy[i] = 1;
+  ++panel->in_flight;
+  return (0);
+}
+
+/**
+ * @brief Completion callback of the interrupt transfers.
+ *
+ *	Transient errors are resubmitted right away, a stall or too many
+ * errors in a row get the endpoint cleared from the main loop, since
+ * libusb_clear_halt() can't be called from a callback.
+ */
+static void LIBUSB_CALL		lumiod_irq(struct libusb_transfer* transfer)
+{
+  lumiod_panel_t*		panel = transfer->user_data;
+  int				i = 0;
+
+  for (i = 0; panel->transfers[i] != transfer; ++i)
+    ;
+  panel->busy[i] = 0;
+  --panel->in_flight;
+
+  switch (transfer->status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+      panel->errors = 0;
+      treat_transfer(panel, transfer);
+      break;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      panel->gone = 1;
+      return;
+    case LIBUSB_TRANSFER_STALL:
+      ++panel->transfer_errors;
+      panel->recover = 1;
+      return;
+    default:
+      ++panel->transfer_errors;
+      panel->half = 0;
+      if (++panel->errors > LUMIOD_QUICK_RETRIES)
+	{
+	  panel->recover = 1;
+	  return;
+	}
+      break;
+    }
+
+  if (!panel->gone && !panel->recover && !stop && submit(panel, i) != 0)
+    panel->recover = 1;
+}
+
+static void			close_panel(lumiod_panel_t* panel)
+{
+  int				i = 0;
+
+  for (i = 0; i < pool_size; ++i)
+    if (panel->transfers[i])
+      libusb_free_transfer(panel->transfers[i]);
+  close_trace(panel);
+  if (panel->uinput >= 0)
+    {
+      ioctl(panel->uinput, UI_DEV_DESTROY);
+      close(panel->uinput);
+    }
+  if (panel->handle)
+    {
+      libusb_release_interface(panel->handle, 0);
+      libusb_close(panel->handle);
+    }
+  libusb_unref_device(panel->dev);
+  free(panel);
+}
+
+/**
+ * @brief Takes care of a newly plugged touchscreen.
+ *
+ *	Same as lumio_probe(): a touchscreen in mouse mode is switched to driver
+ * mode, after what it re-enumerates and comes back here with its driver mode
+ * product id. It is then switched to dualtouch configuration and the pool of
+ * interrupt transfers is queued.
+ */
+static void			attach(libusb_device* dev)
+{
+  lumiod_panel_t*		panel = NULL;
+  unsigned char			msg[LUMIO_REPORT_SIZE];
+  unsigned int			slot = 0;
+  int				i = 0;
+
+  for (slot = 0; slot < LUMIOD_MAX_PANELS && panels[slot]; ++slot)
+    ;
+  if (slot == LUMIOD_MAX_PANELS || !(panel = calloc(1, sizeof (*panel))))
+    {
+      libusb_unref_device(dev);
+      return;
+    }
+
+  panel->dev = dev;
+  panel->id = find_id(dev);
+  panel->uinput = -1;
+
+  if (libusb_open(dev, &panel->handle) != 0)
+    {
+      fprintf(stderr, "lumiod: unable to open touchscreen.\n");
+      panel->handle = NULL;
+      goto error;
+    }
+  libusb_set_auto_detach_kernel_driver(panel->handle, 1);
+  if (libusb_claim_interface(panel->handle, 0) != 0 ||
+      find_endpoints(panel) != 0)
+    {
+      fprintf(stderr, "lumiod: unable to claim touchscreen.\n");
+      goto error;
+    }
+
+  if (!panel->id->driver_mode)
+    {
+      printf("lumiod: Mouse mode, switching to driver mode.\n");
+      lumio_build_driver_mode_msg(msg);
+      if (send_msg(panel, HID_VAL_FEATURE, msg) < 0)
+	fprintf(stderr, "lumiod: Cannot switch to driver mode.\n");
+      goto error;
+    }
+
+  if (switch_to_dualtouch(panel) != 0)
+    {
+      fprintf(stderr, "lumiod: Unable to switch to dual touch mode.\n");
+      goto error;
+    }
+  if (create_uinput(panel) != 0)
+    goto error;
+  if (trace_dir)
+    open_trace(panel);
+
+  for (i = 0; i < pool_size; ++i)
+    {
+      if (!(panel->transfers[i] = libusb_alloc_transfer(0)))
+	goto error;
+      libusb_fill_interrupt_transfer(panel->transfers[i], panel->handle,
+				     panel->in_endpoint, panel->buffers[i],
+				     panel->id->firmware == LUMIO_FIRMWARE_3_0 ?
+				     LUMIO_REPORT_SIZE : LUMIO_HALF_REPORT_SIZE,
+				     lumiod_irq, panel, 0);
+      if (submit(panel, i) != 0)
+	goto error;
+    }
+
+  printf("lumiod: touchscreen %04x:%04x attached (firmware %d.0).\n",
+	 panel->id->vid, panel->id->pid, panel->id->firmware);
+  panels[slot] = panel;
+  return;
+
+ error:
+  for (i = 0; i < pool_size; ++i)
+    if (panel->busy[i])
+      libusb_cancel_transfer(panel->transfers[i]);
+  while (panel->in_flight > 0)
+    libusb_handle_events(NULL);
+  close_panel(panel);
+}
+
+/**
+ * @brief Hotplug callback.
+ *
+ *	Synchronous transfers can't be done from a hotplug callback, new
+ * touchscreens are only queued here and attached from the main loop.
+ */
+static int LIBUSB_CALL		lumiod_hotplug(libusb_context*		ctx,
+					       libusb_device*		dev,
+					       libusb_hotplug_event	event,
+					       void*			user_data)
+{
+  unsigned int			i = 0;
+
+  (void) ctx;
+  (void) user_data;
+
+  if (!find_id(dev))
+    return (0);
+
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+    {
+      if (nb_arrivals < LUMIOD_MAX_PANELS)
+	arrivals[nb_arrivals++] = libusb_ref_device(dev);
+    }
+  else
+    for (i = 0; i < LUMIOD_MAX_PANELS; ++i)
+      if (panels[i] && panels[i]->dev == dev)
+	panels[i]->gone = 1;
+
+  return (0);
+}
+
+/**
+ * @brief Deferred work of the main loop.
+ *
+ *	Clears the in endpoint of the touchscreens which asked for it, and
+ * releases the unplugged ones once all their transfers have come back.
+ */
+static void			process_panels(void)
+{
+  lumiod_panel_t*		panel = NULL;
+  unsigned int			i = 0;
+  int				j = 0;
+
+  for (i = 0; i < nb_arrivals; ++i)
+    attach(arrivals[i]);
+  nb_arrivals = 0;
+
+  for (i = 0; i < LUMIOD_MAX_PANELS; ++i)
+    {
+      if (!(panel = panels[i]))
+	continue;
+
+      if (panel->gone || stop)
+	{
+	  for (j = 0; j < pool_size; ++j)
+	    if (panel->busy[j])
+	      libusb_cancel_transfer(panel->transfers[j]);
+	  if (panel->in_flight == 0)
+	    {
+	      printf("lumiod: touchscreen %04x:%04x detached.\n",
+		     panel->id->vid, panel->id->pid);
+	      close_panel(panel);
+	      panels[i] = NULL;
+	    }
+	  continue;
+	}
+
+      if (panel->trace && now_us() - panel->trace_flushed >= 1e6)
+	flush_trace(panel);
+
+      if (panel->recover && panel->in_flight == 0)
+	{
+	  panel->recover = 0;
+	  panel->errors = 0;
+	  panel->half = 0;
+	  libusb_clear_halt(panel->handle, panel->in_endpoint);
+	  for (j = 0; j < pool_size; ++j)
+	    if (submit(panel, j) != 0)
+	      panel->recover = 1;
+	}
+      else if (panel->recover)
+	for (j = 0; j < pool_size; ++j)
+	  if (panel->busy[j])
+	    libusb_cancel_transfer(panel->transfers[j]);
+    }
+}
+
+static void			print_stats(double elapsed)
+{
+  lumiod_panel_t*		panel = NULL;
+  unsigned int			i = 0;
+
+  for (i = 0; i < LUMIOD_MAX_PANELS; ++i)
+    {
+      if (!(panel = panels[i]))
+	continue;
+      printf("lumiod: %04x:%04x %.1f reports/s, %lu errors, "
+	     "latency avg %.1fus max %.1fus\n",
+	     panel->id->vid, panel->id->pid, panel->reports / elapsed,
+	     panel->transfer_errors,
+	     panel->reports ? panel->latency_sum / panel->reports : 0.0,
+	     panel->latency_max);
+      panel->reports = 0;
+      panel->latency_sum = 0;
+      panel->latency_max = 0;
+    }
+  fflush(stdout);
+}
+
+static void			on_signal(int sig)
+{
+  (void) sig;
+  stop = 1;
+}
+
+static void			usage(void)
+{
+  fprintf(stderr,
+	  "usage: lumiod [-p pool_size] [-s stats_interval] [-w directory]\n"
+	  "  -p n  number of interrupt transfers queued per touchscreen (1-%d,"
+	  " default %d)\n"
+	  "  -s n  print reports/s and callback to uinput latency every n"
+	  " seconds\n"
+	  "  -w d  record the reports of each touchscreen in directory d, see "
+	  "lumio_trace\n",
+	  LUMIOD_MAX_POOL_SIZE, LUMIOD_POOL_SIZE);
+}
+
+int				main(int argc, char** argv)
+{
+  libusb_device**		list = NULL;
+  struct timeval		tv;
+  double			last_stats = 0;
+  int				stats_interval = 0;
+  int				opt = 0;
+  int				i = 0;
+  int				remaining = 0;
+
+  while ((opt = getopt(argc, argv, "p:s:w:h")) != -1)
+    switch (opt)
+      {
+      case 'p':
+	pool_size = atoi(optarg);
+	break;
+      case 's':
+	stats_interval = atoi(optarg);
+	break;
+      case 'w':
+	trace_dir = optarg;
+	break;
+      default:
+	usage();
+	return (1);
+      }
+  if (pool_size < 1 || pool_size > LUMIOD_MAX_POOL_SIZE)
+    {
+      usage();
+      return (1);
+    }
+
+  if (libusb_init(NULL) != 0)
+    {
+      fprintf(stderr, "lumiod: unable to initialize libusb.\n");
+      return (1);
+    }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+    libusb_hotplug_register_callback(NULL,
+				     LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+				     LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+				     LIBUSB_HOTPLUG_ENUMERATE,
+				     LIBUSB_HOTPLUG_MATCH_ANY,
+				     LIBUSB_HOTPLUG_MATCH_ANY,
+				     LIBUSB_HOTPLUG_MATCH_ANY,
+				     lumiod_hotplug, NULL, NULL);
+  else
+    {
+      fprintf(stderr, "lumiod: no hotplug support, "
+	      "only touchscreens already plugged are handled.\n");
+      if (libusb_get_device_list(NULL, &list) >= 0)
+	{
+	  for (i = 0; list[i]; ++i)
+	    if (find_id(list[i]) && nb_arrivals < LUMIOD_MAX_PANELS)
+	      arrivals[nb_arrivals++] = libusb_ref_device(list[i]);
+	  libusb_free_device_list(list, 1);
+	}
+    }
+
+  last_stats = now_us();
+  do
+    {
+      tv.tv_sec = 0;
+      tv.tv_usec = 100000;
+      libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+      process_panels();
+
+      if (stats_interval > 0 && now_us() - last_stats >= stats_interval * 1e6)
+	{
+	  print_stats((now_us() - last_stats) / 1e6);
+	  last_stats = now_us();
+	}
+
+      remaining = 0;
+      for (i = 0; i < LUMIOD_MAX_PANELS; ++i)
+	remaining += panels[i] != NULL;
+    } while (!stop || remaining > 0);
+
+  libusb_exit(NULL);
+
+  return (0);
+}
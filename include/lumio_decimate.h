@@ -0,0 +1,210 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_decimate.h
+ * @author Quentin Casasnovas
+ * @brief Stroke decimation.
+ *
+ *	Ink and whiteboard applications store every position they are sent,
+ * and most of them lie on a straight line between their neighbours. The
+ * decimation, enabled with IOCTL_SET_DECIMATION (see lumio_driver.h), only
+ * reports the positions needed to draw the stroke within tolerance units.
+ *
+ *	It is an opening window, the incremental form of Douglas-Peucker: the
+ * last position reported is the anchor, and the positions received since
+ * are held back as long as every one of them lies within tolerance of the
+ * segment from the anchor to the latest. When a new position breaks that,
+ * the one before it is reported and becomes the anchor. A position is also
+ * reported when the stroke turns back by more than a right angle, however
+ * small the turn, so are the positions a contact comes down, stops and is
+ * lifted at.
+ * No more than LUMIO_DECIMATE_WINDOW positions are held back at once, which
+ * bounds both the work per report and how late a position is reported.
+ *
+ *	Everything is computed with integers, the driver runs it from the urb
+ * completion handler. This file is shared by the driver and the userland
+ * tools, so that the tolerance can be tuned on recorded traces.
+ */
+
+#ifndef LUMIO_DECIMATE_H_
+# define LUMIO_DECIMATE_H_
+
+# include <linux/types.h>
+
+# include "lumio_protocol.h"
+# include "lumio_driver.h"
+
+/** @brief Most positions held back. */
+# define LUMIO_DECIMATE_WINDOW	16
+
+/**
+ * @brief The stroke of a contact.
+ */
+struct			lumio_decimate_state
+{
+  __u16			ax; /**< The anchor, the last position reported. */
+  __u16			ay;
+  __u16			x[LUMIO_DECIMATE_WINDOW]; /**< Positions held back. */
+  __u16			y[LUMIO_DECIMATE_WINDOW];
+  __u8			nb; /**< Number of positions held back. */
+  __u8			down; /**< The contact is down. */
+};
+
+static inline int	lumio_decimate_enabled(const struct lumio_decimation* config)
+{
+  return (config->tolerance != 0);
+}
+
+static inline void	lumio_decimate_reset(struct lumio_decimate_state* s)
+{
+  s->nb = 0;
+  s->down = 0;
+}
+
+/**
+ * @brief Tells whether a position lies within tolerance of a segment.
+ *
+ *	Squared distances, in 64 bits: a coordinate takes 12 bits.
+ */
+static inline int	lumio_decimate_near(__s32 ax, __s32 ay, __s32 bx, __s32 by,
+					    __s32 px, __s32 py, __u32 tolerance)
+{
+  __s64			vx = bx - ax;
+  __s64			vy = by - ay;
+  __s64			wx = px - ax;
+  __s64			wy = py - ay;
+  __s64			len2 = vx * vx + vy * vy;
+  __s64			dot = wx * vx + wy * vy;
+  __s64			cross = wx * vy - wy * vx;
+  __s64			tol2 = (__s64) tolerance * tolerance;
+
+  if (dot <= 0 || len2 == 0)
+    return (wx * wx + wy * wy <= tol2);
+  if (dot >= len2)
+    return ((px - bx) * (__s64) (px - bx) + (py - by) * (__s64) (py - by) <=
+	    tol2);
+
+  return (cross * cross <= tol2 * len2);
+}
+
+/**
+ * @brief Tells whether the positions held back can be left out, should the
+ * stroke go on to x, y.
+ */
+static inline int	lumio_decimate_fits(const struct lumio_decimate_state*	s,
+					    __u32					x,
+					    __u32					y,
+					    __u32					tolerance)
+{
+  __s64			dx = 0;
+  __s64			dy = 0;
+  __s64			px = 0;
+  __s64			py = 0;
+  __u32			i = 0;
+
+  if (s->nb == LUMIO_DECIMATE_WINDOW)
+    return (0);
+
+  /* Turning back, once the stroke has gone further than the tolerance */
+  if (s->nb)
+    {
+      px = s->x[s->nb - 1];
+      py = s->y[s->nb - 1];
+      dx = px - s->ax;
+      dy = py - s->ay;
+      if (dx * dx + dy * dy > (__s64) tolerance * tolerance &&
+	  dx * ((__s64) x - px) + dy * ((__s64) y - py) < 0)
+	return (0);
+    }
+
+  for (i = 0; i < s->nb; ++i)
+    if (!lumio_decimate_near(s->ax, s->ay, x, y, s->x[i], s->y[i], tolerance))
+      return (0);
+
+  return (1);
+}
+
+/**
+ * @brief Decides which positions of a contact are reported.
+ *
+ * @param config The tolerance, see IOCTL_SET_DECIMATION.
+ * @param s The stroke of the contact.
+ * @param contact The contact, as decoded.
+ * @param out Filled with the contacts to report, in order: up to 2.
+ * @return The number of contacts to report, 0 if the position is held back.
+ */
+static inline int	lumio_decimate(const struct lumio_decimation*	config,
+				       struct lumio_decimate_state*	s,
+				       const struct lumio_contact*	contact,
+				       struct lumio_contact*		out)
+{
+  int			n = 0;
+
+  if (!contact->down)
+    {
+      /* The end of the stroke, then the lift */
+      if (s->down && s->nb &&
+	  (s->x[s->nb - 1] != contact->x || s->y[s->nb - 1] != contact->y))
+	{
+	  out[n] = *contact;
+	  out[n].x = s->x[s->nb - 1];
+	  out[n].y = s->y[s->nb - 1];
+	  out[n++].down = 1;
+	}
+      out[n++] = *contact;
+      lumio_decimate_reset(s);
+      return (n);
+    }
+
+  if (!s->down)
+    {
+      s->down = 1;
+      s->nb = 0;
+      s->ax = contact->x;
+      s->ay = contact->y;
+      out[0] = *contact;
+      return (1);
+    }
+
+  /* Not moving: the position held back, if any, is reported right away */
+  if (s->nb && s->x[s->nb - 1] == contact->x && s->y[s->nb - 1] == contact->y)
+    {
+      out[0] = *contact;
+      s->ax = contact->x;
+      s->ay = contact->y;
+      s->nb = 0;
+      return (1);
+    }
+  if (!s->nb && s->ax == contact->x && s->ay == contact->y)
+    return (0);
+
+  if (!lumio_decimate_fits(s, contact->x, contact->y, config->tolerance))
+    {
+      out[0] = *contact;
+      out[0].x = s->ax = s->x[s->nb - 1];
+      out[0].y = s->ay = s->y[s->nb - 1];
+      s->nb = 0;
+      n = 1;
+    }
+  s->x[s->nb] = contact->x;
+  s->y[s->nb++] = contact->y;
+
+  return (n);
+}
+
+#endif /* !LUMIO_DECIMATE_H_ */
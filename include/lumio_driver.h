@@ -28,10 +28,320 @@
 #ifndef LUMIO_DRIVER_H_
 # define LUMIO_DRIVER_H_
 
+# include <linux/types.h>
+# include <linux/filter.h>
+
 # define IOCTL_SET_DELAY_CLIC	0x01
 # define IOCTL_SET_SINGLETOUCH	0x02
 # define IOCTL_SET_DUALTOUCH	0x03
 # define IOCTL_SET_SOUND_ON	0x04
 # define IOCTL_SET_SOUND_OFF	0x05
+# define IOCTL_GET_STATS	0x06
+# define IOCTL_SET_FILTER	0x07
+# define IOCTL_REPLAY_SETUP	0x08
+# define IOCTL_REPLAY_BATCH	0x09
+# define IOCTL_SET_PREDICTION	0x0A
+# define IOCTL_SET_REJECTION	0x0B
+# define IOCTL_SET_REGIONS	0x0C
+# define IOCTL_SET_DECIMATION	0x0D
+# define IOCTL_SET_CONFIG	0x0E
+
+/** @brief Filter run on each raw report, before decoding it. */
+# define LUMIO_HOOK_REPORT	0
+/** @brief Filter run on each decoded contact. */
+# define LUMIO_HOOK_CONTACT	1
+# define LUMIO_NB_HOOKS		2
+
+/**
+ * @brief Driver counters, filled by IOCTL_GET_STATS.
+ *
+ *	The argument of IOCTL_GET_STATS is a pointer to this structure. All
+ * counters start at 0 when the touchscreen is plugged and are never reset.
+ */
+struct			lumio_stats
+{
+  __u32			reports; /**< Reports decoded and sent to the input layer. */
+  __u32			urb_errors; /**< Interrupt urbs completed with an error. */
+  __u32			transient_errors; /**< -EPROTO, -EILSEQ, -EOVERFLOW, ... */
+  __u32			stalls; /**< Interrupt urbs completed with -EPIPE. */
+  __u32			submit_errors; /**< usb_submit_urb() failures. */
+  __u32			clear_halts; /**< usb_clear_halt() calls on the in endpoint. */
+  __u32			resets; /**< usb_reset_device() calls. */
+  __u32			recoveries; /**< Times the report stream came back. */
+  __u32			last_recovery_us; /**< Duration of the last outage. */
+  __u32			max_recovery_us; /**< Longest outage so far. */
+  __u32			filtered_reports; /**< Reports dropped by the report filter. */
+  __u32			filtered_contacts; /**< Contacts dropped by the contact filter. */
+  __u32			total_recovery_us; /**< Sum of the outages. */
+  __u32			lost_reports; /**< Reports the outages cost, estimated. */
+  __u32			faults_injected; /**< Faults injected on purpose. */
+  __u32			rejected_edge; /**< Contacts dropped in the edge dead-zone. */
+  __u32			rejected_jump; /**< Positions dropped for jumping too far. */
+  __u32			rejected_blips; /**< Contacts lifted too soon to be reported. */
+  __u32			decimated; /**< Positions left out by the decimation. */
+  __u32			mode_switches; /**< Switches to the dualtouch configuration. */
+  __u32			last_mode_switch_us; /**< Duration of the last one. */
+  __u32			max_mode_switch_us; /**< Longest one so far. */
+};
+
+/**
+ * @brief A filter, the argument of IOCTL_SET_FILTER.
+ *
+ *	See lumio_filter.h for what filters can do. A len of 0 removes the
+ * filter of the hook. Loading filters needs CAP_SYS_ADMIN. The pointer is
+ * passed as a __u64, so that the struct is the same for 32 bits programs on a
+ * 64 bits kernel.
+ */
+struct			lumio_filter_prog
+{
+  __u32			hook; /**< LUMIO_HOOK_REPORT or LUMIO_HOOK_CONTACT. */
+  __u32			len; /**< Number of instructions. */
+  __u64			filter; /**< The instructions, a struct sock_filter* cast to __u64. */
+};
+
+/** @brief Longest lookahead of the prediction, in ms. */
+# define LUMIO_PREDICT_MAX_LOOKAHEAD	50
+
+/**
+ * @brief Motion prediction, the argument of IOCTL_SET_PREDICTION.
+ *
+ *	The fake mice then report on ABS_X and ABS_Y where each contact should be
+ * lookahead_ms from now, see lumio_predict.h, and its raw position on ABS_RX
+ * and ABS_RY. A lookahead of 0 disables the prediction.
+ */
+struct			lumio_prediction
+{
+  __u32			lookahead_ms; /**< Up to LUMIO_PREDICT_MAX_LOOKAHEAD. */
+  __u32			max_distance; /**< Bound of the extrapolation, in controller units. */
+};
+
+/**
+ * @brief Rejection of spurious contacts, the argument of IOCTL_SET_REJECTION.
+ *
+ *	See lumio_reject.h. Distances are in controller units, and 0 disables
+ * the corresponding check. Contacts dropped are counted in the rejected_*
+ * fields of struct lumio_stats.
+ */
+struct			lumio_rejection
+{
+  __u32			edge; /**< Width of the dead-zone along the borders. */
+  __u32			max_jump; /**< Longest move between two reports, on each axis. */
+  __u32			min_reports; /**< Reports a contact lasts before being reported. */
+};
+
+/** @brief Longest wait for a contact to be reported, in reports. */
+# define LUMIO_REJECT_MAX_REPORTS	32
+
+/** @brief Largest tolerance of the decimation, in controller units. */
+# define LUMIO_DECIMATE_MAX_TOLERANCE	256
+
+/**
+ * @brief Stroke decimation, the argument of IOCTL_SET_DECIMATION.
+ *
+ *	The fake mice then only report the positions needed to draw each stroke
+ * within tolerance units, see lumio_decimate.h; the prediction doesn't apply
+ * meanwhile. A tolerance of 0 disables the decimation.
+ */
+struct			lumio_decimation
+{
+  __u32			tolerance; /**< Up to LUMIO_DECIMATE_MAX_TOLERANCE. */
+};
+
+/** @brief "LCFG", the first bytes of a struct lumio_config. */
+# define LUMIO_CONFIG_MAGIC		0x4746434c
+# define LUMIO_CONFIG_VERSION		1
+
+/**
+ * @brief The whole report pipeline, the argument of IOCTL_SET_CONFIG.
+ *
+ *	Sets the rejection, the prediction and the decimation at once, as
+ * IOCTL_SET_REJECTION, IOCTL_SET_PREDICTION and IOCTL_SET_DECIMATION would,
+ * but none of them if one is out of bounds. lumio_tune writes it to a file as
+ * is, lumio_config loads such files.
+ */
+struct			lumio_config
+{
+  __u32			magic; /**< LUMIO_CONFIG_MAGIC. */
+  __u32			version; /**< LUMIO_CONFIG_VERSION. */
+  struct lumio_rejection	rejection;
+  struct lumio_prediction	prediction;
+  struct lumio_decimation	decimation;
+};
+
+/** @brief Most hot regions of a touchscreen. */
+# define LUMIO_MAX_REGIONS		64
+/** @brief Keys of the regions are below, keyboard keys only (KEY_ESC...). */
+# define LUMIO_REGION_MAX_KEY		0x100
+/** @brief The key is pressed when the contact comes down, released when lifted. */
+# define LUMIO_REGION_PRESS		0
+/** @brief The key is pressed and released when the contact is lifted in the region. */
+# define LUMIO_REGION_CLICK		1
+/** @brief Contacts are no longer reported, only the keys of the regions. */
+# define LUMIO_REGIONS_ONLY		(1 << 0)
+
+/**
+ * @brief A hot region, in controller coordinates.
+ */
+struct			lumio_region
+{
+  __u16			x;
+  __u16			y;
+  __u16			width;
+  __u16			height;
+  __u16			key; /**< KEY_* code sent, below LUMIO_REGION_MAX_KEY. */
+  __u16			mode; /**< LUMIO_REGION_PRESS or LUMIO_REGION_CLICK. */
+};
+
+/**
+ * @brief Hot regions, the argument of IOCTL_SET_REGIONS.
+ *
+ *	The touchscreen gets a "Lumio keys" input device, which sends the key of
+ * the region a contact comes down in (see lumio_regions.h). Regions may
+ * overlap, the first one given wins. With LUMIO_REGIONS_ONLY, nothing else is
+ * reported: a button-only UI isn't woken up by the moves of the fingers. No
+ * region removes the regions. Needs CAP_SYS_ADMIN. As for IOCTL_SET_FILTER, the
+ * pointer is passed as a __u64.
+ */
+struct			lumio_regions
+{
+  __u32			nb_regions; /**< Up to LUMIO_MAX_REGIONS. */
+  __u32			flags; /**< LUMIO_REGIONS_* flags. */
+  __u64			regions; /**< A const struct lumio_region* cast to __u64. */
+};
+
+/** @brief Maximum number of reports in a replay batch. */
+# define LUMIO_REPLAY_MAX_BATCH		65536
+/** @brief Number of buckets of the replay cost histogram. */
+# define LUMIO_REPLAY_HIST_BUCKETS	32
+/** @brief Inject the reports every interval_us instead of back to back. */
+# define LUMIO_REPLAY_PACED		(1 << 0)
+
+/**
+ * @brief A batch of reports, the argument of IOCTL_REPLAY_BATCH.
+ *
+ *	The replay device (/dev/lumio_replay) is a virtual touchscreen: once
+ * IOCTL_REPLAY_SETUP has told it which firmware it emulates (one of the
+ * LUMIO_FIRMWARE_* constants), it registers the same input devices as a real
+ * one, and the reports of each batch go through exactly the same path as the
+ * ones received from the controller. Each report is LUMIO_REPORT_SIZE bytes
+ * long, in the in_buffer layout. The replay device also accepts
+ * IOCTL_GET_STATS and IOCTL_SET_FILTER, and needs CAP_SYS_ADMIN. As for
+ * IOCTL_SET_FILTER, the pointer is passed as a __u64.
+ *
+ *	Reports are injected back to back, or every interval_us with
+ * LUMIO_REPLAY_PACED. The cost of each report is measured from the moment it
+ * is handed to the driver to the moment the input layer is done with it.
+ */
+struct			lumio_replay_batch
+{
+  __u32			nb_reports; /**< In: number of reports. */
+  __u32			flags; /**< In: LUMIO_REPLAY_* flags. */
+  __u32			interval_us; /**< In: interval of paced reports. */
+  __u32			injected; /**< Out: reports injected, less if interrupted. */
+  __u64			reports; /**< In: the reports, a const __u8* cast to __u64. */
+  __u64			elapsed_ns; /**< Out: duration of the batch. */
+  __u64			busy_ns; /**< Out: sum of the cost of the reports. */
+  __u32			min_ns; /**< Out: cheapest report. */
+  __u32			max_ns; /**< Out: most expensive report. */
+  /** Out: bucket i counts the reports which cost 2^i to 2^(i+1) ns. */
+  __u32			histogram[LUMIO_REPLAY_HIST_BUCKETS];
+};
+
+/*
+ * Cooked frames.
+ *
+ *	Reading the lumio%d char device gives the contacts of each report, once
+ * decoded, filtered and rejected (see IOCTL_SET_FILTER and
+ * IOCTL_SET_REJECTION), as struct lumio_cooked_frame: the two contacts of a
+ * report come together instead of on two fake mice. The positions are the
+ * ones of the controller, neither predicted nor decimated, and the regions,
+ * the wall and the partitions don't change them.
+ *
+ *	Each report gives a frame, even with no contact left, but the reports the
+ * report filter drops. A contact is lifted by the only frame where it comes
+ * without LUMIO_COOKED_DOWN, sent even when the filters drop that lift, and
+ * the next contact of its tag gets a new tracking id. A tag missing from a
+ * frame hasn't moved.
+ *
+ *	read() returns as many whole frames as fit in the buffer, and fails with
+ * EINVAL if not even one fits. It blocks until a frame comes unless the device
+ * is opened O_NONBLOCK, and supports poll()/epoll. The report stream starts
+ * with the first read() or poll() of an open, as it does when a fake mouse is
+ * opened. Each open queues up to LUMIO_COOKED_QUEUE frames: a reader that
+ * falls behind loses the oldest ones, counted in the overruns of the next
+ * frame it reads. Once the touchscreen is unplugged, the frames left are
+ * read, then read() fails with ENODEV and poll() returns POLLHUP.
+ */
+
+/** @brief Frames queued for each open of lumio%d, a power of 2. */
+# define LUMIO_COOKED_QUEUE		128
+/** @brief Most contacts in a frame. */
+# define LUMIO_COOKED_MAX_CONTACTS	2
+/** @brief The contact touches the screen, it is lifted in the frame without it. */
+# define LUMIO_COOKED_DOWN		(1 << 0)
+
+/**
+ * @brief A contact of a cooked frame.
+ */
+struct			lumio_cooked_contact
+{
+  __u16			id; /**< Tracking id, the same from down to lift. */
+  __u16			x; /**< In controller coordinates. */
+  __u16			y;
+  __u8			tag; /**< Which finger the controller thinks it is (0/1). */
+  __u8			state; /**< LUMIO_COOKED_* flags. */
+};
+
+/**
+ * @brief The contacts of a report, read from the lumio%d char device.
+ */
+struct			lumio_cooked_frame
+{
+  __u64			time_us; /**< When the report was treated, monotonic clock. */
+  __u32			sequence; /**< Frames of the touchscreen before this one. */
+  __u32			overruns; /**< Frames this open lost right before this one. */
+  __u8			nb_contacts; /**< Up to LUMIO_COOKED_MAX_CONTACTS. */
+  __u8			reserved[7];
+  struct lumio_cooked_contact	contacts[LUMIO_COOKED_MAX_CONTACTS];
+};
+
+/*
+ * Telemetry.
+ *
+ *	Every telemetry_ms milliseconds (a module parameter, 1000 by default, 0
+ * to stop), each touchscreen multicasts a LUMIO_TELEMETRY_CMD_STATS message
+ * to the LUMIO_TELEMETRY_GROUP group of the LUMIO_TELEMETRY_FAMILY generic
+ * netlink family, as long as someone subscribed to it. The rates and counts
+ * are over the last interval, LUMIO_TELEMETRY_A_INTERVAL_MS long.
+ */
+
+# define LUMIO_TELEMETRY_FAMILY		"lumio"
+# define LUMIO_TELEMETRY_VERSION	1
+# define LUMIO_TELEMETRY_GROUP		"telemetry"
+
+/** @brief The only command, sent by the driver. */
+# define LUMIO_TELEMETRY_CMD_STATS	1
+
+/** @brief Usb bus path of the touchscreen, or replayN, a string. */
+# define LUMIO_TELEMETRY_A_BUS_PATH	1
+/** @brief LUMIO_FIRMWARE_* of the controller, a u8. */
+# define LUMIO_TELEMETRY_A_FIRMWARE	2
+/** @brief Time covered by the message, a u32. */
+# define LUMIO_TELEMETRY_A_INTERVAL_MS	3
+/** @brief Reports received per second, a u32. */
+# define LUMIO_TELEMETRY_A_REPORTS_PER_SEC	4
+/** @brief Reports lost to outages, estimated, or dropped by the report filter, a u32. */
+# define LUMIO_TELEMETRY_A_DROPS	5
+/** @brief Interrupt urbs completed with an error, a u32. */
+# define LUMIO_TELEMETRY_A_URB_ERRORS	6
+/** @brief Times the report stream came back, a u32. */
+# define LUMIO_TELEMETRY_A_RECOVERIES	7
+/** @brief Duration of the last switch to the dualtouch configuration, a u32. */
+# define LUMIO_TELEMETRY_A_MODE_SWITCH_US	8
+/** @brief Contacts down, a u8. */
+# define LUMIO_TELEMETRY_A_CONTACTS	9
+/** @brief The struct lumio_stats counters, since the touchscreen was plugged. */
+# define LUMIO_TELEMETRY_A_STATS	10
+# define LUMIO_TELEMETRY_A_MAX		LUMIO_TELEMETRY_A_STATS
 
 #endif /* !LUMIO_DRIVER_H_ */
@@ -31,10 +31,24 @@
 # include <asm/uaccess.h>
 
 # include <linux/usb/input.h>
+# include <linux/workqueue.h>
 # include <linux/smp_lock.h>
 # include <linux/kthread.h>
+# include <linux/rcupdate.h>
+# include <linux/capability.h>
+# include <linux/spinlock.h>
+# include <linux/jiffies.h>
+# include <linux/ktime.h>
+# include <linux/mutex.h>
 # include <linux/kernel.h>
 # include <linux/module.h>
+# include <linux/miscdevice.h>
+# include <linux/hrtimer.h>
+# include <linux/timer.h>
+# include <linux/delay.h>
+# include <linux/fault-inject.h>
+# include <linux/poll.h>
+# include <linux/list.h>
 # include <linux/input.h>
 # include <linux/errno.h>
 # include <linux/sched.h>
@@ -43,37 +57,22 @@
 # include <linux/usb.h>
 # include <linux/fs.h>
 
+# include <net/genetlink.h>
+
+# include "lumio_protocol.h"
 # include "lumio_driver.h"
+# include "lumio_filter.h"
+# include "lumio_listeners.h"
+# include "lumio_predict.h"
+# include "lumio_reject.h"
+# include "lumio_decimate.h"
+# include "lumio_regions.h"
 
 /*
  * defines
  */
 
 
-/** @brief The USB Vendor ID of the device when in mouse mode. */
-# define USB_VID_MM		0x0556
-/** @brief The USB Vendor ID of the device when in driver mode. */
-# define USB_VID_DM		0x0592
-/** @brief The USB Product ID of the device when in mouse mode. */
-# define USB_PID_MM		0x3556
-/** @brief The USB Product ID of the device when in driver mode. */
-# define USB_PID_DM		0x6956
-/** @brief The USB Vendor ID of Lumio (since firmware 2.0) */
-# define USB_VID_LUMIO		0x202E
-/** @brief The USB PID of the device when in driver mode (firmware 2.0). */
-# define USB_PID_DM_2_0			0x0001
-/** @brief The USB PID of the device when in mouse mode (firmware 2.0). */
-# define USB_PID_MM_2_0			0x0002
-/** @brief The USB PID of the device when in dualcontrol mode (firmware 2.0). */
-# define USB_PID_DUAL_CONTROL_2_0	0x0003
-/** @brief The USB PID of the device when in digitizer mode (firmware 2.0). */
-# define USB_PID_DIGITIZER_2_0		0x0004
-/** @brief The USB PID of the device when in dual mode mode (firmware 3.0). */
-# define USB_PID_DUAL_MODE_3_0		0x0005
-/** @brief The USB PID of the device when in 4 sensors mode mode (firmware 3.0). */
-# define USB_PID_4_SENSORS_3_0		0x0006
-
-
 /** @brief The touch screen is in mouse mode. */
 # define USB_MOUSE_MODE		(1 << 0)
 /** @brief The touch screen is in driver mode. */
@@ -85,29 +84,37 @@
 # define USB_SINGLETOUCH_CONFIG	(1 << 1)
 
 
-# define HID_REQ_GET_REPORT	0x01
-# define HID_REQ_SET_REPORT	0x09
-# define HID_VAL_INPUT		0x0100
-# define HID_VAL_OUTPUT		0x0200
-# define HID_VAL_FEATURE	0x0300
-
-# define LUMIO_OPERATION_MASK	0x3
-# define LUMIO_OPERATION_MOVE	(0 << 0)
-# define LUMIO_OPERATION_DOWN	(1 << 0)
-# define LUMIO_OPERATION_UP	(1 << 1)
-
-# define LUMIO_TAGID_MASK	0xc
-# define LUMIO_TAGID_EVENT_ID1	(1 << 2)
-# define LUMIO_TAGID_EVENT_ID2	(1 << 3)
-
-# define LUMIO_FIRMWARE_1_0	0x01
-# define LUMIO_FIRMWARE_2_0	0x02
-# define LUMIO_FIRMWARE_3_0	0x03
-
-
 # define LUMIO_SINGLE_EVENT	0
 # define LUMIO_DUAL_EVENT	1
 
+/** @brief Resubmit the interrupt in urb chain. */
+# define LUMIO_RECOVER_RESUBMIT		0
+/** @brief Clear a halted interrupt in endpoint before resubmitting. */
+# define LUMIO_RECOVER_CLEAR_HALT	1
+/** @brief Reset the device and re-apply driver/dualtouch mode. */
+# define LUMIO_RECOVER_RESET		2
+
+/** @brief Transient errors resubmitted straight from the completion handler. */
+# define LUMIO_QUICK_RETRIES		3
+/** @brief Failed recovery attempts before escalating to a device reset. */
+# define LUMIO_RESET_THRESHOLD		6
+/** @brief Upper bound of the recovery backoff, in milliseconds. */
+# define LUMIO_RECOVERY_MAX_DELAY	1000
+
+/** @brief Timeout of the control messages, in milliseconds. */
+# define LUMIO_CTRL_TIMEOUT		1000
+
+/** @brief Maximum number of panels in the video wall. */
+# define LUMIO_WALL_MAX_PANELS		16
+/** @brief Maximum number of contacts reported by the video wall. */
+# define LUMIO_WALL_MAX_CONTACTS	(LUMIO_WALL_MAX_PANELS * LUMIO_MAX_CONTACTS)
+/** @brief Maximum number of partitions of a touchscreen. */
+# define LUMIO_MAX_PARTITIONS		4
+/** @brief Number of replayed reports copied from userland at once. */
+# define LUMIO_REPLAY_CHUNK		64
+/** @brief Maximum length of a usb bus path (e.g. 2-1.4.3). */
+# define LUMIO_BUS_PATH_SIZE		32
+
 /*
  * macros
  */
@@ -180,8 +187,9 @@
   do									\
     {									\
       (Inputdev)->name = (Name);					\
+      (Inputdev)->phys = (Data)->name;					\
       input_set_drvdata((Inputdev), (Data));				\
-      usb_to_input_id((Data)->udev, &(Inputdev)->id);			\
+      lumio_input_id((Data), (Inputdev));				\
       set_bit(EV_KEY, (Inputdev)->evbit);				\
       set_bit(BTN_LEFT, (Inputdev)->keybit);				\
       set_bit(EV_ABS, (Inputdev)->evbit);				\
@@ -189,12 +197,16 @@
 	{								\
 	  input_set_abs_params((Inputdev), ABS_X, 0, 2047, 0, 0);	\
 	  input_set_abs_params((Inputdev), ABS_Y, 0, 2047, 0, 0);	\
+	  input_set_abs_params((Inputdev), ABS_RX, 0, 2047, 0, 0);	\
+	  input_set_abs_params((Inputdev), ABS_RY, 0, 2047, 0, 0);	\
 	}								\
       else if (data->firmware_version == LUMIO_FIRMWARE_2_0 ||		\
 	       data->firmware_version == LUMIO_FIRMWARE_3_0)		\
 	{								\
 	  input_set_abs_params((Inputdev), ABS_X, 0, 4095, 0, 0);	\
 	  input_set_abs_params((Inputdev), ABS_Y, 0, 4095, 0, 0);	\
+	  input_set_abs_params((Inputdev), ABS_RX, 0, 4095, 0, 0);	\
+	  input_set_abs_params((Inputdev), ABS_RY, 0, 4095, 0, 0);	\
 	}								\
       (Inputdev)->open = lumio_fake_open;				\
       (Inputdev)->close = lumio_fake_close;				\
@@ -252,31 +264,192 @@ typedef struct			usb_fakemouse
   __u16				last_y;
 }				usb_fakemouse_t;
 
+struct usb_touchscreen;
+
+/**
+ * @brief A filter loaded with IOCTL_SET_FILTER.
+ */
+typedef struct			lumio_filter
+{
+  unsigned int			len;
+  struct sock_filter		insns[0];
+}				lumio_filter_t;
+
+/**
+ * @brief A partition of the touchscreen, in controller coordinates.
+ */
+typedef struct			lumio_partition
+{
+  __u32				x;
+  __u32				y;
+  __u32				width;
+  __u32				height;
+}				lumio_partition_t;
+
+/**
+ * @brief A panel of the video wall.
+ *
+ *	Panels are described by the wall module parameter, and get bound to a
+ * touchscreen when the one plugged at their bus path is probed.
+ */
+typedef struct			lumio_wall_panel
+{
+  char				bus_path[LUMIO_BUS_PATH_SIZE]; /**< Where the panel is plugged. */
+  __u32				x; /**< Left of the panel on the wall. */
+  __u32				y; /**< Top of the panel on the wall. */
+  __u32				width;
+  __u32				height;
+  struct usb_touchscreen*	data; /**< The touchscreen, NULL while unplugged. */
+  int				slot[LUMIO_MAX_CONTACTS]; /**< Wall contact of each tag, -1 if none. */
+}				lumio_wall_panel_t;
+
+/**
+ * @brief A contact on the video wall.
+ */
+typedef struct			lumio_wall_contact
+{
+  __u32				x; /**< Position on the wall. */
+  __u32				y;
+  int				tracking_id;
+  __u8				active; /**< The contact is reported. */
+  __u8				lifted; /**< Lifted near a seam, may be handed off. */
+  unsigned long			deadline; /**< End of the hand-off window (jiffies). */
+  struct lumio_wall_panel*	panel; /**< Panel the contact was last seen on. */
+}				lumio_wall_contact_t;
+
+/**
+ * @brief The video wall.
+ *
+ *	All panels of the wall report their contacts to a single multitouch
+ * input device, in the wall coordinates.
+ */
+typedef struct			lumio_wall
+{
+  struct mutex			lock; /**< Protects the device lifetime and the panels binding. */
+  spinlock_t			event_lock; /**< Serializes the contacts and the event stream. */
+  struct input_dev*		idev; /**< The wall device, exists while a panel is bound. */
+  unsigned int			users; /**< Panels bound. */
+  unsigned int			listeners; /**< Opens of the wall device. */
+  struct lumio_wall_panel	panels[LUMIO_WALL_MAX_PANELS];
+  int				nb_panels;
+  struct lumio_wall_contact	contacts[LUMIO_WALL_MAX_CONTACTS];
+  int				next_id; /**< Next tracking id. */
+  __u32				width; /**< Size of the wall. */
+  __u32				height;
+  struct timer_list		handoff_timer; /**< Releases contacts nobody took over. */
+}				lumio_wall_t;
+
 /**
  * @brief Internally datas used by the driver.
  *
  *	Represents the driver internally data that are used to extracts events
  * from the lumio touchscreen, and send it control commands.
+ *
+ *	The fields every report goes through (urb completion, decoding, contact
+ * tracking and input devices) come first, starting on a cache line of their
+ * own; what is only needed at probe time, for control messages or on errors
+ * comes after. A report then touches a handful of consecutive cache lines,
+ * however many touchscreens the host drives.
  */
 typedef struct			usb_touchscreen
 {
-  struct usb_interface*		interface; /**< Interface registered to the driver. */
-  struct usb_fakemouse		fakemouse[2]; /**< The two fake mice devices. */
-  struct usb_device*		udev; /**< Usb device registered to the driver. */
+  /* Report path */
+  unsigned char*		in_buffer ____cacheline_aligned_in_smp; /**< Buffer used to retreive data from ts. */
   struct urb*			urb_in; /**< A urb to communicate with the controller. */
   struct urb*			urb_in2;
+  __u8				firmware_version; /**< The firmware version of the controller. */
+  __u8				disconnected; /**< Set once the interface is gone. */
+  __u16				next_tracking_id;
+  unsigned int			recovery_attempts; /**< Errors since the last good report. */
+  struct lumio_filter*		filter[LUMIO_NB_HOOKS]; /**< Filters, RCU protected. */
+  struct usb_fakemouse		fakemouse[2]; /**< The two fake mice devices. */
+  struct lumio_wall_panel*	wall_panel; /**< Our place on the video wall, if any. */
+  struct input_dev*		partition[LUMIO_MAX_PARTITIONS]; /**< Partition devices, if partitioned. */
+  struct lumio_contact		latched[LUMIO_MAX_CONTACTS]; /**< Last contact of each tag. */
+  __s8				latch[LUMIO_MAX_CONTACTS]; /**< Partition of each tag, -1 while up. */
+  __u16				tracking_id[LUMIO_MAX_CONTACTS]; /**< Tracking id of each tag. */
+  struct lumio_prediction	prediction; /**< Set by IOCTL_SET_PREDICTION. */
+  struct lumio_predictor	predictor[LUMIO_MAX_CONTACTS]; /**< Motion of each tag. */
+  spinlock_t			config_lock; /**< Serializes the pipeline settings with the report path. */
+  struct lumio_rejection	rejection; /**< Set by IOCTL_SET_REJECTION. */
+  struct lumio_reject_state	reject[LUMIO_MAX_CONTACTS]; /**< Rejection state of each tag. */
+  struct lumio_decimation	decimation; /**< Set by IOCTL_SET_DECIMATION. */
+  struct lumio_decimate_state	decimate[LUMIO_MAX_CONTACTS]; /**< Stroke of each tag. */
+  struct lumio_region_index*	regions; /**< Hot regions, RCU protected. */
+  struct input_dev*		keys; /**< Sends the keys of the regions, once some are set. */
+  __u8				region_down[LUMIO_MAX_CONTACTS]; /**< The tag is down, for the regions. */
+  __s8				region_pressed[LUMIO_MAX_CONTACTS]; /**< Region each tag came down in, -1 if none. */
+  __u16				region_key[LUMIO_MAX_CONTACTS]; /**< Key each tag holds down, 0 if none. */
+  __u8				contacts_down; /**< Tags down, one bit each, for the telemetry. */
+  __u16				cooked_id[LUMIO_MAX_CONTACTS]; /**< Tracking id of each tag, in the cooked frames. */
+  __u32				cooked_sequence; /**< Cooked frames so far. */
+  struct list_head		readers; /**< Opens of lumio%d reading frames, under readers_lock. */
+  spinlock_t			readers_lock; /**< Protects the readers and their queues. */
+  wait_queue_head_t		readers_wait; /**< Readers waiting for a frame. */
+  struct lumio_stats		stats; /**< Counters exported by IOCTL_GET_STATS. */
+
+  /* Probe, control and recovery */
+  struct usb_interface*		interface ____cacheline_aligned_in_smp; /**< Interface registered to the driver. */
+  struct usb_device*		udev; /**< Usb device registered to the driver. */
   struct urb*			urb_commander;
-  struct kref			refcount; /**< Reference counter. */
   unsigned char*		out_buffer; /**< Buffer used to send data to ts. */
-  unsigned char*		in_buffer; /**< Buffer used to retreive data from ts. */
+  struct kref			refcount; /**< Reference counter. */
+  char				name[LUMIO_BUS_PATH_SIZE]; /**< Usb bus path, or replayN. */
+  unsigned int			listeners; /**< Input devices of the touchscreen open, under io_lock. */
   __u8				int_out_endpoint; /**< Interrupt endpoint of the device (Out). */
   __u8				int_in_endpoint; /**< Interrupt endpoint of the device (In). */
-  __u8				listeners; /**< Numbers of listeners of our fake mice events. */
   __u8				cur_mode; /**< The current mode of the device. */
-  __u8				firmware_version; /**< The firmware version of the controller. */
+  __u8				interval; /**< Polling interval of the in urbs (ms). */
+
+  struct mutex			io_lock; /**< Serializes urb start/stop and recovery. */
+  struct delayed_work		recovery; /**< Deferred urb error recovery. */
+  unsigned long			recovery_flags; /**< Pending LUMIO_RECOVER_* actions. */
+  ktime_t			error_time; /**< When the current error burst started. */
+  struct delayed_work		telemetry; /**< Multicasts the telemetry. */
+  struct list_head		telemetry_link; /**< In lumio_telemetry_list, under lumio_telemetry_lock. */
+  struct lumio_stats		telemetry_stats; /**< Counters at the last telemetry. */
+  ktime_t			telemetry_time; /**< When the last telemetry was sent. */
+# ifdef LUMIO_FAULT_INJECTION
+  struct timer_list		fault_timer; /**< Completes delayed urbs. */
+  struct urb*			fault_urb; /**< The delayed urb. */
+  __u8				fault_delayed; /**< Completing a delayed urb. */
+# endif
 
   int				(*send_msg)(struct usb_touchscreen*, unsigned int);
   int				(*recv_msg)(struct usb_touchscreen*, unsigned int);
 }				usb_touchscreen_t;
 
+/**
+ * @brief An open of the lumio%d char device.
+ *
+ *	The reader joins the readers of the touchscreen, and starts its report
+ * stream, with its first read() or poll(). Frames are queued from the urb
+ * completion handler, head and tail only grow, under the readers_lock of the
+ * touchscreen.
+ */
+typedef struct			lumio_reader
+{
+  struct usb_touchscreen*	data;
+  struct list_head		link; /**< In the readers of the touchscreen. */
+  struct mutex			lock; /**< Serializes the start of the reader. */
+  __u8				started; /**< The reader holds a listener and is linked. */
+  unsigned int			head; /**< Next frame to read. */
+  unsigned int			tail; /**< Next frame to queue. */
+  __u32				overruns; /**< Frames lost since the last one read. */
+  struct lumio_cooked_frame	frames[LUMIO_COOKED_QUEUE];
+}				lumio_reader_t;
+
+/**
+ * @brief An open of the replay device.
+ *
+ *	Each open of /dev/lumio_replay gets its own virtual touchscreen, which
+ * has no usb device, interface nor urbs.
+ */
+typedef struct			lumio_replay
+{
+  struct mutex			lock; /**< Serializes the ioctls. */
+  struct usb_touchscreen*	data; /**< The virtual touchscreen, once set up. */
+  __u8*				chunk; /**< Reports being replayed. */
+}				lumio_replay_t;
+
 #endif /* !LUMIO_DRIVER__H_ */
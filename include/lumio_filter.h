@@ -0,0 +1,349 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_filter.h
+ * @author Quentin Casasnovas
+ * @brief Report and contact filters.
+ *
+ *	Filters are small programs, encoded like the classic BPF socket filters
+ * (struct sock_filter), which the driver runs on each report before decoding
+ * it (LUMIO_HOOK_REPORT) and on each decoded contact (LUMIO_HOOK_CONTACT). They
+ * are loaded with IOCTL_SET_FILTER, see lumio_driver.h.
+ *
+ *	The context of a program is:
+ * - the packet, which is the raw report: [k] loads read it, in big endian as
+ *   usual with BPF, and len is its length (16 bytes for firmware 1.0 and 2.0,
+ *   64 for firmware 3.0). Report programs may also rewrite it, one byte at a
+ *   time, with the LUMIO_FILTER_STB extension (report[k] = A & 0xff).
+ * - the scratch memory M[], which holds the LUMIO_FILTER_M_* values when the
+ *   program starts. Contact programs may change the contact by storing new
+ *   values in M[LUMIO_FILTER_M_X] to M[LUMIO_FILTER_M_DOWN].
+ * - the return value: 0 drops the report or the contact, anything else keeps
+ *   it.
+ *
+ *	Programs are checked before being loaded (see lumio_filter_check()): only
+ * forward jumps are allowed, so that each instruction is run at most once, and
+ * every memory access is bounds checked, as are the constant shifts (below
+ * 32). Shifting by X by 32 or more gives 0. This file is shared by the driver and
+ * the userland tools, so that a program can be checked and tested before being
+ * loaded.
+ */
+
+#ifndef LUMIO_FILTER_H_
+# define LUMIO_FILTER_H_
+
+# include <linux/types.h>
+# include <linux/filter.h>
+
+# include "lumio_protocol.h"
+# include "lumio_driver.h"
+
+/** @brief Maximum length of a program. */
+# define LUMIO_FILTER_MAX_INSNS		64
+/** @brief Number of 32 bits words of the scratch memory. */
+# define LUMIO_FILTER_MEMWORDS		16
+/** @brief report[k] = A & 0xff, report programs only. */
+# define LUMIO_FILTER_STB		(BPF_ST | BPF_B)
+
+/** @brief Position of the contact. */
+# define LUMIO_FILTER_M_X		0
+# define LUMIO_FILTER_M_Y		1
+/** @brief Tag of the contact (0/1). */
+# define LUMIO_FILTER_M_TAG		2
+/** @brief 1 while the contact touches the screen. */
+# define LUMIO_FILTER_M_DOWN		3
+/** @brief Index of the contact in the report. */
+# define LUMIO_FILTER_M_INDEX		4
+/** @brief Number of contacts in the report. */
+# define LUMIO_FILTER_M_COUNT		5
+/** @brief Firmware version, one of the LUMIO_FIRMWARE_* constants. */
+# define LUMIO_FILTER_M_FIRMWARE	6
+/** @brief Highest coordinate reported by the firmware. */
+# define LUMIO_FILTER_M_MAX_COORD	7
+
+/**
+ * @brief Checks that a program is safe to run.
+ *
+ * @param insns The program.
+ * @param len Its number of instructions.
+ * @param hook LUMIO_HOOK_REPORT or LUMIO_HOOK_CONTACT.
+ * @return 0 if the program may be loaded, -1 otherwise.
+ */
+static inline int		lumio_filter_check(const struct sock_filter*	insns,
+						   unsigned int			len,
+						   int				hook)
+{
+  const struct sock_filter*	f = 0;
+  unsigned int			pc = 0;
+
+  if (len == 0 || len > LUMIO_FILTER_MAX_INSNS)
+    return (-1);
+
+  for (pc = 0; pc < len; ++pc)
+    {
+      f = &insns[pc];
+      switch (f->code)
+	{
+	case BPF_LD | BPF_W | BPF_ABS:
+	  if (f->k > LUMIO_REPORT_SIZE - 4)
+	    return (-1);
+	  break;
+	case BPF_LD | BPF_H | BPF_ABS:
+	  if (f->k > LUMIO_REPORT_SIZE - 2)
+	    return (-1);
+	  break;
+	case BPF_LD | BPF_B | BPF_ABS:
+	  if (f->k >= LUMIO_REPORT_SIZE)
+	    return (-1);
+	  break;
+	case LUMIO_FILTER_STB:
+	  if (hook != LUMIO_HOOK_REPORT || f->k >= LUMIO_REPORT_SIZE)
+	    return (-1);
+	  break;
+	case BPF_LD | BPF_MEM:
+	case BPF_LDX | BPF_MEM:
+	case BPF_ST:
+	case BPF_STX:
+	  if (f->k >= LUMIO_FILTER_MEMWORDS)
+	    return (-1);
+	  break;
+	case BPF_ALU | BPF_DIV | BPF_K:
+	  if (f->k == 0)
+	    return (-1);
+	  break;
+	case BPF_ALU | BPF_LSH | BPF_K:
+	case BPF_ALU | BPF_RSH | BPF_K:
+	  if (f->k >= 32)
+	    return (-1);
+	  break;
+	case BPF_JMP | BPF_JA:
+	  if (f->k >= len - pc - 1)
+	    return (-1);
+	  break;
+	case BPF_JMP | BPF_JEQ | BPF_K:
+	case BPF_JMP | BPF_JEQ | BPF_X:
+	case BPF_JMP | BPF_JGT | BPF_K:
+	case BPF_JMP | BPF_JGT | BPF_X:
+	case BPF_JMP | BPF_JGE | BPF_K:
+	case BPF_JMP | BPF_JGE | BPF_X:
+	case BPF_JMP | BPF_JSET | BPF_K:
+	case BPF_JMP | BPF_JSET | BPF_X:
+	  if (f->jt >= len - pc - 1 || f->jf >= len - pc - 1)
+	    return (-1);
+	  break;
+	case BPF_LD | BPF_W | BPF_LEN:
+	case BPF_LDX | BPF_W | BPF_LEN:
+	case BPF_LD | BPF_IMM:
+	case BPF_LDX | BPF_IMM:
+	case BPF_ALU | BPF_ADD | BPF_K:
+	case BPF_ALU | BPF_ADD | BPF_X:
+	case BPF_ALU | BPF_SUB | BPF_K:
+	case BPF_ALU | BPF_SUB | BPF_X:
+	case BPF_ALU | BPF_MUL | BPF_K:
+	case BPF_ALU | BPF_MUL | BPF_X:
+	case BPF_ALU | BPF_DIV | BPF_X:
+	case BPF_ALU | BPF_AND | BPF_K:
+	case BPF_ALU | BPF_AND | BPF_X:
+	case BPF_ALU | BPF_OR | BPF_K:
+	case BPF_ALU | BPF_OR | BPF_X:
+	case BPF_ALU | BPF_LSH | BPF_X:
+	case BPF_ALU | BPF_RSH | BPF_X:
+	case BPF_ALU | BPF_NEG:
+	case BPF_MISC | BPF_TAX:
+	case BPF_MISC | BPF_TXA:
+	case BPF_RET | BPF_K:
+	case BPF_RET | BPF_A:
+	  break;
+	default:
+	  return (-1);
+	}
+    }
+
+  /* Forward jumps only, the last instruction must end the program */
+  if (BPF_CLASS(insns[len - 1].code) != BPF_RET)
+    return (-1);
+
+  return (0);
+}
+
+/**
+ * @brief Runs a program checked by lumio_filter_check().
+ *
+ * @param insns The program.
+ * @param report The report.
+ * @param report_len Its length.
+ * @param mem The scratch memory, LUMIO_FILTER_MEMWORDS words.
+ * @return The value returned by the program, 0 if it reads past the report.
+ */
+static inline __u32		lumio_filter_run(const struct sock_filter*	insns,
+						 __u8*				report,
+						 unsigned int			report_len,
+						 __u32*				mem)
+{
+  const struct sock_filter*	f = 0;
+  __u32				A = 0;
+  __u32				X = 0;
+  unsigned int			pc = 0;
+
+  for (pc = 0; ; ++pc)
+    {
+      f = &insns[pc];
+      switch (f->code)
+	{
+	case BPF_LD | BPF_W | BPF_ABS:
+	  if (f->k + 4 > report_len)
+	    return (0);
+	  A = (report[f->k] << 24) | (report[f->k + 1] << 16) |
+	    (report[f->k + 2] << 8) | report[f->k + 3];
+	  break;
+	case BPF_LD | BPF_H | BPF_ABS:
+	  if (f->k + 2 > report_len)
+	    return (0);
+	  A = (report[f->k] << 8) | report[f->k + 1];
+	  break;
+	case BPF_LD | BPF_B | BPF_ABS:
+	  if (f->k >= report_len)
+	    return (0);
+	  A = report[f->k];
+	  break;
+	case LUMIO_FILTER_STB:
+	  if (f->k >= report_len)
+	    return (0);
+	  report[f->k] = A & 0xff;
+	  break;
+	case BPF_LD | BPF_W | BPF_LEN:
+	  A = report_len;
+	  break;
+	case BPF_LDX | BPF_W | BPF_LEN:
+	  X = report_len;
+	  break;
+	case BPF_LD | BPF_IMM:
+	  A = f->k;
+	  break;
+	case BPF_LDX | BPF_IMM:
+	  X = f->k;
+	  break;
+	case BPF_LD | BPF_MEM:
+	  A = mem[f->k];
+	  break;
+	case BPF_LDX | BPF_MEM:
+	  X = mem[f->k];
+	  break;
+	case BPF_ST:
+	  mem[f->k] = A;
+	  break;
+	case BPF_STX:
+	  mem[f->k] = X;
+	  break;
+	case BPF_ALU | BPF_ADD | BPF_K:
+	  A += f->k;
+	  break;
+	case BPF_ALU | BPF_ADD | BPF_X:
+	  A += X;
+	  break;
+	case BPF_ALU | BPF_SUB | BPF_K:
+	  A -= f->k;
+	  break;
+	case BPF_ALU | BPF_SUB | BPF_X:
+	  A -= X;
+	  break;
+	case BPF_ALU | BPF_MUL | BPF_K:
+	  A *= f->k;
+	  break;
+	case BPF_ALU | BPF_MUL | BPF_X:
+	  A *= X;
+	  break;
+	case BPF_ALU | BPF_DIV | BPF_K:
+	  A /= f->k;
+	  break;
+	case BPF_ALU | BPF_DIV | BPF_X:
+	  if (X == 0)
+	    return (0);
+	  A /= X;
+	  break;
+	case BPF_ALU | BPF_AND | BPF_K:
+	  A &= f->k;
+	  break;
+	case BPF_ALU | BPF_AND | BPF_X:
+	  A &= X;
+	  break;
+	case BPF_ALU | BPF_OR | BPF_K:
+	  A |= f->k;
+	  break;
+	case BPF_ALU | BPF_OR | BPF_X:
+	  A |= X;
+	  break;
+	case BPF_ALU | BPF_LSH | BPF_K:
+	  A <<= f->k;
+	  break;
+	case BPF_ALU | BPF_LSH | BPF_X:
+	  A = X < 32 ? A << X : 0;
+	  break;
+	case BPF_ALU | BPF_RSH | BPF_K:
+	  A >>= f->k;
+	  break;
+	case BPF_ALU | BPF_RSH | BPF_X:
+	  A = X < 32 ? A >> X : 0;
+	  break;
+	case BPF_ALU | BPF_NEG:
+	  A = -A;
+	  break;
+	case BPF_JMP | BPF_JA:
+	  pc += f->k;
+	  break;
+	case BPF_JMP | BPF_JEQ | BPF_K:
+	  pc += (A == f->k) ? f->jt : f->jf;
+	  break;
+	case BPF_JMP | BPF_JEQ | BPF_X:
+	  pc += (A == X) ? f->jt : f->jf;
+	  break;
+	case BPF_JMP | BPF_JGT | BPF_K:
+	  pc += (A > f->k) ? f->jt : f->jf;
+	  break;
+	case BPF_JMP | BPF_JGT | BPF_X:
+	  pc += (A > X) ? f->jt : f->jf;
+	  break;
+	case BPF_JMP | BPF_JGE | BPF_K:
+	  pc += (A >= f->k) ? f->jt : f->jf;
+	  break;
+	case BPF_JMP | BPF_JGE | BPF_X:
+	  pc += (A >= X) ? f->jt : f->jf;
+	  break;
+	case BPF_JMP | BPF_JSET | BPF_K:
+	  pc += (A & f->k) ? f->jt : f->jf;
+	  break;
+	case BPF_JMP | BPF_JSET | BPF_X:
+	  pc += (A & X) ? f->jt : f->jf;
+	  break;
+	case BPF_MISC | BPF_TAX:
+	  X = A;
+	  break;
+	case BPF_MISC | BPF_TXA:
+	  A = X;
+	  break;
+	case BPF_RET | BPF_K:
+	  return (f->k);
+	case BPF_RET | BPF_A:
+	  return (A);
+	default:
+	  return (0);
+	}
+    }
+}
+
+#endif /* !LUMIO_FILTER_H_ */
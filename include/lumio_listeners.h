@@ -0,0 +1,62 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_listeners.h
+ * @author Quentin Casasnovas
+ * @brief Accounting of the listeners of a touchscreen.
+ *
+ *	A touchscreen only receives reports while one of its input devices is
+ * open (see lumio_start_io() and lumio_stop_io()). These helpers tell when
+ * the first listener comes and the last one goes; the caller holds the lock
+ * protecting the counter. They are shared with the userland tests.
+ */
+
+#ifndef LUMIO_LISTENERS_H_
+# define LUMIO_LISTENERS_H_
+
+# include <linux/types.h>
+
+/**
+ * @brief Counts a new listener.
+ *
+ * @param listeners The counter.
+ * @return 1 if it is the first one, in which case the reports must be started.
+ */
+static inline int	lumio_listener_get(unsigned int* listeners)
+{
+  return ((*listeners)++ == 0);
+}
+
+/**
+ * @brief Forgets a listener.
+ *
+ *	An unbalanced call is ignored, instead of wrapping the counter around and
+ * keeping the reports running forever.
+ *
+ * @param listeners The counter.
+ * @return 1 if it was the last one, in which case the reports must be stopped.
+ */
+static inline int	lumio_listener_put(unsigned int* listeners)
+{
+  if (*listeners == 0)
+    return (0);
+
+  return (--(*listeners) == 0);
+}
+
+#endif /* !LUMIO_LISTENERS_H_ */
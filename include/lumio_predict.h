@@ -0,0 +1,186 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_predict.h
+ * @author Quentin Casasnovas
+ * @brief Motion prediction.
+ *
+ *	Firmware 1.0 and 2.0 controllers send a report every other polling
+ * interval, so what they report is always a bit behind the finger. The
+ * predictor extrapolates each contact a few milliseconds ahead, from its
+ * velocity and acceleration, to hide part of that latency. It is enabled
+ * with IOCTL_SET_PREDICTION, see lumio_driver.h.
+ *
+ *	Everything is computed with 32 bits integers, the driver runs it from
+ * the urb completion handler. Time is counted in ticks of
+ * 2^LUMIO_PREDICT_TICK_SHIFT us, velocities are in 1/256 unit per tick and
+ * accelerations in 1/65536 unit per tick squared; the bounds below keep every
+ * product within 32 bits. Both velocity and acceleration are averaged with
+ * their previous value, which takes the edge off the IR jitter.
+ *
+ *	This file is shared by the driver and the userland tools, so that the
+ * predictor can be tuned on recorded traces.
+ */
+
+#ifndef LUMIO_PREDICT_H_
+# define LUMIO_PREDICT_H_
+
+# include <linux/types.h>
+
+# include "lumio_protocol.h"
+# include "lumio_driver.h"
+
+/** @brief A tick is 64 us. */
+# define LUMIO_PREDICT_TICK_SHIFT	6
+/** @brief Shortest time between two reports taken into account (1 ms). */
+# define LUMIO_PREDICT_MIN_TICKS	16
+/** @brief Longest (64 ms), the contact is seen as resting above it. */
+# define LUMIO_PREDICT_MAX_TICKS	1024
+/** @brief Bound of the acceleration. */
+# define LUMIO_PREDICT_MAX_ACCEL	(1 << 20)
+/** @brief Bound of the extrapolation, before max_distance applies. */
+# define LUMIO_PREDICT_MAX_DELTA	(1 << 16)
+
+/**
+ * @brief The motion of a contact.
+ */
+struct			lumio_predictor
+{
+  __s32			x; /**< Last position reported by the controller. */
+  __s32			y;
+  __s32			vx; /**< Velocity. */
+  __s32			vy;
+  __s32			ax; /**< Acceleration. */
+  __s32			ay;
+  __u32			time_us; /**< When the last position was reported. */
+  __u8			samples; /**< Positions seen since the contact came down. */
+};
+
+static inline __s32	lumio_predict_clamp(__s32 v, __s32 min, __s32 max)
+{
+  return (v < min ? min : (v > max ? max : v));
+}
+
+/**
+ * @brief Updates the motion of a contact with its new position.
+ *
+ *	The time between two positions is the one of the contact itself: a
+ * contact missing from a few reports, while the other one keeps being
+ * reported, gets the time it really went without a position.
+ *
+ * @param p The predictor of the contact.
+ * @param x The position reported.
+ * @param y
+ * @param time_us When it was reported, in us, on any clock (it may wrap).
+ */
+static inline void	lumio_predict_update(struct lumio_predictor*	p,
+					     __s32			x,
+					     __s32			y,
+					     __u32			time_us)
+{
+  __s32			dt = (time_us - p->time_us) >> LUMIO_PREDICT_TICK_SHIFT;
+  __s32			vx = 0;
+  __s32			vy = 0;
+
+  p->time_us = time_us;
+
+  if (p->samples == 0 || dt > LUMIO_PREDICT_MAX_TICKS)
+    {
+      p->vx = p->vy = p->ax = p->ay = 0;
+      p->samples = 0;
+    }
+  else
+    {
+      dt = lumio_predict_clamp(dt, LUMIO_PREDICT_MIN_TICKS,
+			       LUMIO_PREDICT_MAX_TICKS);
+      vx = ((x - p->x) * 256 / dt + p->vx) / 2;
+      vy = ((y - p->y) * 256 / dt + p->vy) / 2;
+      if (p->samples > 1)
+	{
+	  p->ax = (lumio_predict_clamp((vx - p->vx) * 256 / dt,
+				       -LUMIO_PREDICT_MAX_ACCEL,
+				       LUMIO_PREDICT_MAX_ACCEL) + p->ax) / 2;
+	  p->ay = (lumio_predict_clamp((vy - p->vy) * 256 / dt,
+				       -LUMIO_PREDICT_MAX_ACCEL,
+				       LUMIO_PREDICT_MAX_ACCEL) + p->ay) / 2;
+	}
+      p->vx = vx;
+      p->vy = vy;
+    }
+
+  p->x = x;
+  p->y = y;
+  if (p->samples < 255)
+    ++p->samples;
+}
+
+/**
+ * @brief Forgets the motion of a lifted contact.
+ */
+static inline void	lumio_predict_reset(struct lumio_predictor* p)
+{
+  p->samples = 0;
+}
+
+/**
+ * @brief Extrapolates the position of a contact.
+ *
+ *	Position of the contact lookahead_ms from now, its last position plus
+ * v.t + a.t^2 / 2, bounded by max_distance on each axis (the direction is
+ * kept) and by the screen.
+ *
+ * @param p The predictor of the contact, updated with its last position.
+ * @param config The lookahead and the bound, see IOCTL_SET_PREDICTION.
+ * @param max_coord Highest coordinate of the screen.
+ * @param x Filled with the predicted position.
+ * @param y
+ */
+static inline void	lumio_predict(const struct lumio_predictor*	p,
+				      const struct lumio_prediction*	config,
+				      __s32				max_coord,
+				      __s32*				x,
+				      __s32*				y)
+{
+  __s32			t = (config->lookahead_ms * 1000) >> LUMIO_PREDICT_TICK_SHIFT;
+  __s32			max = config->max_distance;
+  __s32			dx = 0;
+  __s32			dy = 0;
+  __s32			longest = 0;
+
+  if (p->samples > 1)
+    {
+      dx = ((p->vx * t) >> 8) + ((((p->ax * t) >> 12) * t) >> 5);
+      dy = ((p->vy * t) >> 8) + ((((p->ay * t) >> 12) * t) >> 5);
+    }
+
+  dx = lumio_predict_clamp(dx, -LUMIO_PREDICT_MAX_DELTA, LUMIO_PREDICT_MAX_DELTA);
+  dy = lumio_predict_clamp(dy, -LUMIO_PREDICT_MAX_DELTA, LUMIO_PREDICT_MAX_DELTA);
+  longest = dx < 0 ? -dx : dx;
+  if ((dy < 0 ? -dy : dy) > longest)
+    longest = dy < 0 ? -dy : dy;
+  if (longest > max)
+    {
+      dx = dx * max / longest;
+      dy = dy * max / longest;
+    }
+
+  *x = lumio_predict_clamp(p->x + dx, 0, max_coord);
+  *y = lumio_predict_clamp(p->y + dy, 0, max_coord);
+}
+
+#endif /* !LUMIO_PREDICT_H_ */
@@ -0,0 +1,254 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_protocol.h
+ * @author Quentin Casasnovas
+ * @brief The lumio controller protocol.
+ *
+ *	This file describes what goes on the wire between the host and the
+ * lumio controller: usb ids, control messages and report layouts. It is shared
+ * by the kernel driver and the userland tools so that they all speak exactly
+ * the same protocol, and therefore only depends on linux/types.h.
+ */
+
+#ifndef LUMIO_PROTOCOL_H_
+# define LUMIO_PROTOCOL_H_
+
+# include <linux/types.h>
+
+# ifndef __KERNEL__
+#  include <string.h>
+# endif
+
+/** @brief The USB Vendor ID of the device when in mouse mode. */
+# define USB_VID_MM		0x0556
+/** @brief The USB Vendor ID of the device when in driver mode. */
+# define USB_VID_DM		0x0592
+/** @brief The USB Product ID of the device when in mouse mode. */
+# define USB_PID_MM		0x3556
+/** @brief The USB Product ID of the device when in driver mode. */
+# define USB_PID_DM		0x6956
+/** @brief The USB Vendor ID of Lumio (since firmware 2.0) */
+# define USB_VID_LUMIO		0x202E
+/** @brief The USB PID of the device when in driver mode (firmware 2.0). */
+# define USB_PID_DM_2_0			0x0001
+/** @brief The USB PID of the device when in mouse mode (firmware 2.0). */
+# define USB_PID_MM_2_0			0x0002
+/** @brief The USB PID of the device when in dualcontrol mode (firmware 2.0). */
+# define USB_PID_DUAL_CONTROL_2_0	0x0003
+/** @brief The USB PID of the device when in digitizer mode (firmware 2.0). */
+# define USB_PID_DIGITIZER_2_0		0x0004
+/** @brief The USB PID of the device when in dual mode mode (firmware 3.0). */
+# define USB_PID_DUAL_MODE_3_0		0x0005
+/** @brief The USB PID of the device when in 4 sensors mode mode (firmware 3.0). */
+# define USB_PID_4_SENSORS_3_0		0x0006
+
+# define HID_REQ_GET_REPORT	0x01
+# define HID_REQ_SET_REPORT	0x09
+# define HID_VAL_INPUT		0x0100
+# define HID_VAL_OUTPUT		0x0200
+# define HID_VAL_FEATURE	0x0300
+
+# define LUMIO_OPERATION_MASK	0x3
+# define LUMIO_OPERATION_MOVE	(0 << 0)
+# define LUMIO_OPERATION_DOWN	(1 << 0)
+# define LUMIO_OPERATION_UP	(1 << 1)
+
+# define LUMIO_TAGID_MASK	0xc
+# define LUMIO_TAGID_EVENT_ID1	(1 << 2)
+# define LUMIO_TAGID_EVENT_ID2	(1 << 3)
+
+# define LUMIO_FIRMWARE_1_0	0x01
+# define LUMIO_FIRMWARE_2_0	0x02
+# define LUMIO_FIRMWARE_3_0	0x03
+
+/** @brief Size of a control message sent with a control urb (fw 1.0/2.0). */
+# define LUMIO_MSG_SIZE		8
+/** @brief Size of a report, or of a message sent with an interrupt urb. */
+# define LUMIO_REPORT_SIZE	64
+/** @brief Size of the report half carried by each in urb (fw 1.0/2.0). */
+# define LUMIO_HALF_REPORT_SIZE	8
+/** @brief Value of the third byte of a report holding two contacts. */
+# define LUMIO_DUAL_REPORT	0x0d
+/** @brief Maximum number of contacts in a report. */
+# define LUMIO_MAX_CONTACTS	2
+
+/**
+ * @brief A contact, as decoded from a report.
+ */
+struct			lumio_contact
+{
+  __u16			x;
+  __u16			y;
+  __u8			tag; /**< Which finger the controller thinks it is (0/1). */
+  __u8			down; /**< 1 while the finger touches the screen. */
+};
+
+/**
+ * @brief Returns the maximum coordinate reported by a firmware.
+ *
+ * @param firmware One of the LUMIO_FIRMWARE_* constants.
+ */
+static inline __u16	lumio_max_coordinate(__u8 firmware)
+{
+  return (firmware == LUMIO_FIRMWARE_1_0 ? 2047 : 4095);
+}
+
+/**
+ * @brief Returns the length of the reports of a firmware.
+ *
+ *	Firmware 1.0 and 2.0 reports are made of two halves, see
+ * lumio_decode_report().
+ *
+ * @param firmware One of the LUMIO_FIRMWARE_* constants.
+ */
+static inline unsigned int	lumio_report_size(__u8 firmware)
+{
+  return (firmware == LUMIO_FIRMWARE_3_0 ?
+	  LUMIO_REPORT_SIZE : 2 * LUMIO_HALF_REPORT_SIZE);
+}
+
+/**
+ * @brief Builds the message switching the controller to driver mode.
+ *
+ *	The controller switches to driver mode when receiving the following 8
+ * bytes as a feature report: 0x7576000000000000. It then re-enumerates with
+ * the driver mode product id.
+ *
+ * @param msg A LUMIO_REPORT_SIZE buffer.
+ */
+static inline void	lumio_build_driver_mode_msg(__u8* msg)
+{
+  memset(msg, 0x0, LUMIO_REPORT_SIZE);
+  msg[0] = 0x75;
+  msg[1] = 0x76;
+}
+
+/**
+ * @brief Builds the message asking or setting the controller configuration.
+ *
+ *	0x7F9B000000000000 asks the controller whether it reports single or
+ * dualtouch events, 0x7F9B010100000000 tells it to report dualtouch events.
+ *
+ * @param msg A LUMIO_REPORT_SIZE buffer.
+ * @param dualtouch Non zero to build the dualtouch request.
+ */
+static inline void	lumio_build_config_msg(__u8* msg, int dualtouch)
+{
+  memset(msg, 0x0, LUMIO_REPORT_SIZE);
+  msg[0] = 0x7F;
+  msg[1] = 0x9B;
+  if (dualtouch)
+    {
+      msg[2] = 0x01;
+      msg[3] = 0x01;
+    }
+}
+
+/**
+ * @brief Interprets the reply to a configuration request.
+ *
+ *	The controller replies 0x7F9B010100000000 when it reports dualtouch
+ * events, and 0x7F9B010000000000 for singletouch events. Anything else, an
+ * empty buffer left by a lost reply for instance, isn't a configuration.
+ *
+ * @param reply The 8 bytes replied by the controller.
+ * @return 1 if the controller reports dualtouch events, 0 if it reports
+ * singletouch events, -1 if the reply isn't a configuration.
+ */
+static inline int	lumio_config_is_dualtouch(const __u8* reply)
+{
+  if (reply[0] != 0x7F || reply[1] != 0x9B)
+    return (-1);
+
+  return (reply[3] == 0x01);
+}
+
+/**
+ * @brief Decodes a report.
+ *
+ *	All firmwares share the same layout, firmware 1.0 and 2.0 only split it
+ * in two 8 bytes halves, each one carried by its own interrupt urb:
+ * - byte 2 is LUMIO_DUAL_REPORT when the report holds two contacts.
+ * - first contact: operation in the low bits of byte 3, tag in bit 2 of byte
+ *   3, x on the high nibble of byte 3 and byte 4, y on the low nibble of byte 6
+ *   and byte 5.
+ * - second contact: operation in the high nibble of byte 9, tag in bit 6 of
+ *   byte 9, x on the low nibble of byte 11 and byte 10, y on the high nibble of
+ *   byte 11 and byte 12.
+ *
+ * @param report The report, at least 16 bytes long.
+ * @param contacts An array of LUMIO_MAX_CONTACTS contacts to fill.
+ * @return The number of contacts decoded.
+ */
+static inline int	lumio_decode_report(const __u8*			report,
+					    struct lumio_contact*	contacts)
+{
+  contacts[0].x = ((report[3] >> 4) << 8) | report[4];
+  contacts[0].y = ((report[6] & 0xf) << 8) | report[5];
+  contacts[0].down = !((report[3] & LUMIO_OPERATION_MASK) & LUMIO_OPERATION_UP);
+  contacts[0].tag = (report[3] & (1 << 2)) ? 0 : 1;
+
+  if (report[2] != LUMIO_DUAL_REPORT)
+    return (1);
+
+  contacts[1].x = ((report[11] & 0xf) << 8) | report[10];
+  contacts[1].y = ((report[11] >> 4) << 8) | report[12];
+  contacts[1].down = !((report[9] >> 4) & LUMIO_OPERATION_UP);
+  contacts[1].tag = (report[9] & (1 << 6)) ? 0 : 1;
+
+  return (2);
+}
+
+/**
+ * @brief Encodes a report, the way the controller does.
+ *
+ *	This is the reverse of lumio_decode_report(), used by the tools which
+ * generate or replay reports.
+ *
+ * @param report A LUMIO_REPORT_SIZE buffer.
+ * @param contacts The contacts to encode.
+ * @param nb_contacts 1 or 2.
+ */
+static inline void	lumio_encode_report(__u8*				report,
+					    const struct lumio_contact*	contacts,
+					    int					nb_contacts)
+{
+  __u8			operation = 0;
+
+  memset(report, 0x0, LUMIO_REPORT_SIZE);
+
+  operation = contacts[0].down ? LUMIO_OPERATION_DOWN : LUMIO_OPERATION_UP;
+  report[3] = ((contacts[0].x >> 8) << 4) | operation |
+    (contacts[0].tag ? 0 : LUMIO_TAGID_EVENT_ID1);
+  report[4] = contacts[0].x & 0xff;
+  report[5] = contacts[0].y & 0xff;
+  report[6] = (contacts[0].y >> 8) & 0xf;
+
+  if (nb_contacts < 2)
+    return;
+
+  report[2] = LUMIO_DUAL_REPORT;
+  operation = contacts[1].down ? LUMIO_OPERATION_DOWN : LUMIO_OPERATION_UP;
+  report[9] = (operation | (contacts[1].tag ? 0 : LUMIO_TAGID_EVENT_ID1)) << 4;
+  report[10] = contacts[1].x & 0xff;
+  report[11] = ((contacts[1].x >> 8) & 0xf) | ((contacts[1].y >> 8) << 4);
+  report[12] = contacts[1].y & 0xff;
+}
+
+#endif /* !LUMIO_PROTOCOL_H_ */
@@ -0,0 +1,183 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_regions.h
+ * @author Quentin Casasnovas
+ * @brief Hot regions.
+ *
+ *	The regions loaded with IOCTL_SET_REGIONS (see lumio_driver.h) are
+ * indexed with a uniform grid of LUMIO_REGION_GRID x LUMIO_REGION_GRID cells
+ * over the controller coordinates: each cell lists the regions overlapping it,
+ * so that finding the region under a contact only looks at a few of them
+ * however many there are. Regions are looked up in the order they were given,
+ * the first one containing the contact wins.
+ *
+ *	The index is built once, when the regions are loaded, and stored in a
+ * single allocation: the per-cell lists are packed one after the other, cell i
+ * spanning entries[cells[i]] to entries[cells[i + 1]].
+ *
+ *	This file is shared by the driver and the userland tools, so that the
+ * regions can be checked before being loaded.
+ */
+
+#ifndef LUMIO_REGIONS_H_
+# define LUMIO_REGIONS_H_
+
+# include <linux/types.h>
+
+# include "lumio_driver.h"
+
+/** @brief Cells of the grid along each axis. */
+# define LUMIO_REGION_GRID	16
+# define LUMIO_REGION_CELLS	(LUMIO_REGION_GRID * LUMIO_REGION_GRID)
+
+/**
+ * @brief The regions of a touchscreen, with their grid index.
+ */
+struct			lumio_region_index
+{
+  __u32			flags; /**< LUMIO_REGIONS_* flags. */
+  __u32			nb_regions;
+  __u32			max_coord; /**< Highest coordinate of the screen. */
+  struct lumio_region	regions[LUMIO_MAX_REGIONS];
+  __u16			cells[LUMIO_REGION_CELLS + 1]; /**< Start of the list of each cell. */
+  __u8			entries[0]; /**< Lists of regions, one per cell. */
+};
+
+static inline __u32	lumio_region_cell(__u32 coord, __u32 max_coord)
+{
+  return (coord * LUMIO_REGION_GRID / (max_coord + 1));
+}
+
+/**
+ * @brief Checks a region.
+ *
+ * @return 0 if valid, -1 otherwise.
+ */
+static inline int	lumio_region_check(const struct lumio_region*	region,
+					   __u32			max_coord)
+{
+  if (region->width == 0 || region->height == 0 ||
+      region->x + region->width > max_coord + 1 ||
+      region->y + region->height > max_coord + 1 ||
+      region->key == 0 || region->key >= LUMIO_REGION_MAX_KEY ||
+      region->mode > LUMIO_REGION_CLICK)
+    return (-1);
+
+  return (0);
+}
+
+/**
+ * @brief Counts the entries of the index, in order to allocate it.
+ *
+ * @return The number of entries, or -1 if a region is invalid.
+ */
+static inline int	lumio_regions_size(const struct lumio_region*	regions,
+					   __u32			nb_regions,
+					   __u32			max_coord)
+{
+  int			size = 0;
+  __u32			i = 0;
+
+  if (nb_regions > LUMIO_MAX_REGIONS)
+    return (-1);
+
+  for (i = 0; i < nb_regions; ++i)
+    {
+      if (lumio_region_check(&regions[i], max_coord) < 0)
+	return (-1);
+      size += (lumio_region_cell(regions[i].x + regions[i].width - 1, max_coord) -
+	       lumio_region_cell(regions[i].x, max_coord) + 1) *
+	(lumio_region_cell(regions[i].y + regions[i].height - 1, max_coord) -
+	 lumio_region_cell(regions[i].y, max_coord) + 1);
+    }
+
+  return (size);
+}
+
+/**
+ * @brief Builds the index of checked regions.
+ *
+ * @param index Allocated with room for lumio_regions_size() entries.
+ */
+static inline void	lumio_regions_build(struct lumio_region_index*	index,
+					    const struct lumio_region*	regions,
+					    __u32			nb_regions,
+					    __u32			flags,
+					    __u32			max_coord)
+{
+  __u32			cell = 0;
+  __u32			cx = 0;
+  __u32			cy = 0;
+  __u32			i = 0;
+  __u16			next = 0;
+
+  index->flags = flags;
+  index->nb_regions = nb_regions;
+  index->max_coord = max_coord;
+  for (i = 0; i < nb_regions; ++i)
+    index->regions[i] = regions[i];
+
+  /* Each cell in turn, so that the lists end up packed and in order */
+  for (cell = 0; cell < LUMIO_REGION_CELLS; ++cell)
+    {
+      index->cells[cell] = next;
+      cx = cell % LUMIO_REGION_GRID;
+      cy = cell / LUMIO_REGION_GRID;
+      for (i = 0; i < nb_regions; ++i)
+	if (lumio_region_cell(regions[i].x, max_coord) <= cx &&
+	    lumio_region_cell(regions[i].x + regions[i].width - 1,
+			      max_coord) >= cx &&
+	    lumio_region_cell(regions[i].y, max_coord) <= cy &&
+	    lumio_region_cell(regions[i].y + regions[i].height - 1,
+			      max_coord) >= cy)
+	  index->entries[next++] = i;
+    }
+  index->cells[LUMIO_REGION_CELLS] = next;
+}
+
+/**
+ * @brief Finds the region under a contact.
+ *
+ * @return The index of the region, or -1 if there is none.
+ */
+static inline int	lumio_region_find(const struct lumio_region_index*	index,
+					  __u32					x,
+					  __u32					y)
+{
+  const struct lumio_region*	region = NULL;
+  __u32			cell = 0;
+  __u32			i = 0;
+
+  if (x > index->max_coord || y > index->max_coord)
+    return (-1);
+
+  cell = lumio_region_cell(y, index->max_coord) * LUMIO_REGION_GRID +
+    lumio_region_cell(x, index->max_coord);
+  for (i = index->cells[cell]; i < index->cells[cell + 1]; ++i)
+    {
+      region = &index->regions[index->entries[i]];
+      if (x >= region->x && x < (__u32) region->x + region->width &&
+	  y >= region->y && y < (__u32) region->y + region->height)
+	return (index->entries[i]);
+    }
+
+  return (-1);
+}
+
+#endif /* !LUMIO_REGIONS_H_ */
@@ -0,0 +1,207 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_reject.h
+ * @author Quentin Casasnovas
+ * @brief Rejection of spurious contacts.
+ *
+ *	Palms, sleeves and reflections on the bezel show up as contacts like any
+ * finger. The rejection stage drops them before they reach the input layer,
+ * set with IOCTL_SET_REJECTION (see lumio_driver.h):
+ * - a contact which comes down within edge units of a border is dropped until
+ *   it is lifted, even if it then moves inwards;
+ * - the position of a contact which moves more than max_jump units between
+ *   two reports is dropped, unless the next report confirms it: the contact
+ *   stays down where it was meanwhile;
+ * - a contact is only reported once it has lasted min_reports reports, the
+ *   ones lifted sooner are blips and never reported at all.
+ *
+ *	Each tag of the controller goes through the states below. This file is
+ * shared by the driver and the userland tools, so that the rejection can be
+ * tuned on recorded traces.
+ */
+
+#ifndef LUMIO_REJECT_H_
+# define LUMIO_REJECT_H_
+
+# include <linux/types.h>
+
+# include "lumio_protocol.h"
+# include "lumio_driver.h"
+
+/** @brief The contact is reported. */
+# define LUMIO_REJECT_NONE	0
+/** @brief Came down in the dead-zone along the edges. */
+# define LUMIO_REJECT_EDGE	1
+/** @brief Moved too far since the previous report. */
+# define LUMIO_REJECT_JUMP	2
+/** @brief Lifted before lasting min_reports reports. */
+# define LUMIO_REJECT_BLIP	3
+/** @brief Not reported yet, may still turn out to be a blip. */
+# define LUMIO_REJECT_HELD	4
+
+/* States of a tag */
+# define LUMIO_REJECT_IDLE	0
+# define LUMIO_REJECT_PENDING	1
+# define LUMIO_REJECT_ACTIVE	2
+# define LUMIO_REJECT_DROPPED	3
+
+/**
+ * @brief What the rejection knows of a tag.
+ */
+struct			lumio_reject_state
+{
+  __u16			x; /**< Last position reported. */
+  __u16			y;
+  __u16			jump_x; /**< Position of a rejected jump, to be confirmed. */
+  __u16			jump_y;
+  __u8			state; /**< One of the LUMIO_REJECT_IDLE... states. */
+  __u8			jumped; /**< jump_x and jump_y are set. */
+  __u16			reports; /**< Reports since the contact came down, 0 if unknown. */
+};
+
+static inline int	lumio_reject_enabled(const struct lumio_rejection* config)
+{
+  return (config->edge || config->max_jump || config->min_reports > 1);
+}
+
+static inline int	lumio_reject_near(__u16 x1, __u16 y1, __u16 x2, __u16 y2,
+					  __u32 distance)
+{
+  __u32			dx = x1 > x2 ? x1 - x2 : x2 - x1;
+  __u32			dy = y1 > y2 ? y1 - y2 : y2 - y1;
+
+  return (dx <= distance && dy <= distance);
+}
+
+/**
+ * @brief Forgets the contact of a tag.
+ */
+static inline void	lumio_reject_reset(struct lumio_reject_state* s)
+{
+  s->state = LUMIO_REJECT_IDLE;
+  s->jumped = 0;
+  s->reports = 0;
+}
+
+/**
+ * @brief Lets the contact of a tag through until it is lifted.
+ *
+ *	Used when the thresholds change while the contact is reported down: it
+ * has been reported already, its lift must be too. Its next position is taken as
+ * is.
+ */
+static inline void	lumio_reject_resync(struct lumio_reject_state* s)
+{
+  lumio_reject_reset(s);
+  s->state = LUMIO_REJECT_ACTIVE;
+}
+
+/**
+ * @brief Decides whether a contact is reported.
+ *
+ *	A contact which is lifted is moved back to the last position reported,
+ * in case that one was a jump.
+ *
+ * @param config The rejection thresholds, see IOCTL_SET_REJECTION.
+ * @param s The state of the tag of the contact.
+ * @param contact The contact, updated if kept.
+ * @param max_coord Highest coordinate of the screen.
+ * @return LUMIO_REJECT_NONE if the contact is to be reported, the reason why
+ * it is not otherwise.
+ */
+static inline int	lumio_reject(const struct lumio_rejection*	config,
+				     struct lumio_reject_state*		s,
+				     struct lumio_contact*		contact,
+				     __u32				max_coord)
+{
+  __u32			edge = config->edge;
+
+  if (!contact->down)
+    {
+      switch (s->state)
+	{
+	case LUMIO_REJECT_ACTIVE:
+	  contact->x = s->x;
+	  contact->y = s->y;
+	  lumio_reject_reset(s);
+	  return (LUMIO_REJECT_NONE);
+	case LUMIO_REJECT_PENDING:
+	  lumio_reject_reset(s);
+	  return (LUMIO_REJECT_BLIP);
+	case LUMIO_REJECT_DROPPED:
+	  lumio_reject_reset(s);
+	  return (LUMIO_REJECT_EDGE);
+	}
+      return (LUMIO_REJECT_NONE);
+    }
+
+  switch (s->state)
+    {
+    case LUMIO_REJECT_IDLE:
+      if (edge && (contact->x < edge || contact->y < edge ||
+		   contact->x + edge > max_coord || contact->y + edge > max_coord))
+	{
+	  s->state = LUMIO_REJECT_DROPPED;
+	  return (LUMIO_REJECT_EDGE);
+	}
+      s->x = contact->x;
+      s->y = contact->y;
+      s->reports = 1;
+      if (config->min_reports > 1)
+	{
+	  s->state = LUMIO_REJECT_PENDING;
+	  return (LUMIO_REJECT_HELD);
+	}
+      s->state = LUMIO_REJECT_ACTIVE;
+      return (LUMIO_REJECT_NONE);
+
+    case LUMIO_REJECT_DROPPED:
+      return (LUMIO_REJECT_EDGE);
+    }
+
+  if (s->reports < 0xffff)
+    ++s->reports;
+
+  /* A jump is only believed when the next report lands near it */
+  if (config->max_jump && s->reports > 1 &&
+      !lumio_reject_near(contact->x, contact->y, s->x, s->y, config->max_jump) &&
+      !(s->jumped && lumio_reject_near(contact->x, contact->y, s->jump_x,
+				       s->jump_y, config->max_jump)))
+    {
+      s->jump_x = contact->x;
+      s->jump_y = contact->y;
+      s->jumped = 1;
+      return (s->state == LUMIO_REJECT_PENDING ? LUMIO_REJECT_HELD :
+	      LUMIO_REJECT_JUMP);
+    }
+  s->jumped = 0;
+  s->x = contact->x;
+  s->y = contact->y;
+
+  if (s->state == LUMIO_REJECT_PENDING)
+    {
+      if (s->reports < config->min_reports)
+	return (LUMIO_REJECT_HELD);
+      s->state = LUMIO_REJECT_ACTIVE;
+    }
+
+  return (LUMIO_REJECT_NONE);
+}
+
+#endif /* !LUMIO_REJECT_H_ */
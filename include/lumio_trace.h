@@ -0,0 +1,584 @@
+/*
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lumio_trace.h
+ * @author Quentin Casasnovas
+ * @brief The lumio trace format.
+ *
+ *	Traces hold the raw reports of a touchscreen, byte for byte, with the
+ * time each one was received. They are meant for recordings lasting hours or
+ * days in the field, so they are compact and can be written and read as a
+ * stream:
+ * - a LUMIO_TRACE_HEADER_SIZE bytes header gives the version of the format,
+ *   the usb ids and firmware of the touchscreen, the size of its reports and
+ *   the resolution of the timestamps (tick_us);
+ * - then come blocks of reports, each one starting with a
+ *   LUMIO_TRACE_BLOCK_HEADER_SIZE bytes header holding its size, how many
+ *   reports it has and the CRC-32 of its payload.
+ *
+ *	Blocks stand on their own: the payload starts with the time of its first
+ * report, in ticks since the start of the trace, so that a damaged block is
+ * skipped without losing the rest of the trace. Each report is then:
+ * - a varint, the change of the time since the previous report
+ *   (zigzag-encoded), shifted left by one;
+ * - a varint, the mask of the bytes which differ from the previous report;
+ * - the bytes which differ, xored with the previous report.
+ * A report identical to the previous one and coming after the same interval
+ * is not stored: they are counted instead, and the count is stored as a
+ * single varint with its lowest bit set. A finger resting on the screen costs
+ * nothing but that count, a moving one a few bytes per report.
+ *
+ *	Everything is little endian. This file is shared by the recording,
+ * conversion and replay tools, the codec itself only depends on linux/types.h.
+ */
+
+#ifndef LUMIO_TRACE_H_
+# define LUMIO_TRACE_H_
+
+# include <linux/types.h>
+
+# include "lumio_protocol.h"
+
+# ifndef __KERNEL__
+#  include <stdio.h>
+# endif
+
+/** @brief First bytes of a trace. */
+# define LUMIO_TRACE_MAGIC		"LUMIOTRC"
+# define LUMIO_TRACE_VERSION		1
+# define LUMIO_TRACE_HEADER_SIZE	64
+/** @brief Length of the name of the source of the trace, with the nul. */
+# define LUMIO_TRACE_SOURCE_SIZE	28
+
+/** @brief Resolution the tools record with unless told otherwise, in us. */
+# define LUMIO_TRACE_DEFAULT_TICK	100
+
+/** @brief First bytes of a block, "LTBK". */
+# define LUMIO_TRACE_BLOCK_MAGIC	0x4b42544c
+# define LUMIO_TRACE_BLOCK_HEADER_SIZE	16
+/** @brief Largest payload of a block. */
+# define LUMIO_TRACE_MAX_BLOCK		65536
+/** @brief Longest a report takes in a block: two varints and the report. */
+# define LUMIO_TRACE_MAX_RECORD		(10 + 10 + LUMIO_REPORT_SIZE)
+
+/** @brief Some bytes of the reports have been rebuilt (dmesg imports). */
+# define LUMIO_TRACE_REBUILT		(1 << 0)
+
+/**
+ * @brief What the header of a trace tells.
+ */
+struct			lumio_trace_info
+{
+  __u16			vid; /**< 0 if unknown. */
+  __u16			pid;
+  __u8			firmware; /**< One of the LUMIO_FIRMWARE_* constants. */
+  __u8			flags; /**< LUMIO_TRACE_* flags. */
+  __u16			report_size;
+  __u16			tick_us; /**< Resolution of the timestamps. */
+  __u64			start_us; /**< Wall clock at the start, 0 if unknown. */
+  char			source[LUMIO_TRACE_SOURCE_SIZE]; /**< What recorded it. */
+};
+
+/**
+ * @brief Writes reports as blocks.
+ *
+ *	block holds the block being filled, its header first: once
+ * lumio_trace_seal() has returned its length it is ready to be written.
+ */
+struct			lumio_trace_encoder
+{
+  __u32			report_size;
+  __u32			tick_us;
+  __u32			size; /**< Bytes of payload used. */
+  __u32			nb_reports;
+  __u32			run; /**< Repeats of the previous report not stored yet. */
+  __u32			dt; /**< Ticks between the last two reports. */
+  __u64			last; /**< Time of the previous report, in ticks. */
+  __u8			prev[LUMIO_REPORT_SIZE];
+  __u8			block[LUMIO_TRACE_BLOCK_HEADER_SIZE + LUMIO_TRACE_MAX_BLOCK];
+};
+
+/**
+ * @brief Reads back the reports of a block.
+ */
+struct			lumio_trace_decoder
+{
+  const __u8*		p;
+  const __u8*		end;
+  __u32			report_size;
+  __u32			tick_us;
+  __u32			left; /**< Reports of the block not read yet. */
+  __u32			run;
+  __u32			dt;
+  __u64			time; /**< In ticks since the start of the trace. */
+  __u64			time_us; /**< The same, in us. */
+  __u8			report[LUMIO_REPORT_SIZE]; /**< The last report read. */
+};
+
+static inline void	lumio_trace_put16(__u8* p, __u16 v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static inline void	lumio_trace_put32(__u8* p, __u32 v)
+{
+  lumio_trace_put16(p, v & 0xffff);
+  lumio_trace_put16(p + 2, v >> 16);
+}
+
+static inline __u16	lumio_trace_get16(const __u8* p)
+{
+  return (p[0] | (p[1] << 8));
+}
+
+static inline __u32	lumio_trace_get32(const __u8* p)
+{
+  return (lumio_trace_get16(p) | ((__u32) lumio_trace_get16(p + 2) << 16));
+}
+
+/**
+ * @brief CRC-32 (IEEE 802.3), four bits at a time.
+ */
+static inline __u32	lumio_trace_crc32(const __u8* buf, __u32 len)
+{
+  static const __u32	table[16] =
+    {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+      0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+      0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+  __u32			crc = 0xffffffff;
+  __u32			i = 0;
+
+  for (i = 0; i < len; ++i)
+    {
+      crc ^= buf[i];
+      crc = (crc >> 4) ^ table[crc & 0xf];
+      crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+
+  return (~crc);
+}
+
+/**
+ * @return The number of bytes written, 10 at most.
+ */
+static inline __u32	lumio_trace_put_varint(__u8* p, __u64 v)
+{
+  __u32			len = 0;
+
+  while (v >= 0x80)
+    {
+      p[len++] = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+  p[len++] = v;
+
+  return (len);
+}
+
+/**
+ * @return 0, or -1 if the varint goes past end.
+ */
+static inline int	lumio_trace_get_varint(const __u8**	p,
+					       const __u8*	end,
+					       __u64*		v)
+{
+  __u32			shift = 0;
+
+  *v = 0;
+  while (*p < end && shift < 64)
+    {
+      *v |= (__u64) (**p & 0x7f) << shift;
+      if (!(*(*p)++ & 0x80))
+	return (0);
+      shift += 7;
+    }
+
+  return (-1);
+}
+
+static inline void	lumio_trace_put_header(__u8*				header,
+					       const struct lumio_trace_info*	info)
+{
+  __u32			i = 0;
+
+  memset(header, 0x0, LUMIO_TRACE_HEADER_SIZE);
+  memcpy(header, LUMIO_TRACE_MAGIC, 8);
+  lumio_trace_put16(header + 8, LUMIO_TRACE_VERSION);
+  lumio_trace_put16(header + 10, LUMIO_TRACE_HEADER_SIZE);
+  lumio_trace_put16(header + 12, info->vid);
+  lumio_trace_put16(header + 14, info->pid);
+  header[16] = info->firmware;
+  header[17] = info->flags;
+  lumio_trace_put16(header + 18, info->report_size);
+  lumio_trace_put16(header + 20, info->tick_us);
+  lumio_trace_put32(header + 24, info->start_us & 0xffffffff);
+  lumio_trace_put32(header + 28, info->start_us >> 32);
+  for (i = 0; i < LUMIO_TRACE_SOURCE_SIZE - 1 && info->source[i]; ++i)
+    header[32 + i] = info->source[i];
+  lumio_trace_put32(header + 60, lumio_trace_crc32(header, 60));
+}
+
+/**
+ * @brief Reads the header of a trace.
+ *
+ * @return 0, or -1 if it's not a trace, a damaged one, or one of a later
+ * version.
+ */
+static inline int	lumio_trace_get_header(const __u8*		header,
+					       struct lumio_trace_info*	info)
+{
+  if (memcmp(header, LUMIO_TRACE_MAGIC, 8) ||
+      lumio_trace_get16(header + 8) != LUMIO_TRACE_VERSION ||
+      lumio_trace_get16(header + 10) != LUMIO_TRACE_HEADER_SIZE ||
+      lumio_trace_get32(header + 60) != lumio_trace_crc32(header, 60))
+    return (-1);
+
+  memset(info, 0x0, sizeof (*info));
+  info->vid = lumio_trace_get16(header + 12);
+  info->pid = lumio_trace_get16(header + 14);
+  info->firmware = header[16];
+  info->flags = header[17];
+  info->report_size = lumio_trace_get16(header + 18);
+  info->tick_us = lumio_trace_get16(header + 20);
+  info->start_us = lumio_trace_get32(header + 24) |
+    ((__u64) lumio_trace_get32(header + 28) << 32);
+  memcpy(info->source, header + 32, LUMIO_TRACE_SOURCE_SIZE - 1);
+  if (info->report_size == 0 || info->report_size > LUMIO_REPORT_SIZE ||
+      info->tick_us == 0)
+    return (-1);
+
+  return (0);
+}
+
+static inline void	lumio_trace_encoder_init(struct lumio_trace_encoder*	enc,
+						 const struct lumio_trace_info*	info)
+{
+  enc->report_size = info->report_size;
+  enc->tick_us = info->tick_us;
+  enc->size = 0;
+  enc->nb_reports = 0;
+  enc->run = 0;
+}
+
+static inline void	lumio_trace_flush_run(struct lumio_trace_encoder* enc)
+{
+  __u8*			payload = enc->block + LUMIO_TRACE_BLOCK_HEADER_SIZE;
+
+  if (enc->run)
+    enc->size += lumio_trace_put_varint(payload + enc->size,
+					((__u64) enc->run << 1) | 1);
+  enc->run = 0;
+}
+
+/**
+ * @brief Adds a report to the block.
+ *
+ * @param time_us When it was received, in us since the start of the trace.
+ * Going back in time is taken as no time at all.
+ * @return 0, or -1 if the block is full, or the report comes too long after
+ * the previous one: the block must be sealed and written before trying again.
+ */
+static inline int	lumio_trace_encode(struct lumio_trace_encoder*	enc,
+					   const __u8*			report,
+					   __u64			time_us)
+{
+  __u8*			payload = enc->block + LUMIO_TRACE_BLOCK_HEADER_SIZE;
+  __u64			time = time_us / enc->tick_us;
+  __u64			mask = 0;
+  __s64			ddt = 0;
+  __u32			dt = 0;
+  __u32			i = 0;
+
+  /*
+   * Room for the pending run, the report and a run after it. Long silences
+   * start a new block too, so that the intervals fit in 30 bits.
+   */
+  if (enc->size + 3 * LUMIO_TRACE_MAX_RECORD > LUMIO_TRACE_MAX_BLOCK ||
+      enc->nb_reports == 0xffffffff ||
+      (enc->nb_reports && time > enc->last && time - enc->last > 0x3fffffff))
+    return (-1);
+
+  if (enc->nb_reports == 0)
+    {
+      enc->size = lumio_trace_put_varint(payload, time);
+      enc->last = time;
+      enc->dt = 0;
+      memset(enc->prev, 0x0, sizeof (enc->prev));
+    }
+  dt = time > enc->last ? time - enc->last : 0;
+  enc->last += dt;
+  ++enc->nb_reports;
+
+  for (i = 0; i < enc->report_size; ++i)
+    if (report[i] != enc->prev[i])
+      mask |= (__u64) 1 << i;
+  if (mask == 0 && dt == enc->dt && enc->nb_reports > 1 &&
+      enc->run < 0x7fffffff)
+    {
+      ++enc->run;
+      return (0);
+    }
+  lumio_trace_flush_run(enc);
+
+  ddt = (__s64) dt - enc->dt;
+  enc->dt = dt;
+  enc->size += lumio_trace_put_varint(payload + enc->size,
+				      (((__u64) ddt << 1) ^ (ddt >> 63)) << 1);
+  enc->size += lumio_trace_put_varint(payload + enc->size, mask);
+  for (i = 0; i < enc->report_size; ++i)
+    if (mask & ((__u64) 1 << i))
+      {
+	payload[enc->size++] = report[i] ^ enc->prev[i];
+	enc->prev[i] = report[i];
+      }
+
+  return (0);
+}
+
+/**
+ * @brief Ends the block, the next report starts a new one.
+ *
+ * @return The number of bytes of block to write, 0 if there is no report.
+ */
+static inline __u32	lumio_trace_seal(struct lumio_trace_encoder* enc)
+{
+  __u32			size = 0;
+
+  if (enc->nb_reports == 0)
+    return (0);
+
+  lumio_trace_flush_run(enc);
+  lumio_trace_put32(enc->block, LUMIO_TRACE_BLOCK_MAGIC);
+  lumio_trace_put32(enc->block + 4, enc->size);
+  lumio_trace_put32(enc->block + 8, enc->nb_reports);
+  lumio_trace_put32(enc->block + 12,
+		    lumio_trace_crc32(enc->block + LUMIO_TRACE_BLOCK_HEADER_SIZE,
+				      enc->size));
+  size = LUMIO_TRACE_BLOCK_HEADER_SIZE + enc->size;
+  enc->size = 0;
+  enc->nb_reports = 0;
+
+  return (size);
+}
+
+/**
+ * @brief Reads the header of a block.
+ *
+ * @return The size of its payload, or -1 if it isn't one.
+ */
+static inline int	lumio_trace_block_size(const __u8* header)
+{
+  __u32			size = lumio_trace_get32(header + 4);
+
+  if (lumio_trace_get32(header) != LUMIO_TRACE_BLOCK_MAGIC ||
+      size == 0 || size > LUMIO_TRACE_MAX_BLOCK)
+    return (-1);
+
+  return (size);
+}
+
+/**
+ * @brief Starts reading a block.
+ *
+ * @param block The header of the block, followed by its payload.
+ * @return 0, or -1 if the block is damaged.
+ */
+static inline int	lumio_trace_begin(struct lumio_trace_decoder*		dec,
+					  const struct lumio_trace_info*	info,
+					  const __u8*				block)
+{
+  int			size = lumio_trace_block_size(block);
+
+  if (size < 0 ||
+      lumio_trace_get32(block + 12) !=
+      lumio_trace_crc32(block + LUMIO_TRACE_BLOCK_HEADER_SIZE, size))
+    return (-1);
+
+  dec->p = block + LUMIO_TRACE_BLOCK_HEADER_SIZE;
+  dec->end = dec->p + size;
+  dec->report_size = info->report_size;
+  dec->tick_us = info->tick_us;
+  dec->left = lumio_trace_get32(block + 8);
+  dec->run = 0;
+  dec->dt = 0;
+  memset(dec->report, 0x0, sizeof (dec->report));
+
+  return (lumio_trace_get_varint(&dec->p, dec->end, &dec->time));
+}
+
+/**
+ * @brief Reads the next report of the block, in dec->report.
+ *
+ * @return 1, 0 at the end of the block, or -1 if the block doesn't make sense.
+ */
+static inline int	lumio_trace_next(struct lumio_trace_decoder* dec)
+{
+  __u64			v = 0;
+  __u64			mask = 0;
+  __s64			ddt = 0;
+  __u32			i = 0;
+
+  if (dec->left == 0)
+    return (0);
+  --dec->left;
+
+  if (dec->run == 0)
+    {
+      if (lumio_trace_get_varint(&dec->p, dec->end, &v) < 0)
+	return (-1);
+      if (v & 1)
+	{
+	  if ((v >> 1) == 0 || (v >> 1) > dec->left + 1)
+	    return (-1);
+	  dec->run = v >> 1;
+	}
+      else
+	{
+	  v >>= 1;
+	  ddt = (__s64) (v >> 1) ^ -(__s64) (v & 1);
+	  if ((__s64) dec->dt + ddt < 0 ||
+	      lumio_trace_get_varint(&dec->p, dec->end, &mask) < 0 ||
+	      (dec->report_size < 64 && (mask >> dec->report_size)))
+	    return (-1);
+	  dec->dt += ddt;
+	  for (i = 0; i < dec->report_size; ++i)
+	    if (mask & ((__u64) 1 << i))
+	      {
+		if (dec->p == dec->end)
+		  return (-1);
+		dec->report[i] ^= *dec->p++;
+	      }
+	  dec->time += dec->dt;
+	  dec->time_us = dec->time * dec->tick_us;
+	  return (1);
+	}
+    }
+
+  --dec->run;
+  dec->time += dec->dt;
+  dec->time_us = dec->time * dec->tick_us;
+
+  return (1);
+}
+
+/**
+ * @brief Finds the next block of a trace held in memory and starts decoding
+ * it.
+ *
+ *	The counterpart of lumio_trace_read_block() for mapped traces: damaged
+ * blocks are skipped the same way, and the decoder reads the block in place.
+ *
+ * @param p Where to look from, moved past the block.
+ * @param end The end of the trace.
+ * @param damaged Incremented for each damaged block skipped.
+ * @return 1, or 0 at the end of the trace.
+ */
+static inline int	lumio_trace_next_block(const __u8**			p,
+					       const __u8*			end,
+					       const struct lumio_trace_info*	info,
+					       struct lumio_trace_decoder*	dec,
+					       unsigned long*			damaged)
+{
+  int			size = 0;
+  int			lost = 0;
+
+  while (end - *p >= LUMIO_TRACE_BLOCK_HEADER_SIZE)
+    {
+      if ((size = lumio_trace_block_size(*p)) < 0)
+	{
+	  if (!lost)
+	    ++*damaged;
+	  lost = 1;
+	  ++*p;
+	  continue;
+	}
+      lost = 0;
+
+      if (end - *p - LUMIO_TRACE_BLOCK_HEADER_SIZE < size)
+	{
+	  ++*damaged;
+	  *p = end;
+	  return (0);
+	}
+      *p += LUMIO_TRACE_BLOCK_HEADER_SIZE + size;
+      if (lumio_trace_begin(dec, info, *p - LUMIO_TRACE_BLOCK_HEADER_SIZE -
+			    size) == 0)
+	return (1);
+      ++*damaged;
+    }
+
+  return (0);
+}
+
+# ifndef __KERNEL__
+
+/**
+ * @brief Reads the next block of a trace and starts decoding it.
+ *
+ *	Damaged blocks are skipped, looking for the next one byte after byte if
+ * even their header is, so that this works on pipes too.
+ *
+ * @param block A LUMIO_TRACE_BLOCK_HEADER_SIZE + LUMIO_TRACE_MAX_BLOCK
+ * buffer.
+ * @param damaged Incremented for each damaged block skipped.
+ * @return 1, or 0 at the end of the trace.
+ */
+static inline int	lumio_trace_read_block(FILE*				file,
+					       const struct lumio_trace_info*	info,
+					       __u8*				block,
+					       struct lumio_trace_decoder*	dec,
+					       unsigned long*			damaged)
+{
+  int			size = 0;
+  int			c = 0;
+
+  for (;;)
+    {
+      if (fread(block, LUMIO_TRACE_BLOCK_HEADER_SIZE, 1, file) != 1)
+	return (0);
+
+      if ((size = lumio_trace_block_size(block)) < 0)
+	{
+	  ++*damaged;
+	  do
+	    {
+	      if ((c = fgetc(file)) == EOF)
+		return (0);
+	      memmove(block, block + 1, LUMIO_TRACE_BLOCK_HEADER_SIZE - 1);
+	      block[LUMIO_TRACE_BLOCK_HEADER_SIZE - 1] = c;
+	    } while ((size = lumio_trace_block_size(block)) < 0);
+	}
+
+      if (fread(block + LUMIO_TRACE_BLOCK_HEADER_SIZE, size, 1, file) != 1)
+	{
+	  ++*damaged;
+	  return (0);
+	}
+      if (lumio_trace_begin(dec, info, block) == 0)
+	return (1);
+      ++*damaged;
+    }
+}
+
+# endif /* !__KERNEL__ */
+
+#endif /* !LUMIO_TRACE_H_ */
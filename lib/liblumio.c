@@ -0,0 +1,621 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file liblumio.c
+ * @author Quentin Casasnovas
+ * @brief Client library of the lumio touchscreens.
+ *
+ *	Panels are found by name among the evdev devices, rather than through
+ * the /dev/input/lumio* links, which only tell apart a single touchscreen.
+ * The two fake mice of a touchscreen are paired by their physical path (the
+ * usb bus path the driver gives them). Each report of the touchscreen makes
+ * each fake mouse whose finger changed send a packet; the packets of both
+ * mice are merged in time order, and those less than LUMIO_MERGE_US apart
+ * make a single frame. Multitouch devices (protocol A) already send a packet
+ * per frame, only the lifts have to be found out, from the ids missing since
+ * the previous frame.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "liblumio.h"
+
+#ifndef input_event_sec
+# define input_event_sec	time.tv_sec
+# define input_event_usec	time.tv_usec
+#endif
+
+/** @brief Events read per read() call. */
+#define LUMIO_BATCH		256
+/** @brief Packets of the two fake mice closer than that make one frame. */
+#define LUMIO_MERGE_US		500
+#define LUMIO_FAKE_MOUSE1	"Lumio touchscreen1"
+#define LUMIO_FAKE_MOUSE2	"Lumio touchscreen2"
+
+#define TEST_BIT(Bit, Array)	\
+  ((Array)[(Bit) / (8 * sizeof (long))] & (1UL << ((Bit) % (8 * sizeof (long)))))
+
+/**
+ * @brief The state of a contact, as last reported.
+ */
+typedef struct			lumio_state_s
+{
+  struct lumio_frame_contact	contact;
+  int				changed; /**< Reported since the last frame. */
+}				lumio_state_t;
+
+typedef struct			lumio_device_s
+{
+  char				path[PATH_MAX];
+  int				fd; /**< -1 once the device is gone. */
+  unsigned int			panel;
+  int				mouse; /**< 0 or 1 for the fake mice, -1 otherwise. */
+  struct input_event		events[LUMIO_BATCH];
+  unsigned int			nb_events;
+  unsigned int			pos;
+  int				drained; /**< Nothing more to read for now. */
+  lumio_state_t			next; /**< Being reported (fake mice). */
+  int				has_raw; /**< Reports ABS_RX and ABS_RY. */
+  struct lumio_frame_contact	mt; /**< Being reported (multitouch). */
+  int				mt_has_position;
+}				lumio_device_t;
+
+typedef struct			lumio_panel_s
+{
+  struct lumio_panel_info	info;
+  int				devices[2]; /**< Index of the devices, -1 if none. */
+  lumio_state_t			mice[2]; /**< Fake mice. */
+  int				pending; /**< A frame is being merged. */
+  uint64_t			pending_us;
+  struct lumio_frame		frame; /**< Multitouch frame being built. */
+  struct lumio_frame		previous; /**< Last multitouch frame. */
+}				lumio_panel_t;
+
+struct				lumio
+{
+  int				epfd;
+  lumio_device_t*		devices;
+  unsigned int			nb_devices;
+  lumio_panel_t*		panels;
+  unsigned int			nb_panels;
+  struct lumio_frame*		queue; /**< Frames not read yet. */
+  unsigned int			queue_start;
+  unsigned int			queue_end;
+  unsigned int			queue_size;
+  uint32_t			next_id;
+};
+
+static uint64_t			event_us(const struct input_event* ev)
+{
+  return ((uint64_t) ev->input_event_sec * 1000000 + ev->input_event_usec);
+}
+
+static struct lumio_frame*	queue_frame(lumio_t* lumio)
+{
+  struct lumio_frame*		queue = NULL;
+
+  if (lumio->queue_end == lumio->queue_size)
+    {
+      if (lumio->queue_start > 0)
+	{
+	  memmove(lumio->queue, lumio->queue + lumio->queue_start,
+		  (lumio->queue_end - lumio->queue_start) * sizeof (*queue));
+	  lumio->queue_end -= lumio->queue_start;
+	  lumio->queue_start = 0;
+	}
+      else
+	{
+	  if (!(queue = realloc(lumio->queue, (lumio->queue_size ? 2 *
+					       lumio->queue_size : 64) *
+				sizeof (*queue))))
+	    return (NULL);
+	  lumio->queue = queue;
+	  lumio->queue_size = lumio->queue_size ? 2 * lumio->queue_size : 64;
+	}
+    }
+
+  return (&lumio->queue[lumio->queue_end++]);
+}
+
+/**
+ * @brief Queues the frame the fake mice packets have been merged into.
+ */
+static void			flush_mice(lumio_t* lumio, lumio_panel_t* panel)
+{
+  struct lumio_frame*		frame = NULL;
+  int				i = 0;
+
+  if (!panel->pending || !(frame = queue_frame(lumio)))
+    return;
+
+  frame->time_us = panel->pending_us;
+  frame->panel = panel - lumio->panels;
+  frame->nb_contacts = 0;
+  for (i = 0; i < 2; ++i)
+    {
+      if (panel->mice[i].contact.down || panel->mice[i].changed)
+	frame->contacts[frame->nb_contacts++] = panel->mice[i].contact;
+      panel->mice[i].changed = 0;
+    }
+  panel->pending = 0;
+}
+
+/**
+ * @brief Handles an event of a fake mouse.
+ *
+ * @return 1 at the end of a packet.
+ */
+static int			mouse_event(lumio_t*			lumio,
+					    lumio_device_t*		dev,
+					    const struct input_event*	ev)
+{
+  lumio_panel_t*		panel = &lumio->panels[dev->panel];
+  lumio_state_t*		state = &panel->mice[dev->mouse];
+  uint64_t			time_us = event_us(ev);
+
+  if (ev->type == EV_KEY && ev->code == BTN_LEFT)
+    dev->next.contact.down = ev->value != 0;
+  else if (ev->type == EV_ABS && ev->code == ABS_X)
+    dev->next.contact.x = ev->value;
+  else if (ev->type == EV_ABS && ev->code == ABS_Y)
+    dev->next.contact.y = ev->value;
+  else if (ev->type == EV_ABS && ev->code == ABS_RX)
+    dev->next.contact.raw_x = ev->value;
+  else if (ev->type == EV_ABS && ev->code == ABS_RY)
+    dev->next.contact.raw_y = ev->value;
+  else if (ev->type == EV_SYN && ev->code == SYN_REPORT)
+    {
+      /* A second packet of the same mouse is the next report */
+      if (panel->pending && (state->changed ||
+			     time_us - panel->pending_us > LUMIO_MERGE_US))
+	flush_mice(lumio, panel);
+      if (!panel->pending)
+	{
+	  panel->pending = 1;
+	  panel->pending_us = time_us;
+	}
+
+      if (dev->next.contact.down && !state->contact.down)
+	dev->next.contact.id = lumio->next_id++;
+      if (!dev->has_raw)
+	{
+	  dev->next.contact.raw_x = dev->next.contact.x;
+	  dev->next.contact.raw_y = dev->next.contact.y;
+	}
+      state->contact = dev->next.contact;
+      state->changed = 1;
+      return (1);
+    }
+
+  return (0);
+}
+
+/**
+ * @brief Handles an event of a multitouch device.
+ *
+ * @return 1 at the end of a packet.
+ */
+static int			mt_event(lumio_t*			lumio,
+					 lumio_device_t*		dev,
+					 const struct input_event*	ev)
+{
+  lumio_panel_t*		panel = &lumio->panels[dev->panel];
+  struct lumio_frame*		frame = &panel->frame;
+  struct lumio_frame*		queued = NULL;
+  unsigned int			i = 0;
+  unsigned int			j = 0;
+
+  if (ev->type == EV_ABS)
+    switch (ev->code)
+      {
+      case ABS_MT_TRACKING_ID:
+	dev->mt.id = ev->value;
+	break;
+      case ABS_MT_POSITION_X:
+	dev->mt.x = dev->mt.raw_x = ev->value;
+	dev->mt_has_position = 1;
+	break;
+      case ABS_MT_POSITION_Y:
+	dev->mt.y = dev->mt.raw_y = ev->value;
+	dev->mt_has_position = 1;
+	break;
+      }
+  else if (ev->type == EV_SYN && ev->code == SYN_MT_REPORT)
+    {
+      if (dev->mt_has_position && frame->nb_contacts < LUMIO_FRAME_MAX_CONTACTS)
+	{
+	  dev->mt.down = 1;
+	  frame->contacts[frame->nb_contacts++] = dev->mt;
+	}
+      memset(&dev->mt, 0x0, sizeof (dev->mt));
+      dev->mt_has_position = 0;
+    }
+  else if (ev->type == EV_SYN && ev->code == SYN_REPORT)
+    {
+      /* The contacts of the previous frame which are missing are lifted */
+      for (i = 0; i < panel->previous.nb_contacts; ++i)
+	{
+	  for (j = 0; j < frame->nb_contacts; ++j)
+	    if (frame->contacts[j].id == panel->previous.contacts[i].id)
+	      break;
+	  if (j == frame->nb_contacts &&
+	      frame->nb_contacts < LUMIO_FRAME_MAX_CONTACTS)
+	    {
+	      frame->contacts[frame->nb_contacts] = panel->previous.contacts[i];
+	      frame->contacts[frame->nb_contacts++].down = 0;
+	    }
+	}
+      frame->time_us = event_us(ev);
+      frame->panel = dev->panel;
+      if (frame->nb_contacts > 0 && (queued = queue_frame(lumio)))
+	*queued = *frame;
+
+      panel->previous.nb_contacts = 0;
+      for (i = 0; i < frame->nb_contacts; ++i)
+	if (frame->contacts[i].down)
+	  panel->previous.contacts[panel->previous.nb_contacts++] =
+	    frame->contacts[i];
+      frame->nb_contacts = 0;
+      return (1);
+    }
+
+  return (0);
+}
+
+/**
+ * @brief Closes a device which is gone.
+ *
+ *	Its place in the panel is freed, for the device to take it again once
+ * plugged back.
+ */
+static void			disconnect(lumio_t* lumio, lumio_device_t* dev)
+{
+  lumio_panel_t*		panel = &lumio->panels[dev->panel];
+  int				i = 0;
+
+  close(dev->fd);
+  dev->fd = -1;
+  dev->drained = 1;
+  panel->devices[dev->mouse >= 0 ? dev->mouse : 0] = -1;
+
+  panel->info.connected = 0;
+  for (i = 0; i < 2; ++i)
+    if (panel->devices[i] >= 0 && lumio->devices[panel->devices[i]].fd >= 0)
+      panel->info.connected = 1;
+}
+
+/**
+ * @brief Reads the next batch of events of a device, if it has none left.
+ */
+static void			refill(lumio_t* lumio, lumio_device_t* dev)
+{
+  ssize_t			size = 0;
+
+  if (dev->pos < dev->nb_events || dev->drained)
+    return;
+
+  dev->pos = dev->nb_events = 0;
+  size = read(dev->fd, dev->events, sizeof (dev->events));
+  if (size > 0)
+    dev->nb_events = size / sizeof (struct input_event);
+  else
+    {
+      dev->drained = 1;
+      if (size == 0 || (errno != EAGAIN && errno != EINTR))
+	disconnect(lumio, dev);
+    }
+}
+
+/**
+ * @brief Turns all the events a panel has into frames.
+ *
+ *	Packets of the devices of the panel are handled in time order: the
+ * device whose next event is the oldest goes first, for a whole packet.
+ */
+static void			pump(lumio_t* lumio, lumio_panel_t* panel)
+{
+  lumio_device_t*		dev = NULL;
+  lumio_device_t*		next = NULL;
+  int				i = 0;
+  int				end = 0;
+
+  for (i = 0; i < 2; ++i)
+    if (panel->devices[i] >= 0 && lumio->devices[panel->devices[i]].fd >= 0)
+      lumio->devices[panel->devices[i]].drained = 0;
+
+  for (;;)
+    {
+      next = NULL;
+      for (i = 0; i < 2; ++i)
+	{
+	  if (panel->devices[i] < 0)
+	    continue;
+	  dev = &lumio->devices[panel->devices[i]];
+	  refill(lumio, dev);
+	  if (dev->pos < dev->nb_events &&
+	      (!next || event_us(&dev->events[dev->pos]) <
+	       event_us(&next->events[next->pos])))
+	    next = dev;
+	}
+      if (!next)
+	break;
+
+      for (end = 0; !end && next->pos < next->nb_events; ++next->pos)
+	end = next->mouse >= 0 ?
+	  mouse_event(lumio, next, &next->events[next->pos]) :
+	  mt_event(lumio, next, &next->events[next->pos]);
+    }
+
+  flush_mice(lumio, panel);
+}
+
+/**
+ * @brief Opens a device, if it is a lumio one.
+ *
+ *	A device joins the panel it was part of before being unplugged, or the
+ * panel of the other fake mouse of its touchscreen, found by their phys.
+ *
+ * @return 1 if a new panel has been found, or one came back, 0 if not, -1 on
+ * failure.
+ */
+static int			probe_device(lumio_t* lumio, const char* path)
+{
+  unsigned long			abs_bits[(ABS_MAX + 8 * sizeof (long)) /
+					 (8 * sizeof (long))];
+  struct input_absinfo		abs;
+  struct epoll_event		ev;
+  char				name[LUMIO_NAME_SIZE];
+  char				phys[LUMIO_NAME_SIZE];
+  lumio_device_t*		dev = NULL;
+  lumio_panel_t*		panel = NULL;
+  void*				grown = NULL;
+  unsigned int			p = 0;
+  int				mouse = -1;
+  int				fd = -1;
+  int				ret = 0;
+
+  if ((fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+    return (0);
+  memset(name, 0x0, sizeof (name));
+  memset(phys, 0x0, sizeof (phys));
+  memset(abs_bits, 0x0, sizeof (abs_bits));
+  if (ioctl(fd, EVIOCGNAME(sizeof (name) - 1), name) < 0 ||
+      strncmp(name, "Lumio ", 6) ||
+      ioctl(fd, EVIOCGBIT(EV_ABS, sizeof (abs_bits)), abs_bits) < 0)
+    {
+      close(fd);
+      return (0);
+    }
+  ioctl(fd, EVIOCGPHYS(sizeof (phys) - 1), phys);
+
+  if (!strcmp(name, LUMIO_FAKE_MOUSE1))
+    mouse = 0;
+  else if (!strcmp(name, LUMIO_FAKE_MOUSE2))
+    mouse = 1;
+  else if (!TEST_BIT(ABS_MT_POSITION_X, abs_bits))
+    {
+      close(fd);
+      return (0);
+    }
+
+  /* The other fake mouse of the touchscreen may already be there */
+  for (p = 0; p < lumio->nb_panels; ++p)
+    {
+      panel = &lumio->panels[p];
+      if (panel->info.type == (mouse >= 0 ? LUMIO_PANEL_FAKE_MICE :
+			       LUMIO_PANEL_MULTITOUCH) &&
+	  panel->devices[mouse >= 0 ? mouse : 0] < 0 &&
+	  !strcmp(panel->info.phys, phys) &&
+	  (mouse >= 0 || !strcmp(panel->info.name, name)))
+	break;
+    }
+  if (p < lumio->nb_panels)
+    ret = !lumio->panels[p].info.connected;
+  else
+    {
+      if (!(grown = realloc(lumio->panels, (lumio->nb_panels + 1) *
+			    sizeof (*panel))))
+	goto error;
+      lumio->panels = grown;
+      p = lumio->nb_panels++;
+      panel = &lumio->panels[p];
+      memset(panel, 0x0, sizeof (*panel));
+      panel->devices[0] = panel->devices[1] = -1;
+      panel->info.type = mouse >= 0 ? LUMIO_PANEL_FAKE_MICE :
+	LUMIO_PANEL_MULTITOUCH;
+      strcpy(panel->info.name, mouse >= 0 ? "Lumio touchscreen" : name);
+      strcpy(panel->info.phys, phys);
+      memset(&abs, 0x0, sizeof (abs));
+      ioctl(fd, EVIOCGABS(mouse >= 0 ? ABS_X : ABS_MT_POSITION_X), &abs);
+      panel->info.max_x = abs.maximum;
+      ioctl(fd, EVIOCGABS(mouse >= 0 ? ABS_Y : ABS_MT_POSITION_Y), &abs);
+      panel->info.max_y = abs.maximum;
+      ret = 1;
+    }
+  panel = &lumio->panels[p];
+  panel->info.connected = 1;
+
+  if (!(grown = realloc(lumio->devices, (lumio->nb_devices + 1) *
+			sizeof (*dev))))
+    goto error;
+  lumio->devices = grown;
+  dev = &lumio->devices[lumio->nb_devices];
+  memset(dev, 0x0, sizeof (*dev));
+  snprintf(dev->path, sizeof (dev->path), "%s", path);
+  dev->fd = fd;
+  dev->panel = p;
+  dev->mouse = mouse;
+  dev->has_raw = mouse >= 0 && TEST_BIT(ABS_RX, abs_bits);
+  panel->devices[mouse >= 0 ? mouse : 0] = lumio->nb_devices;
+
+  memset(&ev, 0x0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = lumio->nb_devices++;
+  if (epoll_ctl(lumio->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      disconnect(lumio, dev);
+      return (-1);
+    }
+
+  return (ret);
+
+ error:
+  close(fd);
+  return (-1);
+}
+
+static int			is_event_device(const struct dirent* entry)
+{
+  return (!strncmp(entry->d_name, "event", 5));
+}
+
+int				lumio_rescan(lumio_t* lumio)
+{
+  struct dirent**		entries = NULL;
+  char				path[PATH_MAX];
+  unsigned int			d = 0;
+  int				version = 0;
+  int				nb_entries = 0;
+  int				found = 0;
+  int				ret = 0;
+  int				i = 0;
+
+  /*
+   * Devices unplugged since the last scan, which may not have been read yet:
+   * their node may already be the one of the device plugged back.
+   */
+  for (d = 0; d < lumio->nb_devices; ++d)
+    if (lumio->devices[d].fd >= 0 &&
+	(access(lumio->devices[d].path, F_OK) < 0 ||
+	 ioctl(lumio->devices[d].fd, EVIOCGVERSION, &version) < 0))
+      disconnect(lumio, &lumio->devices[d]);
+
+  if ((nb_entries = scandir("/dev/input", &entries, is_event_device,
+			    alphasort)) < 0)
+    return (-1);
+
+  for (i = 0; i < nb_entries; ++i)
+    {
+      snprintf(path, sizeof (path), "/dev/input/%s", entries[i]->d_name);
+      for (d = 0; d < lumio->nb_devices; ++d)
+	if (lumio->devices[d].fd >= 0 && !strcmp(lumio->devices[d].path, path))
+	  break;
+      if (d == lumio->nb_devices && (ret = probe_device(lumio, path)) > 0)
+	found += ret;
+      free(entries[i]);
+    }
+  free(entries);
+
+  return (found);
+}
+
+lumio_t*			lumio_open(void)
+{
+  lumio_t*			lumio = NULL;
+
+  if (!(lumio = calloc(1, sizeof (*lumio))))
+    return (NULL);
+  if ((lumio->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      lumio_rescan(lumio) < 0)
+    {
+      lumio_close(lumio);
+      return (NULL);
+    }
+
+  return (lumio);
+}
+
+void				lumio_close(lumio_t* lumio)
+{
+  unsigned int			d = 0;
+
+  if (!lumio)
+    return;
+
+  for (d = 0; d < lumio->nb_devices; ++d)
+    if (lumio->devices[d].fd >= 0)
+      close(lumio->devices[d].fd);
+  if (lumio->epfd >= 0)
+    close(lumio->epfd);
+  free(lumio->devices);
+  free(lumio->panels);
+  free(lumio->queue);
+  free(lumio);
+}
+
+int				lumio_fd(lumio_t* lumio)
+{
+  return (lumio->epfd);
+}
+
+unsigned int			lumio_nb_panels(lumio_t* lumio)
+{
+  return (lumio->nb_panels);
+}
+
+int				lumio_panel(lumio_t*			lumio,
+					    unsigned int		panel,
+					    struct lumio_panel_info*	info)
+{
+  if (panel >= lumio->nb_panels)
+    return (-1);
+
+  *info = lumio->panels[panel].info;
+  return (0);
+}
+
+int				lumio_read(lumio_t*		lumio,
+					   struct lumio_frame*	frames,
+					   unsigned int		max)
+{
+  struct epoll_event		events[32];
+  unsigned int			n = 0;
+  int				nb_events = 0;
+  int				i = 0;
+
+  if (lumio->queue_start == lumio->queue_end)
+    {
+      lumio->queue_start = lumio->queue_end = 0;
+      if ((nb_events = epoll_wait(lumio->epfd, events, 32, 0)) < 0)
+	return (errno == EINTR ? 0 : -1);
+      for (i = 0; i < nb_events; ++i)
+	pump(lumio, &lumio->panels[lumio->devices[events[i].data.u32].panel]);
+    }
+
+  n = lumio->queue_end - lumio->queue_start;
+  if (n > max)
+    n = max;
+  memcpy(frames, lumio->queue + lumio->queue_start, n * sizeof (*frames));
+  lumio->queue_start += n;
+
+  return (n);
+}
@@ -0,0 +1,158 @@
+/*
+    (c) Quentin Casasnovas (quentin.casasnovas@gmail.com)
+
+    This file is part of lumio_driver.
+
+    lumio_driver is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    lumio_driver is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lumio_driver. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file liblumio.h
+ * @author Quentin Casasnovas
+ * @brief Client library of the lumio touchscreens.
+ *
+ *	liblumio finds every lumio input device, whoever created it (the fake
+ * mice of the driver, its video wall and partitions, or lumiod), and turns
+ * their events into frames: all the contacts of a panel at a given time, each
+ * one with an id it keeps until it is lifted.
+ *
+ *	A typical client:
+ *
+ *	lumio_t*		lumio = lumio_open();
+ *	struct lumio_frame	frames[64];
+ *	struct pollfd		pfd = { lumio_fd(lumio), POLLIN, 0 };
+ *
+ *	while (poll(&pfd, 1, -1) > 0)
+ *	  for (n = lumio_read(lumio, frames, 64), i = 0; i < n; ++i)
+ *	    draw(&frames[i]);
+ *
+ * lumio_fd() is an epoll descriptor, it can be added to the main loop of the
+ * client like any other. Events are read in batches, as many as available, and
+ * the frames a call to lumio_read() can't return are kept for the next one.
+ */
+
+#ifndef LIBLUMIO_H_
+# define LIBLUMIO_H_
+
+# include <stdint.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/** @brief Most contacts in a frame (a video wall of 16 panels). */
+# define LUMIO_FRAME_MAX_CONTACTS	32
+/** @brief Longest name of a panel. */
+# define LUMIO_NAME_SIZE		64
+
+/** @brief The two fake mice of a touchscreen driven by lumio_driver. */
+# define LUMIO_PANEL_FAKE_MICE		0
+/** @brief A multitouch device: video wall, partition or lumiod panel. */
+# define LUMIO_PANEL_MULTITOUCH		1
+
+typedef struct lumio		lumio_t;
+
+/**
+ * @brief A contact of a frame.
+ */
+struct				lumio_frame_contact
+{
+  uint32_t			id; /**< Kept from the contact going down until it's lifted. */
+  int32_t			x;
+  int32_t			y;
+  int32_t			raw_x; /**< Before the motion prediction, see lumio_predict. */
+  int32_t			raw_y;
+  uint8_t			down; /**< 0 in the frame where the contact is lifted. */
+};
+
+/**
+ * @brief The contacts of a panel at a given time.
+ */
+struct				lumio_frame
+{
+  uint64_t			time_us; /**< Kernel timestamp of the frame. */
+  uint32_t			panel; /**< Index of the panel, see lumio_panel(). */
+  uint32_t			nb_contacts;
+  struct lumio_frame_contact	contacts[LUMIO_FRAME_MAX_CONTACTS];
+};
+
+/**
+ * @brief A panel found by lumio_open() or lumio_rescan().
+ */
+struct				lumio_panel_info
+{
+  char				name[LUMIO_NAME_SIZE];
+  char				phys[LUMIO_NAME_SIZE]; /**< Usb bus path, if known. */
+  int				type; /**< LUMIO_PANEL_FAKE_MICE or LUMIO_PANEL_MULTITOUCH. */
+  int32_t			max_x; /**< Highest coordinate reported. */
+  int32_t			max_y;
+  int				connected; /**< 0 once the panel is gone. */
+};
+
+/**
+ * @brief Finds and opens every lumio panel.
+ *
+ * @return The context, or NULL with errno set.
+ */
+lumio_t*			lumio_open(void);
+
+/**
+ * @brief Opens the panels which appeared since the last scan.
+ *
+ *	A panel unplugged and plugged back keeps its index.
+ *
+ * @return The number of new or plugged back panels, or -1 with errno set.
+ */
+int				lumio_rescan(lumio_t* lumio);
+
+/**
+ * @brief Closes every panel and frees the context.
+ */
+void				lumio_close(lumio_t* lumio);
+
+/**
+ * @brief Returns a descriptor readable when frames are to be read.
+ */
+int				lumio_fd(lumio_t* lumio);
+
+/**
+ * @brief Returns the number of panels, connected or not.
+ */
+unsigned int			lumio_nb_panels(lumio_t* lumio);
+
+/**
+ * @brief Describes a panel.
+ *
+ * @return 0 on success, -1 if there is no such panel.
+ */
+int				lumio_panel(lumio_t*			lumio,
+					    unsigned int		panel,
+					    struct lumio_panel_info*	info);
+
+/**
+ * @brief Reads frames, without blocking.
+ *
+ * @param frames Filled with up to max frames, oldest first.
+ * @return The number of frames read, 0 if there are none for now, -1 with
+ * errno set on failure.
+ */
+int				lumio_read(lumio_t*		lumio,
+					   struct lumio_frame*	frames,
+					   unsigned int		max);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* !LIBLUMIO_H_ */
@@ -37,8 +37,6 @@
 
 #include "lumio_driver_.h"
 
-#define LUMIO_DEBUG 1
-
 MODULE_DESCRIPTION("USB lumio multi-touchscreen driver");
 MODULE_AUTHOR("Quentin Casasnovas");
 MODULE_LICENSE("GPL");
@@ -60,6 +58,80 @@ static struct usb_driver lumio_driver;
 
 const char*	idev_name1 = "Lumio touchscreen1";
 const char*	idev_name2 = "Lumio touchscreen2";
+const char*	idev_name_wall = "Lumio wall";
+const char*	idev_name_keys = "Lumio keys";
+const char*	idev_name_partition[LUMIO_MAX_PARTITIONS] =
+  {
+    "Lumio partition1",
+    "Lumio partition2",
+    "Lumio partition3",
+    "Lumio partition4",
+  };
+
+static char*	wall[LUMIO_WALL_MAX_PANELS];
+static int	nb_wall = 0;
+module_param_array(wall, charp, &nb_wall, 0444);
+MODULE_PARM_DESC(wall, "Video wall layout, one bus_path:x:y:width:height per "
+		 "panel, panels separated by commas (e.g. "
+		 "wall=2-1.1:0:0:1920:1080,2-1.2:1920:0:1920:1080)");
+
+static unsigned int	wall_handoff = 64;
+module_param(wall_handoff, uint, 0644);
+MODULE_PARM_DESC(wall_handoff, "Maximum distance, in wall units, of a contact "
+		 "handed off across a seam (default 64)");
+
+static unsigned int	wall_handoff_delay = 100;
+module_param(wall_handoff_delay, uint, 0644);
+MODULE_PARM_DESC(wall_handoff_delay, "How long a contact lifted near a seam "
+		 "waits to be handed off, in ms (default 100)");
+
+static char*	partition[LUMIO_MAX_PARTITIONS];
+static int	nb_partition = 0;
+module_param_array(partition, charp, &nb_partition, 0444);
+MODULE_PARM_DESC(partition, "Split the touchscreens in independent devices, one "
+		 "x:y:width:height rectangle in controller coordinates per "
+		 "partition, partitions separated by commas (e.g. "
+		 "partition=0:0:2048:4096,2048:0:2048:4096)");
+
+/* Registered with its set handler, see lumio_telemetry_set() */
+static unsigned int	telemetry_ms = 1000;
+MODULE_PARM_DESC(telemetry_ms, "Interval of the generic netlink telemetry, in "
+		 "milliseconds, 0 to stop it (default 1000)");
+
+static struct lumio_wall	lumio_wall;
+static struct lumio_partition	lumio_partitions[LUMIO_MAX_PARTITIONS];
+
+/*
+ * Touchscreens come from their own cache so that their report path fields
+ * really start on a cache line (see struct usb_touchscreen). The usb buffers
+ * get whole cache lines too: the controller writes the in buffer by DMA, which
+ * must not share a line with anything the cpu writes meanwhile.
+ */
+static struct kmem_cache*	lumio_data_cache;
+static struct kmem_cache*	lumio_buffer_cache;
+
+/**
+ * @brief Fills the id of one of our input devices.
+ *
+ *	Virtual touchscreens (see lumio_replay_setup()) have no usb device, they
+ * show up as virtual Lumio devices.
+ *
+ * @param data The touchscreen.
+ * @param idev The input device.
+ */
+static void			lumio_input_id(struct usb_touchscreen*	data,
+					       struct input_dev*	idev)
+{
+  if (data->udev)
+    usb_to_input_id(data->udev, &idev->id);
+  else
+    {
+      idev->id.bustype = BUS_VIRTUAL;
+      idev->id.vendor = USB_VID_LUMIO;
+      idev->id.product = 0;
+      idev->id.version = data->firmware_version;
+    }
+}
 
 /**
  * @brief Destructor of this driver private data.
@@ -69,14 +141,29 @@ const char*	idev_name2 = "Lumio touchscreen2";
  * memory with no risk. See Documentation/kref.txt for more informations on
  * reference counting in the linux kernel.
  *
+ *	The input devices go first: unregistering one still open closes it,
+ * which stops the urbs (see lumio_stop_io()), so they must still be there.
+ *
  * @param refcount A pointer to the reference counter of our data.
  */
 static void			lumio_delete(struct kref* refcount)
 {
   struct usb_touchscreen*	data =
     container_of(refcount, struct usb_touchscreen, refcount);
+  int				i = 0;
 
-  usb_set_intfdata(data->interface, NULL);
+  if (data->interface)
+    usb_set_intfdata(data->interface, NULL);
+
+  if (data->fakemouse[0].idev)
+    input_unregister_device(data->fakemouse[0].idev);
+  if (data->fakemouse[1].idev)
+    input_unregister_device(data->fakemouse[1].idev);
+  for (i = 0; i < LUMIO_MAX_PARTITIONS; ++i)
+    if (data->partition[i])
+      input_unregister_device(data->partition[i]);
+  if (data->keys)
+    input_unregister_device(data->keys);
 
   if (data->urb_in)
     {
@@ -89,519 +176,2862 @@ static void			lumio_delete(struct kref* refcount)
       usb_free_urb(data->urb_in2);
     }
   if (data->in_buffer)
-    kfree(data->in_buffer);
+    kmem_cache_free(lumio_buffer_cache, data->in_buffer);
   if (data->out_buffer)
-    kfree(data->out_buffer);
-  if (data->fakemouse[0].idev)
-    input_unregister_device(data->fakemouse[0].idev);
-  if (data->fakemouse[1].idev)
-    input_unregister_device(data->fakemouse[1].idev);
+    kmem_cache_free(lumio_buffer_cache, data->out_buffer);
+  for (i = 0; i < LUMIO_NB_HOOKS; ++i)
+    kfree(data->filter[i]);
+  kfree(data->regions);
   usb_put_dev(data->udev);
-  kfree(data);
+  kmem_cache_free(lumio_data_cache, data);
 }
 
 /**
- * @brief Extends features of this driver.
+ * @brief Replaces the filter of a hook.
  *
- *	At first glance, the driver only creates two input device, emulating
- * two mice in the system. But it may be tuned to better suit your needs using
- * this function. For now it only supports setting/getting the delay in which a
- * touch should be recognized as a click (default delay is 20
- * milliseconds). IOCTL commands supported are define in lumio_driver.h.
+ *	The new program is checked (see lumio_filter_check()) before replacing
+ * the old one, which is freed once the completion handlers can't be running it
+ * anymore.
  *
- * @param inode Used to retreive the minor for this device.
- * @param file
- * @param cmd One of the ioctl commands defined in lumio_driver.h.
- * @param arg
- *	The parameter for each comand, authorized values, depending on the cmd
- * argument are :
- * - No commands are supported for now.
- * double clic.
+ * @param data The touchscreen.
+ * @param uprog The lumio_filter_prog given by userland.
  * @return 0 on success, a negative number on failure.
  */
-static int			lumio_ioctl(struct inode*	inode,
-					 struct file*	file,
-					 unsigned int	cmd,
-					 unsigned long	arg)
+static int			lumio_set_filter(struct usb_touchscreen*	data,
+						 void __user*			uprog)
 {
-  struct usb_interface*		interface;
-  struct usb_touchscreen*	data;
-  int				minor;
-
-  minor = MINOR(inode->i_rdev);
-  interface = usb_find_interface(&lumio_driver, minor);
-  if (!interface)
+  struct lumio_filter_prog	prog;
+  struct lumio_filter*		filter = NULL;
+  struct lumio_filter*		old = NULL;
+
+  if (!capable(CAP_SYS_ADMIN))
+    return (-EPERM);
+  if (copy_from_user(&prog, uprog, sizeof(struct lumio_filter_prog)))
+    return (-EFAULT);
+  if (prog.hook >= LUMIO_NB_HOOKS || prog.len > LUMIO_FILTER_MAX_INSNS)
+    return (-EINVAL);
+
+  if (prog.len > 0)
     {
-      printk(KERN_WARNING "lumio_driver: cannot find device for minor.\n");
-      return (-ENODEV);
+      filter = kmalloc(sizeof(struct lumio_filter) +
+		       prog.len * sizeof(struct sock_filter), GFP_KERNEL);
+      if (!filter)
+	return (-ENOMEM);
+      filter->len = prog.len;
+      if (copy_from_user(filter->insns,
+			 (const void __user*) (unsigned long) prog.filter,
+			 prog.len * sizeof(struct sock_filter)))
+	{
+	  kfree(filter);
+	  return (-EFAULT);
+	}
+      if (lumio_filter_check(filter->insns, filter->len, prog.hook) < 0)
+	{
+	  kfree(filter);
+	  return (-EINVAL);
+	}
     }
 
-  data = usb_get_intfdata(interface);
-  if (!data)
-    return (-ENODEV);
+  mutex_lock(&data->io_lock);
+  old = data->filter[prog.hook];
+  rcu_assign_pointer(data->filter[prog.hook], filter);
+  mutex_unlock(&data->io_lock);
 
-  switch (cmd)
-    {
-    default:
-      printk(KERN_WARNING "lumio_driver: 0x%x unsupported ioctl command.\n", cmd);
-      return (-EINVAL);
-      break;
-    }
+  synchronize_rcu();
+  kfree(old);
 
   return (0);
 }
 
 /**
- * @brief Opens the lumio%d char device.
+ * @brief Tells whether a motion prediction can be set.
  *
- *	This function is called when a userland programm opens the char device
- * associated with the lumio touchscreen. A userland programm should only open
- * this device to configure the way this driver manages the touchscreen (see
- * lumio_ioctl()).
- *
- *	If you would like to receive events from the touchscreen, you
- * should open the two emulated mice this driver has created, which should be
- * /dev/input/mouseX (to find what the X is simply cat each mouse and play with
- * the touchscreen, when you see strange characters printed on you term, you
- * found the right char device to open.
- *
- * @warning Again this is not used to receive events from the touchscreen but
- * to configure the driver !
- *
- * @param inode Used to retreive the minor.
- * @param file Used to attach private data to the char device.
- * @return 0 on success, a negative number on failure.
+ * @return 0, or -EINVAL if it is out of bounds.
  */
-static int			lumio_open(struct inode*	inode,
-					struct file*	file)
+static int			lumio_check_prediction(struct usb_touchscreen*		data,
+						       const struct lumio_prediction*	prediction)
 {
-  struct usb_interface*		interface;
-  struct usb_touchscreen*	data;
-  int				minor;
-
-  /* Minor retreiving */
-  minor = MINOR(inode->i_rdev);
-  interface = usb_find_interface(&lumio_driver, minor);
-  if (!interface)
-    {
-      printk(KERN_WARNING "lumio_driver: cannot find device for minor.\n");
-      return (-ENODEV);
-    }
-
-  /* Attaching our data to the usb device */
-  data = usb_get_intfdata(interface);
-  kref_get(&data->refcount);
-  if (!data)
-    return (-ENODEV);
+  if (prediction->lookahead_ms > LUMIO_PREDICT_MAX_LOOKAHEAD ||
+      prediction->max_distance > lumio_max_coordinate(data->firmware_version))
+    return (-EINVAL);
+  return (0);
+}
 
-  file->private_data = data;
+static void			lumio_apply_prediction(struct usb_touchscreen*		data,
+						       const struct lumio_prediction*	prediction)
+{
+  int				i = 0;
 
-  return (0);
+  /* The contacts down meanwhile start over, with or without prediction */
+  for (i = 0; i < LUMIO_MAX_CONTACTS; ++i)
+    lumio_predict_reset(&data->predictor[i]);
+  data->prediction = *prediction;
 }
 
 /**
- * @brief Closes the fs%d char device.
- *
- *	This function is called when a userland programm closes the char device
- * fs%d used to configure this driver (see lumio_ioctl()). The only this function
- * does is releasing the private datas attached to the file descriptor when
- * opening it.
+ * @brief Sets the motion prediction of the fake mice.
  *
- * @param inode
- * @param file
- * @return Always 0.
+ * @param data The touchscreen.
+ * @param uprediction A struct lumio_prediction in userland.
+ * @return 0 on success, a negative number on failure.
  */
-static int			lumio_release(struct inode*	inode,
-					   struct file*		file)
+static int			lumio_set_prediction(struct usb_touchscreen*	data,
+						     void __user*		uprediction)
 {
+  struct lumio_prediction	prediction;
   int				ret = 0;
-  struct usb_touchscreen*	data;
-
-  data = file->private_data;
 
-  if (data)
-    kref_put(&data->refcount, lumio_delete);
-  else
-    ret = -ENODEV;
+  if (copy_from_user(&prediction, uprediction, sizeof(prediction)))
+    return (-EFAULT);
+  if ((ret = lumio_check_prediction(data, &prediction)))
+    return (ret);
+  spin_lock_irq(&data->config_lock);
+  lumio_apply_prediction(data, &prediction);
+  spin_unlock_irq(&data->config_lock);
 
-  file->private_data = NULL;
-
-  return (ret);
+  return (0);
 }
 
-/**
- * @brief
- *	This structure tells the kernel which function we register with the
- *	char device.
- */
-static struct file_operations	lumio_fops =
-  {
-    .owner	= THIS_MODULE,
-    .open	= lumio_open,
-    .release	= lumio_release,
-    .ioctl	= lumio_ioctl,
-  };
+static int			lumio_check_rejection(struct usb_touchscreen*		data,
+						      const struct lumio_rejection*	rejection)
+{
+  __u32				max_coord = lumio_max_coordinate(data->firmware_version);
 
-/**
- * @brief
- *	This structure tells the kernel which char device we will use for this
- *	driver.
- */
-static struct usb_class_driver	lumio_class =
-  {
-    .name	= "lumio%d",
-    .fops	= &lumio_fops,
-    .minor_base	= 0,
-  };
+  if (rejection->edge > max_coord / 4 || rejection->max_jump > max_coord ||
+      rejection->min_reports > LUMIO_REJECT_MAX_REPORTS)
+    return (-EINVAL);
+  return (0);
+}
 
-static int		lumio_send_8_bytes(struct usb_touchscreen*	data,
-					   unsigned int			hid_type)
+static void			lumio_apply_rejection(struct usb_touchscreen*		data,
+						      const struct lumio_rejection*	rejection)
 {
-  printk(KERN_INFO "lumio_driver: send_8_bytes fired!\n");
-  return (usb_control_msg(data->udev,
-			  usb_sndctrlpipe(data->udev, 0),
-			  HID_REQ_SET_REPORT,
-			  USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE,
-			  hid_type,
-			  0, data->out_buffer, 8, 0));
+  int				i = 0;
+
+  /*
+   * The contacts reported down meanwhile are let through until lifted, the
+   * other tags go through every check with their next contact.
+   */
+  for (i = 0; i < LUMIO_MAX_CONTACTS; ++i)
+    if (data->contacts_down & (1 << i))
+      lumio_reject_resync(&data->reject[i]);
+    else
+      lumio_reject_reset(&data->reject[i]);
+  data->rejection = *rejection;
 }
 
-static void		lumio_send_64_aknowledged(struct urb* urb)
+/**
+ * @brief Sets the rejection of spurious contacts.
+ *
+ * @param data The touchscreen.
+ * @param urejection The struct lumio_rejection given by userland.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_set_rejection(struct usb_touchscreen*	data,
+						    void __user*		urejection)
 {
-  struct usb_touchscreen*	data = NULL;
+  struct lumio_rejection	rejection;
+  int				ret = 0;
 
-  ASSERT(urb != NULL);
-  ASSERT(urb->context != NULL);
+  if (copy_from_user(&rejection, urejection, sizeof(rejection)))
+    return (-EFAULT);
+  if ((ret = lumio_check_rejection(data, &rejection)))
+    return (ret);
+  spin_lock_irq(&data->config_lock);
+  lumio_apply_rejection(data, &rejection);
+  spin_unlock_irq(&data->config_lock);
 
-  data = urb->context;
-};
+  return (0);
+}
 
-static int		lumio_send_64_bytes(struct usb_touchscreen*	data,
-					    unsigned int		hid_type)
+static int			lumio_check_decimation(const struct lumio_decimation* decimation)
 {
-  printk(KERN_INFO "lumio_driver: send_64_bytes fired!\n");
-  return (usb_submit_urb(data->urb_commander, GFP_KERNEL));
+  if (decimation->tolerance > LUMIO_DECIMATE_MAX_TOLERANCE)
+    return (-EINVAL);
+  return (0);
 }
 
-static int		lumio_recv_8_bytes(struct usb_touchscreen*	data,
-					    unsigned int		hid_type)
+static void			lumio_apply_decimation(struct usb_touchscreen*		data,
+						       const struct lumio_decimation*	decimation)
 {
-  return (usb_control_msg(data->udev,
-			  usb_rcvctrlpipe(data->udev, 0),
-			  HID_REQ_GET_REPORT,
-			  USB_DIR_IN | USB_TYPE_CLASS | USB_RECIP_INTERFACE,
-			  hid_type,
-			  0, data->in_buffer, 8, 0));
+  int				i = 0;
+
+  /* The strokes going on start over from their next position */
+  for (i = 0; i < LUMIO_MAX_CONTACTS; ++i)
+    lumio_decimate_reset(&data->decimate[i]);
+  data->decimation = *decimation;
 }
 
 /**
- * @brief Tells the controller to switch to driver mode.
- *
- *	The controller may be in two different states (as explained here
- * lumio_probe()). This function sets the controller to driver mode sending it a
- * control urb containing the following 8 bytes : 0x7576000000000000, and
- * then closing the interrupt pipe. The controller should have switched within
- * 2000 milliseconds.
+ * @brief Sets the stroke decimation of the fake mice.
  *
- * @param data The private data asociated with the interface.
- * @return 0 on success, a negative number in other cases.
+ * @param data The touchscreen.
+ * @param udecimation A struct lumio_decimation in userland.
+ * @return 0 on success, a negative number on failure.
  */
-static int		lumio_switch_to_driver_mode(struct usb_touchscreen* data)
+static int			lumio_set_decimation(struct usb_touchscreen*	data,
+						     void __user*		udecimation)
 {
-  int			ret = 0;
-
-  ASSERT(data != NULL);
-  ASSERT(data->out_buffer != NULL);
-
-  /* Constructing the message */
-  memset(data->out_buffer, 0x0, 8);
-  data->out_buffer[0] = 0x75;
-  data->out_buffer[1] = 0x76;
+  struct lumio_decimation	decimation;
+  int				ret = 0;
 
-  SAFE_CALL(data->send_msg(data, HID_VAL_FEATURE),
-	    "Unable to send control urb.\n");
+  if (copy_from_user(&decimation, udecimation, sizeof(decimation)))
+    return (-EFAULT);
+  if ((ret = lumio_check_decimation(&decimation)))
+    return (ret);
+  spin_lock_irq(&data->config_lock);
+  lumio_apply_decimation(data, &decimation);
+  spin_unlock_irq(&data->config_lock);
 
   return (0);
-
- error:
-
-  return (ret);
 }
 
 /**
- * @brief Asks the controller the actual configuration (single/dualtouch).
+ * @brief Sets the rejection, the prediction and the decimation at once.
  *
- *	This function asks the controller, which should already be in driver
- * mode, if it reports single or dualtouch events. This is done by sending it
- * the following 8 bytes 0x7F9B000000000000. We then waits for its reply, which
- * will be 0x7F9B010100000000 if it reports dualtouch events, and
- * 0x7F9B010000000000 for signletouch events.
+ *	Either all of them are set, or none if one is out of bounds or the
+ * configuration is of another version. They are applied under the config_lock,
+ * which the report path holds from the rejection on: a report sees either the
+ * old settings or the new ones, never a mix, and the per-tag states aren't
+ * reset under its feet. The single setters take it the same way.
  *
- * @param data Private data associated with the device.
- * @return Return a positive number corresponding to USB_DUALTOUCH_CONFIG or
- * USB_SINGLETOUCH_CONFIG if there's no problem, a negative number if it fails
- * to ask the controller.
+ * @param data The touchscreen.
+ * @param uconfig A struct lumio_config in userland.
+ * @return 0 on success, a negative number on failure.
  */
-static int	lumio_actual_conf(struct usb_touchscreen* data)
+static int			lumio_set_config(struct usb_touchscreen*	data,
+						 void __user*			uconfig)
 {
-  int		ret = 0;
+  struct lumio_config		config;
+
+  if (copy_from_user(&config, uconfig, sizeof(config)))
+    return (-EFAULT);
+  if (config.magic != LUMIO_CONFIG_MAGIC ||
+      config.version != LUMIO_CONFIG_VERSION ||
+      lumio_check_rejection(data, &config.rejection) ||
+      lumio_check_prediction(data, &config.prediction) ||
+      lumio_check_decimation(&config.decimation))
+    return (-EINVAL);
+
+  spin_lock_irq(&data->config_lock);
+  lumio_apply_rejection(data, &config.rejection);
+  lumio_apply_prediction(data, &config.prediction);
+  lumio_apply_decimation(data, &config.decimation);
+  spin_unlock_irq(&data->config_lock);
 
-  ASSERT(data != NULL);
-  ASSERT(data->out_buffer != NULL);
-  ASSERT(data->in_buffer != NULL);
+  return (0);
+}
 
-  /* Constructing the message */
-  memset(data->out_buffer, 0x0, 8);
-  data->out_buffer[0] = 0x7F;
-  data->out_buffer[1] = 0x9B;
+static int			lumio_fake_open(struct input_dev* dev);
+static void			lumio_fake_close(struct input_dev* dev);
 
-  if (data->firmware_version != LUMIO_FIRMWARE_3_0)
+/**
+ * @brief Registers the device sending the keys of the hot regions.
+ *
+ *	It may send any keyboard key, so that the regions can be changed without
+ * registering it again. Opening it starts the report stream as a fake mouse
+ * does, a kiosk may listen to nothing else. Called without the io_lock: the
+ * keyboard handler opens it as soon as it is registered.
+ *
+ * @param data The touchscreen.
+ * @return The device, NULL on failure.
+ */
+static struct input_dev*	lumio_keys_create(struct usb_touchscreen* data)
+{
+  struct input_dev*		idev = NULL;
+  int				key = 0;
+
+  if (!(idev = input_allocate_device()))
+    return (NULL);
+
+  idev->name = idev_name_keys;
+  idev->phys = data->name;
+  lumio_input_id(data, idev);
+  set_bit(EV_KEY, idev->evbit);
+  for (key = 1; key < LUMIO_REGION_MAX_KEY; ++key)
+    set_bit(key, idev->keybit);
+  idev->open = lumio_fake_open;
+  idev->close = lumio_fake_close;
+  input_set_drvdata(idev, data);
+  if (input_register_device(idev))
     {
-      SAFE_CALL(data->send_msg(data, HID_REQ_SET_REPORT),
-		"Unable to ask actual configuration.\n");
-      
-      mdelay(50);
-      
-      memset(data->in_buffer, 0x0, 16);
-      SAFE_CALL(data->recv_msg(data, HID_REQ_GET_REPORT),
-		"Unable to receive actual configuration.\n");
+      input_free_device(idev);
+      return (NULL);
     }
-  else
-    return (USB_DUALTOUCH_CONFIG);
-
-  if (data->in_buffer[3] == 0x01)
-    return (USB_DUALTOUCH_CONFIG);
-  else
-    return (USB_SINGLETOUCH_CONFIG);
 
- error:
-  return (ret);
+  return (idev);
 }
 
 /**
- * @brief Tells the controller to report dual touch events.
- *
- *	By default, in driver mode, the controller only reports single touch
- * events (see lumio_probe()). Here we tell it to notify us dual touch events
- * sending it the following 8 bytes : 0x7F9B010100000000.
+ * @brief Sets the hot regions.
  *
- *	As the controller may be asked to tell in what configuration it is (see
- * lumio_actual_conf()), it's a good habit to check that it has really changed its
- * configuration to dual touch. If that is not the case we try to set it again
- * to dual touch configuration. After that last try, if the controller is still
- * not in dual touch configuration, an error is generated.
+ *	The index is built before being published, the report path only ever
+ * sees complete ones. The keys still held down are released whenever the
+ * regions change.
  *
- * @param data The private data asociated with the interface.
- * @return 0 on success and a negative number if it fails.
+ * @param data The touchscreen.
+ * @param uregions A struct lumio_regions in userland.
+ * @return 0 on success, a negative number on failure.
  */
-static int	lumio_switch_to_dualtouch_mode(struct usb_touchscreen* data)
+static int			lumio_set_regions(struct usb_touchscreen*	data,
+						  void __user*			uregions)
 {
-  int		nb_try = 0;
+  struct lumio_region*		regions = NULL;
+  struct lumio_regions		arg;
+  struct lumio_region_index*	index = NULL;
+  struct lumio_region_index*	old = NULL;
+  struct input_dev*		keys = NULL;
+  __u32				max_coord = lumio_max_coordinate(data->firmware_version);
+  int				size = 0;
+  int				ret = 0;
+  int				i = 0;
 
-  ASSERT(data != NULL);
-  ASSERT(data->out_buffer != NULL);
+  if (!capable(CAP_SYS_ADMIN))
+    return (-EPERM);
+  if (copy_from_user(&arg, uregions, sizeof(arg)))
+    return (-EFAULT);
+  if (arg.nb_regions > LUMIO_MAX_REGIONS || arg.flags & ~LUMIO_REGIONS_ONLY)
+    return (-EINVAL);
 
-  do
+  if (arg.nb_regions > 0)
     {
-      memset(data->out_buffer, 0x0, 64);
-      data->out_buffer[0] = 0x7F;
-      data->out_buffer[1] = 0x9B;
-      data->out_buffer[2] = 0x01;
-      data->out_buffer[3] = 0x01;
-      if (data->send_msg(data, HID_REQ_SET_REPORT) != 0)
-	printk(KERN_INFO "lumio_driver: Can't set to dual touch mode... Retrying.\n");
+      if (!(regions = kmalloc(arg.nb_regions * sizeof(struct lumio_region),
+			      GFP_KERNEL)))
+	return (-ENOMEM);
+      if (copy_from_user(regions,
+			 (const void __user*) (unsigned long) arg.regions,
+			 arg.nb_regions * sizeof(struct lumio_region)))
+	ret = -EFAULT;
+      else if ((size = lumio_regions_size(regions, arg.nb_regions,
+					  max_coord)) < 0)
+	ret = -EINVAL;
+      else if (!(index = kmalloc(sizeof(struct lumio_region_index) + size,
+				 GFP_KERNEL)))
+	ret = -ENOMEM;
+      else
+	lumio_regions_build(index, regions, arg.nb_regions, arg.flags,
+			    max_coord);
+      kfree(regions);
+      if (ret < 0)
+	return (ret);
+    }
+
+  if (index && !data->keys && !(keys = lumio_keys_create(data)))
+    {
+      kfree(index);
+      return (-ENOMEM);
+    }
+
+  mutex_lock(&data->io_lock);
+  if (data->disconnected)
+    ret = -ENODEV;
+  else if (keys && !data->keys)
+    {
+      data->keys = keys;
+      keys = NULL;
+    }
+  if (ret < 0)
+    {
+      mutex_unlock(&data->io_lock);
+      kfree(index);
+      if (keys)
+	input_unregister_device(keys);
+      return (ret);
+    }
+  /*
+   * The region each tag came down in is an index in the old table: the keys
+   * held are released and the contacts down meanwhile press nothing. The
+   * report path runs the regions under the config_lock, it sees either the
+   * old table and its state or the new one from scratch.
+   */
+  old = data->regions;
+  spin_lock_irq(&data->config_lock);
+  rcu_assign_pointer(data->regions, index);
+  for (i = 0; i < LUMIO_MAX_CONTACTS; ++i)
+    {
+      if (data->region_key[i])
+	input_report_key(data->keys, data->region_key[i], 0);
+      data->region_key[i] = 0;
+      data->region_pressed[i] = -1;
+      data->region_down[i] = (data->contacts_down >> i) & 1;
+    }
+  if (data->keys)
+    input_sync(data->keys);
+  spin_unlock_irq(&data->config_lock);
+  mutex_unlock(&data->io_lock);
+
+  /* Another call registered the keys first, closing ours takes the io_lock */
+  if (keys)
+    input_unregister_device(keys);
+  synchronize_rcu();
+  kfree(old);
+
+  return (0);
+}
+
+/**
+ * @brief Handles the ioctl commands shared by all touchscreens.
+ *
+ * @param data The touchscreen.
+ * @param cmd One of the ioctl commands defined in lumio_driver.h.
+ * @param arg The parameter of the command.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_data_ioctl(struct usb_touchscreen*	data,
+						 unsigned int			cmd,
+						 unsigned long			arg)
+{
+  switch (cmd)
+    {
+    case IOCTL_GET_STATS:
+      if (copy_to_user((void __user*) arg, &data->stats,
+		       sizeof(struct lumio_stats)))
+	return (-EFAULT);
+      break;
+    case IOCTL_SET_FILTER:
+      return (lumio_set_filter(data, (void __user*) arg));
+    case IOCTL_SET_PREDICTION:
+      return (lumio_set_prediction(data, (void __user*) arg));
+    case IOCTL_SET_REJECTION:
+      return (lumio_set_rejection(data, (void __user*) arg));
+    case IOCTL_SET_REGIONS:
+      return (lumio_set_regions(data, (void __user*) arg));
+    case IOCTL_SET_DECIMATION:
+      return (lumio_set_decimation(data, (void __user*) arg));
+    case IOCTL_SET_CONFIG:
+      return (lumio_set_config(data, (void __user*) arg));
+    default:
+      printk(KERN_WARNING "lumio_driver: 0x%x unsupported ioctl command.\n", cmd);
+      return (-EINVAL);
+      break;
+    }
+
+  return (0);
+}
+
+/**
+ * @brief Extends features of this driver.
+ *
+ *	At first glance, the driver only creates two input device, emulating
+ * two mice in the system. But it may be tuned to better suit your needs using
+ * this function. IOCTL commands supported are define in lumio_driver.h.
+ *
+ * @param inode Used to retreive the minor for this device.
+ * @param file
+ * @param cmd One of the ioctl commands defined in lumio_driver.h.
+ * @param arg
+ *	The parameter for each comand, authorized values, depending on the cmd
+ * argument are :
+ * - IOCTL_GET_STATS: a pointer to a struct lumio_stats to fill.
+ * - IOCTL_SET_FILTER: a pointer to a struct lumio_filter_prog.
+ * - IOCTL_SET_PREDICTION: a pointer to a struct lumio_prediction.
+ * - IOCTL_SET_REJECTION: a pointer to a struct lumio_rejection.
+ * - IOCTL_SET_REGIONS: a pointer to a struct lumio_regions.
+ * - IOCTL_SET_DECIMATION: a pointer to a struct lumio_decimation.
+ * - IOCTL_SET_CONFIG: a pointer to a struct lumio_config.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_ioctl(struct inode*	inode,
+					 struct file*	file,
+					 unsigned int	cmd,
+					 unsigned long	arg)
+{
+  struct usb_interface*		interface;
+  struct usb_touchscreen*	data;
+  int				minor;
+
+  minor = MINOR(inode->i_rdev);
+  interface = usb_find_interface(&lumio_driver, minor);
+  if (!interface)
+    {
+      printk(KERN_WARNING "lumio_driver: cannot find device for minor.\n");
+      return (-ENODEV);
+    }
+
+  data = usb_get_intfdata(interface);
+  if (!data)
+    return (-ENODEV);
+
+  return (lumio_data_ioctl(data, cmd, arg));
+}
+
+/*
+ * Fault injection.
+ *
+ *	Built with FAULT_INJECTION=y, on a kernel with CONFIG_FAULT_INJECTION,
+ * the driver can fail on purpose, using the kernel fault injection framework.
+ * Each fault class has its own fault_attr, set up in debugfs (probability,
+ * interval, times, see Documentation/fault-injection):
+ * - lumio_fail_eproto, lumio_fail_epipe, lumio_fail_eshutdown: an interrupt in
+ *   urb completes with that status instead of its report.
+ * - lumio_fail_delay: an interrupt in urb completes fault_delay_ms late.
+ * - lumio_fail_ctrl: the reply to a control message never comes, the request
+ *   times out after LUMIO_CTRL_TIMEOUT ms.
+ * Injected faults are counted in lumio_stats.
+ */
+
+#if defined(LUMIO_FAULT_INJECTION) && defined(CONFIG_FAULT_INJECTION)
+
+static DECLARE_FAULT_ATTR(lumio_fail_eproto);
+static DECLARE_FAULT_ATTR(lumio_fail_epipe);
+static DECLARE_FAULT_ATTR(lumio_fail_eshutdown);
+static DECLARE_FAULT_ATTR(lumio_fail_delay);
+static DECLARE_FAULT_ATTR(lumio_fail_ctrl);
+
+static unsigned int	fault_delay_ms = 20;
+module_param(fault_delay_ms, uint, 0644);
+MODULE_PARM_DESC(fault_delay_ms, "Delay of the lumio_fail_delay faults, in ms "
+		 "(default 20)");
+
+/**
+ * @brief Injects a fault in a completed interrupt in urb.
+ *
+ * @param data The touchscreen.
+ * @param urb The urb that has completed.
+ * @return 1 if the completion has been delayed, in which case the handler
+ * must return, 0 otherwise.
+ */
+static int			lumio_fault_urb(struct usb_touchscreen*	data,
+						struct urb*		urb)
+{
+  if (urb->status != 0 || data->fault_delayed)
+    return (0);
+
+  if (should_fail(&lumio_fail_eproto, 1))
+    urb->status = -EPROTO;
+  else if (should_fail(&lumio_fail_epipe, 1))
+    urb->status = -EPIPE;
+  else if (should_fail(&lumio_fail_eshutdown, 1))
+    urb->status = -ESHUTDOWN;
+  else if (should_fail(&lumio_fail_delay, 1))
+    {
+      ++data->stats.faults_injected;
+      data->fault_urb = urb;
+      mod_timer(&data->fault_timer, jiffies + msecs_to_jiffies(fault_delay_ms));
+      return (1);
+    }
+
+  if (urb->status != 0)
+    ++data->stats.faults_injected;
+
+  return (0);
+}
+
+/**
+ * @brief Completes an urb whose completion has been delayed.
+ *
+ * @param arg The touchscreen.
+ */
+static void			lumio_fault_delayed(unsigned long arg)
+{
+  struct usb_touchscreen*	data = (struct usb_touchscreen*) arg;
+  unsigned long			flags = 0;
+
+  if (data->listeners == 0 || data->disconnected)
+    return;
+
+  local_irq_save(flags);
+  data->fault_delayed = 1;
+  data->fault_urb->complete(data->fault_urb);
+  data->fault_delayed = 0;
+  local_irq_restore(flags);
+}
+
+/**
+ * @brief Drops the reply of a control message.
+ *
+ * @param data The touchscreen.
+ * @return -ETIMEDOUT if the reply is dropped, 0 otherwise.
+ */
+static int			lumio_fault_ctrl(struct usb_touchscreen* data)
+{
+  if (!should_fail(&lumio_fail_ctrl, 1))
+    return (0);
+
+  ++data->stats.faults_injected;
+  msleep(LUMIO_CTRL_TIMEOUT);
+  return (-ETIMEDOUT);
+}
+
+static void			lumio_fault_init_data(struct usb_touchscreen* data)
+{
+  setup_timer(&data->fault_timer, lumio_fault_delayed, (unsigned long) data);
+}
+
+static void			lumio_fault_stop(struct usb_touchscreen* data)
+{
+  del_timer_sync(&data->fault_timer);
+}
+
+static void			lumio_fault_init(void)
+{
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+  init_fault_attr_dentries(&lumio_fail_eproto, "lumio_fail_eproto");
+  init_fault_attr_dentries(&lumio_fail_epipe, "lumio_fail_epipe");
+  init_fault_attr_dentries(&lumio_fail_eshutdown, "lumio_fail_eshutdown");
+  init_fault_attr_dentries(&lumio_fail_delay, "lumio_fail_delay");
+  init_fault_attr_dentries(&lumio_fail_ctrl, "lumio_fail_ctrl");
+#endif
+}
+
+static void			lumio_fault_exit(void)
+{
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+  cleanup_fault_attr_dentries(&lumio_fail_eproto);
+  cleanup_fault_attr_dentries(&lumio_fail_epipe);
+  cleanup_fault_attr_dentries(&lumio_fail_eshutdown);
+  cleanup_fault_attr_dentries(&lumio_fail_delay);
+  cleanup_fault_attr_dentries(&lumio_fail_ctrl);
+#endif
+}
+
+#else
+
+# define lumio_fault_urb(Data, Urb)	(0)
+# define lumio_fault_ctrl(Data)		(0)
+# define lumio_fault_init_data(Data)	do { } while (0)
+# define lumio_fault_stop(Data)		do { } while (0)
+# define lumio_fault_init()		do { } while (0)
+# define lumio_fault_exit()		do { } while (0)
+
+#endif /* LUMIO_FAULT_INJECTION */
+
+static int		lumio_send_8_bytes(struct usb_touchscreen*	data,
+					   unsigned int			hid_type)
+{
+  printk(KERN_INFO "lumio_driver: send_8_bytes fired!\n");
+  return (usb_control_msg(data->udev,
+			  usb_sndctrlpipe(data->udev, 0),
+			  HID_REQ_SET_REPORT,
+			  USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE,
+			  hid_type,
+			  0, data->out_buffer, 8, LUMIO_CTRL_TIMEOUT));
+}
+
+static void		lumio_send_64_aknowledged(struct urb* urb)
+{
+  struct usb_touchscreen*	data = NULL;
+
+  ASSERT(urb != NULL);
+  ASSERT(urb->context != NULL);
+
+  data = urb->context;
+};
+
+static int		lumio_send_64_bytes(struct usb_touchscreen*	data,
+					    unsigned int		hid_type)
+{
+  printk(KERN_INFO "lumio_driver: send_64_bytes fired!\n");
+  return (usb_submit_urb(data->urb_commander, GFP_KERNEL));
+}
+
+static int		lumio_recv_8_bytes(struct usb_touchscreen*	data,
+					    unsigned int		hid_type)
+{
+  int			ret = 0;
+
+  if ((ret = lumio_fault_ctrl(data)) < 0)
+    return (ret);
+
+  return (usb_control_msg(data->udev,
+			  usb_rcvctrlpipe(data->udev, 0),
+			  HID_REQ_GET_REPORT,
+			  USB_DIR_IN | USB_TYPE_CLASS | USB_RECIP_INTERFACE,
+			  hid_type,
+			  0, data->in_buffer, 8, LUMIO_CTRL_TIMEOUT));
+}
+
+/**
+ * @brief Tells the controller to switch to driver mode.
+ *
+ *	The controller may be in two different states (as explained here
+ * lumio_probe()). This function sets the controller to driver mode sending it a
+ * control urb containing the following 8 bytes : 0x7576000000000000, and
+ * then closing the interrupt pipe. The controller should have switched within
+ * 2000 milliseconds.
+ *
+ * @param data The private data asociated with the interface.
+ * @return 0 on success, a negative number in other cases.
+ */
+static int		lumio_switch_to_driver_mode(struct usb_touchscreen* data)
+{
+  int			ret = 0;
+
+  ASSERT(data != NULL);
+  ASSERT(data->out_buffer != NULL);
+
+  /* Constructing the message */
+  lumio_build_driver_mode_msg(data->out_buffer);
+
+  SAFE_CALL(data->send_msg(data, HID_VAL_FEATURE),
+	    "Unable to send control urb.\n");
+
+  return (0);
+
+ error:
+
+  return (ret);
+}
+
+/**
+ * @brief Asks the controller the actual configuration (single/dualtouch).
+ *
+ *	This function asks the controller, which should already be in driver
+ * mode, if it reports single or dualtouch events. This is done by sending it
+ * the following 8 bytes 0x7F9B000000000000. We then waits for its reply, which
+ * will be 0x7F9B010100000000 if it reports dualtouch events, and
+ * 0x7F9B010000000000 for signletouch events.
+ *
+ * @param data Private data associated with the device.
+ * @return Return a positive number corresponding to USB_DUALTOUCH_CONFIG or
+ * USB_SINGLETOUCH_CONFIG if there's no problem, a negative number if it fails
+ * to ask the controller.
+ */
+static int	lumio_actual_conf(struct usb_touchscreen* data)
+{
+  int		ret = 0;
+
+  ASSERT(data != NULL);
+  ASSERT(data->out_buffer != NULL);
+  ASSERT(data->in_buffer != NULL);
+
+  /* Constructing the message */
+  lumio_build_config_msg(data->out_buffer, 0);
+
+  if (data->firmware_version != LUMIO_FIRMWARE_3_0)
+    {
+      SAFE_CALL(data->send_msg(data, HID_REQ_SET_REPORT),
+		"Unable to ask actual configuration.\n");
+      
+      mdelay(50);
+      
+      memset(data->in_buffer, 0x0, 16);
+      SAFE_CALL(data->recv_msg(data, HID_REQ_GET_REPORT),
+		"Unable to receive actual configuration.\n");
+    }
+  else
+    return (USB_DUALTOUCH_CONFIG);
+
+  switch (lumio_config_is_dualtouch(data->in_buffer))
+    {
+    case 1:
+      return (USB_DUALTOUCH_CONFIG);
+    case 0:
+      return (USB_SINGLETOUCH_CONFIG);
+    default:
+      printk(KERN_WARNING "lumio_driver: Unexpected configuration reply.\n");
+      return (-EIO);
+    }
+
+ error:
+  return (ret);
+}
+
+/**
+ * @brief Tells the controller to report dual touch events.
+ *
+ *	By default, in driver mode, the controller only reports single touch
+ * events (see lumio_probe()). Here we tell it to notify us dual touch events
+ * sending it the following 8 bytes : 0x7F9B010100000000.
+ *
+ *	As the controller may be asked to tell in what configuration it is (see
+ * lumio_actual_conf()), it's a good habit to check that it has really changed its
+ * configuration to dual touch. If that is not the case we try to set it again
+ * to dual touch configuration. After that last try, if the controller is still
+ * not in dual touch configuration, an error is generated.
+ *
+ * @param data The private data asociated with the interface.
+ * @return 0 on success and a negative number if it fails.
+ */
+static int	lumio_switch_to_dualtouch_mode(struct usb_touchscreen* data)
+{
+  int		nb_try = 0;
+  int		conf = 0;
+  ktime_t	start = ktime_get();
+
+  ASSERT(data != NULL);
+  ASSERT(data->out_buffer != NULL);
+
+  do
+    {
+      lumio_build_config_msg(data->out_buffer, 1);
+      if (data->send_msg(data, HID_REQ_SET_REPORT) < 0)
+	printk(KERN_INFO "lumio_driver: Can't set to dual touch mode... Retrying.\n");
+
+      mdelay(10);
+      ++nb_try;
+      conf = lumio_actual_conf(data);
+    } while (nb_try < 3 && conf != USB_DUALTOUCH_CONFIG);
+
+  ++data->stats.mode_switches;
+  data->stats.last_mode_switch_us =
+    (__u32) ktime_to_us(ktime_sub(ktime_get(), start));
+  if (data->stats.last_mode_switch_us > data->stats.max_mode_switch_us)
+    data->stats.max_mode_switch_us = data->stats.last_mode_switch_us;
+
+  if (conf != USB_DUALTOUCH_CONFIG)
+    return (-ENODEV);
+
+  return (0);
+}
+
+/**
+ * @brief Discovers all endpoints the device has to offer.
+ *
+ *	 This functions probes all endpoints attached to the device and record
+ * them in the private structure associated with the interface (see
+ * ::usb_touchscreen). Endpoints are kind off pipes used to communicate with the
+ * touchscreen.
+ *
+ * @param data The private structure associated with the interface.
+ * @return 0 on success, a negative number if it fails probing endpoints.
+ */
+static int				lumio_find_endpoints(struct usb_touchscreen* data)
+{
+  unsigned int				i;
+  struct usb_host_interface*		iface_desc;
+  struct usb_endpoint_descriptor*	endpoint;
+
+  ASSERT(data != NULL);
+
+  iface_desc = data->interface->cur_altsetting;
+
+  for (i = 0; i < iface_desc->desc.bNumEndpoints; ++i)
+    {
+      endpoint = &iface_desc->endpoint[i].desc;
+      if ((endpoint->bEndpointAddress & USB_DIR_IN) &&
+	  IS_INT_ENDPOINT(endpoint->bmAttributes))
+	{
+	  data->int_in_endpoint = endpoint->bEndpointAddress;
+	}
+      else if (!(endpoint->bEndpointAddress & USB_DIR_IN) &&
+	       IS_INT_ENDPOINT(endpoint->bmAttributes))
+	{
+	  data->int_out_endpoint = endpoint->bEndpointAddress;
+	  printk(KERN_INFO "lumio_driver: Out interrupt endpoint adress is: %d.\n",
+		 data->int_out_endpoint);
+	}
+    }
+
+  return (0);
+}
+
+/**
+ * @brief Starts the receiving of urbs.
+ *
+ *	This function is called each time somebody starts listening to the
+ * events of the touchscreen. The first one starts receiving interrupt in urbs
+ * to get report from the touchscreen. Once the touchscreen is unplugged, its
+ * input devices can't be opened anymore.
+ *
+ * @param data The touchscreen.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_start_io(struct usb_touchscreen* data)
+{
+  int				ret = 0;
+
+  ASSERT(data != NULL);
+
+  mutex_lock(&data->io_lock);
+  if (data->disconnected)
+    {
+      ret = -ENODEV;
+      goto error;
+    }
+  if (lumio_listener_get(&data->listeners) && data->urb_in &&
+      (ret = usb_submit_urb(data->urb_in, GFP_KERNEL)) < 0)
+    {
+      lumio_listener_put(&data->listeners);
+      printk(KERN_WARNING "lumio_driver: Unable to register int in urb.\n");
+      goto error;
+    }
+
+  printk(KERN_INFO "lumio_driver: O nb_listeners: %u\n", data->listeners);
+  mutex_unlock(&data->io_lock);
+  return (0);
+
+ error:
+  mutex_unlock(&data->io_lock);
+  return (ret);
+}
+
+/**
+ * @brief Stops the urb if nobody is listenning.
+ *
+ *	Counterpart of lumio_start_io(), the urbs are only stopped when the last
+ * listener is gone. They are killed with the io_lock held: a listener coming
+ * right after would otherwise get its urb killed under its feet. The recovery
+ * work takes the io_lock, it is cancelled once it is released; a listener may
+ * have come meanwhile and queued a recovery of its own, which is then queued
+ * again rather than lost. Without listeners, pending actions are dropped.
+ *
+ *	Virtual touchscreens have no urbs, and firmware 3.0 ones a single one.
+ *
+ * @param data The touchscreen.
+ */
+static void			lumio_stop_io(struct usb_touchscreen* data)
+{
+  int				last = 0;
+
+  ASSERT(data != NULL);
+
+  mutex_lock(&data->io_lock);
+  last = lumio_listener_put(&data->listeners);
+  printk(KERN_INFO "lumio_driver: nb_listeners: %u\n", data->listeners);
+  if (last)
+    {
+      if (data->urb_in)
+	usb_kill_urb(data->urb_in);
+      if (data->urb_in2)
+	usb_kill_urb(data->urb_in2);
+      /*
+       * Only now, a completion may have armed the fault timer until the urbs
+       * were killed. Meanwhile the timer does nothing without listeners.
+       */
+      lumio_fault_stop(data);
+    }
+  mutex_unlock(&data->io_lock);
+
+  if (!last)
+    return;
+
+  cancel_delayed_work_sync(&data->recovery);
+  mutex_lock(&data->io_lock);
+  if (data->listeners > 0 && !data->disconnected && data->recovery_flags)
+    schedule_delayed_work(&data->recovery, 0);
+  else if (data->listeners == 0)
+    data->recovery_flags = 0;
+  mutex_unlock(&data->io_lock);
+}
+
+/**
+ * @brief Starts the receiving of urbs.
+ *
+ *	This function is called each first time one of the two char device
+ * corresponding to our fake mice, or the keys of the hot regions (see
+ * lumio_keys_create()), is opened. That means somebody is listening
+ * to events from our touchscreen and that we should start receiving interrupt
+ * in urbs to get report from the touchscreen.
+ *
+ * @param dev The char device that is first read by a process.
+ */
+static int			lumio_fake_open(struct input_dev* dev)
+{
+  return (lumio_start_io(input_get_drvdata(dev)));
+}
+
+/**
+ * @brief Stops the urb if nobody is listenning.
+ *
+ *	This function is called by the input layer when the last process has
+ * released one of the two char devices that emulates mice. As there only one
+ * touchscreen for two fake mice, we actually stops receiving urb only when the two
+ * char devices are not being red anymore.
+ *
+ * @param dev The input device that is not readed anymore.
+ */
+static void			lumio_fake_close(struct input_dev* dev)
+{
+  lumio_stop_io(input_get_drvdata(dev));
+}
+
+/**
+ * @brief Opens the lumio%d char device.
+ *
+ *	This function is called when a userland programm opens the char device
+ * associated with the lumio touchscreen, to configure the way this driver
+ * manages the touchscreen (see lumio_ioctl()) or to read its cooked frames
+ * (see lumio_read()). Each open gets its own reader, the report stream only
+ * starts once it reads: configuring the touchscreen doesn't wake it up.
+ *
+ * @param inode Used to retreive the minor.
+ * @param file Used to attach private data to the char device.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_open(struct inode*	inode,
+					struct file*	file)
+{
+  struct usb_interface*		interface;
+  struct usb_touchscreen*	data;
+  struct lumio_reader*		reader;
+  int				minor;
+
+  /* Minor retreiving */
+  minor = MINOR(inode->i_rdev);
+  interface = usb_find_interface(&lumio_driver, minor);
+  if (!interface)
+    {
+      printk(KERN_WARNING "lumio_driver: cannot find device for minor.\n");
+      return (-ENODEV);
+    }
+
+  reader = kzalloc(sizeof (struct lumio_reader), GFP_KERNEL);
+  if (!reader)
+    return (-ENOMEM);
+  mutex_init(&reader->lock);
+  INIT_LIST_HEAD(&reader->link);
+
+  /*
+   * Attaching our data to the usb device. The usb core opens us with the big
+   * kernel lock held, which lumio_disconnect() takes to clear the interface
+   * data: the reference is taken before it can drop its own.
+   */
+  data = usb_get_intfdata(interface);
+  if (!data)
+    {
+      kfree(reader);
+      return (-ENODEV);
+    }
+  kref_get(&data->refcount);
+
+  reader->data = data;
+  file->private_data = reader;
+
+  return (0);
+}
+
+/**
+ * @brief Closes the lumio%d char device.
+ *
+ *	This function is called when a userland programm closes the char device
+ * lumio%d. A reader that has started leaves the readers of the touchscreen and
+ * stops listening to it (see lumio_stop_io()), then the reference taken when
+ * opening is released.
+ *
+ * @param inode
+ * @param file
+ * @return 0 on success, -ENODEV if the file had no reader.
+ */
+static int			lumio_release(struct inode*	inode,
+					   struct file*		file)
+{
+  struct lumio_reader*		reader;
+  struct usb_touchscreen*	data;
+
+  reader = file->private_data;
+  if (!reader)
+    return (-ENODEV);
+  data = reader->data;
+
+  if (reader->started)
+    {
+      spin_lock_irq(&data->readers_lock);
+      list_del(&reader->link);
+      spin_unlock_irq(&data->readers_lock);
+      lumio_stop_io(data);
+    }
+  kfree(reader);
+  kref_put(&data->refcount, lumio_delete);
+
+  file->private_data = NULL;
+
+  return (0);
+}
+
+/**
+ * @brief Starts a reader with its first read() or poll().
+ *
+ *	The reader listens to the touchscreen, as an open fake mouse does (see
+ * lumio_start_io()), and joins its readers, so that the urb completion handler
+ * queues it the frames.
+ *
+ * @param reader The reader.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_reader_start(struct lumio_reader* reader)
+{
+  struct usb_touchscreen*	data = reader->data;
+  int				ret = 0;
+
+  mutex_lock(&reader->lock);
+  if (!reader->started && (ret = lumio_start_io(data)) == 0)
+    {
+      spin_lock_irq(&data->readers_lock);
+      list_add_tail(&reader->link, &data->readers);
+      spin_unlock_irq(&data->readers_lock);
+      reader->started = 1;
+    }
+  mutex_unlock(&reader->lock);
+
+  return (ret);
+}
+
+/**
+ * @brief Tells whether a frame is waiting for the reader.
+ */
+static int			lumio_reader_ready(struct lumio_reader* reader)
+{
+  return (ACCESS_ONCE(reader->head) != ACCESS_ONCE(reader->tail));
+}
+
+/**
+ * @brief Takes the oldest frame of a reader.
+ *
+ *	The frames the reader lost before this one are counted in its overruns.
+ *
+ * @param reader The reader.
+ * @param frame Filled with the frame.
+ * @return 1 if a frame was taken, 0 if there was none.
+ */
+static int			lumio_reader_pop(struct lumio_reader*		reader,
+						 struct lumio_cooked_frame*	frame)
+{
+  struct usb_touchscreen*	data = reader->data;
+  int				ret = 0;
+
+  spin_lock_irq(&data->readers_lock);
+  if (reader->head != reader->tail)
+    {
+      *frame = reader->frames[reader->head++ & (LUMIO_COOKED_QUEUE - 1)];
+      frame->overruns = reader->overruns;
+      reader->overruns = 0;
+      ret = 1;
+    }
+  spin_unlock_irq(&data->readers_lock);
+
+  return (ret);
+}
+
+/**
+ * @brief Reads cooked frames from the lumio%d char device.
+ *
+ *	As many whole frames as fit in the buffer are returned in a single call,
+ * see struct lumio_cooked_frame. Without frames, the call blocks unless the
+ * file is non blocking; once the touchscreen is unplugged and the frames left
+ * read, it fails with -ENODEV. A fault past the first frame returns the frames
+ * copied before it, the one which faulted is lost.
+ *
+ * @param file
+ * @param buffer Where to copy the frames.
+ * @param count Size of the buffer, at least one frame.
+ * @param ppos Unused, the device isn't seekable.
+ * @return The size of the frames read, or a negative number on failure.
+ */
+static ssize_t			lumio_read(struct file*		file,
+					   char __user*		buffer,
+					   size_t		count,
+					   loff_t*		ppos)
+{
+  struct lumio_reader*		reader = file->private_data;
+  struct usb_touchscreen*	data = reader->data;
+  struct lumio_cooked_frame	frame;
+  size_t			done = 0;
+  int				ret = 0;
+
+  if (count < sizeof (struct lumio_cooked_frame))
+    return (-EINVAL);
+  if ((ret = lumio_reader_start(reader)) < 0)
+    return (ret);
+
+  for (;;)
+    {
+      while (done + sizeof (struct lumio_cooked_frame) <= count &&
+	     lumio_reader_pop(reader, &frame))
+	{
+	  if (copy_to_user(buffer + done, &frame,
+			   sizeof (struct lumio_cooked_frame)))
+	    return (done ? (ssize_t) done : -EFAULT);
+	  done += sizeof (struct lumio_cooked_frame);
+	}
+      if (done)
+	return (done);
+
+      if (data->disconnected)
+	return (-ENODEV);
+      if (file->f_flags & O_NONBLOCK)
+	return (-EAGAIN);
+      if (wait_event_interruptible(data->readers_wait,
+				   lumio_reader_ready(reader) ||
+				   data->disconnected))
+	return (-ERESTARTSYS);
+    }
+}
+
+/**
+ * @brief Polls the lumio%d char device.
+ *
+ *	The device is readable while frames wait for the reader, and hung up
+ * once the touchscreen is unplugged.
+ *
+ * @param file
+ * @param wait
+ * @return The POLL* events.
+ */
+static unsigned int		lumio_poll(struct file*		file,
+					   poll_table*		wait)
+{
+  struct lumio_reader*		reader = file->private_data;
+  struct usb_touchscreen*	data = reader->data;
+  unsigned int			mask = 0;
+
+  if (lumio_reader_start(reader) < 0)
+    return (POLLERR | POLLHUP);
+
+  poll_wait(file, &data->readers_wait, wait);
+  if (lumio_reader_ready(reader))
+    mask |= POLLIN | POLLRDNORM;
+  if (data->disconnected)
+    mask |= POLLERR | POLLHUP;
+
+  return (mask);
+}
+
+/**
+ * @brief
+ *	This structure tells the kernel which function we register with the
+ *	char device.
+ */
+static struct file_operations	lumio_fops =
+  {
+    .owner	= THIS_MODULE,
+    .open	= lumio_open,
+    .release	= lumio_release,
+    .read	= lumio_read,
+    .poll	= lumio_poll,
+    .ioctl	= lumio_ioctl,
+  };
+
+/**
+ * @brief
+ *	This structure tells the kernel which char device we will use for this
+ *	driver.
+ */
+static struct usb_class_driver	lumio_class =
+  {
+    .name	= "lumio%d",
+    .fops	= &lumio_fops,
+    .minor_base	= 0,
+  };
+
+/*
+ * Video wall.
+ *
+ *	Panels listed in the wall module parameter don't get their own fake mice.
+ * They all report to a single multitouch input device (protocol A), whose
+ * coordinates are the ones of the wall: each panel covers the rectangle the
+ * parameter gives it. A contact lifted close to a seam is reported lifted
+ * right away, but its tracking id is kept for wall_handoff_delay ms, so that
+ * the same finger coming down on the neighbouring panel gets it back instead
+ * of being seen as a new one.
+ *
+ *	Reports of all panels go through the event lock, which makes the event
+ * stream of the wall globally ordered: each frame holds every contact of the
+ * wall.
+ */
+
+/**
+ * @brief Parses the wall module parameter.
+ *
+ * @return 0 on success, -EINVAL if the layout is wrong.
+ */
+static int			lumio_wall_parse(void)
+{
+  struct lumio_wall_panel*	panel = NULL;
+  char*				coords = NULL;
+  size_t			len = 0;
+  int				i = 0;
+
+  for (i = 0; i < nb_wall; ++i)
+    {
+      panel = &lumio_wall.panels[i];
+      coords = strchr(wall[i], ':');
+      len = coords ? coords - wall[i] : 0;
+      if (!coords || len == 0 || len >= LUMIO_BUS_PATH_SIZE ||
+	  sscanf(coords + 1, "%u:%u:%u:%u", &panel->x, &panel->y,
+		 &panel->width, &panel->height) != 4 ||
+	  panel->width == 0 || panel->height == 0)
+	{
+	  printk(KERN_WARNING "lumio_driver: bad wall panel \"%s\", expected "
+		 "bus_path:x:y:width:height.\n", wall[i]);
+	  return (-EINVAL);
+	}
+      memcpy(panel->bus_path, wall[i], len);
+      panel->bus_path[len] = '\0';
+      panel->slot[0] = -1;
+      panel->slot[1] = -1;
+      lumio_wall.width = max(lumio_wall.width, panel->x + panel->width);
+      lumio_wall.height = max(lumio_wall.height, panel->y + panel->height);
+    }
+  lumio_wall.nb_panels = nb_wall;
+
+  return (0);
+}
+
+/**
+ * @brief Returns the wall panel plugged at a bus path, NULL if there's none.
+ */
+static struct lumio_wall_panel*	lumio_wall_find(const char* bus_path)
+{
+  int				i = 0;
+
+  for (i = 0; i < lumio_wall.nb_panels; ++i)
+    if (!strcmp(lumio_wall.panels[i].bus_path, bus_path))
+      return (&lumio_wall.panels[i]);
+
+  return (NULL);
+}
+
+/**
+ * @brief Sends every contact of the wall to the input layer.
+ *
+ *	Must be called with the event lock held.
+ */
+static void			lumio_wall_sync(void)
+{
+  struct lumio_wall_contact*	contact = NULL;
+  struct lumio_wall_contact*	first = NULL;
+  struct input_dev*		idev = lumio_wall.idev;
+  int				i = 0;
+
+  if (!idev)
+    return;
+
+  for (i = 0; i < LUMIO_WALL_MAX_CONTACTS; ++i)
+    {
+      contact = &lumio_wall.contacts[i];
+      if (!contact->active || contact->lifted)
+	continue;
+      if (!first)
+	first = contact;
+      input_report_abs(idev, ABS_MT_TRACKING_ID, contact->tracking_id);
+      input_report_abs(idev, ABS_MT_POSITION_X, contact->x);
+      input_report_abs(idev, ABS_MT_POSITION_Y, contact->y);
+      input_mt_sync(idev);
+    }
+
+  if (!first)
+    input_mt_sync(idev);
+  input_report_key(idev, BTN_TOUCH, first != NULL);
+  if (first)
+    {
+      input_report_abs(idev, ABS_X, first->x);
+      input_report_abs(idev, ABS_Y, first->y);
+    }
+  input_sync(idev);
+}
+
+/**
+ * @brief Tells whether a position of a panel is close to one of its seams.
+ *
+ *	A seam is any side of the panel which isn't on the border of the wall.
+ */
+static int			lumio_wall_near_seam(struct lumio_wall_panel*	panel,
+						     __u32			x,
+						     __u32			y)
+{
+  return ((panel->x > 0 && x < panel->x + wall_handoff) ||
+	  (panel->y > 0 && y < panel->y + wall_handoff) ||
+	  (panel->x + panel->width < lumio_wall.width &&
+	   x + wall_handoff >= panel->x + panel->width) ||
+	  (panel->y + panel->height < lumio_wall.height &&
+	   y + wall_handoff >= panel->y + panel->height));
+}
+
+/**
+ * @brief Finds the wall contact of a finger coming down on a panel.
+ *
+ *	If a contact has just been lifted near a seam of another panel, close
+ * enough, the finger is the same one crossing the seam and takes it over.
+ * Otherwise a new contact is started. Must be called with the event lock held.
+ *
+ * @return The index of the contact, -1 if the wall has too many of them.
+ */
+static int			lumio_wall_touch(struct lumio_wall_panel*	panel,
+						 __u32				x,
+						 __u32				y)
+{
+  struct lumio_wall_contact*	contact = NULL;
+  int				free_slot = -1;
+  int				i = 0;
+
+  for (i = 0; i < LUMIO_WALL_MAX_CONTACTS; ++i)
+    {
+      contact = &lumio_wall.contacts[i];
+      if (!contact->active)
+	{
+	  if (free_slot < 0)
+	    free_slot = i;
+	  continue;
+	}
+      if (contact->lifted && contact->panel != panel &&
+	  time_before(jiffies, contact->deadline) &&
+	  abs((int) contact->x - (int) x) + abs((int) contact->y - (int) y) <=
+	  wall_handoff)
+	{
+	  contact->lifted = 0;
+	  contact->panel = panel;
+	  return (i);
+	}
+    }
+
+  if (free_slot < 0)
+    return (-1);
+
+  contact = &lumio_wall.contacts[free_slot];
+  contact->active = 1;
+  contact->lifted = 0;
+  contact->panel = panel;
+  contact->tracking_id = lumio_wall.next_id;
+  lumio_wall.next_id = (lumio_wall.next_id + 1) & 0xffff;
+
+  return (free_slot);
+}
+
+/**
+ * @brief Releases a wall contact whose finger has been lifted.
+ *
+ *	Near a seam, the contact is no longer reported but its slot and tracking
+ * id are kept until the hand-off timer runs out, in case the finger comes down
+ * on the neighbouring panel. Must be called with the event lock held.
+ */
+static void			lumio_wall_lift(struct lumio_wall_contact* contact)
+{
+  if (!lumio_wall_near_seam(contact->panel, contact->x, contact->y))
+    {
+      contact->active = 0;
+      return;
+    }
+
+  contact->lifted = 1;
+  contact->deadline = jiffies + msecs_to_jiffies(wall_handoff_delay);
+  if (!timer_pending(&lumio_wall.handoff_timer) ||
+      time_before(contact->deadline, lumio_wall.handoff_timer.expires))
+    mod_timer(&lumio_wall.handoff_timer, contact->deadline);
+}
+
+/**
+ * @brief Releases the tracking ids of the lifted contacts nobody took over.
+ *
+ *	They were reported lifted already, the event stream doesn't change.
+ *
+ * @param unused
+ */
+static void			lumio_wall_handoff_expired(unsigned long unused)
+{
+  struct lumio_wall_contact*	contact = NULL;
+  unsigned long			flags = 0;
+  unsigned long			next = 0;
+  int				pending = 0;
+  int				i = 0;
+
+  spin_lock_irqsave(&lumio_wall.event_lock, flags);
+  for (i = 0; i < LUMIO_WALL_MAX_CONTACTS; ++i)
+    {
+      contact = &lumio_wall.contacts[i];
+      if (!contact->active || !contact->lifted)
+	continue;
+      if (!time_before(jiffies, contact->deadline))
+	{
+	  contact->active = 0;
+	  contact->lifted = 0;
+	}
+      else if (!pending++ || time_before(contact->deadline, next))
+	next = contact->deadline;
+    }
+  if (pending)
+    mod_timer(&lumio_wall.handoff_timer, next);
+  spin_unlock_irqrestore(&lumio_wall.event_lock, flags);
+}
+
+/**
+ * @brief Reports the contacts of a panel on the wall.
+ *
+ * @param data The touchscreen, which is a panel of the wall.
+ * @param contacts The decoded contacts.
+ * @param nb_contacts How many of them.
+ */
+static void			lumio_wall_report(struct usb_touchscreen*	data,
+						  struct lumio_contact*		contacts,
+						  int				nb_contacts)
+{
+  struct lumio_wall_panel*	panel = data->wall_panel;
+  struct lumio_wall_contact*	contact = NULL;
+  unsigned long			flags = 0;
+  __u32				range = lumio_max_coordinate(data->firmware_version) + 1;
+  __u32				x = 0;
+  __u32				y = 0;
+  int*				slot = NULL;
+  int				i = 0;
+
+  spin_lock_irqsave(&lumio_wall.event_lock, flags);
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      slot = &panel->slot[contacts[i].tag];
+      if (!contacts[i].down)
+	{
+	  if (*slot >= 0)
+	    lumio_wall_lift(&lumio_wall.contacts[*slot]);
+	  *slot = -1;
+	  continue;
+	}
+
+      x = panel->x + contacts[i].x * panel->width / range;
+      y = panel->y + contacts[i].y * panel->height / range;
+      if (*slot < 0 && (*slot = lumio_wall_touch(panel, x, y)) < 0)
+	continue;
+      contact = &lumio_wall.contacts[*slot];
+      contact->x = x;
+      contact->y = y;
+    }
+  lumio_wall_sync();
+  spin_unlock_irqrestore(&lumio_wall.event_lock, flags);
+}
+
+/**
+ * @brief Starts the panels of the wall when somebody opens its device.
+ *
+ * @param dev The wall device.
+ */
+static int			lumio_wall_open(struct input_dev* dev)
+{
+  struct usb_touchscreen*	data = NULL;
+  int				ret = 0;
+  int				i = 0;
+
+  mutex_lock(&lumio_wall.lock);
+  if (lumio_wall.listeners++ == 0)
+    for (i = 0; i < lumio_wall.nb_panels; ++i)
+      if ((data = lumio_wall.panels[i].data) && lumio_start_io(data) < 0)
+	{
+	  ret = -EIO;
+	  while (i-- > 0)
+	    if ((data = lumio_wall.panels[i].data))
+	      lumio_stop_io(data);
+	  lumio_wall.listeners = 0;
+	  break;
+	}
+  mutex_unlock(&lumio_wall.lock);
+
+  return (ret);
+}
+
+/**
+ * @brief Stops the panels of the wall once its device isn't read anymore.
+ *
+ * @param dev The wall device.
+ */
+static void			lumio_wall_close(struct input_dev* dev)
+{
+  struct usb_touchscreen*	data = NULL;
+  int				i = 0;
+
+  mutex_lock(&lumio_wall.lock);
+  if (--lumio_wall.listeners == 0)
+    for (i = 0; i < lumio_wall.nb_panels; ++i)
+      if ((data = lumio_wall.panels[i].data))
+	lumio_stop_io(data);
+  mutex_unlock(&lumio_wall.lock);
+}
+
+/**
+ * @brief Creates the wall input device.
+ *
+ *	Must be called without the wall lock: a client may open the device as
+ * soon as it is registered, which takes it (see lumio_wall_open()).
+ *
+ * @param data The first panel of the wall to be plugged.
+ * @return The registered device, NULL on failure.
+ */
+static struct input_dev*	lumio_wall_create(struct usb_touchscreen* data)
+{
+  struct input_dev*		idev = NULL;
+
+  if (!(idev = input_allocate_device()))
+    return (NULL);
+
+  idev->name = idev_name_wall;
+  lumio_input_id(data, idev);
+  set_bit(EV_SYN, idev->evbit);
+  set_bit(EV_KEY, idev->evbit);
+  set_bit(BTN_TOUCH, idev->keybit);
+  set_bit(EV_ABS, idev->evbit);
+  input_set_abs_params(idev, ABS_X, 0, lumio_wall.width - 1, 0, 0);
+  input_set_abs_params(idev, ABS_Y, 0, lumio_wall.height - 1, 0, 0);
+  input_set_abs_params(idev, ABS_MT_POSITION_X, 0, lumio_wall.width - 1, 0, 0);
+  input_set_abs_params(idev, ABS_MT_POSITION_Y, 0, lumio_wall.height - 1, 0, 0);
+  input_set_abs_params(idev, ABS_MT_TRACKING_ID, 0, 0xffff, 0, 0);
+  idev->open = lumio_wall_open;
+  idev->close = lumio_wall_close;
+
+  if (input_register_device(idev))
+    {
+      input_free_device(idev);
+      return (NULL);
+    }
+
+  return (idev);
+}
+
+/**
+ * @brief Binds a touchscreen to its panel of the wall.
+ *
+ *	The wall device is created with the first panel. It is registered
+ * without the wall lock, then published under it; a panel joining at the same
+ * time may have published its own first, ours is unregistered then. As in
+ * lumio_wall_leave(), the device is unregistered without the wall lock.
+ *
+ * @param data The touchscreen, whose wall_panel is set.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_wall_join(struct usb_touchscreen* data)
+{
+  struct input_dev*		idev = NULL;
+  unsigned long			flags = 0;
+  int				create = 0;
+  int				ret = 0;
+
+  mutex_lock(&lumio_wall.lock);
+  create = !lumio_wall.idev;
+  mutex_unlock(&lumio_wall.lock);
+  if (create && !(idev = lumio_wall_create(data)))
+    {
+      printk(KERN_WARNING "lumio_driver: Unable to create the wall device.\n");
+      data->wall_panel = NULL;
+      return (-ENOMEM);
+    }
+
+  mutex_lock(&lumio_wall.lock);
+  if (!lumio_wall.idev && idev)
+    {
+      spin_lock_irqsave(&lumio_wall.event_lock, flags);
+      lumio_wall.idev = idev;
+      spin_unlock_irqrestore(&lumio_wall.event_lock, flags);
+      idev = NULL;
+    }
+  if (lumio_wall.listeners > 0)
+    SAFE_CALL(lumio_start_io(data), "Unable to start wall panel.\n");
+  ++lumio_wall.users;
+  data->wall_panel->data = data;
+  printk(KERN_INFO "lumio_driver: %s joined the wall at %u,%u.\n",
+	 data->name, data->wall_panel->x, data->wall_panel->y);
+  mutex_unlock(&lumio_wall.lock);
+
+  if (idev)
+    input_unregister_device(idev);
+  return (0);
+
+ error:
+  if (lumio_wall.users == 0 && !idev)
+    {
+      spin_lock_irqsave(&lumio_wall.event_lock, flags);
+      idev = lumio_wall.idev;
+      lumio_wall.idev = NULL;
+      spin_unlock_irqrestore(&lumio_wall.event_lock, flags);
+    }
+  mutex_unlock(&lumio_wall.lock);
+  if (idev)
+    input_unregister_device(idev);
+  data->wall_panel = NULL;
+  return (ret);
+}
+
+/**
+ * @brief Unbinds a touchscreen from the wall.
+ *
+ *	Its contacts are released, and the wall device goes away with the last
+ * panel. The device is unregistered without the wall lock, as it may call
+ * lumio_wall_close().
+ *
+ * @param data The touchscreen.
+ */
+static void			lumio_wall_leave(struct usb_touchscreen* data)
+{
+  struct lumio_wall_panel*	panel = data->wall_panel;
+  struct input_dev*		idev = NULL;
+  unsigned long			flags = 0;
+  int				i = 0;
+
+  mutex_lock(&lumio_wall.lock);
+  if (lumio_wall.listeners > 0)
+    lumio_stop_io(data);
+  panel->data = NULL;
+
+  spin_lock_irqsave(&lumio_wall.event_lock, flags);
+  for (i = 0; i < LUMIO_WALL_MAX_CONTACTS; ++i)
+    if (lumio_wall.contacts[i].active && lumio_wall.contacts[i].panel == panel)
+      lumio_wall.contacts[i].active = 0;
+  panel->slot[0] = -1;
+  panel->slot[1] = -1;
+  lumio_wall_sync();
+  if (--lumio_wall.users == 0)
+    {
+      idev = lumio_wall.idev;
+      lumio_wall.idev = NULL;
+    }
+  spin_unlock_irqrestore(&lumio_wall.event_lock, flags);
+  mutex_unlock(&lumio_wall.lock);
+
+  if (idev)
+    {
+      del_timer_sync(&lumio_wall.handoff_timer);
+      input_unregister_device(idev);
+    }
+  data->wall_panel = NULL;
+}
+
+static void			lumio_which_finger(struct usb_touchscreen* data,
+						   __u8*	which,
+						   __u32	x,
+						   __u32	y)
+{
+  __u32				distance_from_first_finger = 0;
+  __u32				distance_from_second_finger = 0;
+
+  ASSERT(data != NULL);
+  ASSERT(which != NULL);
+
+  distance_from_first_finger =
+    abs(data->fakemouse[0].last_x - x) + abs(data->fakemouse[0].last_y - y);
+  distance_from_second_finger =
+    abs(data->fakemouse[1].last_x - x) + abs(data->fakemouse[1].last_y - y);
+
+  if (distance_from_first_finger < distance_from_second_finger)
+    *which = 0;
+  else
+    *which = 1;
+}
+
+/*
+ * Partitions.
+ *
+ *	When the partition module parameter is given, the touchscreens are split
+ * in rectangles, each one being its own multitouch input device (protocol A)
+ * whose coordinates are relative to the rectangle. A contact belongs to the
+ * partition it came down in until it is lifted, even if it slides out of it,
+ * so that two users side by side never steal each other's fingers. Contacts
+ * coming down outside of every partition are ignored. Panels of the video wall
+ * aren't partitioned.
+ */
+
+/**
+ * @brief Parses the partition module parameter.
+ *
+ * @return 0 on success, -EINVAL if the layout is wrong.
+ */
+static int			lumio_partition_parse(void)
+{
+  struct lumio_partition*	rect = NULL;
+  int				i = 0;
+
+  for (i = 0; i < nb_partition; ++i)
+    {
+      rect = &lumio_partitions[i];
+      if (sscanf(partition[i], "%u:%u:%u:%u", &rect->x, &rect->y,
+		 &rect->width, &rect->height) != 4 ||
+	  rect->width == 0 || rect->height == 0 ||
+	  rect->x + rect->width > 4096 || rect->y + rect->height > 4096)
+	{
+	  printk(KERN_WARNING "lumio_driver: bad partition \"%s\", expected "
+		 "x:y:width:height within 0-4095.\n", partition[i]);
+	  return (-EINVAL);
+	}
+    }
+
+  return (0);
+}
+
+/**
+ * @brief Returns the partition a position is in, -1 if there's none.
+ */
+static int			lumio_partition_find(__u32 x, __u32 y)
+{
+  struct lumio_partition*	rect = NULL;
+  int				i = 0;
+
+  for (i = 0; i < nb_partition; ++i)
+    {
+      rect = &lumio_partitions[i];
+      if (x >= rect->x && x < rect->x + rect->width &&
+	  y >= rect->y && y < rect->y + rect->height)
+	return (i);
+    }
+
+  return (-1);
+}
+
+/**
+ * @brief Sends the contacts of a partition to its input device.
+ *
+ * @param data The touchscreen.
+ * @param which The partition.
+ */
+static void			lumio_partition_sync(struct usb_touchscreen*	data,
+						     int			which)
+{
+  struct lumio_partition*	rect = &lumio_partitions[which];
+  struct input_dev*		idev = data->partition[which];
+  int				down = 0;
+  int				x = 0;
+  int				y = 0;
+  int				i = 0;
+
+  for (i = 0; i < LUMIO_MAX_CONTACTS; ++i)
+    {
+      if (data->latch[i] != which)
+	continue;
+      x = clamp_t(int, data->latched[i].x - (int) rect->x, 0,
+		  rect->width - 1);
+      y = clamp_t(int, data->latched[i].y - (int) rect->y, 0,
+		  rect->height - 1);
+      input_report_abs(idev, ABS_MT_TRACKING_ID, data->tracking_id[i]);
+      input_report_abs(idev, ABS_MT_POSITION_X, x);
+      input_report_abs(idev, ABS_MT_POSITION_Y, y);
+      input_mt_sync(idev);
+      if (!down++)
+	{
+	  input_report_abs(idev, ABS_X, x);
+	  input_report_abs(idev, ABS_Y, y);
+	}
+    }
+
+  if (!down)
+    input_mt_sync(idev);
+  input_report_key(idev, BTN_TOUCH, down != 0);
+  input_sync(idev);
+}
+
+/**
+ * @brief Routes the contacts of a report to the partitions.
+ *
+ * @param data The touchscreen.
+ * @param contacts The decoded contacts.
+ * @param nb_contacts How many of them.
+ */
+static void			lumio_partition_report(struct usb_touchscreen*	data,
+						       struct lumio_contact*	contacts,
+						       int			nb_contacts)
+{
+  unsigned int			touched = 0;
+  int				tag = 0;
+  int				which = 0;
+  int				i = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      tag = contacts[i].tag;
+      which = data->latch[tag];
+      if (!contacts[i].down)
+	{
+	  if (which >= 0)
+	    touched |= 1 << which;
+	  data->latch[tag] = -1;
+	  continue;
+	}
+
+      if (which < 0)
+	{
+	  if ((which = lumio_partition_find(contacts[i].x, contacts[i].y)) < 0)
+	    continue;
+	  data->latch[tag] = which;
+	  data->tracking_id[tag] = data->next_tracking_id++;
+	}
+      data->latched[tag] = contacts[i];
+      touched |= 1 << which;
+    }
+
+  for (i = 0; i < nb_partition; ++i)
+    if (touched & (1 << i))
+      lumio_partition_sync(data, i);
+}
+
+static int			lumio_partition_open(struct input_dev* dev)
+{
+  return (lumio_start_io(input_get_drvdata(dev)));
+}
+
+static void			lumio_partition_close(struct input_dev* dev)
+{
+  lumio_stop_io(input_get_drvdata(dev));
+}
+
+/**
+ * @brief Registers the partition devices of a touchscreen.
+ *
+ *	Devices already registered when an error occurs are unregistered by
+ * lumio_delete().
+ *
+ * @param data The touchscreen.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+static int			lumio_partition_init(struct usb_touchscreen* data)
+{
+  struct lumio_partition*	rect = NULL;
+  struct input_dev*		idev = NULL;
+  int				i = 0;
+
+  data->latch[0] = -1;
+  data->latch[1] = -1;
+
+  for (i = 0; i < nb_partition; ++i)
+    {
+      rect = &lumio_partitions[i];
+      if (!(idev = input_allocate_device()))
+	return (-ENOMEM);
+
+      idev->name = idev_name_partition[i];
+      input_set_drvdata(idev, data);
+      lumio_input_id(data, idev);
+      set_bit(EV_SYN, idev->evbit);
+      set_bit(EV_KEY, idev->evbit);
+      set_bit(BTN_TOUCH, idev->keybit);
+      set_bit(EV_ABS, idev->evbit);
+      input_set_abs_params(idev, ABS_X, 0, rect->width - 1, 0, 0);
+      input_set_abs_params(idev, ABS_Y, 0, rect->height - 1, 0, 0);
+      input_set_abs_params(idev, ABS_MT_POSITION_X, 0, rect->width - 1, 0, 0);
+      input_set_abs_params(idev, ABS_MT_POSITION_Y, 0, rect->height - 1, 0, 0);
+      input_set_abs_params(idev, ABS_MT_TRACKING_ID, 0, 0xffff, 0, 0);
+      idev->open = lumio_partition_open;
+      idev->close = lumio_partition_close;
+
+      if (input_register_device(idev))
+	{
+	  input_free_device(idev);
+	  return (-ENOMEM);
+	}
+      data->partition[i] = idev;
+    }
+
+  return (0);
+}
+
+/**
+ * @brief Runs the contact filter on each contact of a report.
+ *
+ *	The contacts dropped by the filter are removed from the array, the others
+ * are updated with what the filter left in its scratch memory.
+ *
+ * @param data The touchscreen.
+ * @param filter The contact filter.
+ * @param contacts The decoded contacts.
+ * @param nb_contacts How many of them.
+ * @return The number of contacts left.
+ */
+static int			lumio_filter_contacts(struct usb_touchscreen*	data,
+						      struct lumio_filter*	filter,
+						      struct lumio_contact*	contacts,
+						      int			nb_contacts)
+{
+  __u32				mem[LUMIO_FILTER_MEMWORDS];
+  __u16				max_coord = lumio_max_coordinate(data->firmware_version);
+  int				kept = 0;
+  int				i = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      memset(mem, 0x0, sizeof(mem));
+      mem[LUMIO_FILTER_M_X] = contacts[i].x;
+      mem[LUMIO_FILTER_M_Y] = contacts[i].y;
+      mem[LUMIO_FILTER_M_TAG] = contacts[i].tag;
+      mem[LUMIO_FILTER_M_DOWN] = contacts[i].down;
+      mem[LUMIO_FILTER_M_INDEX] = i;
+      mem[LUMIO_FILTER_M_COUNT] = nb_contacts;
+      mem[LUMIO_FILTER_M_FIRMWARE] = data->firmware_version;
+      mem[LUMIO_FILTER_M_MAX_COORD] = max_coord;
+
+      if (!lumio_filter_run(filter->insns, data->in_buffer,
+			    lumio_report_size(data->firmware_version), mem))
+	{
+	  ++data->stats.filtered_contacts;
+	  continue;
+	}
+
+      contacts[kept].x = min(mem[LUMIO_FILTER_M_X], (__u32) max_coord);
+      contacts[kept].y = min(mem[LUMIO_FILTER_M_Y], (__u32) max_coord);
+      contacts[kept].tag = mem[LUMIO_FILTER_M_TAG] & 1;
+      contacts[kept].down = mem[LUMIO_FILTER_M_DOWN] != 0;
+      ++kept;
+    }
+
+  return (kept);
+}
+
+/**
+ * @brief Drops the spurious contacts of a report.
+ *
+ *	See lumio_reject.h. The contacts rejected are removed from the array and
+ * counted by reason. A contact down in the dead-zone is counted once, when it
+ * comes down, not with each of its reports.
+ *
+ * @param data The touchscreen.
+ * @param contacts The decoded contacts.
+ * @param nb_contacts How many of them.
+ * @return The number of contacts left.
+ */
+static int			lumio_reject_contacts(struct usb_touchscreen*	data,
+						      struct lumio_contact*	contacts,
+						      int			nb_contacts)
+{
+  __u32				max_coord = lumio_max_coordinate(data->firmware_version);
+  struct lumio_reject_state*	s = NULL;
+  __u8				state = 0;
+  int				kept = 0;
+  int				i = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      s = &data->reject[contacts[i].tag];
+      state = s->state;
+      switch (lumio_reject(&data->rejection, s, &contacts[i], max_coord))
+	{
+	case LUMIO_REJECT_NONE:
+	  contacts[kept++] = contacts[i];
+	  break;
+	case LUMIO_REJECT_EDGE:
+	  if (state == LUMIO_REJECT_IDLE)
+	    ++data->stats.rejected_edge;
+	  break;
+	case LUMIO_REJECT_JUMP:
+	  ++data->stats.rejected_jump;
+	  break;
+	case LUMIO_REJECT_BLIP:
+	  ++data->stats.rejected_blips;
+	  break;
+	}
+    }
 
-      mdelay(10);
-      ++nb_try;
-    } while (nb_try < 3 && lumio_actual_conf(data) == USB_SINGLETOUCH_CONFIG);
+  return (kept);
+}
 
-  if (nb_try == 3)
-    return (-ENODEV);
+/**
+ * @brief Puts back the lifts the filters dropped.
+ *
+ *	A lift ends the stroke of its tag on the fake mice and in the cooked
+ * frames, the next contact of the tag getting a new tracking id: a filter
+ * dropping it would leave the tag down for good. The lift of a tag reported
+ * down is kept unless a contact of that tag is left in the report.
+ *
+ * @param data The touchscreen.
+ * @param contacts The contacts left, room for LUMIO_MAX_CONTACTS.
+ * @param nb_contacts How many of them.
+ * @param lifts The lifts of the report, as decoded.
+ * @param nb_lifts How many of them.
+ * @return The number of contacts left.
+ */
+static int			lumio_keep_lifts(struct usb_touchscreen*	data,
+						 struct lumio_contact*		contacts,
+						 int				nb_contacts,
+						 const struct lumio_contact*	lifts,
+						 int				nb_lifts)
+{
+  __u8				left = 0;
+  int				i = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    left |= 1 << contacts[i].tag;
+  for (i = 0; i < nb_lifts && nb_contacts < LUMIO_MAX_CONTACTS; ++i)
+    if (data->contacts_down & ~left & (1 << lifts[i].tag))
+      {
+	left |= 1 << lifts[i].tag;
+	contacts[nb_contacts++] = lifts[i];
+      }
+
+  return (nb_contacts);
+}
 
-  return (0);
+/**
+ * @brief Reports the contacts on the fake mice, decimated.
+ *
+ *	Each position reported gets its own input_sync(): a contact lifted may
+ * first report the end of its stroke. The raw position is the one reported,
+ * there's no prediction.
+ *
+ * @param data The touchscreen.
+ * @param contacts The contacts of the report.
+ * @param nb_contacts How many of them.
+ */
+static void			lumio_decimate_report(struct usb_touchscreen*		data,
+						      const struct lumio_contact*	contacts,
+						      int				nb_contacts)
+{
+  struct lumio_contact		out[2];
+  struct input_dev*		idev = NULL;
+  int				n = 0;
+  int				i = 0;
+  int				j = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      idev = data->fakemouse[contacts[i].tag].idev;
+      n = lumio_decimate(&data->decimation, &data->decimate[contacts[i].tag],
+			 &contacts[i], out);
+      if (n == 0)
+	++data->stats.decimated;
+      for (j = 0; j < n; ++j)
+	{
+	  input_report_key(idev, BTN_LEFT, out[j].down);
+	  input_report_abs(idev, ABS_X, out[j].x);
+	  input_report_abs(idev, ABS_Y, out[j].y);
+	  input_report_abs(idev, ABS_RX, out[j].x);
+	  input_report_abs(idev, ABS_RY, out[j].y);
+	  input_sync(idev);
+	}
+    }
 }
 
 /**
- * @brief Discovers all endpoints the device has to offer.
+ * @brief Sends the keys of the hot regions.
  *
- *	 This functions probes all endpoints attached to the device and record
- * them in the private structure associated with the interface (see
- * ::usb_touchscreen). Endpoints are kind off pipes used to communicate with the
- * touchscreen.
+ *	Only the transitions of the contacts matter: a contact coming down
+ * presses the key of a LUMIO_REGION_PRESS region, a contact lifted releases
+ * it, or clicks the key of the LUMIO_REGION_CLICK region it came down in if it
+ * is still in there. Moves cost nothing.
  *
- * @param data The private structure associated with the interface.
- * @return 0 on success, a negative number if it fails probing endpoints.
+ * @param data The touchscreen.
+ * @param index The regions.
+ * @param contacts The contacts of the report.
+ * @param nb_contacts How many of them.
  */
-static int				lumio_find_endpoints(struct usb_touchscreen* data)
+static void			lumio_regions_report(struct usb_touchscreen*		data,
+						     const struct lumio_region_index*	index,
+						     const struct lumio_contact*	contacts,
+						     int				nb_contacts)
 {
-  unsigned int				i;
-  struct usb_host_interface*		iface_desc;
-  struct usb_endpoint_descriptor*	endpoint;
+  const struct lumio_region*	region = NULL;
+  int				sync = 0;
+  int				tag = 0;
+  int				r = 0;
+  int				i = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      tag = contacts[i].tag;
+      if (contacts[i].down == data->region_down[tag])
+	continue;
+      data->region_down[tag] = contacts[i].down;
+
+      if (contacts[i].down)
+	{
+	  r = lumio_region_find(index, contacts[i].x, contacts[i].y);
+	  data->region_pressed[tag] = r;
+	  if (r >= 0 && index->regions[r].mode == LUMIO_REGION_PRESS)
+	    {
+	      data->region_key[tag] = index->regions[r].key;
+	      input_report_key(data->keys, data->region_key[tag], 1);
+	      sync = 1;
+	    }
+	  continue;
+	}
+
+      if (data->region_key[tag])
+	{
+	  input_report_key(data->keys, data->region_key[tag], 0);
+	  data->region_key[tag] = 0;
+	  sync = 1;
+	}
+      r = data->region_pressed[tag];
+      data->region_pressed[tag] = -1;
+      if (r < 0 || r >= index->nb_regions)
+	continue;
+      region = &index->regions[r];
+      if (region->mode == LUMIO_REGION_CLICK &&
+	  lumio_region_find(index, contacts[i].x, contacts[i].y) == r)
+	{
+	  input_report_key(data->keys, region->key, 1);
+	  input_sync(data->keys);
+	  input_report_key(data->keys, region->key, 0);
+	  sync = 1;
+	}
+    }
+
+  if (sync)
+    input_sync(data->keys);
+}
+
+/**
+ * @brief Queues a frame to each reader of the lumio%d char device.
+ *
+ *	Called from the urb completion handler, with the contacts left once
+ * rejected and before the tags down are updated: a contact coming down gets a
+ * new tracking id here, whether somebody reads or not. A report with no
+ * contact left still gives a frame. A reader whose queue is full loses its
+ * oldest frame.
+ *
+ * @param data The touchscreen.
+ * @param contacts The contacts of the report.
+ * @param nb_contacts Number of contacts.
+ */
+static void			lumio_cook(struct usb_touchscreen*	data,
+					   const struct lumio_contact*	contacts,
+					   int				nb_contacts)
+{
+  struct lumio_cooked_frame	frame;
+  struct lumio_cooked_contact*	cooked = NULL;
+  struct lumio_reader*		reader = NULL;
+  unsigned long			flags = 0;
+  int				tag = 0;
+  int				i = 0;
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      tag = contacts[i].tag;
+      if (contacts[i].down && !(data->contacts_down & (1 << tag)))
+	data->cooked_id[tag] = data->next_tracking_id++;
+    }
+
+  if (list_empty(&data->readers))
+    return;
+
+  memset(&frame, 0x0, sizeof (struct lumio_cooked_frame));
+  frame.time_us = ktime_to_us(ktime_get());
+  frame.sequence = data->cooked_sequence++;
+  frame.nb_contacts = nb_contacts;
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      cooked = &frame.contacts[i];
+      cooked->id = data->cooked_id[contacts[i].tag];
+      cooked->x = contacts[i].x;
+      cooked->y = contacts[i].y;
+      cooked->tag = contacts[i].tag;
+      cooked->state = contacts[i].down ? LUMIO_COOKED_DOWN : 0;
+    }
+
+  spin_lock_irqsave(&data->readers_lock, flags);
+  list_for_each_entry(reader, &data->readers, link)
+    {
+      if (reader->tail - reader->head == LUMIO_COOKED_QUEUE)
+	{
+	  ++reader->head;
+	  ++reader->overruns;
+	}
+      reader->frames[reader->tail++ & (LUMIO_COOKED_QUEUE - 1)] = frame;
+    }
+  spin_unlock_irqrestore(&data->readers_lock, flags);
+
+  wake_up_interruptible(&data->readers_wait);
+}
+
+/**
+ * @brief Sends a report to the input layer.
+ *
+ *	The report is decoded (see lumio_decode_report()) and each contact is
+ * reported on the fake mouse matching the tag the controller gave it. Filters
+ * loaded with IOCTL_SET_FILTER run before decoding and on each contact, though
+ * the lifts of the tags down are kept (see lumio_keep_lifts()), then the
+ * spurious contacts are rejected (see IOCTL_SET_REJECTION), and the readers of
+ * the lumio%d char device get them as a frame (see lumio_cook()).
+ * The strokes of the fake mice may be decimated (see IOCTL_SET_DECIMATION).
+ *
+ * @param data The touchscreen, whose in_buffer holds the report.
+ * @param event_type LUMIO_SINGLE_EVENT or LUMIO_DUAL_EVENT.
+ */
+static void			lumio_treat_event(struct usb_touchscreen*	data,
+						  int				event_type)
+{
+  struct lumio_contact		contacts[LUMIO_MAX_CONTACTS];
+  struct lumio_contact		lifts[LUMIO_MAX_CONTACTS];
+  __u32				mem[LUMIO_FILTER_MEMWORDS];
+  struct lumio_filter*		filter = NULL;
+  struct lumio_region_index*	regions = NULL;
+  int				nb_contacts = 0;
+  int				nb_lifts = 0;
+  int				filtered = 0;
+  int				i = 0;
+  __u8				which = 0;
+  __u32				x = 0;
+  __u32				y = 0;
+  __u32				up = 0;
+  __s32				predicted_x = 0;
+  __s32				predicted_y = 0;
+  __u32				now_us = 0;
+  unsigned long			flags = 0;
 
   ASSERT(data != NULL);
+  ASSERT(data->in_buffer != NULL);
 
-  iface_desc = data->interface->cur_altsetting;
+  ++data->stats.reports;
 
-  for (i = 0; i < iface_desc->desc.bNumEndpoints; ++i)
+  memset(mem, 0x0, sizeof(mem));
+  mem[LUMIO_FILTER_M_FIRMWARE] = data->firmware_version;
+  mem[LUMIO_FILTER_M_MAX_COORD] = lumio_max_coordinate(data->firmware_version);
+
+  nb_contacts = lumio_decode_report(data->in_buffer, contacts);
+  for (i = 0; i < nb_contacts; ++i)
+    if (!contacts[i].down)
+      lifts[nb_lifts++] = contacts[i];
+
+  rcu_read_lock();
+  filter = rcu_dereference(data->filter[LUMIO_HOOK_REPORT]);
+  if (filter && !lumio_filter_run(filter->insns, data->in_buffer,
+				  lumio_report_size(data->firmware_version), mem))
     {
-      endpoint = &iface_desc->endpoint[i].desc;
-      if ((endpoint->bEndpointAddress & USB_DIR_IN) &&
-	  IS_INT_ENDPOINT(endpoint->bmAttributes))
+      ++data->stats.filtered_reports;
+      filtered = 1;
+      nb_contacts = 0;
+    }
+  else if ((filter = rcu_dereference(data->filter[LUMIO_HOOK_CONTACT])))
+    nb_contacts = lumio_filter_contacts(data, filter, contacts, nb_contacts);
+  rcu_read_unlock();
+
+  /* The settings don't change under our feet (see lumio_set_config()) */
+  spin_lock_irqsave(&data->config_lock, flags);
+
+  if (nb_lifts)
+    nb_contacts = lumio_keep_lifts(data, contacts, nb_contacts, lifts,
+				   nb_lifts);
+  /* A report filtered out goes no further, unless it lifts a tag down */
+  if (filtered && !nb_contacts)
+    goto out;
+
+  if (lumio_reject_enabled(&data->rejection))
+    nb_contacts = lumio_reject_contacts(data, contacts, nb_contacts);
+
+  lumio_cook(data, contacts, nb_contacts);
+
+  for (i = 0; i < nb_contacts; ++i)
+    if (contacts[i].down)
+      data->contacts_down |= 1 << contacts[i].tag;
+    else
+      data->contacts_down &= ~(1 << contacts[i].tag);
+
+  rcu_read_lock();
+  regions = rcu_dereference(data->regions);
+  if (regions)
+    {
+      lumio_regions_report(data, regions, contacts, nb_contacts);
+      if (regions->flags & LUMIO_REGIONS_ONLY)
 	{
-	  data->int_in_endpoint = endpoint->bEndpointAddress;
+	  rcu_read_unlock();
+	  goto out;
 	}
-      else if (!(endpoint->bEndpointAddress & USB_DIR_IN) &&
-	       IS_INT_ENDPOINT(endpoint->bmAttributes))
+    }
+  rcu_read_unlock();
+
+  if (data->wall_panel)
+    {
+      lumio_wall_report(data, contacts, nb_contacts);
+      goto out;
+    }
+  if (nb_partition > 0)
+    {
+      lumio_partition_report(data, contacts, nb_contacts);
+      goto out;
+    }
+  if (lumio_decimate_enabled(&data->decimation))
+    {
+      lumio_decimate_report(data, contacts, nb_contacts);
+      goto out;
+    }
+
+  if (data->prediction.lookahead_ms)
+    now_us = (__u32) ktime_to_us(ktime_get());
+
+  for (i = 0; i < nb_contacts; ++i)
+    {
+      which = contacts[i].tag;
+      x = contacts[i].x;
+      y = contacts[i].y;
+      up = contacts[i].down;
+
+      /* Reporting the touch to the input layer */
+      input_report_key(data->fakemouse[which].idev,
+		       BTN_LEFT, up);
+      if (data->prediction.lookahead_ms && up)
 	{
-	  data->int_out_endpoint = endpoint->bEndpointAddress;
-	  printk(KERN_INFO "lumio_driver: Out interrupt endpoint adress is: %d.\n",
-		 data->int_out_endpoint);
+	  lumio_predict_update(&data->predictor[which], x, y, now_us);
+	  lumio_predict(&data->predictor[which], &data->prediction,
+			lumio_max_coordinate(data->firmware_version),
+			&predicted_x, &predicted_y);
 	}
+      else
+	{
+	  /* Lifted: back to where the finger really was */
+	  lumio_predict_reset(&data->predictor[which]);
+	  predicted_x = x;
+	  predicted_y = y;
+	}
+      input_report_abs(data->fakemouse[which].idev,
+		       ABS_X, predicted_x);
+      input_report_abs(data->fakemouse[which].idev,
+		       ABS_Y, predicted_y);
+      input_report_abs(data->fakemouse[which].idev,
+		       ABS_RX, x);
+      input_report_abs(data->fakemouse[which].idev,
+		       ABS_RY, y);
+      input_sync(data->fakemouse[which].idev);
+
+#ifdef LUMIO_DEBUG
+      PRINT_RECEIVED_DEBUG_TRACE();
+#endif
     }
 
-  return (0);
+ out:
+  spin_unlock_irqrestore(&data->config_lock, flags);
 }
 
 /**
- * @brief Starts the receiving of urbs.
+ * @brief Queues a recovery action.
  *
- *	This function is called each first time one of the two char device
- * corresponding to our fake mice is opened. That means somebody is listening
- * to events from our touchscreen and that we should start receiving interrupt
- * in urbs to get report from the touchscreen.
+ *	Recovery actions that may sleep (clearing a halt, resetting the device)
+ * can't be done from the urb completion handler, they are deferred to the
+ * recovery work. The delay doubles with each failed attempt, starting from the
+ * polling interval, so that a device which keeps failing doesn't flood the bus
+ * nor the logs.
  *
- * @param dev The char device that is first read by a process.
+ * @param data The touchscreen.
+ * @param action One of LUMIO_RECOVER_RESUBMIT, LUMIO_RECOVER_CLEAR_HALT and
+ * LUMIO_RECOVER_RESET.
  */
-static int			lumio_fake_open(struct input_dev* dev)
+static void			lumio_schedule_recovery(struct usb_touchscreen* data,
+							int			action)
+{
+  unsigned int			shift = 0;
+  unsigned int			delay = 0;
+
+  set_bit(action, &data->recovery_flags);
+
+  if (data->recovery_attempts > LUMIO_QUICK_RETRIES)
+    shift = min(data->recovery_attempts - LUMIO_QUICK_RETRIES, 10u);
+  delay = min((unsigned int) data->interval << shift,
+	      (unsigned int) LUMIO_RECOVERY_MAX_DELAY);
+
+  schedule_delayed_work(&data->recovery, msecs_to_jiffies(delay));
+}
+
+/**
+ * @brief Submits one of the interrupt in urbs from the completion handler.
+ *
+ *	A failed submission would silently stop the report stream, so it is
+ * handed to the recovery work instead of being ignored.
+ *
+ * @param data The touchscreen.
+ * @param urb Either urb_in or urb_in2.
+ */
+static void			lumio_submit_in(struct usb_touchscreen*	data,
+						struct urb*		urb)
 {
-  struct usb_touchscreen*	data = input_get_drvdata(dev);
   int				ret = 0;
 
-  ASSERT(data != NULL);
+  ret = usb_submit_urb(urb, GFP_ATOMIC);
+  if (ret == 0 || ret == -EPERM || ret == -ENODEV)
+    return;
+
+  ++data->stats.submit_errors;
+  if (data->recovery_attempts++ == 0)
+    data->error_time = ktime_get();
+  lumio_schedule_recovery(data, LUMIO_RECOVER_RESUBMIT);
+}
+
+/**
+ * @brief Returns the time between two reports, in microseconds.
+ *
+ *	Firmware 1.0 and 2.0 need two urbs per report.
+ */
+static __u32			lumio_report_period_us(struct usb_touchscreen* data)
+{
+  __u32				period = data->interval * 1000;
+
+  if (data->firmware_version != LUMIO_FIRMWARE_3_0)
+    period *= 2;
+
+  return (period ? period : 1000);
+}
+
+/**
+ * @brief Checks the status of a completed interrupt in urb.
+ *
+ *	Errors are classified as follow:
+ * - -ECONNRESET, -ENOENT: the urb has been killed, nothing to do.
+ * - -ESHUTDOWN: nothing to do once lumio_disconnect() has seen the device go.
+ *   Until then, the host controller may just be going through a bad patch (or
+ *   the fault is injected): the chain is restarted from the recovery work,
+ *   which gives up as soon as the device is disconnected.
+ * - -EPIPE: the endpoint is halted, the halt is cleared from the recovery work.
+ * - Anything else (-EPROTO, -EILSEQ, -EOVERFLOW, -ETIME, ...) is considered
+ *   transient: the chain is restarted right away for the first
+ *   LUMIO_QUICK_RETRIES errors, then with an exponential backoff, and the
+ *   device is finally reset after LUMIO_RESET_THRESHOLD errors in a row.
+ *
+ * @param data The touchscreen.
+ * @param urb The urb that has completed.
+ * @return 0 if the urb holds a report, a negative number otherwise.
+ */
+static int			lumio_check_urb(struct usb_touchscreen*	data,
+						struct urb*		urb)
+{
+  __s64				outage = 0;
+
+  switch (urb->status)
+    {
+    case 0:
+      if (data->recovery_attempts != 0)
+	{
+	  outage = ktime_to_us(ktime_sub(ktime_get(), data->error_time));
+	  data->stats.last_recovery_us = (__u32) outage;
+	  data->stats.total_recovery_us += (__u32) outage;
+	  data->stats.lost_reports += (__u32) outage / lumio_report_period_us(data);
+	  if (data->stats.last_recovery_us > data->stats.max_recovery_us)
+	    data->stats.max_recovery_us = data->stats.last_recovery_us;
+	  ++data->stats.recoveries;
+	  data->recovery_attempts = 0;
+	}
+      return (0);
+    case -ECONNRESET:
+    case -ENOENT:
+      return (-1);
+    case -ESHUTDOWN:
+      if (data->disconnected)
+	return (-1);
+      ++data->stats.urb_errors;
+      if (data->recovery_attempts++ == 0)
+	data->error_time = ktime_get();
+      lumio_schedule_recovery(data, LUMIO_RECOVER_RESUBMIT);
+      return (-1);
+    }
 
-  if (data->listeners == 0)
+  ++data->stats.urb_errors;
+  if (data->recovery_attempts++ == 0)
+    data->error_time = ktime_get();
+
+  if (urb->status == -EPIPE)
     {
-      SAFE_CALL(usb_submit_urb(data->urb_in, GFP_KERNEL),
-		"Unable to register int in urb.\n");
-      data->listeners = 1;
+      ++data->stats.stalls;
+      lumio_schedule_recovery(data, LUMIO_RECOVER_CLEAR_HALT);
+      return (-1);
     }
+
+  ++data->stats.transient_errors;
+  if (data->recovery_attempts >= LUMIO_RESET_THRESHOLD)
+    lumio_schedule_recovery(data, LUMIO_RECOVER_RESET);
+  else if (data->recovery_attempts > LUMIO_QUICK_RETRIES)
+    lumio_schedule_recovery(data, LUMIO_RECOVER_RESUBMIT);
   else
-    ++data->listeners;
+    lumio_submit_in(data, data->urb_in);
 
-  printk(KERN_INFO "lumio_driver: O nb_listeners: %d\n", data->listeners);
-  return (0);
+  return (-1);
+}
 
- error:
-  return (ret);
+/**
+ * @brief Resets the touchscreen.
+ *
+ *	This is the last resort when the device keeps failing. The usb core
+ * calls lumio_pre_reset() and lumio_post_reset() around the reset, the latter
+ * takes care of re-applying the dualtouch configuration and restarting the
+ * report stream.
+ *
+ * @param data The touchscreen.
+ */
+static void			lumio_reset(struct usb_touchscreen* data)
+{
+  int				ret = 0;
+
+  if (data->disconnected)
+    return;
+
+  ++data->stats.resets;
+  printk(KERN_WARNING "lumio_driver: too many errors, resetting device.\n");
+
+  ret = usb_lock_device_for_reset(data->udev, data->interface);
+  if (ret < 0)
+    {
+      printk(KERN_WARNING "lumio_driver: unable to lock device for reset.\n");
+      return;
+    }
+  ret = usb_reset_device(data->udev);
+  usb_unlock_device(data->udev);
+
+  if (ret < 0)
+    printk(KERN_WARNING "lumio_driver: device reset failed (%d).\n", ret);
 }
 
 /**
- * @brief Stops the urb if nobody is listenning.
+ * @brief Recovers from interrupt in urb errors.
  *
- *	This function is called by the input layer when the last process has
- * released one of the two char devices that emulates mice. As there only one
- * touchscreen for two fake mice, we actually stops receiving urb only when the two
- * char devices are not being red anymore.
+ *	Runs the actions queued by lumio_schedule_recovery(), in process
+ * context. If clearing the halt or resubmitting the urb fails, the next
+ * attempt is queued with a longer delay, until the device gets reset.
  *
- * @param dev The input device that is not readed anymore.
+ * @param work The recovery member of the touchscreen.
  */
-static void			lumio_fake_close(struct input_dev* dev)
+static void			lumio_recovery_work(struct work_struct* work)
 {
-  struct usb_touchscreen*	data = input_get_drvdata(dev);
+  struct usb_touchscreen*	data =
+    container_of(work, struct usb_touchscreen, recovery.work);
+  int				ret = 0;
 
-  ASSERT(data != NULL);
+  if (test_and_clear_bit(LUMIO_RECOVER_RESET, &data->recovery_flags))
+    {
+      clear_bit(LUMIO_RECOVER_CLEAR_HALT, &data->recovery_flags);
+      clear_bit(LUMIO_RECOVER_RESUBMIT, &data->recovery_flags);
+      lumio_reset(data);
+      return;
+    }
+
+  mutex_lock(&data->io_lock);
 
-  --data->listeners;
-  if (data->listeners == 0)
+  if (data->disconnected || data->listeners == 0)
     {
-      usb_kill_urb(data->urb_in);
-      usb_kill_urb(data->urb_in2);
+      data->recovery_flags = 0;
+      goto out;
+    }
+
+  usb_kill_urb(data->urb_in);
+  if (data->urb_in2)
+    usb_kill_urb(data->urb_in2);
+
+  if (test_and_clear_bit(LUMIO_RECOVER_CLEAR_HALT, &data->recovery_flags))
+    {
+      ++data->stats.clear_halts;
+      ret = usb_clear_halt(data->udev,
+			   usb_rcvintpipe(data->udev, data->int_in_endpoint));
+      if (ret < 0)
+	{
+	  printk(KERN_WARNING "lumio_driver: unable to clear halt (%d).\n", ret);
+	  lumio_schedule_recovery(data, LUMIO_RECOVER_RESET);
+	  goto out;
+	}
+    }
+
+  clear_bit(LUMIO_RECOVER_RESUBMIT, &data->recovery_flags);
+  ret = usb_submit_urb(data->urb_in, GFP_KERNEL);
+  if (ret < 0)
+    {
+      ++data->stats.submit_errors;
+      ++data->recovery_attempts;
+      lumio_schedule_recovery(data,
+			      data->recovery_attempts >= LUMIO_RESET_THRESHOLD ?
+			      LUMIO_RECOVER_RESET : LUMIO_RECOVER_RESUBMIT);
     }
-  printk(KERN_INFO "lumio_driver: nb_listeners: %d\n", data->listeners);
+
+ out:
+  mutex_unlock(&data->io_lock);
 }
 
-static void			lumio_which_finger(struct usb_touchscreen* data,
-						   __u8*	which,
-						   __u32	x,
-						   __u32	y)
+/*
+ * Telemetry.
+ *
+ *	Each touchscreen multicasts its counters over generic netlink every
+ * telemetry_ms milliseconds (see LUMIO_TELEMETRY_FAMILY in lumio_driver.h).
+ * The message is only built when someone subscribed to the group, and its
+ * counts are since the last message sent, so nothing is done meanwhile; the
+ * report path only keeps the counters it always did, and the contacts down.
+ * The work is not queued at all while telemetry_ms is 0, setting it again
+ * restarts the work of every touchscreen in lumio_telemetry_list.
+ */
+
+static struct genl_family		lumio_genl_family =
+  {
+    .id		= GENL_ID_GENERATE,
+    .name	= LUMIO_TELEMETRY_FAMILY,
+    .version	= LUMIO_TELEMETRY_VERSION,
+    .maxattr	= LUMIO_TELEMETRY_A_MAX,
+  };
+
+static struct genl_multicast_group	lumio_genl_telemetry =
+  {
+    .name	= LUMIO_TELEMETRY_GROUP,
+  };
+
+static LIST_HEAD(lumio_telemetry_list);
+static DEFINE_MUTEX(lumio_telemetry_lock);
+
+/**
+ * @brief Queues the next telemetry of a touchscreen.
+ *
+ *	Intervals of whole seconds are rounded, so that the touchscreens of a
+ * host wake it up once rather than each in turn.
+ *
+ * @param data The touchscreen.
+ */
+static void			lumio_telemetry_schedule(struct usb_touchscreen* data)
 {
-  __u32				distance_from_first_finger = 0;
-  __u32				distance_from_second_finger = 0;
+  unsigned int			interval = telemetry_ms;
+  unsigned long			delay = 0;
 
-  ASSERT(data != NULL);
-  ASSERT(which != NULL);
+  if (interval == 0)
+    return;
+  delay = msecs_to_jiffies(interval);
+  if (interval % 1000 == 0)
+    delay = round_jiffies_relative(delay);
 
-  distance_from_first_finger =
-    abs(data->fakemouse[0].last_x - x) + abs(data->fakemouse[0].last_y - y);
-  distance_from_second_finger =
-    abs(data->fakemouse[1].last_x - x) + abs(data->fakemouse[1].last_y - y);
+  schedule_delayed_work(&data->telemetry, delay);
+}
+
+/**
+ * @brief Builds the telemetry message of a touchscreen.
+ *
+ * @param data The touchscreen.
+ * @param stats Its counters now.
+ * @param elapsed_us Time since the last telemetry.
+ * @return The message, NULL on failure.
+ */
+static struct sk_buff*		lumio_telemetry_msg(struct usb_touchscreen*		data,
+						    const struct lumio_stats*	stats,
+						    u64				elapsed_us)
+{
+  const struct lumio_stats*	last = &data->telemetry_stats;
+  struct sk_buff*		skb = NULL;
+  void*				hdr = NULL;
+  u64				rate = 0;
+
+  skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+  if (!skb)
+    return (NULL);
+  hdr = genlmsg_put(skb, 0, 0, &lumio_genl_family, 0,
+		    LUMIO_TELEMETRY_CMD_STATS);
+  if (!hdr)
+    goto error;
+
+  if (elapsed_us)
+    rate = div64_u64((u64) (stats->reports - last->reports) * USEC_PER_SEC +
+		     elapsed_us / 2, elapsed_us);
+  if (nla_put_string(skb, LUMIO_TELEMETRY_A_BUS_PATH, data->name) ||
+      nla_put_u8(skb, LUMIO_TELEMETRY_A_FIRMWARE, data->firmware_version) ||
+      nla_put_u32(skb, LUMIO_TELEMETRY_A_INTERVAL_MS,
+		  (u32) div_u64(elapsed_us, 1000)) ||
+      nla_put_u32(skb, LUMIO_TELEMETRY_A_REPORTS_PER_SEC, (u32) rate) ||
+      nla_put_u32(skb, LUMIO_TELEMETRY_A_DROPS,
+		  stats->lost_reports - last->lost_reports +
+		  stats->filtered_reports - last->filtered_reports) ||
+      nla_put_u32(skb, LUMIO_TELEMETRY_A_URB_ERRORS,
+		  stats->urb_errors - last->urb_errors) ||
+      nla_put_u32(skb, LUMIO_TELEMETRY_A_RECOVERIES,
+		  stats->recoveries - last->recoveries) ||
+      nla_put_u32(skb, LUMIO_TELEMETRY_A_MODE_SWITCH_US,
+		  stats->last_mode_switch_us) ||
+      nla_put_u8(skb, LUMIO_TELEMETRY_A_CONTACTS,
+		 hweight8(data->contacts_down)) ||
+      nla_put(skb, LUMIO_TELEMETRY_A_STATS, sizeof(struct lumio_stats), stats))
+    goto error;
+  genlmsg_end(skb, hdr);
+
+  return (skb);
+
+ error:
+  nlmsg_free(skb);
+  return (NULL);
+}
+
+/**
+ * @brief Multicasts the telemetry of a touchscreen, and queues the next one.
+ *
+ *	The completion handlers keep counting meanwhile: a message may be a
+ * report off, the next one makes up for it. The snapshot is only taken when a
+ * message is sent, the first message after a while without listeners covers
+ * that whole while.
+ *
+ * @param work The telemetry member of the touchscreen.
+ */
+static void			lumio_telemetry_work(struct work_struct* work)
+{
+  struct usb_touchscreen*	data =
+    container_of(work, struct usb_touchscreen, telemetry.work);
+  struct lumio_stats		stats = data->stats;
+  struct sk_buff*		skb = NULL;
+  ktime_t			now = ktime_get();
+
+  if (telemetry_ms &&
+      netlink_has_listeners(init_net.genl_sock, lumio_genl_telemetry.id))
+    {
+      skb = lumio_telemetry_msg(data, &stats,
+				ktime_to_us(ktime_sub(now, data->telemetry_time)));
+      if (skb)
+	{
+	  genlmsg_multicast(skb, 0, lumio_genl_telemetry.id, GFP_KERNEL);
+	  data->telemetry_stats = stats;
+	  data->telemetry_time = now;
+	}
+    }
 
-  if (distance_from_first_finger < distance_from_second_finger)
-    *which = 0;
-  else
-    *which = 1;
+  lumio_telemetry_schedule(data);
 }
 
-static void			lumio_treat_event(struct usb_touchscreen*	data,
-						  int				event_type)
+/**
+ * @brief Starts the telemetry of a touchscreen.
+ *
+ *	It is stopped with lumio_telemetry_stop(), before the last reference on
+ * the touchscreen is dropped.
+ *
+ * @param data The touchscreen.
+ */
+static void			lumio_telemetry_start(struct usb_touchscreen* data)
 {
-  unsigned char*		event = NULL;
-  __u8				which = 0;
-  __u32				x = 0;
-  __u32				y = 0;
-  __u32				up = 0;
-
-  ASSERT(data != NULL);
-  ASSERT(data->in_buffer != NULL);
+  mutex_lock(&lumio_telemetry_lock);
+  data->telemetry_stats = data->stats;
+  data->telemetry_time = ktime_get();
+  list_add_tail(&data->telemetry_link, &lumio_telemetry_list);
+  lumio_telemetry_schedule(data);
+  mutex_unlock(&lumio_telemetry_lock);
+}
 
-  event = data->in_buffer;
-  x = ((event[3] >> 4) << 8) | event[4];
-  y = ((event[6] & 0xf) << 8) | event[5];
-  up = !!!((event[3] & LUMIO_OPERATION_MASK) & LUMIO_OPERATION_UP);
+/**
+ * @brief Stops the telemetry of a touchscreen.
+ *
+ * @param data The touchscreen.
+ */
+static void			lumio_telemetry_stop(struct usb_touchscreen* data)
+{
+  mutex_lock(&lumio_telemetry_lock);
+  list_del_init(&data->telemetry_link);
+  mutex_unlock(&lumio_telemetry_lock);
+  cancel_delayed_work_sync(&data->telemetry);
+}
 
-  if ((event[3] & (1 << 2)) == (1 << 2))
-    which = 0;
-  else
-    which = 1;
+/**
+ * @brief Sets telemetry_ms, and requeues the telemetry of every touchscreen.
+ *
+ *	A work queued with the former interval is cancelled rather than waited
+ * for, and none is queued when telemetry_ms is set to 0. A work running
+ * meanwhile queues itself with the interval it read, once at most.
+ *
+ * @param val The new value, as written to the parameter.
+ * @param kp The parameter.
+ * @return 0 on success, a negative number if val is not a number.
+ */
+static int			lumio_telemetry_set(const char*		val,
+						    struct kernel_param*	kp)
+{
+  struct usb_touchscreen*	data = NULL;
+  int				ret = 0;
 
-  /* Reporting the touch to the input layer */
-  input_report_key(data->fakemouse[which].idev,
-		   BTN_LEFT, up);
-  input_report_abs(data->fakemouse[which].idev,
-		   ABS_X, x);
-  input_report_abs(data->fakemouse[which].idev,
-		   ABS_Y, y);
-  input_sync(data->fakemouse[which].idev);
+  mutex_lock(&lumio_telemetry_lock);
+  if ((ret = param_set_uint(val, kp)) == 0)
+    list_for_each_entry(data, &lumio_telemetry_list, telemetry_link)
+      {
+	cancel_delayed_work(&data->telemetry);
+	lumio_telemetry_schedule(data);
+      }
+  mutex_unlock(&lumio_telemetry_lock);
 
-#ifdef LUMIO_DEBUG
-  PRINT_RECEIVED_DEBUG_TRACE();
-#endif
+  return (ret);
+}
 
-  if (event_type == LUMIO_DUAL_EVENT)
-    {
-      x = ((event[11] & 0xf) << 8) | event[10];
-      y = ((event[11] >> 4) << 8) | event[12];
-      up = !!!((event[9] >> 4) & LUMIO_OPERATION_UP);
+module_param_call(telemetry_ms, lumio_telemetry_set, param_get_uint,
+		  &telemetry_ms, 0644);
 
-      if ((event[9] & (1 << 6)) == (1 << 6))
-	which = 0;
-      else
-	which = 1;
+/**
+ * @brief Registers the generic netlink family and its group.
+ *
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_telemetry_init(void)
+{
+  int				ret = 0;
 
-      /* Reporting the second touch */
-      input_report_key(data->fakemouse[which].idev,
-      		       BTN_LEFT, up);
-      input_report_abs(data->fakemouse[which].idev,
-		       ABS_X, x);
-      input_report_abs(data->fakemouse[which].idev,
-		       ABS_Y, y);
-      input_sync(data->fakemouse[which].idev);
+  if ((ret = genl_register_family(&lumio_genl_family)) < 0)
+    return (ret);
+  if ((ret = genl_register_mc_group(&lumio_genl_family,
+				    &lumio_genl_telemetry)) < 0)
+    genl_unregister_family(&lumio_genl_family);
 
-#ifdef LUMIO_DEBUG
-  PRINT_RECEIVED_DEBUG_TRACE();
-#endif
+  return (ret);
+}
 
-    }
+/**
+ * @brief Handles a complete report, held in in_buffer.
+ *
+ *	Called from the urb completion handlers, and for each report of a replay
+ * batch (see lumio_replay_batch()), so that replayed reports cost exactly what
+ * real ones do.
+ *
+ * @param data The touchscreen.
+ */
+static void			lumio_process_report(struct usb_touchscreen* data)
+{
+  if (data->in_buffer[2] == LUMIO_DUAL_REPORT)
+    lumio_treat_event(data, LUMIO_DUAL_EVENT);
+  else
+    lumio_treat_event(data, LUMIO_SINGLE_EVENT);
 }
 
 /**
@@ -622,21 +3052,18 @@ static void			lumio_irq1(struct urb* urb)
   ASSERT(urb != NULL);
   ASSERT(urb->context != NULL);
 
-  if (urb->status != 0)
+  data = urb->context;
+  if (lumio_fault_urb(data, urb) || lumio_check_urb(data, urb) != 0)
     return;
 
   printk(KERN_INFO "lumio_driver: IRQ1 fired!\n");
 
-  data = urb->context;
   if (data->firmware_version != LUMIO_FIRMWARE_3_0)
-    usb_submit_urb(data->urb_in2, GFP_ATOMIC);
+    lumio_submit_in(data, data->urb_in2);
   else
     {
-      if (data->in_buffer[2] == 0x0d)
-	lumio_treat_event(data, LUMIO_DUAL_EVENT);
-      else
-	lumio_treat_event(data, LUMIO_SINGLE_EVENT);
-      usb_submit_urb(data->urb_in, GFP_ATOMIC);
+      lumio_process_report(data);
+      lumio_submit_in(data, data->urb_in);
     }
 }
 
@@ -647,29 +3074,21 @@ static void			lumio_irq2(struct urb* urb)
   ASSERT(urb != NULL);
   ASSERT(urb->context != NULL);
 
-  if (urb->status != 0)
-    return;
-
   data = urb->context;
+  if (lumio_fault_urb(data, urb) || lumio_check_urb(data, urb) != 0)
+    return;
 
-  if (data->in_buffer[2] == 0x0d)
-    lumio_treat_event(data, LUMIO_DUAL_EVENT);
-  else
-    lumio_treat_event(data, LUMIO_SINGLE_EVENT);
-
-  usb_submit_urb(data->urb_in, GFP_ATOMIC);
+  lumio_process_report(data);
+  lumio_submit_in(data, data->urb_in);
 }
 
 /**
- * @brief Initializes almost everything.
- *
- *	This functions registers two input devices which are the two fake mice,
- * and the urb needed to communicate with the device.
+ * @brief Allocates the urbs needed to communicate with the device.
  *
  * @param data Driver's internal datas.
  * @return 0 on success, a negative number if it fails.
  */
-static int		lumio_init_data(struct usb_touchscreen* data)
+static int		lumio_init_urbs(struct usb_touchscreen* data)
 {
   int interval = 0;
 
@@ -714,6 +3133,34 @@ static int		lumio_init_data(struct usb_touchscreen* data)
 
     }
 
+  data->interval = interval;
+
+  return (0);
+
+ error:
+  return (-ENOMEM);
+}
+
+/**
+ * @brief Registers the input devices.
+ *
+ *	These are the two fake mice, unless the touchscreen is a panel of the
+ * video wall or is partitioned.
+ *
+ * @param data Driver's internal datas.
+ * @return 0 on success, a negative number if it fails.
+ */
+static int		lumio_init_inputs(struct usb_touchscreen* data)
+{
+  ASSERT(data != NULL);
+
+  /* Panels of the video wall report to the wall device (see lumio_wall_join()) */
+  data->wall_panel = lumio_wall_find(data->name);
+  if (data->wall_panel)
+    return (0);
+  if (nb_partition > 0)
+    return (lumio_partition_init(data));
+
   if (!(data->fakemouse[0].idev = input_allocate_device()))
     goto error;
   if (!(data->fakemouse[1].idev = input_allocate_device()))
@@ -741,6 +3188,24 @@ static int		lumio_init_data(struct usb_touchscreen* data)
   return (-ENOMEM);
 }
 
+/**
+ * @brief Initializes almost everything.
+ *
+ *	This functions registers the input devices, which are the two fake mice
+ * unless configured otherwise, and the urb needed to communicate with the
+ * device.
+ *
+ * @param data Driver's internal datas.
+ * @return 0 on success, a negative number if it fails.
+ */
+static int		lumio_init_data(struct usb_touchscreen* data)
+{
+  if (lumio_init_urbs(data) < 0)
+    return (-ENOMEM);
+
+  return (lumio_init_inputs(data));
+}
+
 static int	lumio_probe_firmware(usb_touchscreen_t*			data,
 			     const struct usb_device_id*	entity)
 {
@@ -808,7 +3273,7 @@ static int __devinit		lumio_probe(struct usb_interface*	interface,
   int				ret = 0;
   struct usb_touchscreen*			data;
 
-  data = kzalloc(sizeof(struct usb_touchscreen), GFP_KERNEL);
+  data = kmem_cache_zalloc(lumio_data_cache, GFP_KERNEL);
   if (!data)
     {
       printk(KERN_WARNING "lumio_driver: unable to allocate private structure.\n");
@@ -817,14 +3282,24 @@ static int __devinit		lumio_probe(struct usb_interface*	interface,
     }
 
   kref_init(&data->refcount);
+  mutex_init(&data->io_lock);
+  INIT_LIST_HEAD(&data->readers);
+  spin_lock_init(&data->readers_lock);
+  spin_lock_init(&data->config_lock);
+  init_waitqueue_head(&data->readers_wait);
+  INIT_DELAYED_WORK(&data->recovery, lumio_recovery_work);
+  INIT_DELAYED_WORK(&data->telemetry, lumio_telemetry_work);
+  INIT_LIST_HEAD(&data->telemetry_link);
+  lumio_fault_init_data(data);
 
   usb_set_intfdata(interface, data);
 
   data->udev = usb_get_dev(interface_to_usbdev(interface));
   data->interface = interface;
+  strlcpy(data->name, dev_name(&data->udev->dev), LUMIO_BUS_PATH_SIZE);
   data->cur_mode = USB_MOUSE_MODE;
-  data->in_buffer = kzalloc(64, GFP_KERNEL);
-  data->out_buffer = kzalloc(64, GFP_KERNEL);
+  data->in_buffer = kmem_cache_zalloc(lumio_buffer_cache, GFP_KERNEL);
+  data->out_buffer = kmem_cache_zalloc(lumio_buffer_cache, GFP_KERNEL);
   data->recv_msg = lumio_recv_8_bytes;
   if (!data->in_buffer || !data->out_buffer)
     {
@@ -861,6 +3336,10 @@ static int __devinit		lumio_probe(struct usb_interface*	interface,
 		"Unable to switch to dual touch mode.\n");
 
       printk(KERN_INFO "lumio_driver: Set to dual control.\n");
+
+      if (data->wall_panel)
+	SAFE_CALL(lumio_wall_join(data), "Unable to join the wall.\n");
+      lumio_telemetry_start(data);
       break;
     }
 
@@ -899,18 +3378,359 @@ static void __devexit		lumio_disconnect(struct usb_interface* interface)
 
   unlock_kernel();
 
+  if (data && data->wall_panel)
+    lumio_wall_leave(data);
+
   if (data)
-    kref_put(&data->refcount, lumio_delete);
+    {
+      mutex_lock(&data->io_lock);
+      data->disconnected = 1;
+      mutex_unlock(&data->io_lock);
+      wake_up_interruptible(&data->readers_wait);
+      lumio_fault_stop(data);
+      cancel_delayed_work_sync(&data->recovery);
+      lumio_telemetry_stop(data);
+      kref_put(&data->refcount, lumio_delete);
+    }
 
   printk(KERN_INFO "lumio_driver: device unplugged.\n");
 }
 
+/**
+ * @brief Called by the usb core before resetting the device.
+ *
+ *	Stops the report stream. The io_lock is held until lumio_post_reset()
+ * so that nobody restarts it in the meantime.
+ *
+ * @param interface
+ * @return Always 0.
+ */
+static int			lumio_pre_reset(struct usb_interface* interface)
+{
+  struct usb_touchscreen*	data = usb_get_intfdata(interface);
+
+  mutex_lock(&data->io_lock);
+  if (data->urb_in)
+    usb_kill_urb(data->urb_in);
+  if (data->urb_in2)
+    usb_kill_urb(data->urb_in2);
+
+  return (0);
+}
+
+/**
+ * @brief Called by the usb core once the device has been reset.
+ *
+ *	A reset puts the controller back in singletouch configuration, so the
+ * dualtouch configuration is re-applied before restarting the report stream.
+ * If the controller came back in mouse mode its descriptors have changed and
+ * the usb core rebinds the driver instead, which switches it to driver mode
+ * again (see lumio_probe()).
+ *
+ * @param interface
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_post_reset(struct usb_interface* interface)
+{
+  struct usb_touchscreen*	data = usb_get_intfdata(interface);
+  int				ret = 0;
+
+  if (data->urb_in)
+    {
+      if (lumio_switch_to_dualtouch_mode(data) < 0)
+	printk(KERN_WARNING "lumio_driver: unable to restore dual touch mode.\n");
+      if (data->listeners > 0)
+	ret = usb_submit_urb(data->urb_in, GFP_KERNEL);
+      if (ret < 0)
+	{
+	  ++data->stats.submit_errors;
+	  lumio_schedule_recovery(data, LUMIO_RECOVER_RESUBMIT);
+	}
+    }
+  mutex_unlock(&data->io_lock);
+
+  return (0);
+}
+
 static struct usb_driver	lumio_driver =
   {
     .name	= "lumio_driver",
     .id_table	= lumio_id_table,
     .probe	= lumio_probe,
     .disconnect	= lumio_disconnect,
+    .pre_reset	= lumio_pre_reset,
+    .post_reset	= lumio_post_reset,
+  };
+
+/*
+ * Replay.
+ *
+ *	/dev/lumio_replay creates virtual touchscreens, which have the same input
+ * devices as real ones but no usb device. The reports written to them go
+ * through lumio_process_report(), with interrupts disabled like in the urb
+ * completion handlers, so that the whole path from the decoding to the input
+ * layer (and everything listening to it) can be benchmarked without any
+ * hardware.
+ */
+
+static atomic_t			lumio_replay_count = ATOMIC_INIT(0);
+
+/**
+ * @brief Creates the virtual touchscreen of a replay device open.
+ *
+ * @param replay The open of the replay device.
+ * @param firmware The firmware to emulate, one of LUMIO_FIRMWARE_*.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_replay_setup(struct lumio_replay*	replay,
+						   unsigned long	firmware)
+{
+  struct usb_touchscreen*	data = NULL;
+  int				ret = 0;
+
+  if (replay->data)
+    return (-EBUSY);
+  if (firmware < LUMIO_FIRMWARE_1_0 || firmware > LUMIO_FIRMWARE_3_0)
+    return (-EINVAL);
+
+  data = kmem_cache_zalloc(lumio_data_cache, GFP_KERNEL);
+  if (!data)
+    return (-ENOMEM);
+
+  kref_init(&data->refcount);
+  mutex_init(&data->io_lock);
+  INIT_LIST_HEAD(&data->readers);
+  spin_lock_init(&data->readers_lock);
+  spin_lock_init(&data->config_lock);
+  init_waitqueue_head(&data->readers_wait);
+  INIT_DELAYED_WORK(&data->recovery, lumio_recovery_work);
+  INIT_DELAYED_WORK(&data->telemetry, lumio_telemetry_work);
+  INIT_LIST_HEAD(&data->telemetry_link);
+  lumio_fault_init_data(data);
+
+  data->cur_mode = USB_DRIVER_MODE;
+  data->firmware_version = firmware;
+  snprintf(data->name, LUMIO_BUS_PATH_SIZE, "replay%d",
+	   atomic_inc_return(&lumio_replay_count) - 1);
+  data->in_buffer = kmem_cache_zalloc(lumio_buffer_cache, GFP_KERNEL);
+  if (!data->in_buffer)
+    {
+      ret = -ENOMEM;
+      goto error;
+    }
+
+  SAFE_CALL(lumio_init_inputs(data), "Unable to allocate replay input devices.\n");
+  if (data->wall_panel)
+    SAFE_CALL(lumio_wall_join(data), "Unable to join the wall.\n");
+
+  replay->data = data;
+  lumio_telemetry_start(data);
+  printk(KERN_INFO "lumio_driver: %s emulates firmware %lu.\n",
+	 data->name, firmware);
+
+  return (0);
+
+ error:
+  kref_put(&data->refcount, lumio_delete);
+  return (ret);
+}
+
+/**
+ * @brief Accounts the cost of a replayed report.
+ */
+static void			lumio_replay_account(struct lumio_replay_batch*	batch,
+						     s64			cost)
+{
+  __u32				ns = (__u32) min_t(s64, cost, 0xffffffff);
+  int				bucket = ns ? fls(ns) - 1 : 0;
+
+  batch->busy_ns += ns;
+  if (ns < batch->min_ns)
+    batch->min_ns = ns;
+  if (ns > batch->max_ns)
+    batch->max_ns = ns;
+  ++batch->histogram[min(bucket, LUMIO_REPLAY_HIST_BUCKETS - 1)];
+  ++batch->injected;
+}
+
+/**
+ * @brief Replays a batch of reports.
+ *
+ *	Reports are copied from userland LUMIO_REPLAY_CHUNK at a time, outside
+ * of the measurements. Paced reports are injected at fixed times from the start
+ * of the batch, so that the pace doesn't drift with the cost of the reports. A
+ * signal stops the batch, the results of the reports already injected are
+ * still returned.
+ *
+ * @param replay The open of the replay device.
+ * @param ubatch The lumio_replay_batch given by userland.
+ * @return 0 on success, a negative number on failure.
+ */
+static int			lumio_replay_batch(struct lumio_replay*	replay,
+						   void __user*		ubatch)
+{
+  struct usb_touchscreen*	data = replay->data;
+  struct lumio_replay_batch	batch;
+  const __u8 __user*		reports = NULL;
+  unsigned long			flags = 0;
+  unsigned int			n = 0;
+  unsigned int			i = 0;
+  unsigned int			j = 0;
+  ktime_t			start;
+  ktime_t			deadline;
+  ktime_t			t0;
+  s64				cost = 0;
+
+  if (!data)
+    return (-EINVAL);
+  if (copy_from_user(&batch, ubatch, sizeof(struct lumio_replay_batch)))
+    return (-EFAULT);
+  if (batch.nb_reports > LUMIO_REPLAY_MAX_BATCH)
+    return (-EINVAL);
+
+  reports = (const __u8 __user*) (unsigned long) batch.reports;
+  batch.injected = 0;
+  batch.busy_ns = 0;
+  batch.min_ns = 0xffffffff;
+  batch.max_ns = 0;
+  memset(batch.histogram, 0x0, sizeof(batch.histogram));
+
+  start = ktime_get();
+  for (i = 0; i < batch.nb_reports; i += n)
+    {
+      n = min_t(unsigned int, batch.nb_reports - i, LUMIO_REPLAY_CHUNK);
+      if (copy_from_user(replay->chunk, reports + i * LUMIO_REPORT_SIZE,
+			 n * LUMIO_REPORT_SIZE))
+	return (-EFAULT);
+
+      for (j = 0; j < n; ++j)
+	{
+	  if (batch.flags & LUMIO_REPLAY_PACED)
+	    {
+	      deadline = ktime_add_ns(start, (u64) (i + j) * batch.interval_us *
+				      NSEC_PER_USEC);
+	      set_current_state(TASK_INTERRUPTIBLE);
+	      schedule_hrtimeout(&deadline, HRTIMER_MODE_ABS);
+	    }
+	  if (signal_pending(current))
+	    goto out;
+
+	  local_irq_save(flags);
+	  memcpy(data->in_buffer, replay->chunk + j * LUMIO_REPORT_SIZE,
+		 LUMIO_REPORT_SIZE);
+	  t0 = ktime_get();
+	  lumio_process_report(data);
+	  cost = ktime_to_ns(ktime_sub(ktime_get(), t0));
+	  local_irq_restore(flags);
+
+	  lumio_replay_account(&batch, cost);
+	}
+      cond_resched();
+    }
+
+ out:
+  batch.elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+  if (batch.injected == 0)
+    batch.min_ns = 0;
+  if (copy_to_user(ubatch, &batch, sizeof(struct lumio_replay_batch)))
+    return (-EFAULT);
+
+  return (0);
+}
+
+static int			lumio_replay_open(struct inode*	inode,
+						  struct file*	file)
+{
+  struct lumio_replay*		replay = NULL;
+
+  if (!capable(CAP_SYS_ADMIN))
+    return (-EPERM);
+
+  replay = kzalloc(sizeof(struct lumio_replay), GFP_KERNEL);
+  if (!replay)
+    return (-ENOMEM);
+  replay->chunk = kmalloc(LUMIO_REPLAY_CHUNK * LUMIO_REPORT_SIZE, GFP_KERNEL);
+  if (!replay->chunk)
+    {
+      kfree(replay);
+      return (-ENOMEM);
+    }
+  mutex_init(&replay->lock);
+  file->private_data = replay;
+
+  return (0);
+}
+
+/**
+ * @brief Destroys the virtual touchscreen with the last reference on the file.
+ */
+static int			lumio_replay_release(struct inode*	inode,
+						     struct file*	file)
+{
+  struct lumio_replay*		replay = file->private_data;
+
+  if (replay->data)
+    {
+      if (replay->data->wall_panel)
+	lumio_wall_leave(replay->data);
+      lumio_telemetry_stop(replay->data);
+      kref_put(&replay->data->refcount, lumio_delete);
+    }
+  kfree(replay->chunk);
+  kfree(replay);
+  file->private_data = NULL;
+
+  return (0);
+}
+
+/**
+ * @brief Handles the replay commands, and the ones of lumio_data_ioctl().
+ *
+ * @param file
+ * @param cmd IOCTL_REPLAY_SETUP, whose argument is the firmware to emulate,
+ * IOCTL_REPLAY_BATCH, whose argument is a struct lumio_replay_batch, or one of
+ * the commands of the lumio%d char devices.
+ * @param arg
+ * @return 0 on success, a negative number on failure.
+ */
+static long			lumio_replay_ioctl(struct file*		file,
+						   unsigned int		cmd,
+						   unsigned long	arg)
+{
+  struct lumio_replay*		replay = file->private_data;
+  long				ret = 0;
+
+  mutex_lock(&replay->lock);
+  switch (cmd)
+    {
+    case IOCTL_REPLAY_SETUP:
+      ret = lumio_replay_setup(replay, arg);
+      break;
+    case IOCTL_REPLAY_BATCH:
+      ret = lumio_replay_batch(replay, (void __user*) arg);
+      break;
+    default:
+      ret = replay->data ? lumio_data_ioctl(replay->data, cmd, arg) : -EINVAL;
+      break;
+    }
+  mutex_unlock(&replay->lock);
+
+  return (ret);
+}
+
+static struct file_operations	lumio_replay_fops =
+  {
+    .owner		= THIS_MODULE,
+    .open		= lumio_replay_open,
+    .release		= lumio_replay_release,
+    .unlocked_ioctl	= lumio_replay_ioctl,
+  };
+
+static struct miscdevice	lumio_replay_dev =
+  {
+    .minor	= MISC_DYNAMIC_MINOR,
+    .name	= "lumio_replay",
+    .fops	= &lumio_replay_fops,
   };
 
 /**
@@ -926,24 +3746,72 @@ static int __init		lumio_init(void)
 {
   int			ret = 0;
 
-  SAFE_CALL(usb_register(&lumio_driver),
-	    "Unable to register lumio touchscreen driver.\n");
+  mutex_init(&lumio_wall.lock);
+  spin_lock_init(&lumio_wall.event_lock);
+  setup_timer(&lumio_wall.handoff_timer, lumio_wall_handoff_expired, 0);
+  SAFE_CALL(lumio_wall_parse(), "Invalid wall layout.\n");
+  SAFE_CALL(lumio_partition_parse(), "Invalid partitions.\n");
+
+  lumio_data_cache = kmem_cache_create("lumio_touchscreen",
+				       sizeof (struct usb_touchscreen), 0,
+				       SLAB_HWCACHE_ALIGN, NULL);
+  lumio_buffer_cache = kmem_cache_create("lumio_buffer", LUMIO_REPORT_SIZE, 0,
+					 SLAB_HWCACHE_ALIGN, NULL);
+  if (!lumio_data_cache || !lumio_buffer_cache)
+    {
+      printk(KERN_WARNING "lumio_driver: Unable to create the slab caches.\n");
+      ret = -ENOMEM;
+      goto error;
+    }
+  lumio_fault_init();
+
+  if ((ret = lumio_telemetry_init()) < 0)
+    {
+      printk(KERN_WARNING "lumio_driver: Unable to register the telemetry family.\n");
+      lumio_fault_exit();
+      goto error;
+    }
+  if ((ret = usb_register(&lumio_driver)) < 0)
+    {
+      printk(KERN_WARNING "lumio_driver: Unable to register lumio touchscreen driver.\n");
+      genl_unregister_family(&lumio_genl_family);
+      lumio_fault_exit();
+      goto error;
+    }
+  if ((ret = misc_register(&lumio_replay_dev)) < 0)
+    {
+      printk(KERN_WARNING "lumio_driver: Unable to register the replay device.\n");
+      usb_deregister(&lumio_driver);
+      genl_unregister_family(&lumio_genl_family);
+      lumio_fault_exit();
+      goto error;
+    }
   return (0);
 
  error:
+  if (lumio_buffer_cache)
+    kmem_cache_destroy(lumio_buffer_cache);
+  if (lumio_data_cache)
+    kmem_cache_destroy(lumio_data_cache);
 
-  return (-ret);
+  return (ret);
 }
 
 /**
  * @brief Called when rmmoding the driver.
  *
  *	This function unregister (rmmode) the lumio touchscreen driver from the
- * linked list of usb drivers in the kernel.
+ * linked list of usb drivers in the kernel, and removes the replay device and
+ * the telemetry family.
  */
 static void __exit		lumio_exit(void)
 {
+  misc_deregister(&lumio_replay_dev);
   usb_deregister(&lumio_driver);
+  genl_unregister_family(&lumio_genl_family);
+  lumio_fault_exit();
+  kmem_cache_destroy(lumio_buffer_cache);
+  kmem_cache_destroy(lumio_data_cache);
 }
 
 module_init(lumio_init);